@@ -0,0 +1,1442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <argp.h>
+
+// ====================================================================
+// Synthetic bus trace generator, for benchmarking decode6809
+// ====================================================================
+//
+// This runs a 6809 program on a small cycle accurate model of the CPU, and
+// writes the bus cycles it generates as a capture file, in any of the
+// layouts decode6809 accepts. The model covers the documented 6809
+// instruction set, but not the undocumented opcodes or the 6309's native
+// mode and extra instructions; an unsupported instruction stops the
+// generator with an error. A 6309 in emulation mode has the same bus cycles
+// (so a trace can be decoded with -c6309), apart from DAA's result.
+//
+// Only the IRQ is modelled (with --irq), so CWAI and SYNC need it, and the
+// program must run on its own: it can't call an operating system (so e.g.
+// test/assembler/6809test.asm, which needs the Beeb's MOS, can't be run).
+//
+// Each instruction is modelled as its fetches, followed by any dead
+// cycles, followed by its operand accesses, which is what decode6809
+// expects (see Fig 17 in the 6809 datasheet).
+
+const char *argp_program_version = "gen6809 0.1";
+
+static char doc[] = "\n\
+Generates a synthetic 6809 bus trace, for benchmarking decode6809.\n\
+\n\
+The trace is written to FILENAME (or stdout), and is --cycles bus cycles\n\
+long (the suffixes K, M and G are accepted).\n\
+\n\
+The program run is a built-in workload (a loop that fills, sums and sorts a\n\
+buffer, with an IRQ handler), unless --load is given. Vectors are taken from\n\
+memory, so a loaded image must include them (or use --pc).\n\
+\n\
+Layouts (--layout):\n\
+ - byte: 8-bit samples of the data bus (decode with --byte)\n\
+ - word: 16-bit samples, one per bus cycle, with the default bit assignments\n\
+ - clke: 16-bit samples, --spc per bus cycle, with clke on bit 12 (decode\n\
+         with --clke=12 --addr= and the same --skew)\n\
+\n\
+--signals selects which control signals are captured in the word and clke\n\
+layouts (default rnw,lic,bs,ba,addr); the others are zero, and should be\n\
+marked as unconnected when decoding (e.g. --lic=).\n\
+\n\
+The IRQ handler is only recognised by decode6809 if addr and bs are\n\
+captured. CWAI and SYNC wait for the next IRQ, so need --irq (and SYNC is\n\
+only recognised if ba is captured).\n";
+
+static char args_doc[] = "[FILENAME]";
+
+enum {
+   KEY_LAYOUT = 1,
+   KEY_SIGNALS,
+   KEY_SPC,
+   KEY_SKEW,
+   KEY_LOAD,
+   KEY_PC,
+   KEY_IRQ,
+   KEY_CYCLES
+};
+
+static struct argp_option options[] = {
+   { "layout",  KEY_LAYOUT,  "LAYOUT",  0, "Capture layout: byte, word or clke (default word)", 0},
+   { "signals", KEY_SIGNALS, "LIST",    0, "Control signals captured (default rnw,lic,bs,ba,addr)", 0},
+   { "spc",     KEY_SPC,     "N",       0, "Samples per bus cycle in the clke layout (default 4)", 0},
+   { "skew",    KEY_SKEW,    "N",       0, "Skew of the data bus in the clke layout, in samples", 0},
+   { "load",    KEY_LOAD,    "FILE,HEX",0, "Load a binary image at an address (can be repeated)", 0},
+   { "pc",      KEY_PC,      "HEX",     0, "Start address (default is the reset vector)", 0},
+   { "irq",     KEY_IRQ,     "N",       0, "Raise an IRQ every N cycles (default 0 = never)", 0},
+   { "cycles",  KEY_CYCLES,  "N",       0, "Number of bus cycles to generate (default 1M)", 0},
+   { NULL,      0,           NULL,      0, NULL, 0}
+};
+
+typedef enum {
+   LAYOUT_BYTE,
+   LAYOUT_WORD,
+   LAYOUT_CLKE
+} layout_t;
+
+#define SIG_RNW  0x01
+#define SIG_LIC  0x02
+#define SIG_BS   0x04
+#define SIG_BA   0x08
+#define SIG_ADDR 0x10
+#define SIG_ALL  0x1F
+
+#define IDX_DATA 0
+#define IDX_RNW  8
+#define IDX_LIC  9
+#define IDX_BS   10
+#define IDX_BA   11
+#define IDX_ADDR 12
+#define IDX_CLKE 12
+
+// Must match the decoder's skew buffer
+#define MAX_SKEW 15
+
+struct arguments {
+   layout_t layout;
+   int      signals;
+   int      spc;
+   int      skew;
+   int      pc;
+   uint64_t irq;
+   uint64_t cycles;
+   char    *filename;
+} arguments;
+
+// ====================================================================
+// CPU state
+// ====================================================================
+
+#define CC_E 0x80
+#define CC_F 0x40
+#define CC_H 0x20
+#define CC_I 0x10
+#define CC_N 0x08
+#define CC_Z 0x04
+#define CC_V 0x02
+#define CC_C 0x01
+
+static uint8_t  mem[0x10000];
+static uint8_t  A, B, DP, CC;
+static uint16_t X, Y, U, S, PC;
+
+// The start of the instruction being executed (for error messages)
+static uint16_t instr_pc;
+
+// ====================================================================
+// Built-in workload
+// ====================================================================
+
+#define WORKLOAD_ORG 0xF000
+
+// RAM: SEED=$10, SUM=$12, COUNT=$14, TICKS=$16, PROD=$18, BUF=$0200
+
+static const uint8_t workload[] = {
+   0x10, 0xCE, 0x04, 0x00,      // F000 RESET   LDS   #$0400
+   0xCE, 0x06, 0x00,            // F004         LDU   #$0600
+   0x4F,                        // F007         CLRA
+   0x1F, 0x8B,                  // F008         TFR   A,DP
+   0x8E, 0xAC, 0xE1,            // F00A         LDX   #$ACE1
+   0x9F, 0x10,                  // F00D         STX   <SEED
+   0x0F, 0x16,                  // F00F         CLR   <TICKS
+   0x1C, 0xEF,                  // F011         ANDCC #$EF
+   0x8E, 0x02, 0x00,            // F013 MAIN    LDX   #BUF
+   0xC6, 0x40,                  // F016         LDB   #$40
+   0xBD, 0xF0, 0x5F,            // F018 FILL    JSR   RAND
+   0xA7, 0x80,                  // F01B         STA   ,X+
+   0x5A,                        // F01D         DECB
+   0x26, 0xF8,                  // F01E         BNE   FILL
+   0x8E, 0x02, 0x00,            // F020         LDX   #BUF
+   0xCC, 0x00, 0x00,            // F023         LDD   #$0000
+   0xDD, 0x12,                  // F026         STD   <SUM
+   0xC6, 0x40,                  // F028         LDB   #$40
+   0x34, 0x04,                  // F02A SUMLP   PSHS  B
+   0xE6, 0x80,                  // F02C         LDB   ,X+
+   0x4F,                        // F02E         CLRA
+   0xD3, 0x12,                  // F02F         ADDD  <SUM
+   0xDD, 0x12,                  // F031         STD   <SUM
+   0x35, 0x04,                  // F033         PULS  B
+   0x5A,                        // F035         DECB
+   0x26, 0xF2,                  // F036         BNE   SUMLP
+   0x8E, 0x02, 0x00,            // F038         LDX   #BUF
+   0xC6, 0x3F,                  // F03B         LDB   #$3F
+   0xA6, 0x84,                  // F03D SORT    LDA   ,X
+   0xA1, 0x01,                  // F03F         CMPA  1,X
+   0x23, 0x0A,                  // F041         BLS   NOSWAP
+   0x34, 0x02,                  // F043         PSHS  A
+   0xA6, 0x01,                  // F045         LDA   1,X
+   0xA7, 0x84,                  // F047         STA   ,X
+   0x35, 0x02,                  // F049         PULS  A
+   0xA7, 0x01,                  // F04B         STA   1,X
+   0x30, 0x01,                  // F04D NOSWAP  LEAX  1,X
+   0x5A,                        // F04F         DECB
+   0x26, 0xEB,                  // F050         BNE   SORT
+   0x7C, 0x00, 0x14,            // F052         INC   >COUNT
+   0x96, 0x16,                  // F055         LDA   <TICKS
+   0xD6, 0x14,                  // F057         LDB   <COUNT
+   0x3D,                        // F059         MUL
+   0xFD, 0x00, 0x18,            // F05A         STD   >PROD
+   0x20, 0xB4,                  // F05D         BRA   MAIN
+   0xDC, 0x10,                  // F05F RAND    LDD   <SEED
+   0x58,                        // F061         ASLB
+   0x49,                        // F062         ROLA
+   0x24, 0x02,                  // F063         BCC   RAND1
+   0xC8, 0x2D,                  // F065         EORB  #$2D
+   0xDD, 0x10,                  // F067 RAND1   STD   <SEED
+   0x39,                        // F069         RTS
+   0x0C, 0x16,                  // F06A IRQ     INC   <TICKS
+   0x96, 0x16,                  // F06C         LDA   <TICKS
+   0x84, 0x07,                  // F06E         ANDA  #$07
+   0x26, 0x0A,                  // F070         BNE   IRQ1
+   0x10, 0x8E, 0x02, 0x00,      // F072         LDY   #BUF
+   0xEC, 0xA4,                  // F076         LDD   ,Y
+   0x1E, 0x89,                  // F078         EXG   A,B
+   0xED, 0xA4,                  // F07A         STD   ,Y
+   0x3B,                        // F07C IRQ1    RTI
+};
+
+#define WORKLOAD_IRQ 0xF06A
+
+static void load_workload() {
+   memcpy(mem + WORKLOAD_ORG, workload, sizeof(workload));
+   mem[0xFFF8] = WORKLOAD_IRQ >> 8;
+   mem[0xFFF9] = WORKLOAD_IRQ & 0xff;
+   mem[0xFFFE] = WORKLOAD_ORG >> 8;
+   mem[0xFFFF] = WORKLOAD_ORG & 0xff;
+}
+
+static void load_image(char *arg) {
+   char *comma = strchr(arg, ',');
+   if (!comma) {
+      fprintf(stderr, "--load needs FILE,HEX\n");
+      exit(1);
+   }
+   *comma = 0;
+   int addr = strtol(comma + 1, NULL, 16) & 0xffff;
+   FILE *file = fopen(arg, "rb");
+   if (!file) {
+      perror("failed to open image");
+      exit(1);
+   }
+   size_t n = fread(mem + addr, 1, 0x10000 - addr, file);
+   fclose(file);
+   if (n == 0) {
+      fprintf(stderr, "image %s is empty\n", arg);
+      exit(1);
+   }
+}
+
+// ====================================================================
+// Bus cycles
+// ====================================================================
+
+typedef struct {
+   uint16_t addr;
+   uint8_t  data;
+   uint8_t  rnw;
+   uint8_t  lic;
+   uint8_t  bs;
+   uint8_t  ba;
+} cycle_t;
+
+// Cycles are buffered until the end of an instruction (so LIC can be set
+// on its last cycle), and then written out in batches
+#define CYCLE_BUFFER 4096
+#define MAX_INSTR_CYCLES 64
+
+static cycle_t cycles[CYCLE_BUFFER];
+static int num_cycles = 0;
+static uint64_t total_cycles = 0;
+static uint64_t total_instructions = 0;
+
+// When the next IRQ is raised (it stays raised until it's taken)
+static uint64_t next_irq = 0;
+
+// Cycles in the current instruction
+static int instr_cycles;
+
+static FILE *out;
+
+// Samples are written through a buffer of their own (fwrite per sample is
+// slow enough to limit the size of a trace that can be generated)
+#define OUT_BUFFER (1 << 20)
+static uint8_t out_buf[OUT_BUFFER];
+static size_t out_len = 0;
+
+static void flush_out() {
+   if (out_len && fwrite(out_buf, 1, out_len, out) != out_len) {
+      perror("failed to write capture file");
+      exit(1);
+   }
+   out_len = 0;
+}
+
+static inline void put8(uint8_t sample) {
+   if (out_len + 1 > OUT_BUFFER) {
+      flush_out();
+   }
+   out_buf[out_len++] = sample;
+}
+
+static inline void put16(uint16_t sample) {
+   if (out_len + 2 > OUT_BUFFER) {
+      flush_out();
+   }
+   // Host byte order, like the captures decode6809 reads
+   memcpy(out_buf + out_len, &sample, 2);
+   out_len += 2;
+}
+
+// The last few raw samples, for the skew delay line in the clke layout
+static uint16_t ctrl_line[MAX_SKEW + 1];
+static uint8_t  data_line[MAX_SKEW + 1];
+static uint64_t num_raw = 0;
+
+static void write_raw(uint16_t ctrl, uint8_t data) {
+   // A positive skew delays the data bus, a negative one the control signals
+   int i = num_raw % (MAX_SKEW + 1);
+   ctrl_line[i] = ctrl;
+   data_line[i] = data;
+   int d_ctrl = arguments.skew < 0 ? -arguments.skew : 0;
+   int d_data = arguments.skew > 0 ?  arguments.skew : 0;
+   uint16_t sample = 0;
+   if (num_raw >= (uint64_t) d_ctrl) {
+      sample |= ctrl_line[(num_raw - d_ctrl) % (MAX_SKEW + 1)];
+   }
+   if (num_raw >= (uint64_t) d_data) {
+      sample |= data_line[(num_raw - d_data) % (MAX_SKEW + 1)] << IDX_DATA;
+   }
+   num_raw++;
+   put16(sample);
+}
+
+static void flush_cycles() {
+   int sig = arguments.signals;
+   for (int i = 0; i < num_cycles; i++) {
+      cycle_t *c = cycles + i;
+      if (arguments.layout == LAYOUT_BYTE) {
+         put8(c->data);
+         continue;
+      }
+      uint16_t ctrl = 0;
+      if (sig & SIG_RNW) {
+         ctrl |= c->rnw << IDX_RNW;
+      }
+      if (sig & SIG_LIC) {
+         ctrl |= c->lic << IDX_LIC;
+      }
+      if (sig & SIG_BS) {
+         ctrl |= c->bs << IDX_BS;
+      }
+      // BA is only high during a SYNC (the bus is never granted here)
+      if (sig & SIG_BA) {
+         ctrl |= c->ba << IDX_BA;
+      }
+      if (arguments.layout == LAYOUT_WORD) {
+         if (sig & SIG_ADDR) {
+            ctrl |= (c->addr & 15) << IDX_ADDR;
+         }
+         put16(ctrl | (c->data << IDX_DATA));
+      } else {
+         // clke is high for the first half of the cycle, and the data is
+         // only valid either side of its falling edge (the bus floats high
+         // the rest of the time)
+         int half = arguments.spc / 2;
+         for (int j = 0; j < arguments.spc; j++) {
+            int valid = j == half - 1 || j == half;
+            write_raw(ctrl | ((j < half) << IDX_CLKE), valid ? c->data : 0xff);
+         }
+      }
+   }
+   total_cycles += num_cycles;
+   num_cycles = 0;
+}
+
+static inline void bus(int addr, int data, int rnw, int bs) {
+   cycle_t *c = cycles + num_cycles++;
+   c->addr = addr;
+   c->data = data;
+   c->rnw  = rnw;
+   c->lic  = 0;
+   c->bs   = bs;
+   c->ba   = 0;
+   instr_cycles++;
+}
+
+static inline int rd(int addr) {
+   addr &= 0xffff;
+   bus(addr, mem[addr], 1, 0);
+   return mem[addr];
+}
+
+static inline void wr(int addr, int data) {
+   addr &= 0xffff;
+   mem[addr] = data;
+   bus(addr, data, 0, 0);
+}
+
+// A dead cycle, which reads $FFFF
+static inline void dead() {
+   bus(0xffff, mem[0xffff], 1, 0);
+}
+
+static inline int vector(int addr) {
+   bus(addr, mem[addr], 1, 1);
+   return mem[addr];
+}
+
+// A SYNC acknowledge cycle, with the buses floating
+static inline void sync_ack() {
+   dead();
+   cycles[num_cycles - 1].ba = 1;
+}
+
+// Adds dead cycles until the instruction has used n cycles
+static inline void pad(int n) {
+   while (instr_cycles < n) {
+      dead();
+   }
+}
+
+static inline int fetch() {
+   return rd(PC++);
+}
+
+static inline int fetch16() {
+   int hi = fetch();
+   return (hi << 8) | fetch();
+}
+
+static inline int rd16(int addr) {
+   int hi = rd(addr);
+   return (hi << 8) | rd(addr + 1);
+}
+
+static inline void wr16(int addr, int data) {
+   wr(addr, data >> 8);
+   wr(addr + 1, data & 0xff);
+}
+
+static inline void push8(uint16_t *sp, int data) {
+   wr(--*sp, data);
+}
+
+static inline void push16(uint16_t *sp, int data) {
+   push8(sp, data & 0xff);
+   push8(sp, data >> 8);
+}
+
+static inline int pull8(uint16_t *sp) {
+   return rd((*sp)++);
+}
+
+static inline int pull16(uint16_t *sp) {
+   int hi = pull8(sp);
+   return (hi << 8) | pull8(sp);
+}
+
+static void begin_instruction() {
+   instr_pc = PC;
+   instr_cycles = 0;
+}
+
+static void end_instruction() {
+   cycles[num_cycles - 1].lic = 1;
+   total_instructions++;
+   if (num_cycles > CYCLE_BUFFER - MAX_INSTR_CYCLES) {
+      flush_cycles();
+   }
+}
+
+static void unsupported(int prefix, int opcode) {
+   flush_cycles();
+   flush_out();
+   if (prefix) {
+      fprintf(stderr, "unsupported instruction %02X %02X at %04X\n", prefix, opcode, instr_pc);
+   } else {
+      fprintf(stderr, "unsupported instruction %02X at %04X\n", opcode, instr_pc);
+   }
+   exit(1);
+}
+
+// Whether the IRQ has been raised by the current cycle
+static inline int irq_raised() {
+   return arguments.irq && total_cycles + num_cycles >= next_irq;
+}
+
+// For CWAI and SYNC, which wait for an interrupt (with the given cycle)
+static void wait_for_irq(void (*wait_cycle)()) {
+   if (!arguments.irq) {
+      flush_cycles();
+      flush_out();
+      fprintf(stderr, "the instruction at %04X waits for an interrupt, which needs --irq\n", instr_pc);
+      exit(1);
+   }
+   do {
+      (*wait_cycle)();
+      // (The buffer must have room for the rest of the instruction)
+      if (num_cycles > CYCLE_BUFFER - MAX_INSTR_CYCLES) {
+         flush_cycles();
+      }
+   } while (!irq_raised());
+}
+
+// ====================================================================
+// Flags
+// ====================================================================
+
+static inline void set_nz8(int r) {
+   CC &= ~(CC_N | CC_Z);
+   if (r & 0x80) {
+      CC |= CC_N;
+   }
+   if (!(r & 0xff)) {
+      CC |= CC_Z;
+   }
+}
+
+static inline void set_nz16(int r) {
+   CC &= ~(CC_N | CC_Z);
+   if (r & 0x8000) {
+      CC |= CC_N;
+   }
+   if (!(r & 0xffff)) {
+      CC |= CC_Z;
+   }
+}
+
+static inline int logic8(int r) {
+   CC &= ~CC_V;
+   set_nz8(r);
+   return r & 0xff;
+}
+
+static inline int add8(int a, int b, int carry) {
+   int r = a + b + carry;
+   CC &= ~(CC_H | CC_V | CC_C);
+   if ((a ^ b ^ r) & 0x10) {
+      CC |= CC_H;
+   }
+   if (~(a ^ b) & (a ^ r) & 0x80) {
+      CC |= CC_V;
+   }
+   if (r & 0x100) {
+      CC |= CC_C;
+   }
+   set_nz8(r);
+   return r & 0xff;
+}
+
+static inline int sub8(int a, int b, int borrow) {
+   int r = a - b - borrow;
+   CC &= ~(CC_V | CC_C);
+   if ((a ^ b) & (a ^ r) & 0x80) {
+      CC |= CC_V;
+   }
+   if (r & 0x100) {
+      CC |= CC_C;
+   }
+   set_nz8(r);
+   return r & 0xff;
+}
+
+static inline int add16(int a, int b) {
+   int r = a + b;
+   CC &= ~(CC_V | CC_C);
+   if (~(a ^ b) & (a ^ r) & 0x8000) {
+      CC |= CC_V;
+   }
+   if (r & 0x10000) {
+      CC |= CC_C;
+   }
+   set_nz16(r);
+   return r & 0xffff;
+}
+
+static inline int sub16(int a, int b) {
+   int r = a - b;
+   CC &= ~(CC_V | CC_C);
+   if ((a ^ b) & (a ^ r) & 0x8000) {
+      CC |= CC_V;
+   }
+   if (r & 0x10000) {
+      CC |= CC_C;
+   }
+   set_nz16(r);
+   return r & 0xffff;
+}
+
+// The read-modify-write operations (the low nibble of 0x00-0x0F, 0x40-0x7F)
+
+static int is_rmw(int op) {
+   return op != 0x1 && op != 0x2 && op != 0x5 && op != 0xB && op != 0xE;
+}
+
+static int rmw(int op, int a) {
+   int r;
+   switch (op) {
+   case 0x0: // NEG
+      r = (-a) & 0xff;
+      CC &= ~(CC_V | CC_C);
+      if (a == 0x80) {
+         CC |= CC_V;
+      }
+      if (r) {
+         CC |= CC_C;
+      }
+      set_nz8(r);
+      return r;
+   case 0x3: // COM
+      r = (~a) & 0xff;
+      CC = (CC & ~CC_V) | CC_C;
+      set_nz8(r);
+      return r;
+   case 0x4: // LSR
+      r = a >> 1;
+      CC = (CC & ~CC_C) | (a & 1);
+      set_nz8(r);
+      return r;
+   case 0x6: // ROR
+      r = (a >> 1) | ((CC & CC_C) << 7);
+      CC = (CC & ~CC_C) | (a & 1);
+      set_nz8(r);
+      return r;
+   case 0x7: // ASR
+      r = (a >> 1) | (a & 0x80);
+      CC = (CC & ~CC_C) | (a & 1);
+      set_nz8(r);
+      return r;
+   case 0x8: // ASL
+   case 0x9: // ROL
+      r = ((a << 1) | (op == 0x9 ? (CC & CC_C) : 0)) & 0xff;
+      CC &= ~(CC_V | CC_C);
+      if (a & 0x80) {
+         CC |= CC_C;
+      }
+      if ((a ^ (a << 1)) & 0x80) {
+         CC |= CC_V;
+      }
+      set_nz8(r);
+      return r;
+   case 0xA: // DEC
+      r = (a - 1) & 0xff;
+      CC &= ~CC_V;
+      if (a == 0x80) {
+         CC |= CC_V;
+      }
+      set_nz8(r);
+      return r;
+   case 0xC: // INC
+      r = (a + 1) & 0xff;
+      CC &= ~CC_V;
+      if (a == 0x7f) {
+         CC |= CC_V;
+      }
+      set_nz8(r);
+      return r;
+   case 0xD: // TST
+      return logic8(a);
+   case 0xF: // CLR
+      CC = (CC & ~(CC_N | CC_V | CC_C)) | CC_Z;
+      return 0;
+   default:
+      return a;
+   }
+}
+
+static int branch_taken(int op) {
+   int c = CC & CC_C;
+   int z = (CC & CC_Z) != 0;
+   int n = (CC & CC_N) != 0;
+   int v = (CC & CC_V) != 0;
+   int taken;
+   switch ((op >> 1) & 7) {
+   case 0:  taken = 1;             break; // BRA / BRN
+   case 1:  taken = !(c || z);     break; // BHI / BLS
+   case 2:  taken = !c;            break; // BCC / BCS
+   case 3:  taken = !z;            break; // BNE / BEQ
+   case 4:  taken = !v;            break; // BVC / BVS
+   case 5:  taken = !n;            break; // BPL / BMI
+   case 6:  taken = n == v;        break; // BGE / BLT
+   default: taken = !z && n == v;  break; // BGT / BLE
+   }
+   return (op & 1) ? !taken : taken;
+}
+
+// ====================================================================
+// Addressing modes
+// ====================================================================
+
+static uint16_t *index_reg(int pb) {
+   switch ((pb >> 5) & 3) {
+   case 0:  return &X;
+   case 1:  return &Y;
+   case 2:  return &U;
+   default: return &S;
+   }
+}
+
+// Indexed addressing: fetches the postbyte (and any offset), and returns
+// the effective address. The extra cycles are added to *total, and any
+// indirection is done at the right point in the instruction.
+
+static int indexed(int *total) {
+   int pb = fetch();
+   uint16_t *r = index_reg(pb);
+   int ea;
+   // The first postbyte cycle is the opcode
+   int base = instr_cycles - 2;
+   if (!(pb & 0x80)) {
+      // 5-bit offset
+      *total += 1;
+      return (*r + ((pb & 0x10) ? (pb & 0x0f) - 0x10 : (pb & 0x0f))) & 0xffff;
+   }
+   static const int extra[16] = { 2, 3, 2, 3, 0, 1, 1, -1, 1, 4, -1, 4, 1, 5, -1, 5 };
+   int mode = pb & 0x0f;
+   int indirect = (pb & 0x10) != 0;
+   if (extra[mode] < 0 || (indirect && (mode == 0 || mode == 2)) || (mode == 0x0f && !indirect)) {
+      unsupported(0, pb);
+   }
+   int cycles = (mode == 0x0f) ? 5 : extra[mode] + (indirect ? 3 : 0);
+   *total += cycles;
+   switch (mode) {
+   case 0x0: ea = *r; *r += 1;                   break; // ,R+
+   case 0x1: ea = *r; *r += 2;                   break; // ,R++
+   case 0x2: *r -= 1; ea = *r;                   break; // ,-R
+   case 0x3: *r -= 2; ea = *r;                   break; // ,--R
+   case 0x4: ea = *r;                            break; // ,R
+   case 0x5: ea = *r + (int8_t) B;               break; // B,R
+   case 0x6: ea = *r + (int8_t) A;               break; // A,R
+   case 0x8: ea = *r + (int8_t) fetch();         break; // n8,R
+   case 0x9: ea = *r + fetch16();                break; // n16,R
+   case 0xB: ea = *r + ((A << 8) | B);           break; // D,R
+   case 0xC: ea = (int8_t) fetch(); ea += PC;    break; // n8,PCR
+   case 0xD: ea = fetch16(); ea += PC;           break; // n16,PCR
+   default:  ea = fetch16();                     break; // [n16]
+   }
+   ea &= 0xffff;
+   if (indirect) {
+      // The pointer is read at the end of the postbyte cycles
+      pad(base + cycles);
+      ea = rd16(ea);
+   }
+   return ea;
+}
+
+// ====================================================================
+// Instructions
+// ====================================================================
+
+typedef enum {
+   MODE_IMM,
+   MODE_DIR,
+   MODE_IDX,
+   MODE_EXT
+} addr_mode_t;
+
+// Fetches the operand address, and returns the total cycles for the
+// instruction, given its cycles in direct mode (indexed is the same plus
+// the postbyte cycles, and extended is one more)
+static int address(addr_mode_t mode, int dir_cycles, int *ea) {
+   int total = dir_cycles;
+   switch (mode) {
+   case MODE_DIR:
+      *ea = (DP << 8) | fetch();
+      break;
+   case MODE_IDX:
+      *ea = indexed(&total);
+      break;
+   default:
+      *ea = fetch16();
+      total++;
+      break;
+   }
+   return total;
+}
+
+static uint16_t *reg16(int code) {
+   switch (code) {
+   case 1:  return &X;
+   case 2:  return &Y;
+   case 3:  return &U;
+   case 4:  return &S;
+   case 5:  return &PC;
+   default: return NULL;
+   }
+}
+
+static int get_reg(int code) {
+   switch (code) {
+   case 0x0: return (A << 8) | B;
+   case 0x8: return A;
+   case 0x9: return B;
+   case 0xA: return CC;
+   case 0xB: return DP;
+   default:  return *reg16(code);
+   }
+}
+
+static void set_reg(int code, int value) {
+   switch (code) {
+   case 0x0: A = value >> 8; B = value & 0xff; break;
+   case 0x8: A = value;  break;
+   case 0x9: B = value;  break;
+   case 0xA: CC = value; break;
+   case 0xB: DP = value; break;
+   default:  *reg16(code) = value; break;
+   }
+}
+
+static int valid_reg(int code) {
+   return code <= 5 || (code >= 8 && code <= 0xB);
+}
+
+// The 0x80-0xFF opcodes, which are regular: bits 4-5 are the addressing
+// mode, bit 6 selects A or B (or D/U), and bits 0-3 are the operation
+static void op_regular(int prefix, int op) {
+   addr_mode_t mode = (op >> 4) & 3;
+   int low = op & 0x0f;
+   int isb = (op & 0x40) != 0;
+   int ea = 0;
+   int total = 0;
+
+   // Pseudo-immediate: JSR and BSR
+   if (low == 0xD && !isb) {
+      if (prefix) {
+         unsupported(prefix, op);
+      }
+      if (mode == MODE_IMM) {
+         // BSR
+         int offset = (int8_t) fetch();
+         ea = (PC + offset) & 0xffff;
+         total = 7;
+      } else {
+         total = address(mode, 7, &ea);
+      }
+      pad(total - 4);
+      rd(ea);
+      dead();
+      push16(&S, PC);
+      PC = ea;
+      return;
+   }
+
+   // The 16-bit operations
+   int is16 = 0;
+   int arith16 = 0;
+   uint16_t *r16 = NULL;
+   if (low == 0x3) {
+      // SUBD/ADDD (CMPD/CMPU with a prefix)
+      is16 = arith16 = 1;
+   } else if (low == 0xC || low == 0xE || low == 0xF || (isb && low == 0xD)) {
+      is16 = 1;
+      arith16 = (low == 0xC && !isb);  // CMPX (CMPY/CMPS with a prefix)
+      if (low == 0xE || low == 0xF) {
+         r16 = isb ? (prefix == 0x10 ? &S : &U) : (prefix == 0x10 ? &Y : &X);
+      } else if (!isb) {
+         r16 = (prefix == 0x10) ? &Y : (prefix == 0x11) ? &S : &X;
+      }
+   }
+   // Check the prefix is valid for the operation
+   if (prefix) {
+      int ok = 0;
+      if (prefix == 0x10) {
+         ok = (!isb && (low == 0x3 || low == 0xC || low == 0xE || low == 0xF)) || (isb && (low == 0xE || low == 0xF));
+      } else {
+         ok = !isb && (low == 0x3 || low == 0xC);
+      }
+      if (!ok) {
+         unsupported(prefix, op);
+      }
+   }
+
+   // Stores have no immediate mode
+   int store = (low == 0x7) || (low == 0xF) || (isb && low == 0xD);
+   if (store && mode == MODE_IMM) {
+      unsupported(prefix, op);
+   }
+
+   int operand = 0;
+   if (mode == MODE_IMM) {
+      operand = is16 ? fetch16() : fetch();
+      if (arith16) {
+         dead();
+      }
+   } else {
+      total = address(mode, is16 ? (arith16 ? 6 : 5) : 4, &ea);
+      if (prefix) {
+         total++;
+      }
+      if (store) {
+         pad(total - (is16 ? 2 : 1));
+      } else if (is16) {
+         pad(total - (arith16 ? 3 : 2));
+         operand = rd16(ea);
+         if (arith16) {
+            dead();
+         }
+      } else {
+         pad(total - 1);
+         operand = rd(ea);
+      }
+   }
+
+   uint8_t *acc = isb ? &B : &A;
+   int D = (A << 8) | B;
+   switch (low) {
+   case 0x0: *acc = sub8(*acc, operand, 0);                    break; // SUB
+   case 0x1: sub8(*acc, operand, 0);                           break; // CMP
+   case 0x2: *acc = sub8(*acc, operand, CC & CC_C);            break; // SBC
+   case 0x3:
+      if (prefix == 0x10) {
+         sub16(D, operand);                                           // CMPD
+      } else if (prefix == 0x11) {
+         sub16(U, operand);                                           // CMPU
+      } else if (isb) {
+         D = add16(D, operand);                                       // ADDD
+         A = D >> 8; B = D & 0xff;
+      } else {
+         D = sub16(D, operand);                                       // SUBD
+         A = D >> 8; B = D & 0xff;
+      }
+      break;
+   case 0x4: *acc = logic8(*acc & operand);                    break; // AND
+   case 0x5: logic8(*acc & operand);                           break; // BIT
+   case 0x6: *acc = logic8(operand);                           break; // LD
+   case 0x7: logic8(*acc); wr(ea, *acc);                       break; // ST
+   case 0x8: *acc = logic8(*acc ^ operand);                    break; // EOR
+   case 0x9: *acc = add8(*acc, operand, CC & CC_C);            break; // ADC
+   case 0xA: *acc = logic8(*acc | operand);                    break; // OR
+   case 0xB: *acc = add8(*acc, operand, 0);                    break; // ADD
+   case 0xC:
+      if (isb) {
+         A = operand >> 8; B = operand & 0xff;                        // LDD
+         CC &= ~CC_V;
+         set_nz16(operand);
+      } else {
+         sub16(*r16, operand);                                        // CMPX/CMPY/CMPS
+      }
+      break;
+   case 0xD:                                                          // STD
+      CC &= ~CC_V;
+      set_nz16(D);
+      wr16(ea, D);
+      break;
+   case 0xE:                                                          // LDX/LDY/LDU/LDS
+      *r16 = operand;
+      CC &= ~CC_V;
+      set_nz16(operand);
+      break;
+   case 0xF:                                                          // STX/STY/STU/STS
+      CC &= ~CC_V;
+      set_nz16(*r16);
+      wr16(ea, *r16);
+      break;
+   }
+}
+
+// The memory read-modify-write operations (and JMP)
+static void op_memory(int op) {
+   addr_mode_t mode = (op < 0x10) ? MODE_DIR : (op < 0x70) ? MODE_IDX : MODE_EXT;
+   int low = op & 0x0f;
+   int ea;
+   if (low == 0xE) {
+      // JMP
+      pad(address(mode, 3, &ea));
+      PC = ea;
+      return;
+   }
+   if (!is_rmw(low)) {
+      unsupported(0, op);
+   }
+   int total = address(mode, 6, &ea);
+   pad(total - 3);
+   int value = rd(ea);
+   dead();
+   int result = rmw(low, value);
+   if (low == 0xD) {
+      // TST doesn't write
+      dead();
+   } else {
+      wr(ea, result);
+   }
+}
+
+static void push_regs(uint16_t *sp, uint16_t other, int pb) {
+   if (pb & 0x80) push16(sp, PC);
+   if (pb & 0x40) push16(sp, other);
+   if (pb & 0x20) push16(sp, Y);
+   if (pb & 0x10) push16(sp, X);
+   if (pb & 0x08) push8(sp, DP);
+   if (pb & 0x04) push8(sp, B);
+   if (pb & 0x02) push8(sp, A);
+   if (pb & 0x01) push8(sp, CC);
+}
+
+static void pull_regs(uint16_t *sp, uint16_t *other, int pb) {
+   if (pb & 0x01) CC = pull8(sp);
+   if (pb & 0x02) A  = pull8(sp);
+   if (pb & 0x04) B  = pull8(sp);
+   if (pb & 0x08) DP = pull8(sp);
+   if (pb & 0x10) X  = pull16(sp);
+   if (pb & 0x20) Y  = pull16(sp);
+   if (pb & 0x40) *other = pull16(sp);
+   if (pb & 0x80) PC = pull16(sp);
+}
+
+// Stacks the entire state (for SWI, CWAI and IRQ)
+static void stack_all() {
+   CC |= CC_E;
+   push_regs(&S, U, 0xFF);
+}
+
+// Fetches a vector, and jumps to it
+static void take_vector(int addr) {
+   int hi = vector(addr);
+   PC = (hi << 8) | vector(addr + 1);
+   dead();
+}
+
+// SWI, SWI2 and SWI3 (after the opcode, and any prefix)
+static void op_swi(int prefix) {
+   rd(PC);
+   dead();
+   stack_all();
+   dead();
+   if (prefix == 0x10) {
+      take_vector(0xFFF4);
+   } else if (prefix == 0x11) {
+      take_vector(0xFFF2);
+   } else {
+      CC |= CC_I | CC_F;
+      take_vector(0xFFFA);
+   }
+}
+
+static void op_daa() {
+   int lo = A & 0x0f;
+   int hi = A & 0xf0;
+   int correction = 0;
+   if ((CC & CC_H) || lo > 0x09) {
+      correction |= 0x06;
+   }
+   if ((CC & CC_C) || hi > 0x90 || (hi > 0x80 && lo > 0x09)) {
+      correction |= 0x60;
+   }
+   int r = A + correction;
+   // C is only ever set, and V is as decode6809 (and real parts) have it
+   CC |= (r >> 8) & CC_C;
+   CC &= ~CC_V;
+   if (((r >> 7) & 1) ^ (CC & CC_C)) {
+      CC |= CC_V;
+   }
+   A = r & 0xff;
+   set_nz8(A);
+}
+
+// The prefixed instructions below 0x80: the long conditional branches, and
+// SWI2/SWI3
+static void op_prefixed(int prefix, int op) {
+   if (op == 0x3F) {
+      op_swi(prefix);
+   } else if (prefix == 0x10 && op > 0x20 && op < 0x30) {
+      int offset = fetch16();
+      dead();
+      if (branch_taken(op)) {
+         dead();
+         PC += offset;
+      }
+   } else {
+      unsupported(prefix, op);
+   }
+}
+
+static void op_inherent(int op) {
+   // The cycle after the opcode reads the next byte
+   int pb;
+   switch (op) {
+   case 0x12: // NOP
+      rd(PC);
+      break;
+   case 0x13: // SYNC
+      rd(PC);
+      wait_for_irq(sync_ack);
+      dead();
+      break;
+   case 0x16: // LBRA
+      {
+         int offset = fetch16();
+         dead();
+         dead();
+         PC += offset;
+      }
+      break;
+   case 0x17: // LBSR
+      {
+         int offset = fetch16();
+         int ea = (PC + offset) & 0xffff;
+         pad(5);
+         rd(ea);
+         dead();
+         push16(&S, PC);
+         PC = ea;
+      }
+      break;
+   case 0x19: // DAA
+      rd(PC);
+      op_daa();
+      break;
+   case 0x3C: // CWAI
+      CC &= fetch();
+      rd(PC);
+      dead();
+      stack_all();
+      if (CC & CC_I) {
+         flush_cycles();
+         flush_out();
+         fprintf(stderr, "the CWAI at %04X leaves the IRQ masked, so never ends\n", instr_pc);
+         exit(1);
+      }
+      wait_for_irq(dead);
+      CC |= CC_I;
+      take_vector(0xFFF8);
+      next_irq += arguments.irq;
+      break;
+   case 0x3F: // SWI
+      op_swi(0);
+      break;
+   case 0x1D: // SEX
+      rd(PC);
+      A = (B & 0x80) ? 0xff : 0x00;
+      set_nz8(B);
+      break;
+   case 0x3A: // ABX
+      rd(PC);
+      dead();
+      X += B;
+      break;
+   case 0x3D: // MUL
+      {
+         rd(PC);
+         pad(11);
+         int D = A * B;
+         A = D >> 8;
+         B = D & 0xff;
+         CC &= ~(CC_Z | CC_C);
+         if (!D) {
+            CC |= CC_Z;
+         }
+         if (B & 0x80) {
+            CC |= CC_C;
+         }
+      }
+      break;
+   case 0x39: // RTS
+      rd(PC);
+      PC = pull16(&S);
+      dead();
+      break;
+   case 0x3B: // RTI
+      rd(PC);
+      CC = pull8(&S);
+      if (CC & CC_E) {
+         pull_regs(&S, &U, 0x7E);
+      }
+      PC = pull16(&S);
+      dead();
+      break;
+   case 0x1A: // ORCC
+      CC |= fetch();
+      dead();
+      break;
+   case 0x1C: // ANDCC
+      CC &= fetch();
+      dead();
+      break;
+   case 0x1E: // EXG
+   case 0x1F: // TFR
+      pb = fetch();
+      {
+         int src = pb >> 4;
+         int dst = pb & 0x0f;
+         if (!valid_reg(src) || !valid_reg(dst) || (src < 8) != (dst < 8)) {
+            unsupported(op, pb);
+         }
+         pad(op == 0x1E ? 8 : 6);
+         int value = get_reg(src);
+         if (op == 0x1E) {
+            set_reg(src, get_reg(dst));
+         }
+         set_reg(dst, value);
+      }
+      break;
+   case 0x30: // LEAX
+   case 0x31: // LEAY
+   case 0x32: // LEAS
+   case 0x33: // LEAU
+      {
+         int total = 4;
+         int ea = indexed(&total);
+         pad(total);
+         // LEAX and LEAY only affect Z
+         if (op == 0x30 || op == 0x31) {
+            *(op == 0x30 ? &X : &Y) = ea;
+            CC &= ~CC_Z;
+            if (!ea) {
+               CC |= CC_Z;
+            }
+         } else if (op == 0x32) {
+            S = ea;
+         } else {
+            U = ea;
+         }
+      }
+      break;
+   case 0x34: // PSHS
+   case 0x36: // PSHU
+      pb = fetch();
+      pad(5);
+      if (op == 0x34) {
+         push_regs(&S, U, pb);
+      } else {
+         push_regs(&U, S, pb);
+      }
+      break;
+   case 0x35: // PULS
+   case 0x37: // PULU
+      pb = fetch();
+      pad(4);
+      if (op == 0x35) {
+         pull_regs(&S, &U, pb);
+      } else {
+         pull_regs(&U, &S, pb);
+      }
+      dead();
+      break;
+   default:
+      if ((op & 0xe0) == 0x40) {
+         // Accumulator read-modify-write (NEGA ... CLRB)
+         uint8_t *acc = (op & 0x10) ? &B : &A;
+         if (!is_rmw(op & 0x0f)) {
+            unsupported(0, op);
+         }
+         rd(PC);
+         *acc = rmw(op & 0x0f, *acc);
+      } else if ((op & 0xf0) == 0x20) {
+         // Short branches
+         int offset = (int8_t) fetch();
+         dead();
+         if (branch_taken(op)) {
+            PC += offset;
+         }
+      } else {
+         unsupported(0, op);
+      }
+   }
+}
+
+static void execute() {
+   begin_instruction();
+   int op = fetch();
+   int prefix = 0;
+   if (op == 0x10 || op == 0x11) {
+      prefix = op;
+      op = fetch();
+   }
+   if (prefix && op < 0x80) {
+      op_prefixed(prefix, op);
+   } else if (op >= 0x80) {
+      op_regular(prefix, op);
+   } else if (op < 0x10 || op >= 0x60) {
+      op_memory(op);
+   } else {
+      op_inherent(op);
+   }
+   end_instruction();
+}
+
+// IRQ, between instructions
+static void interrupt() {
+   begin_instruction();
+   rd(PC);
+   rd(PC);
+   dead();
+   stack_all();
+   dead();
+   CC |= CC_I;
+   take_vector(0xFFF8);
+   next_irq += arguments.irq;
+   end_instruction();
+}
+
+static void reset() {
+   begin_instruction();
+   for (int i = 0; i < 8; i++) {
+      dead();
+   }
+   int hi = vector(0xFFFE);
+   PC = (hi << 8) | vector(0xFFFF);
+   dead();
+   DP = 0;
+   CC |= CC_F | CC_I;
+   end_instruction();
+}
+
+// ====================================================================
+// Main
+// ====================================================================
+
+static uint64_t parse_count(const char *arg) {
+   char *end;
+   uint64_t n = strtoull(arg, &end, 10);
+   switch (*end) {
+   case 'k': case 'K': n *= 1000;        break;
+   case 'm': case 'M': n *= 1000000;     break;
+   case 'g': case 'G': n *= 1000000000;  break;
+   }
+   return n;
+}
+
+static int parse_signals(const char *arg) {
+   static const char *names[] = { "rnw", "lic", "bs", "ba", "addr" };
+   int signals = 0;
+   char *copy = strdup(arg);
+   for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+      int i;
+      for (i = 0; i < 5; i++) {
+         if (!strcmp(tok, names[i])) {
+            signals |= 1 << i;
+            break;
+         }
+      }
+      if (i == 5) {
+         signals = -1;
+         break;
+      }
+   }
+   free(copy);
+   return signals;
+}
+
+static int loaded = 0;
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+   struct arguments *arguments = state->input;
+   switch (key) {
+   case KEY_LAYOUT:
+      if (!strcmp(arg, "byte")) {
+         arguments->layout = LAYOUT_BYTE;
+      } else if (!strcmp(arg, "word")) {
+         arguments->layout = LAYOUT_WORD;
+      } else if (!strcmp(arg, "clke")) {
+         arguments->layout = LAYOUT_CLKE;
+      } else {
+         argp_error(state, "unknown layout %s", arg);
+      }
+      break;
+   case KEY_SIGNALS:
+      arguments->signals = parse_signals(arg);
+      if (arguments->signals < 0) {
+         argp_error(state, "unknown signal in %s", arg);
+      }
+      break;
+   case KEY_SPC:
+      arguments->spc = atoi(arg);
+      if (arguments->spc < 2 || (arguments->spc & 1)) {
+         argp_error(state, "--spc must be even, and at least 2");
+      }
+      break;
+   case KEY_SKEW:
+      arguments->skew = atoi(arg);
+      if (arguments->skew < -MAX_SKEW || arguments->skew > MAX_SKEW) {
+         argp_error(state, "--skew must be between -%d and %d", MAX_SKEW, MAX_SKEW);
+      }
+      break;
+   case KEY_LOAD:
+      load_image(arg);
+      loaded = 1;
+      break;
+   case KEY_PC:
+      arguments->pc = strtol(arg, NULL, 16) & 0xffff;
+      break;
+   case KEY_IRQ:
+      arguments->irq = parse_count(arg);
+      break;
+   case KEY_CYCLES:
+      arguments->cycles = parse_count(arg);
+      break;
+   case ARGP_KEY_ARG:
+      if (state->arg_num >= 1) {
+         argp_usage(state);
+      }
+      arguments->filename = arg;
+      break;
+   default:
+      return ARGP_ERR_UNKNOWN;
+   }
+   return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc, NULL, NULL, NULL };
+
+int main(int argc, char *argv[]) {
+   arguments.layout   = LAYOUT_WORD;
+   arguments.signals  = SIG_ALL;
+   arguments.spc      = 4;
+   arguments.skew     = 0;
+   arguments.pc       = -1;
+   arguments.irq      = 0;
+   arguments.cycles   = 1000000;
+   arguments.filename = NULL;
+
+   argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+   if (arguments.layout == LAYOUT_CLKE && (arguments.signals & SIG_ADDR)) {
+      // clke takes over bit 12
+      arguments.signals &= ~SIG_ADDR;
+   }
+   if (!loaded) {
+      load_workload();
+   }
+
+   if (arguments.filename) {
+      out = fopen(arguments.filename, "wb");
+      if (!out) {
+         perror("failed to create capture file");
+         return 1;
+      }
+   } else {
+      out = stdout;
+   }
+
+   reset();
+   if (arguments.pc >= 0) {
+      PC = arguments.pc;
+   }
+   next_irq = arguments.irq;
+   while (total_cycles + num_cycles < arguments.cycles) {
+      if (irq_raised() && !(CC & CC_I)) {
+         interrupt();
+      } else {
+         execute();
+      }
+   }
+   flush_cycles();
+   flush_out();
+
+   if (fclose(out)) {
+      perror("failed to write capture file");
+      return 1;
+   }
+   // For the benchmark driver (the reset and interrupts count as instructions)
+   fprintf(stderr, "cycles = %"PRIu64"\n", total_cycles);
+   fprintf(stderr, "instructions = %"PRIu64"\n", total_instructions);
+   return 0;
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// ====================================================================
+// Runs a command, and reports its elapsed time and peak RSS
+// ====================================================================
+//
+// Usage: measure REPORT COMMAND [ARGS...]
+//
+// REPORT gets one line: the elapsed seconds, and the peak RSS in KB. This
+// is what /usr/bin/time -f "%e %M" does, but that isn't always installed.
+
+int main(int argc, char *argv[]) {
+   if (argc < 3) {
+      fprintf(stderr, "usage: measure REPORT COMMAND [ARGS...]\n");
+      return 1;
+   }
+   struct timespec start, end;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   pid_t pid = fork();
+   if (pid < 0) {
+      perror("fork failed");
+      return 1;
+   }
+   if (pid == 0) {
+      execvp(argv[2], argv + 2);
+      perror("exec failed");
+      _exit(127);
+   }
+   int status;
+   struct rusage usage;
+   if (wait4(pid, &status, 0, &usage) < 0) {
+      perror("wait failed");
+      return 1;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   FILE *report = fopen(argv[1], "w");
+   if (!report) {
+      perror("failed to create report");
+      return 1;
+   }
+   fprintf(report, "%.3f %ld\n", elapsed, usage.ru_maxrss);
+   fclose(report);
+   return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
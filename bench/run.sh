@@ -0,0 +1,80 @@
+#!/bin/bash
+
+# Throughput benchmark for decode6809
+#
+# Generates a synthetic capture in each layout (see gen6809 --help), decodes
+# it, and reports samples/s, instructions/s and the peak RSS of the decoder.
+#
+# Usage: bench/run.sh [CYCLES] [MODE...]
+#
+#   CYCLES      bus cycles per capture (default 250M, suffixes K, M and G)
+#   MODE        modes to run (default all)
+#
+# Environment:
+#   DECODE_OPTS extra decode6809 options (e.g. "-q", or "--pipeline")
+#   BENCH_DIR   where the captures are written (default /tmp/bench6809)
+#   KEEP=1      keep the captures, and reuse them on the next run
+
+cd `dirname $0`
+
+DIR=build
+BENCH_DIR=${BENCH_DIR:-/tmp/bench6809}
+CYCLES=${1:-250M}
+shift
+
+mkdir -p $DIR $BENCH_DIR
+
+gcc -Wall -Wextra -O3 -D_GNU_SOURCE -o $DIR/gen6809 gen6809.c || exit 1
+gcc -Wall -Wextra -O3 -o $DIR/measure measure.c || exit 1
+
+DECODER=../decode6809
+if [ ! -x $DECODER ]; then
+    (cd .. && ./build.sh) || exit 1
+fi
+
+# name : bytes per sample : gen6809 options : decode6809 options
+#
+# (The 6309 mode decodes a 6809 trace as a 6309 in emulation mode, which has
+# the same bus cycles; gen6809 doesn't model the 6309's native mode)
+MODES="
+word       : 2 : --irq=5000                                :
+word-nolic : 2 : --irq=5000 --signals=rnw,bs,ba,addr       : --lic=
+word-data  : 2 : --signals=                                : --rnw= --lic= --bs= --ba= --addr=
+byte       : 1 : --layout=byte                             : --byte
+clke       : 2 : --layout=clke                             : --clke=12 --addr=
+clke-skew  : 2 : --layout=clke --skew=2                    : --clke=12 --addr= --skew=2
+6309       : 2 : --irq=5000                                : -c6309
+"
+
+printf "%-11s %12s %8s %12s %12s %9s\n" mode samples seconds samples/s instr/s "rss(MB)"
+
+while IFS=: read name bps gen_opts decode_opts; do
+    name=`echo $name`
+    if [ -z "$name" ]; then
+        continue
+    fi
+    if [ $# -gt 0 ] && [[ ! " $* " =~ " $name " ]]; then
+        continue
+    fi
+
+    capture=$BENCH_DIR/$name-$CYCLES.bin
+    if [ ! -f $capture ] || [ ! -f $capture.log ]; then
+        $DIR/gen6809 --cycles=$CYCLES $gen_opts $capture 2> $capture.log || exit 1
+    fi
+    instructions=`sed -n 's/^instructions = //p' $capture.log`
+    samples=$(( `stat -c %s $capture` / bps ))
+
+    $DIR/measure $BENCH_DIR/report $DECODER $decode_opts $DECODE_OPTS $capture > /dev/null || echo "$name: decode6809 failed"
+    read seconds rss < $BENCH_DIR/report
+
+    awk -v n=$name -v s=$samples -v t=$seconds -v i=$instructions -v r=$rss 'BEGIN {
+        if (t <= 0) t = 0.001;
+        printf "%-11s %12d %8.2f %12.0f %12.0f %9.1f\n", n, s, t, s / t, i / t, r / 1024
+    }'
+
+    if [ "$KEEP" != "1" ]; then
+        rm -f $capture $capture.log
+    fi
+done <<< "$MODES"
+
+rm -f $BENCH_DIR/report
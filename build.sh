@@ -21,4 +21,15 @@ else
   DEFS="-D_GNU_SOURCE"
 fi
 
-gcc -Wall -Wextra -Wno-unused-parameter -Wno-missing-field-initializers -O3 $DEFS $INCS -o decode6809 src/main.c src/memory.c src/em_6809.c src/dis_6809.c $LIBS
+# Optional support for compressed capture files
+for lib in zlib:z:HAVE_ZLIB zstd:zstd:HAVE_ZSTD lz4frame:lz4:HAVE_LZ4; do
+  IFS=: read hdr name def <<< "$lib"
+  if echo "#include <$hdr.h>" | gcc $INCS -E - > /dev/null 2>&1; then
+    LIBS="$LIBS -l$name"
+    DEFS="$DEFS -D$def"
+  fi
+done
+
+LIBS="$LIBS -lpthread"
+
+gcc -Wall -Wextra -Wno-unused-parameter -Wno-missing-field-initializers -O3 $DEFS $INCS -o decode6809 src/main.c src/capture.c src/output.c src/jobs.c src/memory.c src/em_6809.c src/dis_6809.c src/trace.c src/index.c src/state.c src/profile.c src/callgraph.c src/irqstats.c src/timeline.c src/coverage.c $LIBS
@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "defs.h"
+#include "output.h"
+#include "callgraph.h"
+
+// With --callgraph=FILE, the decoder follows the calls and returns, and
+// charges the cycles of each instruction to the chain of calls it was made
+// from. At the end of the capture, FILE is written in the collapsed stack
+// format used by flame graph tools (one line per call chain, with the
+// callee entry points separated by semicolons, then the cycles), and the
+// functions with the most inclusive cycles are listed.
+//
+// JSR, BSR, LBSR and the SWIs are calls, and RTS, RTI and PULS ...,PC are
+// returns. Interrupts (and CWAI) start a new chain, from an "interrupt"
+// root, rather than appearing to be called by whatever they interrupted.
+//
+// Each call is recorded with the stack pointer after the return address
+// was pushed, and a return pops the calls that the stack pointer has gone
+// back above. So that a multitasking OS (e.g. OS-9) switching between
+// processes doesn't confuse this, there is a shadow call stack for each
+// region of memory the S stack has been seen in, and a return is matched
+// against the one it's near.
+
+#define ROOT_MAIN       -1
+#define ROOT_INTERRUPT  -2
+
+// A return to more than this above a call is taken to be on another stack
+#define STACK_REGION    0x100
+
+#define MAX_STACKS      16
+#define MAX_DEPTH       256
+
+#define HASH_SIZE       0x10000
+
+// A node in the call tree, for each distinct chain of calls
+typedef struct {
+   int key;                   // bank << 16 | entry point, or ROOT_...
+   int parent;                // Index of the caller's node, or -1
+   int next;                  // Next node in the same hash bucket
+   uint64_t calls;
+   uint64_t cycles;           // Cycles of the function itself (exclusive)
+   uint64_t total;            // Including its callees (inclusive)
+} callgraph_node_t;
+
+typedef struct {
+   int node;                  // -1 until the first instruction of the callee
+   int parent;                // Node of the caller
+   int s;                     // Stack pointer after the call (or -1)
+} callgraph_frame_t;
+
+typedef struct {
+   callgraph_frame_t frames[MAX_DEPTH];
+   int depth;
+   uint64_t last_used;
+} callgraph_stack_t;
+
+// A row of the function summary
+typedef struct {
+   int key;
+   uint64_t calls;
+   uint64_t cycles;
+   uint64_t total;
+} callgraph_function_t;
+
+static FILE *file;
+static int top;
+static cpu_emulator_t *em;
+static void *em_ctx;
+
+static callgraph_node_t *nodes;
+static int num_nodes;
+static int max_nodes;
+static int hash[HASH_SIZE];
+
+static callgraph_stack_t stacks[MAX_STACKS];
+static callgraph_stack_t *stack;
+static uint64_t num_events;
+
+static int main_root;
+static int interrupt_root;
+
+// The node the next instruction's cycles go to
+static int current;
+
+static uint64_t total_cycles;
+
+// ====================================================================
+// Call tree
+// ====================================================================
+
+static int get_node(int parent, int key) {
+   unsigned int h = ((unsigned int) key * 0x9e3779b1u + (unsigned int) parent) & (HASH_SIZE - 1);
+   for (int n = hash[h]; n >= 0; n = nodes[n].next) {
+      if (nodes[n].key == key && nodes[n].parent == parent) {
+         return n;
+      }
+   }
+   if (num_nodes == max_nodes) {
+      max_nodes = max_nodes ? max_nodes * 2 : 0x1000;
+      nodes = realloc(nodes, max_nodes * sizeof(callgraph_node_t));
+      if (!nodes) {
+         fprintf(stderr, "failed to allocate call graph\n");
+         exit(1);
+      }
+   }
+   int n = num_nodes++;
+   memset(nodes + n, 0, sizeof(callgraph_node_t));
+   nodes[n].key = key;
+   nodes[n].parent = parent;
+   nodes[n].next = hash[h];
+   hash[h] = n;
+   return n;
+}
+
+static int write_name(char *bp, int key) {
+   if (key == ROOT_MAIN) {
+      return sprintf(bp, "main");
+   } else if (key == ROOT_INTERRUPT) {
+      return sprintf(bp, "interrupt");
+   }
+   int bank = (key >> 16) - 1;
+   int pc = key & 0xffff;
+   if (bank < 0) {
+      return sprintf(bp, "%04X", pc);
+   } else if (bank < 16) {
+      return sprintf(bp, "%X-%04X", bank, pc);
+   } else {
+      return sprintf(bp, "?-%04X", pc);
+   }
+}
+
+// ====================================================================
+// Shadow call stacks
+// ====================================================================
+
+static int is_near(int s, int frame_s) {
+   return s < 0 || frame_s < 0 || (frame_s >= s && frame_s - s <= STACK_REGION);
+}
+
+static void set_current() {
+   if (stack->depth == 0) {
+      current = main_root;
+   } else {
+      callgraph_frame_t *frame = stack->frames + stack->depth - 1;
+      current = frame->node >= 0 ? frame->node : frame->parent;
+   }
+}
+
+static void use_stack(callgraph_stack_t *st) {
+   stack = st;
+   stack->last_used = ++num_events;
+}
+
+// Finds the stack a call (or interrupt) with the stack pointer s is made on:
+// the current stack if s is near it, otherwise another one that s is near,
+// otherwise an empty (or the least recently used) stack
+
+static void find_stack_for_call(int s) {
+   if (stack->depth == 0 || is_near(s, stack->frames[stack->depth - 1].s)) {
+      use_stack(stack);
+      return;
+   }
+   callgraph_stack_t *best = NULL;
+   for (int i = 0; i < MAX_STACKS; i++) {
+      callgraph_stack_t *st = stacks + i;
+      if (st->depth > 0 && is_near(s, st->frames[st->depth - 1].s)) {
+         use_stack(st);
+         return;
+      }
+      if (!best || (best->depth > 0 && (st->depth == 0 || st->last_used < best->last_used))) {
+         best = st;
+      }
+   }
+   best->depth = 0;
+   use_stack(best);
+}
+
+static void push_frame(int parent, int s) {
+   if (stack->depth == MAX_DEPTH) {
+      // Runaway recursion, or a stack that's never unwound
+      memmove(stack->frames, stack->frames + 1, (MAX_DEPTH - 1) * sizeof(callgraph_frame_t));
+      stack->depth--;
+   }
+   callgraph_frame_t *frame = stack->frames + stack->depth++;
+   frame->node = -1;
+   frame->parent = parent;
+   frame->s = s;
+}
+
+// Pops the frames of st that a return to s has gone above, returning how
+// many were popped
+
+static int pop_frames(callgraph_stack_t *st, int s) {
+   int popped = 0;
+   while (st->depth > 0) {
+      callgraph_frame_t *frame = st->frames + st->depth - 1;
+      if (s >= 0 && frame->s >= 0 && (frame->s >= s || s - frame->s > STACK_REGION)) {
+         break;
+      }
+      st->depth--;
+      popped++;
+      if (s < 0 || frame->s < 0) {
+         break;
+      }
+   }
+   return popped;
+}
+
+static void do_return(int s) {
+   if (pop_frames(stack, s)) {
+      return;
+   }
+   // It may be a return to a process on another stack (e.g. the RTI at the
+   // end of a task switch)
+   for (int i = 0; i < MAX_STACKS; i++) {
+      if (stacks + i != stack && pop_frames(stacks + i, s)) {
+         use_stack(stacks + i);
+         return;
+      }
+   }
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+int callgraph_init(arguments_t *args, cpu_emulator_t *emulator, void *emulator_ctx) {
+   // Created now, so a bad path isn't only found at the end of the capture
+   file = fopen(args->callgraph_file, "w");
+   if (!file) {
+      perror("failed to create call graph");
+      return -1;
+   }
+   top = args->profile_top;
+   em = emulator;
+   em_ctx = emulator_ctx;
+   memset(hash, -1, sizeof(hash));
+   main_root = get_node(-1, ROOT_MAIN);
+   interrupt_root = get_node(-1, ROOT_INTERRUPT);
+   current = main_root;
+   stack = stacks;
+   return 0;
+}
+
+// Called after each instruction (or interrupt or reset sequence), with the
+// bank of its pc at the time
+
+void callgraph_instruction(instruction_t *instruction, int num_cycles, int bank) {
+   if (instruction->rst_seen) {
+      for (int i = 0; i < MAX_STACKS; i++) {
+         stacks[i].depth = 0;
+      }
+      current = main_root;
+      nodes[current].cycles += num_cycles;
+      total_cycles += num_cycles;
+      return;
+   }
+   if (instruction->intr_seen) {
+      // The entry sequence is charged to the root of the interrupt
+      nodes[interrupt_root].cycles += num_cycles;
+      total_cycles += num_cycles;
+      int s = em->get_S(em_ctx);
+      find_stack_for_call(s);
+      push_frame(interrupt_root, s);
+      set_current();
+      return;
+   }
+
+   // The first instruction of a call names it
+   if (stack->depth > 0 && stack->frames[stack->depth - 1].node < 0 && instruction->pc >= 0) {
+      callgraph_frame_t *frame = stack->frames + stack->depth - 1;
+      frame->node = get_node(frame->parent, instruction->pc | (bank + 1) << 16);
+      nodes[frame->node].calls++;
+      current = frame->node;
+   }
+
+   nodes[current].cycles += num_cycles;
+   total_cycles += num_cycles;
+
+   int i = 0;
+   while (i < instruction->length - 1 && (instruction->instr[i] == 0x10 || instruction->instr[i] == 0x11)) {
+      i++;
+   }
+   if (!instruction->length) {
+      return;
+   }
+   switch (instruction->instr[i]) {
+   case 0x17: // LBSR
+   case 0x8d: // BSR
+   case 0x9d: // JSR
+   case 0xad:
+   case 0xbd:
+   case 0x3f: // SWI, SWI2, SWI3
+      {
+         int s = em->get_S(em_ctx);
+         find_stack_for_call(s);
+         push_frame(current, s);
+      }
+      break;
+   case 0x3c: // CWAI
+      {
+         int s = em->get_S(em_ctx);
+         find_stack_for_call(s);
+         push_frame(interrupt_root, s);
+      }
+      break;
+   case 0x35: // PULS
+      if (!(instruction->instr[i + 1] & 0x80)) {
+         return;
+      }
+      // Fall through
+   case 0x39: // RTS
+   case 0x3b: // RTI
+      do_return(em->get_S(em_ctx));
+      break;
+   default:
+      return;
+   }
+   set_current();
+}
+
+// ====================================================================
+// Report
+// ====================================================================
+
+static int compare_keys(const void *a, const void *b) {
+   return nodes[*(const int *)a].key - nodes[*(const int *)b].key;
+}
+
+static int compare_functions(const void *a, const void *b) {
+   const callgraph_function_t *fa = a;
+   const callgraph_function_t *fb = b;
+   if (fa->total != fb->total) {
+      return fa->total < fb->total ? 1 : -1;
+   }
+   return fa->key - fb->key;
+}
+
+static double percent(uint64_t cycles) {
+   return total_cycles ? 100.0 * cycles / total_cycles : 0.0;
+}
+
+// Is there a node for the same function further up the chain (i.e. is it
+// recursive, so its cycles are already in the caller's inclusive cycles)?
+
+static int is_recursive(int n) {
+   for (int p = nodes[n].parent; p >= 0; p = nodes[p].parent) {
+      if (nodes[p].key == nodes[n].key) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+static int write_collapsed() {
+   int *chain = malloc(MAX_STACKS * MAX_DEPTH * sizeof(int));
+   if (!chain) {
+      fprintf(stderr, "failed to allocate call graph\n");
+      fclose(file);
+      return -1;
+   }
+   char name[16];
+   for (int n = 0; n < num_nodes; n++) {
+      if (!nodes[n].cycles) {
+         continue;
+      }
+      int len = 0;
+      for (int p = n; p >= 0 && len < MAX_STACKS * MAX_DEPTH; p = nodes[p].parent) {
+         chain[len++] = p;
+      }
+      while (len-- > 0) {
+         write_name(name, nodes[chain[len]].key);
+         fputs(name, file);
+         fputc(len ? ';' : ' ', file);
+      }
+      fprintf(file, "%"PRIu64"\n", nodes[n].cycles);
+   }
+   free(chain);
+   if (fclose(file)) {
+      perror("failed to write call graph");
+      return -1;
+   }
+   return 0;
+}
+
+// Returns -1 if the call graph couldn't be written, which has already been
+// reported
+
+int callgraph_report() {
+   int failed = write_collapsed() < 0;
+
+   // Children are always created after their parents
+   for (int n = num_nodes - 1; n >= 0; n--) {
+      nodes[n].total += nodes[n].cycles;
+      if (nodes[n].parent >= 0) {
+         nodes[nodes[n].parent].total += nodes[n].total;
+      }
+   }
+
+   // Combine the nodes of each function
+   int *order = malloc(num_nodes * sizeof(int));
+   callgraph_function_t *functions = malloc(num_nodes * sizeof(callgraph_function_t));
+   if (!order || !functions) {
+      fprintf(stderr, "failed to allocate call graph report\n");
+      free(order);
+      free(functions);
+      return -1;
+   }
+   for (int n = 0; n < num_nodes; n++) {
+      order[n] = n;
+   }
+   qsort(order, num_nodes, sizeof(int), compare_keys);
+   int num_functions = 0;
+   for (int i = 0; i < num_nodes; i++) {
+      callgraph_node_t *node = nodes + order[i];
+      if (!num_functions || functions[num_functions - 1].key != node->key) {
+         callgraph_function_t *f = functions + num_functions++;
+         memset(f, 0, sizeof(callgraph_function_t));
+         f->key = node->key;
+      }
+      callgraph_function_t *f = functions + num_functions - 1;
+      f->calls += node->calls;
+      f->cycles += node->cycles;
+      if (!is_recursive(order[i])) {
+         f->total += node->total;
+      }
+   }
+   qsort(functions, num_functions, sizeof(callgraph_function_t), compare_functions);
+
+   output_printf("callgraph: %"PRIu64" cycles, %d call chains\n", total_cycles, num_nodes);
+   output_printf("function        calls       cycles       %%    incl cycles       %%\n");
+   if (top > 0 && num_functions > top) {
+      num_functions = top;
+   }
+   for (int i = 0; i < num_functions; i++) {
+      callgraph_function_t *f = functions + i;
+      char name[16];
+      write_name(name, f->key);
+      output_printf("%-9s %12"PRIu64" %12"PRIu64" %6.2f%% %14"PRIu64" %6.2f%%\n",
+                    name, f->calls, f->cycles, percent(f->cycles), f->total, percent(f->total));
+   }
+   free(order);
+   free(functions);
+   return failed ? -1 : 0;
+}
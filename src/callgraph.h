@@ -0,0 +1,12 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include "defs.h"
+
+int callgraph_init(arguments_t *args, cpu_emulator_t *em, void *em_ctx);
+
+void callgraph_instruction(instruction_t *instruction, int num_cycles, int bank);
+
+int callgraph_report();
+
+#endif
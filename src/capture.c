@@ -0,0 +1,645 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "defs.h"
+#include "capture.h"
+#include "spsc.h"
+
+// Size of the fread buffer, in bytes, used when the capture can't be mapped
+
+#define BUFSIZE 16384
+
+// The buffer has room for a partial sample carried over from the previous read
+
+static uint8_t buffer[BUFSIZE + 2];
+
+static size_t buffer_len = 0;
+
+// Number of bytes handed out by the previous read
+static size_t buffer_used = 0;
+
+// Number of bytes still to be skipped when reading through stdio
+static size_t buffer_skip = 0;
+
+static FILE *stream = NULL;
+
+// Set if the capture couldn't be read to the end (see capture_close())
+static int read_failed = 0;
+
+// When the capture is a regular file it's memory mapped and walked in
+// place, which avoids copying every sample through the stdio buffer.
+
+static uint8_t *map_base = NULL;
+static size_t   map_size = 0;
+static uint8_t *map_ptr  = NULL;
+static uint8_t *map_end  = NULL;
+
+// ====================================================================
+// Compressed captures
+// ====================================================================
+
+// Compressed captures are decompressed on a separate thread into a small
+// pool of large chunks, so decompression overlaps with the emulation.
+
+#define CHUNK_SIZE  (1024 * 1024) // Must be a multiple of 2
+#define NUM_CHUNKS  4
+
+#define INPUT_SIZE  (64 * 1024)
+
+typedef enum {
+   COMP_NONE,
+   COMP_GZIP,
+   COMP_ZSTD,
+   COMP_LZ4
+} compression_t;
+
+static const char *compression_names[] = {
+   "uncompressed",
+   "gzip",
+   "zstd",
+   "lz4"
+};
+
+typedef struct {
+   uint8_t *data;
+   size_t   len;
+} chunk_t;
+
+static compression_t compression = COMP_NONE;
+
+static chunk_t chunks[NUM_CHUNKS];
+
+// Chunks are filled and consumed in order, so two counters are enough
+static int num_filled   = 0;
+static int num_consumed = 0;
+static int eof          = 0;
+
+// Set at the end of each complete compressed stream (or gzip member), so
+// the input ending anywhere else can be reported as a truncated capture
+static int stream_ended = 0;
+
+static pthread_t       decompressor;
+static pthread_mutex_t chunk_lock      = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  chunk_available = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  chunk_free      = PTHREAD_COND_INITIALIZER;
+
+// The chunk currently being consumed by capture_read(), and the number of
+// decompressed bytes still to be skipped.
+static chunk_t *chunk_current = NULL;
+static size_t   chunk_skip    = 0;
+
+static uint8_t input[INPUT_SIZE];
+static size_t  input_len = 0;
+static size_t  input_pos = 0;
+
+// Returns 0 at the end of the compressed input
+static int fill_input() {
+   if (input_pos == input_len) {
+      input_len = fread(input, 1, INPUT_SIZE, stream);
+      input_pos = 0;
+      if (input_len == 0 && ferror(stream)) {
+         perror("failed to read capture file");
+         read_failed = 1;
+      }
+   }
+   return input_len > 0;
+}
+
+static void decompress_error(const char *msg) {
+   fprintf(stderr, "%s decompression failed: %s\n", compression_names[compression], msg);
+   read_failed = 1;
+}
+
+// Each decompressor fills the chunk as far as possible, returning the
+// number of bytes written, or zero at the end of the stream (or after an
+// error). Once the input has run out, the decompressor is still called
+// until the stream ends, as it may be holding back some output; if it
+// can't make any progress, the capture was truncated.
+
+#ifdef HAVE_ZLIB
+static z_stream zs;
+
+static size_t decompress_gzip(uint8_t *out, size_t len) {
+   zs.next_out  = out;
+   zs.avail_out = len;
+   while (zs.avail_out > 0 && !read_failed) {
+      int more = fill_input();
+      if (!more && stream_ended) {
+         break;
+      }
+      zs.next_in  = input + input_pos;
+      zs.avail_in = input_len - input_pos;
+      int ret = inflate(&zs, Z_NO_FLUSH);
+      input_pos = input_len - zs.avail_in;
+      if (ret == Z_STREAM_END) {
+         // Concatenated gzip members are allowed
+         stream_ended = 1;
+         inflateReset(&zs);
+      } else if (ret == Z_OK) {
+         stream_ended = 0;
+      } else if (ret == Z_BUF_ERROR && !more) {
+         decompress_error("truncated stream");
+      } else {
+         decompress_error(zs.msg ? zs.msg : "corrupt stream");
+      }
+   }
+   return len - zs.avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static ZSTD_DStream *zstd;
+
+static size_t decompress_zstd(uint8_t *out, size_t len) {
+   ZSTD_outBuffer ob = { out, len, 0 };
+   while (ob.pos < ob.size && !read_failed) {
+      int more = fill_input();
+      if (!more && stream_ended) {
+         break;
+      }
+      ZSTD_inBuffer ib = { input, input_len, input_pos };
+      size_t before = ob.pos;
+      size_t ret = ZSTD_decompressStream(zstd, &ob, &ib);
+      input_pos = ib.pos;
+      if (ZSTD_isError(ret)) {
+         decompress_error(ZSTD_getErrorName(ret));
+      } else {
+         // Zero means a frame has been completely decoded and flushed
+         stream_ended = (ret == 0);
+         if (!more && !stream_ended && ob.pos == before) {
+            decompress_error("truncated stream");
+         }
+      }
+   }
+   return ob.pos;
+}
+#endif
+
+#ifdef HAVE_LZ4
+static LZ4F_dctx *lz4;
+
+static size_t decompress_lz4(uint8_t *out, size_t len) {
+   size_t pos = 0;
+   while (pos < len && !read_failed) {
+      int more = fill_input();
+      if (!more && stream_ended) {
+         break;
+      }
+      size_t dst_size = len - pos;
+      size_t src_size = input_len - input_pos;
+      size_t ret = LZ4F_decompress(lz4, out + pos, &dst_size, input + input_pos, &src_size, NULL);
+      input_pos += src_size;
+      pos += dst_size;
+      if (LZ4F_isError(ret)) {
+         decompress_error(LZ4F_getErrorName(ret));
+      } else {
+         // Zero means a frame has been completely decoded
+         stream_ended = (ret == 0);
+         if (!more && !stream_ended && dst_size == 0) {
+            decompress_error("truncated stream");
+         }
+      }
+   }
+   return pos;
+}
+#endif
+
+static size_t (*decompress_fn)(uint8_t *out, size_t len);
+
+static void *decompress_thread(void *arg) {
+   for (int n = 0; ; n++) {
+      chunk_t *chunk = chunks + (n % NUM_CHUNKS);
+      // Wait for the chunk to be returned by the consumer
+      pthread_mutex_lock(&chunk_lock);
+      while (n - num_consumed >= NUM_CHUNKS) {
+         pthread_cond_wait(&chunk_free, &chunk_lock);
+      }
+      pthread_mutex_unlock(&chunk_lock);
+      // Fill it completely, so only the last chunk can end mid-sample
+      size_t len = 0;
+      size_t num;
+      while (len < CHUNK_SIZE && (num = (*decompress_fn)(chunk->data + len, CHUNK_SIZE - len)) > 0) {
+         len += num;
+      }
+      chunk->len = len;
+      pthread_mutex_lock(&chunk_lock);
+      num_filled++;
+      if (len < CHUNK_SIZE) {
+         eof = 1;
+      }
+      pthread_cond_signal(&chunk_available);
+      pthread_mutex_unlock(&chunk_lock);
+      if (len < CHUNK_SIZE) {
+         return NULL;
+      }
+   }
+}
+
+static compression_t detect_compression(const uint8_t *magic, size_t len) {
+   if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+      return COMP_GZIP;
+   }
+   if (len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+      return COMP_ZSTD;
+   }
+   if (len >= 4 && magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4d && magic[3] == 0x18) {
+      return COMP_LZ4;
+   }
+   return COMP_NONE;
+}
+
+static int start_decompressor(compression_t type) {
+   compression = type;
+   switch (type) {
+#ifdef HAVE_ZLIB
+   case COMP_GZIP:
+      // 15 + 32 enables automatic gzip/zlib header detection
+      if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+         return -1;
+      }
+      decompress_fn = decompress_gzip;
+      break;
+#endif
+#ifdef HAVE_ZSTD
+   case COMP_ZSTD:
+      zstd = ZSTD_createDStream();
+      if (!zstd) {
+         return -1;
+      }
+      ZSTD_initDStream(zstd);
+      decompress_fn = decompress_zstd;
+      break;
+#endif
+#ifdef HAVE_LZ4
+   case COMP_LZ4:
+      if (LZ4F_isError(LZ4F_createDecompressionContext(&lz4, LZ4F_VERSION))) {
+         return -1;
+      }
+      decompress_fn = decompress_lz4;
+      break;
+#endif
+   default:
+      fprintf(stderr, "capture file is %s compressed, but decode6809 was built without %s support\n",
+              compression_names[type], compression_names[type]);
+      return -1;
+   }
+   for (int i = 0; i < NUM_CHUNKS; i++) {
+      chunks[i].data = malloc(CHUNK_SIZE);
+      if (!chunks[i].data) {
+         return -1;
+      }
+   }
+   if (pthread_create(&decompressor, NULL, decompress_thread, NULL)) {
+      return -1;
+   }
+   return 0;
+}
+
+static size_t read_compressed(const void **ptr, size_t size) {
+   for (;;) {
+      pthread_mutex_lock(&chunk_lock);
+      // Return the previous chunk to the decompressor
+      if (chunk_current) {
+         chunk_current = NULL;
+         num_consumed++;
+         pthread_cond_signal(&chunk_free);
+      }
+      while (num_consumed == num_filled && !eof) {
+         pthread_cond_wait(&chunk_available, &chunk_lock);
+      }
+      if (num_consumed == num_filled) {
+         pthread_mutex_unlock(&chunk_lock);
+         return 0;
+      }
+      chunk_current = chunks + (num_consumed % NUM_CHUNKS);
+      pthread_mutex_unlock(&chunk_lock);
+      // Skipping is a pointer offset into the decompressed data
+      size_t skip = chunk_skip < chunk_current->len ? chunk_skip : chunk_current->len;
+      chunk_skip -= skip;
+      size_t num = (chunk_current->len - skip) / size;
+      if (num > 0) {
+         *ptr = chunk_current->data + skip;
+         return num;
+      }
+   }
+}
+
+static void stop_decompressor() {
+   // Drain any remaining chunks, so the decompressor thread can finish
+   const void *ptr;
+   while (read_compressed(&ptr, 1) > 0) {
+   }
+   pthread_join(decompressor, NULL);
+   for (int i = 0; i < NUM_CHUNKS; i++) {
+      free(chunks[i].data);
+   }
+   switch (compression) {
+#ifdef HAVE_ZLIB
+   case COMP_GZIP:
+      inflateEnd(&zs);
+      break;
+#endif
+#ifdef HAVE_ZSTD
+   case COMP_ZSTD:
+      ZSTD_freeDStream(zstd);
+      break;
+#endif
+#ifdef HAVE_LZ4
+   case COMP_LZ4:
+      LZ4F_freeDecompressionContext(lz4);
+      break;
+#endif
+   default:
+      break;
+   }
+}
+
+// ====================================================================
+// Uncompressed captures
+// ====================================================================
+
+static int capture_map(uint64_t skip_bytes) {
+   struct stat st;
+   if (fstat(fileno(stream), &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+      return 0;
+   }
+   void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(stream), 0);
+   if (base == MAP_FAILED) {
+      return 0;
+   }
+   // The capture is consumed once, from start to end
+   madvise(base, st.st_size, MADV_SEQUENTIAL);
+   map_base = base;
+   map_size = st.st_size;
+   map_end  = map_base + map_size;
+   // Skipping is just a pointer offset
+   map_ptr  = map_base + skip_bytes;
+   if (map_ptr > map_end) {
+      map_ptr = map_end;
+   }
+   return 1;
+}
+
+static size_t read_direct(const void **ptr, size_t size) {
+   if (compression != COMP_NONE) {
+      return read_compressed(ptr, size);
+   } else if (map_base) {
+      size_t num = (map_end - map_ptr) / size;
+      *ptr = map_ptr;
+      map_ptr += num * size;
+      return num;
+   } else {
+      // Carry over any partial sample from the previous read
+      buffer_len -= buffer_used;
+      memmove(buffer, buffer + buffer_used, buffer_len);
+      size_t num;
+      do {
+         if (buffer_skip) {
+            num = buffer_skip < buffer_len ? buffer_skip : buffer_len;
+            buffer_len -= num;
+            buffer_skip -= num;
+            memmove(buffer, buffer + num, buffer_len);
+         }
+         if (buffer_len >= size) {
+            break;
+         }
+         num = fread(buffer + buffer_len, 1, BUFSIZE - buffer_len, stream);
+         buffer_len += num;
+         if (num == 0 && ferror(stream)) {
+            perror("failed to read capture file");
+            read_failed = 1;
+         }
+      } while (num > 0);
+      *ptr = buffer;
+      buffer_used = (buffer_len / size) * size;
+      return buffer_len / size;
+   }
+}
+
+// ====================================================================
+// Read-ahead
+// ====================================================================
+
+// With --pipeline, the capture is read on a separate thread, one slice at a
+// time, so reading (and any page faults on a mapped file) overlaps with the
+// sample extraction. Mapped slices are passed on in place; anything else is
+// copied, as read_direct() reuses its buffers on the next call.
+
+#define SLICE_SIZE  (256 * 1024) // Must be a multiple of 2
+#define NUM_SLICES  8
+
+typedef struct {
+   const uint8_t *ptr;
+   size_t         num;
+   uint8_t       *copy;
+} slice_t;
+
+static slice_t slices[NUM_SLICES];
+
+static spsc_t slice_full;
+static spsc_t slice_free;
+
+static slice_t *slice_current = NULL;
+
+static int readahead = 0;
+static int readahead_done = 0;
+static size_t readahead_size;
+
+static pthread_t reader;
+
+static void *reader_thread(void *arg) {
+   size_t size = readahead_size;
+   size_t per_slice = SLICE_SIZE / size;
+   const uint8_t *ptr;
+   size_t num;
+   volatile uint8_t touch;
+   while ((num = read_direct((const void **)&ptr, size)) > 0) {
+      while (num > 0) {
+         slice_t *slice = spsc_pop(&slice_free);
+         size_t n = num < per_slice ? num : per_slice;
+         if (map_base) {
+            // Touch each page, so it's faulted in on this thread
+            for (size_t i = 0; i < n * size; i += 4096) {
+               touch = ptr[i];
+            }
+            slice->ptr = ptr;
+         } else {
+            memcpy(slice->copy, ptr, n * size);
+            slice->ptr = slice->copy;
+         }
+         slice->num = n;
+         spsc_push(&slice_full, slice);
+         ptr += n * size;
+         num -= n;
+      }
+   }
+   (void) touch;
+   spsc_push(&slice_full, NULL);
+   return NULL;
+}
+
+static int start_readahead(size_t size) {
+   readahead_size = size;
+   spsc_init(&slice_full);
+   spsc_init(&slice_free);
+   for (int i = 0; i < NUM_SLICES; i++) {
+      slices[i].copy = NULL;
+      if (!map_base) {
+         slices[i].copy = malloc(SLICE_SIZE);
+         if (!slices[i].copy) {
+            return -1;
+         }
+      }
+      spsc_push(&slice_free, slices + i);
+   }
+   if (pthread_create(&reader, NULL, reader_thread, NULL)) {
+      return -1;
+   }
+   readahead = 1;
+   return 0;
+}
+
+static size_t read_ahead(const void **ptr) {
+   if (readahead_done) {
+      return 0;
+   }
+   // Return the previous slice to the reader
+   if (slice_current) {
+      spsc_push(&slice_free, slice_current);
+   }
+   slice_current = spsc_pop(&slice_full);
+   if (!slice_current) {
+      readahead_done = 1;
+      return 0;
+   }
+   *ptr = slice_current->ptr;
+   return slice_current->num;
+}
+
+static void stop_readahead() {
+   // Drain any remaining slices, so the reader thread can finish
+   const void *ptr;
+   while (read_ahead(&ptr) > 0) {
+   }
+   pthread_join(reader, NULL);
+   for (int i = 0; i < NUM_SLICES; i++) {
+      free(slices[i].copy);
+   }
+   readahead = 0;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+// Opens the capture, ready to read from sample first (after any skip)
+
+int capture_open(arguments_t *args, uint64_t first) {
+   if (!args->filename || !strcmp(args->filename, "-")) {
+      stream = stdin;
+   } else {
+      stream = fopen(args->filename, "r");
+      if (stream == NULL) {
+         perror("failed to open capture file");
+         return -1;
+      }
+   }
+
+   uint64_t skip_bytes = (args->skip + first) * (args->byte ? 1 : 2);
+
+   // Sniff the start of the capture for a compression magic number. The
+   // bytes read are passed on to whichever reader ends up being used.
+   input_len = fread(input, 1, 4, stream);
+   compression_t type = detect_compression(input, input_len);
+   if (type != COMP_NONE) {
+      chunk_skip = skip_bytes;
+      if (start_decompressor(type) < 0) {
+         return -1;
+      }
+   } else if (!capture_map(skip_bytes)) {
+      // Fall back to stdio for pipes (or if the mapping fails)
+      // Skip the start of the file, by discarding it as it's read (this
+      // also works for pipes, where fseek doesn't)
+      memcpy(buffer, input, input_len);
+      buffer_len = input_len;
+      buffer_skip = skip_bytes;
+   }
+   if (args->pipeline && start_readahead(args->byte ? 1 : 2) < 0) {
+      fprintf(stderr, "failed to start capture reader thread\n");
+      return -1;
+   }
+   return 0;
+}
+
+// Returns the number of samples of the given size (1 or 2 bytes) that are
+// available at *ptr, or zero at the end of the capture.
+
+size_t capture_read(const void **ptr, size_t size) {
+   if (readahead) {
+      return read_ahead(ptr);
+   } else {
+      return read_direct(ptr, size);
+   }
+}
+
+// Returns the number of samples of the given size in a mapped capture
+// (after any skip), or zero if the capture can't be randomly accessed.
+
+uint64_t capture_length(size_t size) {
+   if (!map_base || readahead) {
+      return 0;
+   }
+   return (map_end - map_ptr) / size;
+}
+
+// Limits a mapped capture to num samples, starting first samples in (after
+// any skip). This must be called before the first capture_read().
+
+void capture_set_range(uint64_t first, uint64_t num, size_t size) {
+   map_ptr += first * size;
+   if (map_ptr > map_end) {
+      map_ptr = map_end;
+   }
+   if ((uint64_t) (map_end - map_ptr) > num * size) {
+      map_end = map_ptr + num * size;
+   }
+}
+
+// Returns -1 if the capture couldn't be read to the end (a read error, or a
+// corrupt or truncated compressed capture), which has already been reported
+
+int capture_close() {
+   if (readahead) {
+      stop_readahead();
+   }
+   if (compression != COMP_NONE) {
+      stop_decompressor();
+   }
+   if (map_base) {
+      munmap(map_base, map_size);
+      map_base = NULL;
+   }
+   if (stream) {
+      fclose(stream);
+      stream = NULL;
+   }
+   return read_failed ? -1 : 0;
+}
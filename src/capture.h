@@ -0,0 +1,19 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "defs.h"
+
+int capture_open(arguments_t *args, uint64_t first);
+
+size_t capture_read(const void **ptr, size_t size);
+
+uint64_t capture_length(size_t size);
+
+void capture_set_range(uint64_t first, uint64_t num, size_t size);
+
+int capture_close();
+
+#endif
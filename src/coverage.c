@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "defs.h"
+#include "memory.h"
+#include "output.h"
+#include "coverage.h"
+
+// With --coverage=FILE, the memory model marks each location fetched as
+// part of an instruction (the first byte of which is its opcode, or
+// prefix), and each location read as anything else, in a bitmap. At the
+// end of the capture, the locations the ROM image in FILE is loaded at
+// (--coverage-addr) are summarised:
+//
+// - how much of the ROM was executed and how much was read as data
+// - the same for each 1KB region of it
+// - the ranges that were never executed (with how much of each was read as
+//   data, or if it's all padding)
+//
+// The image itself is only used for its size and for spotting padding.
+// As with the heatmap, the coverage follows the banking, so on the Beeb a
+// ROM in 8000-BFFF is given with its bank (e.g. F-8000), and code run while
+// the PC is unknown is only counted if it leads in sequence to where the PC
+// becomes known (see em_6809.c).
+
+#define REGION_SIZE    0x400
+
+static memory_t *mem;
+static char *filename;
+static uint8_t *rom;
+static int rom_size;
+static int rom_addr;
+static int rom_bank;
+
+// Writes an address in the ROM, with its bank if it has one
+
+static int write_addr(char *bp, int addr) {
+   if (rom_bank >= 0) {
+      return sprintf(bp, "%X-%04X", rom_bank, addr);
+   } else {
+      return sprintf(bp, "%04X", addr);
+   }
+}
+
+// Writes a range of the ROM (from start to end - 1)
+
+static void write_range(char *bp, int start, int end) {
+   bp += write_addr(bp, rom_addr + start);
+   *bp++ = '-';
+   write_addr(bp, rom_addr + end - 1);
+}
+
+static double percent(int n, int total) {
+   return total ? 100.0 * n / total : 0.0;
+}
+
+// Fills in the coverage (COVERED_xxx) of each byte of the ROM
+
+static void get_coverage(uint8_t *covered) {
+   for (int i = 0; i < rom_size; i++) {
+      covered[i] = memory_get_coverage(mem, memory_get_location(mem, rom_bank, rom_addr + i));
+   }
+}
+
+static void report_regions(uint8_t *covered) {
+   output_printf("coverage: by region:\n");
+   output_printf("   %-13s %15s %15s\n", "region", "executed", "read as data");
+   for (int start = 0; start < rom_size; start += REGION_SIZE) {
+      int end = start + REGION_SIZE < rom_size ? start + REGION_SIZE : rom_size;
+      int executed = 0;
+      int data = 0;
+      for (int i = start; i < end; i++) {
+         if (covered[i] & (COVERED_OPCODE | COVERED_OPERAND)) {
+            executed++;
+         }
+         if (covered[i] & COVERED_DATA) {
+            data++;
+         }
+      }
+      char range[32];
+      write_range(range, start, end);
+      output_printf("   %-13s %6d (%5.1f%%) %6d (%5.1f%%)\n", range,
+                    executed, percent(executed, end - start), data, percent(data, end - start));
+   }
+}
+
+static void report_never_executed(uint8_t *covered) {
+   output_printf("coverage: never executed:\n");
+   int start = 0;
+   while (start < rom_size) {
+      if (covered[start] & (COVERED_OPCODE | COVERED_OPERAND)) {
+         start++;
+         continue;
+      }
+      int end = start;
+      int data = 0;
+      int same = 1;
+      while (end < rom_size && !(covered[end] & (COVERED_OPCODE | COVERED_OPERAND))) {
+         if (covered[end] & COVERED_DATA) {
+            data++;
+         }
+         if (rom[end] != rom[start]) {
+            same = 0;
+         }
+         end++;
+      }
+      char range[32];
+      write_range(range, start, end);
+      // A run of the same byte is taken to be padding (if it's not read)
+      if (same && !data && end - start >= 16) {
+         output_printf("   %-13s %6d bytes, all %02X\n", range, end - start, rom[start]);
+      } else {
+         output_printf("   %-13s %6d bytes, %d read as data\n", range, end - start, data);
+      }
+      start = end;
+   }
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+int coverage_init(arguments_t *args, memory_t *memory) {
+   mem = memory;
+   filename = args->coverage_file;
+   FILE *file = fopen(filename, "rb");
+   if (!file) {
+      perror("failed to open coverage ROM");
+      return -1;
+   }
+   rom = malloc(0x10000);
+   if (!rom) {
+      fprintf(stderr, "failed to allocate coverage ROM\n");
+      fclose(file);
+      return -1;
+   }
+   rom_size = fread(rom, 1, 0x10000, file);
+   int too_big = fgetc(file) != EOF;
+   fclose(file);
+   if (rom_size == 0 || too_big) {
+      fprintf(stderr, "the coverage ROM must be 1 to 65536 bytes\n");
+      return -1;
+   }
+   // By default, the ROM is at the top of memory (with the vectors)
+   rom_addr = args->coverage_addr >= 0 ? args->coverage_addr : 0x10000 - rom_size;
+   rom_bank = args->coverage_bank;
+   if (rom_addr + rom_size > 0x10000) {
+      fprintf(stderr, "the coverage ROM doesn't fit at %04X\n", rom_addr);
+      return -1;
+   }
+   for (int addr = rom_addr; addr < rom_addr + rom_size; addr++) {
+      if (memory_get_location(mem, rom_bank, addr) < 0) {
+         fprintf(stderr, "the coverage ROM bank doesn't include %04X\n", addr);
+         return -1;
+      }
+      if (rom_bank < 0 && memory_get_bank(mem, addr) >= 0) {
+         fprintf(stderr, "the coverage ROM is paged, so --coverage-addr needs its bank (e.g. F-8000)\n");
+         return -1;
+      }
+   }
+   return 0;
+}
+
+void coverage_report() {
+   uint8_t *covered = malloc(rom_size);
+   if (!covered) {
+      fprintf(stderr, "failed to allocate coverage\n");
+      return;
+   }
+   get_coverage(covered);
+   int executed = 0;
+   int instructions = 0;
+   int data = 0;
+   int untouched = 0;
+   for (int i = 0; i < rom_size; i++) {
+      if (covered[i] & COVERED_OPCODE) {
+         instructions++;
+      }
+      if (covered[i] & (COVERED_OPCODE | COVERED_OPERAND)) {
+         executed++;
+      }
+      if (covered[i] & COVERED_DATA) {
+         data++;
+      }
+      if (!covered[i]) {
+         untouched++;
+      }
+   }
+   char addr[16];
+   write_addr(addr, rom_addr);
+   output_printf("coverage: %s: %d bytes at %s\n", filename, rom_size, addr);
+   output_printf("   executed     %6d (%5.1f%%), %d opcodes\n", executed, percent(executed, rom_size), instructions);
+   output_printf("   read as data %6d (%5.1f%%)\n", data, percent(data, rom_size));
+   output_printf("   untouched    %6d (%5.1f%%)\n", untouched, percent(untouched, rom_size));
+   report_regions(covered);
+   report_never_executed(covered);
+   free(covered);
+}
@@ -0,0 +1,10 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include "defs.h"
+
+int coverage_init(arguments_t *args, memory_t *mem);
+
+void coverage_report();
+
+#endif
@@ -43,6 +43,17 @@ typedef enum {
    MACHINE_SBC09,
 } machine_t;
 
+typedef enum {
+   OUTPUT_TEXT,
+   OUTPUT_BINARY,
+} output_format_t;
+
+typedef enum {
+   HEATMAP_CSV,
+   HEATMAP_PAGES,
+   HEATMAP_BINARY,
+} heatmap_format_t;
+
 typedef enum {
    CPU_UNKNOWN,
    CPU_6809,
@@ -61,15 +72,19 @@ typedef enum {
    LAST
 } sample_type_t;
 
+// A bus sample is packed into 32 bits, as several million of these are
+// queued for lookahead. Each control pin is a 2-bit signed field, so it
+// can hold 0, 1 or -1 (unknown), and the bitfields act as the accessors.
+// The sample count is not stored, it's derived from the queue position.
+
 typedef struct {
-   sample_type_t   type;
-   uint32_t      sample_count;
-   uint8_t       data;
-   int8_t         rnw; // -1 indicates unknown
-   int8_t         lic; // -1 indicates unknown
-   int8_t          bs; // -1 indicates unknown
-   int8_t          ba; // -1 indicates unknown
-   int8_t        addr; // -1 indicates unknown
+   uint32_t      data : 8;
+   int32_t        rnw : 2; // -1 indicates unknown
+   int32_t        lic : 2; // -1 indicates unknown
+   int32_t         bs : 2; // -1 indicates unknown
+   int32_t         ba : 2; // -1 indicates unknown
+   int32_t       addr : 5; // -1 indicates unknown
+   uint32_t      type : 1; // sample_type_t
 } sample_t;
 
 // This is used to pa
@@ -81,6 +96,15 @@ typedef struct {
    int           intr_seen;
 } instruction_t;
 
+// A snapshot of the emulated register state, so the state can be shown
+// after the emulation has moved on (e.g. on the --pipeline formatter thread)
+
+#define MAX_STATE_REGS 24
+
+typedef struct {
+   int reg[MAX_STATE_REGS];
+} cpu_state_t;
+
 void write_hex1(char *buffer, int value);
 void write_hex2(char *buffer, int value);
 void write_hex4(char *buffer, int value);
@@ -127,6 +151,27 @@ typedef struct {
    int trigger_skipint;
    char *filename;
    int show_romno;
+   int pipeline;
+   int jobs;
+   output_format_t output_format;
+   char *index_file;
+   int index_interval;
+   int64_t from_sample;
+   int from_pc;
+   uint64_t from_occurrence;
+   char *save_state;
+   char *load_state;
+   int profile;
+   int profile_top;
+   char *callgraph_file;
+   int irq_stats;
+   char *heatmap_file;
+   heatmap_format_t heatmap_format;
+   char *timeline_file;
+   char *timeline_symbols;
+   char *coverage_file;
+   int coverage_addr;
+   int coverage_bank;
 } arguments_t;
 
 // Error return valyes from count_cycles
@@ -134,24 +179,44 @@ typedef struct {
 #define CYCLES_UNKNOWN   -1   // The cycle count could not be determined
 #define CYCLES_TRUNCATED -2   // The final instruction was truncated
 
+// Longest emulator context, as saved by save_context()
+#define MAX_CONTEXT_SIZE 256
+
+// Room disassemble() needs in its buffer, even for a shorter instruction
+#define MIN_DISASSEMBLY_BUFFER 32
+
+// The memory model (see memory.c)
+typedef struct memory memory_t;
+
+// An emulator keeps all of its state in a context, created by create(),
+// that is passed to each of the other methods, so several emulators can
+// run in one process
+
 typedef struct {
-   void (*init)(arguments_t *args);
-   int (*emulate)(sample_t *sample_q, int num_samples, instruction_t *instruction);
-   int (*disassemble)(char *bp, instruction_t *instruction);
-   int (*get_PC)();
-   int (*get_NM)();
-   int (*read_memory)(int address);
-   char *(*get_state)();
-   uint32_t (*get_and_clear_fail)();
+   void *(*create)(arguments_t *args, memory_t *mem);
+   void (*init)(void *ctx, arguments_t *args, memory_t *mem);
+   void (*destroy)(void *ctx);
+   int (*emulate)(void *ctx, sample_t *sample_q, int num_samples, instruction_t *instruction);
+   int (*disassemble)(void *ctx, char *bp, instruction_t *instruction); // bp needs MIN_DISASSEMBLY_BUFFER (returns the length)
+   int (*get_PC)(void *ctx);
+   int (*get_NM)(void *ctx);
+   int (*get_S)(void *ctx);
+   int (*read_memory)(void *ctx, int address);
+   void (*save_state)(void *ctx, cpu_state_t *state);
+   int (*save_context)(void *ctx, uint8_t *buffer); // Complete state, for a checkpoint (returns the length)
+   int (*load_context)(void *ctx, const uint8_t *buffer, int len);
+   char *(*get_state)(char *bp, const cpu_state_t *state);
+   uint32_t (*get_and_clear_fail)(void *ctx);
    int (*write_fail)(char *bp, uint32_t fail);
+   const char *const *state_names; // Name of each cpu_state_t register (NULL terminated)
 } cpu_emulator_t;
 
-extern uint32_t failflag;
-
-static inline void validate_address(sample_t *sample, int ea, int fail) {
+// Returns the fail flag if the sample's address doesn't match ea
+static inline uint32_t validate_address(sample_t *sample, int ea, uint32_t fail) {
    if (sample->addr >= 0 && sample->addr != (ea & 15)) {
-      failflag |= fail;
+      return fail;
    }
+   return 0;
 }
 
 #endif
@@ -7,8 +7,6 @@
 
 static const char regi2[] = { 'X', 'Y', 'U', 'S' };
 
-static const char **regi4;
-
 static const char *regi4_6809[] = { "D",  "X",  "Y",  "U",  "S", "PC", "??", "??",
                                     "A",  "B", "CC", "DP", "??", "??", "??", "??" };
 
@@ -26,10 +24,6 @@ static const char tfmr0inc[] = { '+', '-', '+', ' ' };
 
 static const char tfmr1inc[] = { '+', '-', ' ', '+' };
 
-static opcode_t *instr_table;
-
-int cpu6309 = 0;
-
 static char *strinsert(char *ptr, const char *str) {
    while (*str) {
       *ptr++ = *str++;
@@ -38,22 +32,12 @@ static char *strinsert(char *ptr, const char *str) {
 }
 
 
-void dis_6809_init(cpu_t cpu_type, opcode_t *cpu_instr_table) {
-   if (cpu_type == CPU_6309 || cpu_type == CPU_6309E) {
-      regi4 = regi4_6309;
-      cpu6309 = 1;
-   } else {
-      regi4 = regi4_6809;
-      cpu6309 = 0;
-   }
-   instr_table = cpu_instr_table;
-}
-
 static inline int is_prefix(uint8_t data) {
    return (data & 0xfe) == 0x10;
 }
 
-int dis_6809_disassemble(char *buffer, instruction_t *instruction) {
+int dis_6809_disassemble(char *buffer, instruction_t *instruction, int cpu6309, opcode_t *instr_table) {
+   const char **regi4 = cpu6309 ? regi4_6309 : regi4_6809;
    int prefix = 0;
    int oi = 0;
    int pb = 0;
@@ -447,3 +431,44 @@ int dis_6809_disassemble(char *buffer, instruction_t *instruction) {
    }
    return ptr - buffer;
 }
+
+// ====================================================================
+// Disassembly cache
+// ====================================================================
+
+// The text depends only on the instruction bytes, the address (for
+// relative branches) and the CPU type, so an entry can never be stale:
+// if code is modified, or a different ROM bank is paged in, the bytes or
+// the address no longer match and the lookup simply misses.
+
+int dis_6809_disassemble_cached(dis_6809_cache_t *cache, char *buffer, instruction_t *instruction, int cpu6309, opcode_t *instr_table) {
+   int length = instruction->length;
+   if (length == 0 || length > (int) sizeof(uint64_t)) {
+      return dis_6809_disassemble(buffer, instruction, cpu6309, instr_table);
+   }
+   if (cache->cpu6309 != cpu6309 || cache->instr_table != instr_table) {
+      memset(cache->entries, 0, sizeof(cache->entries));
+      cache->cpu6309 = cpu6309;
+      cache->instr_table = instr_table;
+   }
+   uint64_t bytes = 0;
+   memcpy(&bytes, instruction->instr, length);
+   uint64_t hash = (bytes ^ ((uint64_t) (uint32_t) instruction->pc << 20)) * 0x9E3779B97F4A7C15ULL;
+   dis_cache_entry_t *entry = cache->entries + (hash >> (64 - DIS_CACHE_BITS));
+   if (entry->length == length && entry->pc == instruction->pc && entry->bytes == bytes) {
+      // Copying the whole of the text is quicker than copying its length
+      // (hence MIN_DISASSEMBLY_BUFFER)
+      memcpy(buffer, entry->text, DIS_CACHE_TEXT);
+      return entry->text_len;
+   }
+   int n = dis_6809_disassemble(buffer, instruction, cpu6309, instr_table);
+   if (n <= DIS_CACHE_TEXT) {
+      entry->bytes    = bytes;
+      entry->pc       = instruction->pc;
+      entry->length   = length;
+      entry->text_len = n;
+      memcpy(entry->text, buffer, n);
+      memset(entry->text + n, 0, DIS_CACHE_TEXT - n);
+   }
+   return n;
+}
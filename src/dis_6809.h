@@ -4,8 +4,28 @@
 #include "defs.h"
 #include "types_6809.h"
 
-void dis_6809_init(cpu_t cpu_type, opcode_t *cpu_instr_table);
+int dis_6809_disassemble(char *buffer, instruction_t *instruction, int cpu6309, opcode_t *instr_table);
 
-int dis_6809_disassemble(char *buffer, instruction_t *instruction);
+// A cache of disassembled instructions
+
+#define DIS_CACHE_BITS 12
+#define DIS_CACHE_TEXT MIN_DISASSEMBLY_BUFFER
+
+typedef struct {
+   uint64_t bytes;     // The instruction bytes (zero padded)
+   int      pc;
+   uint8_t  length;    // Zero if the entry is empty
+   uint8_t  text_len;
+   char     text[DIS_CACHE_TEXT]; // Zero padded
+} dis_cache_entry_t;
+
+typedef struct {
+   int cpu6309;
+   opcode_t *instr_table;
+   dis_cache_entry_t entries[1 << DIS_CACHE_BITS];
+} dis_6809_cache_t;
+
+// The buffer needs MIN_DISASSEMBLY_BUFFER, as a hit copies the whole entry
+int dis_6809_disassemble_cached(dis_6809_cache_t *cache, char *buffer, instruction_t *instruction, int cpu6309, opcode_t *instr_table);
 
 #endif
@@ -2,7 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include "memory.h"
+#include "output.h"
 #include "types_6809.h"
 #include "em_6809.h"
 #include "dis_6809.h"
@@ -111,63 +113,86 @@ static int postbyte_cycles_6309_nat[0x100] = {
 static int count_ones_in_nibble[] =    { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
 
 // ====================================================================
-// Static variables
+// Emulator context
 // ====================================================================
 
-// Which state string to use
-static const char *cpu_state;
-
-// Is the CPU the 6309?
-static int cpu6309 = 0;
-
-// Which opcode table to use
-static opcode_t *instr_table;
-
-// 6809 registers: -1 means unknown
-static int ACCA = -1;
-static int ACCB = -1;
-static int X    = -1;
-static int Y    = -1;
-static int S    = -1;
-static int U    = -1;
-static int DP   = -1;
-static int PC   = -1;
-static int M    = -1;
-
-// 6809 flags: -1 means unknown
-static int E    = -1;
-static int F    = -1;
-static int H    = -1;
-static int I    = -1;
-static int N    = -1;
-static int Z    = -1;
-static int V    = -1;
-static int C    = -1;
-
-// Additional 6309 registers: -1 means unknown
-static int ACCE = -1;
-static int ACCF = -1;
-static int TV   = -1;
-
-// Additional 6309 flags: -1 means unknown
-static int NM   = -1; // Native Mode
-static int FM   = -1; // FIRQ Mode
-static int IL   = -1; // Illegal Instruction Trap
-static int DZ   = -1; // Divide by zero trap
-
-// Misc
-static int show_cycle_errors = 0;
-
-// Vector base (which might change on a machine-by-machine basis)
-static int vector_base = 0xfff0;
-
-// Used to supress errors in the instruction following xxxR reg,PC
-static int async_pc_write = 0;
-static int fail_syncbug = 0;
-
-// Used to set the flags on Store Immediare
-static storeimm_t storeimm = GRP_DEFAULT;
-static int last_res16 = 0;
+// The most instructions run with the PC unknown that are remembered (see
+// defer_instruction())
+
+#define MAX_DEFERRED 256
+
+// All of the emulator's state lives here, so several emulators can run in
+// one process (e.g. one per sync trial)
+
+struct em6809_ctx {
+
+   // Is the CPU the 6309?
+   int cpu6309;
+
+   // Which opcode table to use
+   opcode_t *instr_table;
+
+   // The memory model
+   memory_t *mem;
+
+   // Disassembly cache (allocated on first use, by whichever thread
+   // formats the output)
+   dis_6809_cache_t *dis_cache;
+
+   // Prediction failures in the current instruction
+   uint32_t failflag;
+
+   // 6809 registers: -1 means unknown
+   int ACCA;
+   int ACCB;
+   int X;
+   int Y;
+   int S;
+   int U;
+   int DP;
+   int PC;
+   int M;
+
+   // 6809 flags: -1 means unknown
+   int E;
+   int F;
+   int H;
+   int I;
+   int N;
+   int Z;
+   int V;
+   int C;
+
+   // Additional 6309 registers: -1 means unknown
+   int ACCE;
+   int ACCF;
+   int TV;
+
+   // Additional 6309 flags: -1 means unknown
+   int NM; // Native Mode
+   int FM; // FIRQ Mode
+   int IL; // Illegal Instruction Trap
+   int DZ; // Divide by zero trap
+
+   // Misc
+   int show_cycle_errors;
+
+   // Vector base (which might change on a machine-by-machine basis)
+   int vector_base;
+
+   // Used to supress errors in the instruction following xxxR reg,PC
+   int async_pc_write;
+   int fail_syncbug;
+
+   // Used to set the flags on Store Immediare
+   storeimm_t storeimm;
+   int last_res16;
+
+   // The lengths of the instructions run in sequence with the PC unknown,
+   // so they can be counted (for --heatmap and --coverage) once it's known
+   int deferred[MAX_DEFERRED];
+   int num_deferred;
+};
 
 enum {
    VEC_IL   = 0x00,
@@ -228,6 +253,10 @@ static const char * fail_hints[32] = {
 static opcode_t instr_table_6809[];
 static opcode_t instr_table_6309[];
 
+static operation_t op_BRN  ;
+static operation_t op_EXG  ;
+static operation_t op_JMP  ;
+static operation_t op_LBRN ;
 static operation_t op_MULD ;
 static operation_t op_LDMD ;
 static operation_t op_SYNC ;
@@ -237,208 +266,228 @@ static operation_t op_XSTX ;
 static operation_t op_XSTY ;
 static operation_t op_XSTU ;
 static operation_t op_XSTS ;
+static operation_t op_XHCF ;
+static operation_t op_PSHS ;
+static operation_t op_PSHU ;
+static operation_t op_PULS ;
+static operation_t op_PULU ;
+static operation_t op_PSHSW;
+static operation_t op_PSHUW;
+static operation_t op_PULSW;
+static operation_t op_PULUW;
 
 // ====================================================================
 // Helper Methods
 // ====================================================================
 
-static void check_FLAGS(int operand) {
-   if (E >= 0) {
-      if (E != ((operand >> 7) & 1)) {
-         failflag |= FAIL_E;
+// The memory model reports any failures, which are added to the current
+// instruction's
+
+static inline void mem_read(em6809_ctx_t *ctx, sample_t *sample, int ea, mem_access_t type) {
+   ctx->failflag |= memory_read(ctx->mem, sample, ea, type);
+}
+
+static inline void mem_write(em6809_ctx_t *ctx, sample_t *sample, int ea, mem_access_t type) {
+   ctx->failflag |= memory_write(ctx->mem, sample, ea, type);
+}
+
+static void check_FLAGS(em6809_ctx_t *ctx, int operand) {
+   if (ctx->E >= 0) {
+      if (ctx->E != ((operand >> 7) & 1)) {
+         ctx->failflag |= FAIL_E;
       }
    }
-   if (F >= 0) {
-      if (F != ((operand >> 6) & 1)) {
-         failflag |= FAIL_F;
+   if (ctx->F >= 0) {
+      if (ctx->F != ((operand >> 6) & 1)) {
+         ctx->failflag |= FAIL_F;
       }
    }
-   if (H >= 0) {
-      if (H != ((operand >> 5) & 1)) {
-         failflag |= FAIL_H;
+   if (ctx->H >= 0) {
+      if (ctx->H != ((operand >> 5) & 1)) {
+         ctx->failflag |= FAIL_H;
       }
    }
-   if (I >= 0) {
-      if (I != ((operand >> 4) & 1)) {
-         failflag |= FAIL_I;
+   if (ctx->I >= 0) {
+      if (ctx->I != ((operand >> 4) & 1)) {
+         ctx->failflag |= FAIL_I;
       }
    }
-   if (N >= 0) {
-      if (N != ((operand >> 3) & 1)) {
-         failflag |= FAIL_N;
+   if (ctx->N >= 0) {
+      if (ctx->N != ((operand >> 3) & 1)) {
+         ctx->failflag |= FAIL_N;
       }
    }
-   if (Z >= 0) {
-      if (Z != ((operand >> 2) & 1)) {
-         failflag |= FAIL_Z;
+   if (ctx->Z >= 0) {
+      if (ctx->Z != ((operand >> 2) & 1)) {
+         ctx->failflag |= FAIL_Z;
       }
    }
-   if (V >= 0) {
-      if (V != ((operand >> 1) & 1)) {
-         failflag |= FAIL_V;
+   if (ctx->V >= 0) {
+      if (ctx->V != ((operand >> 1) & 1)) {
+         ctx->failflag |= FAIL_V;
       }
    }
-   if (C >= 0) {
-      if (C != ((operand >> 0) & 1)) {
-         failflag |= FAIL_C;
+   if (ctx->C >= 0) {
+      if (ctx->C != ((operand >> 0) & 1)) {
+         ctx->failflag |= FAIL_C;
       }
    }
 }
 
-static int get_FLAG(int i) {
+static int get_FLAG(em6809_ctx_t *ctx, int i) {
    switch (i) {
-   case 0: return C;
-   case 1: return V;
-   case 2: return Z;
-   case 3: return N;
-   case 4: return I;
-   case 5: return H;
-   case 6: return F;
-   case 7: return E;
+   case 0: return ctx->C;
+   case 1: return ctx->V;
+   case 2: return ctx->Z;
+   case 3: return ctx->N;
+   case 4: return ctx->I;
+   case 5: return ctx->H;
+   case 6: return ctx->F;
+   case 7: return ctx->E;
    }
    return -1;
 }
 
-static void set_FLAG(int i, int val) {
+static void set_FLAG(em6809_ctx_t *ctx, int i, int val) {
    switch (i) {
-   case 0: C = val; break;
-   case 1: V = val; break;
-   case 2: Z = val; break;
-   case 3: N = val; break;
-   case 4: I = val; break;
-   case 5: H = val; break;
-   case 6: F = val; break;
-   case 7: E = val; break;
+   case 0: ctx->C = val; break;
+   case 1: ctx->V = val; break;
+   case 2: ctx->Z = val; break;
+   case 3: ctx->N = val; break;
+   case 4: ctx->I = val; break;
+   case 5: ctx->H = val; break;
+   case 6: ctx->F = val; break;
+   case 7: ctx->E = val; break;
    }
 }
 
-static int get_FLAGS() {
-   if (E < 0 || F < 0 || H < 0 || I < 0 || N < 0 || Z < 0 || V < 0 || C < 0) {
+static int get_FLAGS(em6809_ctx_t *ctx) {
+   if (ctx->E < 0 || ctx->F < 0 || ctx->H < 0 || ctx->I < 0 || ctx->N < 0 || ctx->Z < 0 || ctx->V < 0 || ctx->C < 0) {
       return -1;
    } else {
-      return (E << 7) | (F << 6) | (H << 5) | (I << 4) | (N << 3) | (Z << 2) | (V << 1) | C;
+      return (ctx->E << 7) | (ctx->F << 6) | (ctx->H << 5) | (ctx->I << 4) | (ctx->N << 3) | (ctx->Z << 2) | (ctx->V << 1) | ctx->C;
    }
 }
 
-static void set_FLAGS(int val) {
+static void set_FLAGS(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
-      E = (val >> 7) & 1;
-      F = (val >> 6) & 1;
-      H = (val >> 5) & 1;
-      I = (val >> 4) & 1;
-      N = (val >> 3) & 1;
-      Z = (val >> 2) & 1;
-      V = (val >> 1) & 1;
-      C = (val >> 0) & 1;
+      ctx->E = (val >> 7) & 1;
+      ctx->F = (val >> 6) & 1;
+      ctx->H = (val >> 5) & 1;
+      ctx->I = (val >> 4) & 1;
+      ctx->N = (val >> 3) & 1;
+      ctx->Z = (val >> 2) & 1;
+      ctx->V = (val >> 1) & 1;
+      ctx->C = (val >> 0) & 1;
    } else {
-      E = -1;
-      F = -1;
-      H = -1;
-      I = -1;
-      N = -1;
-      Z = -1;
-      V = -1;
-      C = -1;
+      ctx->E = -1;
+      ctx->F = -1;
+      ctx->H = -1;
+      ctx->I = -1;
+      ctx->N = -1;
+      ctx->Z = -1;
+      ctx->V = -1;
+      ctx->C = -1;
    }
 }
 
-static void set_NZ_unknown() {
-   N = -1;
-   Z = -1;
+static void set_NZ_unknown(em6809_ctx_t *ctx) {
+   ctx->N = -1;
+   ctx->Z = -1;
 }
 
-static void set_NZC_unknown() {
-   N = -1;
-   Z = -1;
-   C = -1;
+static void set_NZC_unknown(em6809_ctx_t *ctx) {
+   ctx->N = -1;
+   ctx->Z = -1;
+   ctx->C = -1;
 }
 
-static void set_NZV_unknown() {
-   N = -1;
-   Z = -1;
-   V = -1;
+static void set_NZV_unknown(em6809_ctx_t *ctx) {
+   ctx->N = -1;
+   ctx->Z = -1;
+   ctx->V = -1;
 }
 
-static void set_HNZVC_unknown() {
-   H = -1;
-   N = -1;
-   Z = -1;
-   V = -1;
-   C = -1;
+static void set_HNZVC_unknown(em6809_ctx_t *ctx) {
+   ctx->H = -1;
+   ctx->N = -1;
+   ctx->Z = -1;
+   ctx->V = -1;
+   ctx->C = -1;
 }
 
-static void set_NZVC_unknown() {
-   N = -1;
-   Z = -1;
-   V = -1;
-   C = -1;
+static void set_NZVC_unknown(em6809_ctx_t *ctx) {
+   ctx->N = -1;
+   ctx->Z = -1;
+   ctx->V = -1;
+   ctx->C = -1;
 }
 
-static void set_NZ(int value) {
-   N = (value >> 7) & 1;
-   Z = value == 0;
+static void set_NZ(em6809_ctx_t *ctx, int value) {
+   ctx->N = (value >> 7) & 1;
+   ctx->Z = value == 0;
 }
 
-static void set_NZ16(int value) {
-   N = (value >> 15) & 1;
-   Z = value == 0;
+static void set_NZ16(em6809_ctx_t *ctx, int value) {
+   ctx->N = (value >> 15) & 1;
+   ctx->Z = value == 0;
 }
 
-static int pop8s(sample_t *sample) {
-   memory_read(sample, S, MEM_STACK);
-   if (S >= 0) {
-      S = (S + 1) & 0xffff;
+static int pop8s(em6809_ctx_t *ctx, sample_t *sample) {
+   mem_read(ctx, sample, ctx->S, MEM_STACK);
+   if (ctx->S >= 0) {
+      ctx->S = (ctx->S + 1) & 0xffff;
    }
    return sample->data;
 }
 
-static int push8s(sample_t *sample) {
-   if (S >= 0) {
-      S = (S - 1) & 0xffff;
+static int push8s(em6809_ctx_t *ctx, sample_t *sample) {
+   if (ctx->S >= 0) {
+      ctx->S = (ctx->S - 1) & 0xffff;
    }
-   memory_write(sample, S, MEM_STACK);
+   mem_write(ctx, sample, ctx->S, MEM_STACK);
    return sample->data;
 }
 
-static int pop16s(sample_t *sample) {
-   pop8s(sample);
-   pop8s(sample + 1);
+static int pop16s(em6809_ctx_t *ctx, sample_t *sample) {
+   pop8s(ctx, sample);
+   pop8s(ctx, sample + 1);
    return (sample->data << 8) + (sample + 1)->data;
 
 }
 
-static int push16s(sample_t *sample) {
-   push8s(sample);
-   push8s(sample + 1);
+static int push16s(em6809_ctx_t *ctx, sample_t *sample) {
+   push8s(ctx, sample);
+   push8s(ctx, sample + 1);
    return ((sample + 1)->data << 8) + sample->data;
 }
 
 
-static int pop8u(sample_t *sample) {
-   memory_read(sample, U, MEM_STACK);
-   if (U >= 0) {
-      U = (U + 1) & 0xffff;
+static int pop8u(em6809_ctx_t *ctx, sample_t *sample) {
+   mem_read(ctx, sample, ctx->U, MEM_STACK);
+   if (ctx->U >= 0) {
+      ctx->U = (ctx->U + 1) & 0xffff;
    }
    return sample->data;
 }
 
-static int push8u(sample_t *sample) {
-   if (U >= 0) {
-      U = (U - 1) & 0xffff;
+static int push8u(em6809_ctx_t *ctx, sample_t *sample) {
+   if (ctx->U >= 0) {
+      ctx->U = (ctx->U - 1) & 0xffff;
    }
-   memory_write(sample, U, MEM_STACK);
+   mem_write(ctx, sample, ctx->U, MEM_STACK);
    return sample->data;
 }
 
-static int pop16u(sample_t *sample) {
-   pop8u(sample);
-   pop8u(sample + 1);
+static int pop16u(em6809_ctx_t *ctx, sample_t *sample) {
+   pop8u(ctx, sample);
+   pop8u(ctx, sample + 1);
    return (sample->data << 8) + (sample + 1)->data;
 }
 
-static int push16u(sample_t *sample) {
-   push8u(sample);
-   push8u(sample + 1);
+static int push16u(em6809_ctx_t *ctx, sample_t *sample) {
+   push8u(ctx, sample);
+   push8u(ctx, sample + 1);
    return ((sample + 1)->data << 8) + sample->data;
 }
 
@@ -459,63 +508,63 @@ static void unpack(int result, int *hi_byte, int *lo_byte) {
    }
 }
 
-static int *get_index_reg(int i) {
+static int *get_index_reg(em6809_ctx_t *ctx, int i) {
    i &= 3;
    switch(i) {
-   case 0: return &X;
-   case 1: return &Y;
-   case 2: return &U;
-   default: return &S;
+   case 0: return &ctx->X;
+   case 1: return &ctx->Y;
+   case 2: return &ctx->U;
+   default: return &ctx->S;
    }
 }
 
 // Used in EXN/TRV on the 6809
-static int get_regp_6809(int i) {
+static int get_regp_6809(em6809_ctx_t *ctx, int i) {
    i &= 15;
    int ret;
    switch(i) {
    case  0:
-      ret = pack(ACCA, ACCB);
+      ret = pack(ctx->ACCA, ctx->ACCB);
       break;
    case  1:
-      ret = X;
+      ret = ctx->X;
       break;
    case  2:
-      ret = Y;
+      ret = ctx->Y;
       break;
    case  3:
-      ret = U;
+      ret = ctx->U;
       break;
    case  4:
-      ret = S;
+      ret = ctx->S;
       break;
    case  5:
-      ret = PC;
+      ret = ctx->PC;
       break;
    case  8:
       // Extend ACCA value to 16 bits by padding with FF
-      ret = ACCA;
+      ret = ctx->ACCA;
       if (ret >= 0) {
          ret |= 0xff00;
       }
       break;
    case  9:
       // Extend ACCB value to 16 bits by padding with FF
-      ret = ACCB;
+      ret = ctx->ACCB;
       if (ret >= 0) {
          ret |= 0xff00;
       }
       break;
    case 10:
       // Extend CC value to 16 bits by replicating
-      ret = get_FLAGS();
+      ret = get_FLAGS(ctx);
       if (ret >= 0) {
          ret |= ret << 8;
       }
       break;
    case 11:
       // Extend DP value to 16 bits by replicating
-      ret = DP;
+      ret = ctx->DP;
       if (ret >= 0) {
          ret |= ret << 8;
       }
@@ -528,86 +577,86 @@ static int get_regp_6809(int i) {
 }
 
 // Used in EXN/TRV on the 6809
-static void set_regp_6809(int i, int val) {
+static void set_regp_6809(em6809_ctx_t *ctx, int i, int val) {
    // Must correctly handle case where val<0 (undefined)
    i &= 15;
    switch(i) {
-   case  0: unpack(val, &ACCA, &ACCB);         break;
-   case  1: X  = val;                          break;
-   case  2: Y  = val;                          break;
-   case  3: U  = val;                          break;
-   case  4: S  = val;                          break;
-   case  5: PC = val;                          break;
-   case  8: ACCA = val < 0 ? val : val & 0xff; break;
-   case  9: ACCB = val < 0 ? val : val & 0xff; break;
-   case 10: set_FLAGS(val);                    break;
-   case 11: DP = val < 0 ? val : val & 0xff;   break;
+   case  0: unpack(val, &ctx->ACCA, &ctx->ACCB);         break;
+   case  1: ctx->X  = val;                          break;
+   case  2: ctx->Y  = val;                          break;
+   case  3: ctx->U  = val;                          break;
+   case  4: ctx->S  = val;                          break;
+   case  5: ctx->PC = val;                          break;
+   case  8: ctx->ACCA = val < 0 ? val : val & 0xff; break;
+   case  9: ctx->ACCB = val < 0 ? val : val & 0xff; break;
+   case 10: set_FLAGS(ctx, val);                    break;
+   case 11: ctx->DP = val < 0 ? val : val & 0xff;   break;
    }
 }
 
 // Used in EXN/TRV on the 6309
-static int get_regp_6309(int i) {
+static int get_regp_6309(em6809_ctx_t *ctx, int i) {
    i &= 15;
    int ret;
    switch(i) {
-   case  0: ret = pack(ACCA, ACCB);   break;
-   case  1: ret = X;                  break;
-   case  2: ret = Y;                  break;
-   case  3: ret = U;                  break;
-   case  4: ret = S;                  break;
-   case  5: ret = PC;                 break;
-   case  6: ret = pack(ACCE, ACCF);   break;
-   case  7: ret = TV;                 break;
-   case  8: ret = pack0(ACCA);        break;
-   case  9: ret = pack0(ACCB);        break;
-   case 10: ret = pack0(get_FLAGS()); break;
-   case 11: ret = pack0(DP);          break;
+   case  0: ret = pack(ctx->ACCA, ctx->ACCB);   break;
+   case  1: ret = ctx->X;                  break;
+   case  2: ret = ctx->Y;                  break;
+   case  3: ret = ctx->U;                  break;
+   case  4: ret = ctx->S;                  break;
+   case  5: ret = ctx->PC;                 break;
+   case  6: ret = pack(ctx->ACCE, ctx->ACCF);   break;
+   case  7: ret = ctx->TV;                 break;
+   case  8: ret = pack0(ctx->ACCA);        break;
+   case  9: ret = pack0(ctx->ACCB);        break;
+   case 10: ret = pack0(get_FLAGS(ctx)); break;
+   case 11: ret = pack0(ctx->DP);          break;
    case 12: ret = 0;                  break;
    case 13: ret = 0;                  break;
-   case 14: ret = pack0(ACCE);        break;
-   case 15: ret = pack0(ACCF);        break;
+   case 14: ret = pack0(ctx->ACCE);        break;
+   case 15: ret = pack0(ctx->ACCF);        break;
    }
    return ret;
 }
 
 // Used in EXN/TRV on the 6309
-static void set_regp_6309(int i, int val) {
+static void set_regp_6309(em6809_ctx_t *ctx, int i, int val) {
    // Must correctly handle case where val<0 (undefined)
    i &= 15;
    // cases 12 and 13 (writing back to the 0 register) are NOPs (they don't trap)
    switch(i) {
-   case  0: unpack(val, &ACCA, &ACCB); break;
-   case  1: X  = val;                  break;
-   case  2: Y  = val;                  break;
-   case  3: U  = val;                  break;
-   case  4: S  = val;                  break;
-   case  5: PC = val;                  break;
-   case  6: unpack(val, &ACCE, &ACCF); break;
-   case  7: TV = val;                  break;
-   case  8: unpack(val, &ACCA,  NULL); break;
-   case  9: unpack(val,  NULL, &ACCB); break;
-   case 10: set_FLAGS(val);            break;
-   case 11: DP = (val < 0) ? val : (val >> 8) & 0xff; break;
-   case 14: unpack(val, &ACCE,  NULL); break;
-   case 15: unpack(val,  NULL, &ACCF); break;
+   case  0: unpack(val, &ctx->ACCA, &ctx->ACCB); break;
+   case  1: ctx->X  = val;                  break;
+   case  2: ctx->Y  = val;                  break;
+   case  3: ctx->U  = val;                  break;
+   case  4: ctx->S  = val;                  break;
+   case  5: ctx->PC = val;                  break;
+   case  6: unpack(val, &ctx->ACCE, &ctx->ACCF); break;
+   case  7: ctx->TV = val;                  break;
+   case  8: unpack(val, &ctx->ACCA,  NULL); break;
+   case  9: unpack(val,  NULL, &ctx->ACCB); break;
+   case 10: set_FLAGS(ctx, val);            break;
+   case 11: ctx->DP = (val < 0) ? val : (val >> 8) & 0xff; break;
+   case 14: unpack(val, &ctx->ACCE,  NULL); break;
+   case 15: unpack(val,  NULL, &ctx->ACCF); break;
    }
 }
 
 // Used in EXN/TFR
-static int get_regp(int i) {
-   if (cpu6309) {
-      return get_regp_6309(i);
+static int get_regp(em6809_ctx_t *ctx, int i) {
+   if (ctx->cpu6309) {
+      return get_regp_6309(ctx, i);
    } else {
-      return get_regp_6809(i);
+      return get_regp_6809(ctx, i);
    }
 }
 
 // Used in EXN/TFR
-static void set_regp(int i, int val) {
-   if (cpu6309) {
-      set_regp_6309(i, val);
+static void set_regp(em6809_ctx_t *ctx, int i, int val) {
+   if (ctx->cpu6309) {
+      set_regp_6309(ctx, i, val);
    } else {
-      set_regp_6809(i, val);
+      set_regp_6809(ctx, i, val);
    }
 }
 
@@ -615,66 +664,15 @@ static void set_regp(int i, int val) {
 // Public Methods
 // ====================================================================
 
-static void em_6809_init(arguments_t *args) {
-   // Set everything to unknown
-   ACCA = -1;
-   ACCB = -1;
-   ACCE = -1;
-   ACCF = -1;
-   X    = -1;
-   Y    = -1;
-   S    = -1;
-   U    = -1;
-   DP   = -1;
-   PC   = -1;
-   TV   = -1;
-   E    = -1;
-   F    = -1;
-   H    = -1;
-   I    = -1;
-   N    = -1;
-   Z    = -1;
-   V    = -1;
-   C    = -1;
-   NM   = -1;
-   FM   = -1;
-   IL   = -1;
-   DZ   = -1;
-   // Parse arguments
-   show_cycle_errors = args->show_cycles;
-   if (args->reg_s >= 0) {
-      S = args->reg_s;
-   }
-   if (args->reg_u >= 0) {
-      U = args->reg_u;
-   }
-   if (args->reg_pc >= 0) {
-      PC = args->reg_pc;
-   }
-   if (args->reg_dp >= 0) {
-      DP = args->reg_dp;
-   }
-   if (args->reg_nm >= 0) {
-      NM = (args->reg_nm > 0);
-   }
-   if (args->reg_fm >= 0) {
-      FM = (args->reg_fm > 0);
-   }
-   if (args->machine == MACHINE_BEEB) {
-      vector_base = 0xf7f0; // A11 is inverted in vector pull
-   }
-   cpu6309 = args->cpu_type == CPU_6309 || args->cpu_type == CPU_6309E;
-   fail_syncbug = args->fail_syncbug && cpu6309;
+// The instruction tables are shared by all contexts, so are checked (and
+// fixed up) just once
 
-   if (cpu6309) {
-      cpu_state = cpu_6309_state;
-      instr_table = instr_table_6309;
-   } else {
-      cpu_state = cpu_6809_state;
-      instr_table = instr_table_6809;
+static void check_instr_tables() {
+   static int checked = 0;
+   if (checked) {
+      return;
    }
-
-   dis_6809_init(args->cpu_type, instr_table);
+   checked = 1;
 
    // Validate the cycles in the maps are consistent
    opcode_t *instr_6309 = instr_table_6309;
@@ -690,7 +688,7 @@ static void em_6809_init(arguments_t *args) {
          }
       } else {
          if (instr_6309->cycles != instr_6809->cycles) {
-            printf("cycle mismatch in instruction table: %04x (%d cf %d)\n", i, instr_6309->cycles, instr_6809->cycles);
+            output_printf("cycle mismatch in instruction table: %04x (%d cf %d)\n", i, instr_6309->cycles, instr_6809->cycles);
             fail = 1;
          }
       }
@@ -702,12 +700,98 @@ static void em_6809_init(arguments_t *args) {
    }
 }
 
-static int em_6809_match_interrupt(sample_t *sample_q, int num_samples, int pc) {
+static void em_6809_init(void *context, arguments_t *args, memory_t *mem) {
+   em6809_ctx_t *ctx = context;
+   ctx->mem = mem;
+   ctx->failflag = 0;
+   // Set everything to unknown
+   ctx->ACCA = -1;
+   ctx->ACCB = -1;
+   ctx->ACCE = -1;
+   ctx->ACCF = -1;
+   ctx->X    = -1;
+   ctx->Y    = -1;
+   ctx->S    = -1;
+   ctx->U    = -1;
+   ctx->DP   = -1;
+   ctx->PC   = -1;
+   ctx->TV   = -1;
+   ctx->E    = -1;
+   ctx->F    = -1;
+   ctx->H    = -1;
+   ctx->I    = -1;
+   ctx->N    = -1;
+   ctx->Z    = -1;
+   ctx->V    = -1;
+   ctx->C    = -1;
+   ctx->NM   = -1;
+   ctx->FM   = -1;
+   ctx->IL   = -1;
+   ctx->DZ   = -1;
+   ctx->M    = -1;
+   ctx->async_pc_write = 0;
+   ctx->storeimm = GRP_DEFAULT;
+   ctx->last_res16 = 0;
+   ctx->num_deferred = 0;
+   // Parse arguments
+   ctx->show_cycle_errors = args->show_cycles;
+   if (args->reg_s >= 0) {
+      ctx->S = args->reg_s;
+   }
+   if (args->reg_u >= 0) {
+      ctx->U = args->reg_u;
+   }
+   if (args->reg_pc >= 0) {
+      ctx->PC = args->reg_pc;
+   }
+   if (args->reg_dp >= 0) {
+      ctx->DP = args->reg_dp;
+   }
+   if (args->reg_nm >= 0) {
+      ctx->NM = (args->reg_nm > 0);
+   }
+   if (args->reg_fm >= 0) {
+      ctx->FM = (args->reg_fm > 0);
+   }
+   if (args->machine == MACHINE_BEEB) {
+      ctx->vector_base = 0xf7f0; // A11 is inverted in vector pull
+   } else {
+      ctx->vector_base = 0xfff0;
+   }
+   ctx->cpu6309 = args->cpu_type == CPU_6309 || args->cpu_type == CPU_6309E;
+   ctx->fail_syncbug = args->fail_syncbug && ctx->cpu6309;
+
+   if (ctx->cpu6309) {
+      ctx->instr_table = instr_table_6309;
+   } else {
+      ctx->instr_table = instr_table_6809;
+   }
+}
+
+static void *em_6809_create(arguments_t *args, memory_t *mem) {
+   check_instr_tables();
+   em6809_ctx_t *ctx = malloc(sizeof(em6809_ctx_t));
+   if (!ctx) {
+      fprintf(stderr, "failed to allocate emulator context\n");
+      exit(1);
+   }
+   ctx->dis_cache = NULL;
+   em_6809_init(ctx, args, mem);
+   return ctx;
+}
+
+static void em_6809_destroy(void *context) {
+   em6809_ctx_t *ctx = context;
+   free(ctx->dis_cache);
+   free(ctx);
+}
+
+static int em_6809_match_interrupt(em6809_ctx_t *ctx, sample_t *sample_q, int num_samples, int pc) {
    // An interrupt always starts with the current PC being pushed to the stack
    // so check for this. This conveniently excludes CWAI, where PC+1 will be
    // pushed to the stack, to prevent the CWAI being endlessly executed.
    if (pc >= 0) {
-      int offset = (NM == 1) ?  4 : 3;
+      int offset = (ctx->NM == 1) ?  4 : 3;
       int pushedPC = sample_q[offset].data + (sample_q[offset + 1].data << 8);
       if (pc != pushedPC) {
          return 0;
@@ -716,8 +800,8 @@ static int em_6809_match_interrupt(sample_t *sample_q, int num_samples, int pc)
    // Calculate expected offset to vector fetch taking account of
    // native mode on the 6309 pushing two extra bytes (ACCE/ACCF)
    // (and one pipeline stall cycle ??)
-   int fast_o = (NM == 1) ? 10 :  7;
-   int full_o = (NM == 1) ? 19 : 16;
+   int fast_o = (ctx->NM == 1) ? 10 :  7;
+   int full_o = (ctx->NM == 1) ? 19 : 16;
    // FIQ:
    //    m +  7   addr=6 ba=0 bs=1 <<<<<< fast_o
    //    m +  8   addr=7 ba=0 bs=1
@@ -748,7 +832,7 @@ static int em_6809_match_interrupt(sample_t *sample_q, int num_samples, int pc)
    return 0;
 }
 
-static int em_6809_match_reset(sample_t *sample_q, int num_samples) {
+static int em_6809_match_reset(em6809_ctx_t *ctx, sample_t *sample_q, int num_samples) {
    // To match reset A3..0 of the address bus must be connected, so we see the vector
    //
    // i - n    lic=0 addr=8 ba=0 bs=0
@@ -761,7 +845,7 @@ static int em_6809_match_reset(sample_t *sample_q, int num_samples) {
       int i = 0;
       if (sample_q->lic >= 0) {
          // LIC is available, so find the next instruction boundary
-         if (NM == 1) {
+         if (ctx->NM == 1) {
             i++;
          }
          while (i < num_samples - 3 && !sample_q[i].lic) {
@@ -784,7 +868,7 @@ static int em_6809_match_reset(sample_t *sample_q, int num_samples) {
       }
       if (sample_q[i].ba < 1 && sample_q[i].bs == 1 && sample_q[i].addr == 0x0E) {
          // Avoid matching XRES on the 6809 (opcode 0x3e, length 19)
-         if (cpu6309 || sample_q[0].data != 0x3E || i != 16) {
+         if (ctx->cpu6309 || sample_q[0].data != 0x3E || i != 16) {
             return i + 3;
          }
       }
@@ -796,25 +880,25 @@ static inline int is_prefix(sample_t *sample) {
    return (sample->data & 0xfe) == 0x10;
 }
 
-static inline opcode_t *get_instruction(opcode_t *instr_table, sample_t *sample) {
+static inline opcode_t *get_instruction(em6809_ctx_t *ctx, opcode_t *instr_table, sample_t *sample) {
    int prefix = 0;
    if (is_prefix(sample)) {
       prefix = 1 + (sample->data & 1);
       sample++;
       // On the 6809, additional prefixes are ignored
-      while (!cpu6309 && is_prefix(sample)) {
+      while (!ctx->cpu6309 && is_prefix(sample)) {
          sample++;
       }
    }
    return instr_table + 0x100 * prefix + sample->data;
 }
 
-static int count_cycles_with_lic(sample_q_t *sample_q) {
+static int count_cycles_with_lic(em6809_ctx_t *ctx, sample_q_t *sample_q) {
    sample_t *sample = sample_q->sample;
    int num_samples = sample_q->num_samples;
    // If NM==0 then LIC set on the last cycle of the instruction
    // If NM==1 then LIC set on the first cycle of the instruction
-   int offset = (NM == 1) ? 1 : 0;
+   int offset = (ctx->NM == 1) ? 1 : 0;
    // Search for LIC
    for (int i = offset; i < num_samples; i++) {
       if (sample[i].type == LAST) {
@@ -828,25 +912,96 @@ static int count_cycles_with_lic(sample_q_t *sample_q) {
 }
 
 
-static void em_6809_reset(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+// Until the PC is known (e.g. at the start of a capture, or after a jump to
+// an unknown address) instructions can't be counted by the memory model.
+// Those that are sequential are remembered, and when the PC becomes known
+// they are counted working back from it. Anything that might change the
+// flow forgets them.
+
+// Returns 1 if an instruction always carries on to the one after it
+
+static int is_sequential(opcode_t *instr, int pb) {
+   operation_t *op = instr->op;
+   switch (op->type) {
+   case READOP:
+   case LOADOP:
+   case STOREOP:
+   case RMWOP:
+      return op != &op_XHCF;
+   case LEAOP:
+      return op != &op_JMP;
+   case BRANCHOP:
+      return op == &op_BRN || op == &op_LBRN;
+   case REGOP:
+      // TFR, EXG and the 6309 inter-register instructions can write the PC (5)
+      if (instr->mode == REGISTER) {
+         return (pb & 0x0f) != 5 && (op != &op_EXG || (pb >> 4) != 5);
+      }
+      return 1;
+   case OTHER:
+      if (op == &op_PULS || op == &op_PULU) {
+         return !(pb & 0x80);
+      }
+      return op == &op_PSHS || op == &op_PSHU ||
+             op == &op_PSHSW || op == &op_PSHUW || op == &op_PULSW || op == &op_PULUW;
+   default:
+      return 0;
+   }
+}
+
+// Counts the remembered instructions, given the PC of the one that followed
+// them (or just forgets them if it's unknown)
+
+static void place_deferred(em6809_ctx_t *ctx, int pc) {
+   if (pc >= 0) {
+      for (int i = ctx->num_deferred - 1; i >= 0; i--) {
+         pc = (pc - ctx->deferred[i]) & 0xffff;
+         memory_count_instruction(ctx->mem, pc, ctx->deferred[i]);
+      }
+   }
+   ctx->num_deferred = 0;
+}
+
+// Called after an instruction that started with the PC unknown
+
+static void defer_instruction(em6809_ctx_t *ctx, opcode_t *instr, int pb, instruction_t *instruction) {
+   if (instr->op->type == JSROP) {
+      // The return address gives the PC of JSR/BSR/LBSR
+      place_deferred(ctx, instruction->pc);
+      memory_count_instruction(ctx->mem, instruction->pc, instruction->length);
+   } else if (ctx->PC < 0 && is_sequential(instr, pb)) {
+      // (If the PC is now known, it was a trap)
+      if (ctx->num_deferred == MAX_DEFERRED) {
+         // Forget the oldest
+         memmove(ctx->deferred, ctx->deferred + 1, (MAX_DEFERRED - 1) * sizeof(int));
+         ctx->num_deferred--;
+      }
+      ctx->deferred[ctx->num_deferred++] = instruction->length;
+   } else {
+      ctx->num_deferred = 0;
+   }
+}
+
+static void em_6809_reset(em6809_ctx_t *ctx, sample_t *sample_q, int num_cycles, instruction_t *instruction) {
    instruction->pc = -1;
+   ctx->num_deferred = 0;
    instruction->length = 0;
    instruction->rst_seen = 1;
    // All other registers are unchanged on reset
-   DP = 0;
-   F  = 1;
-   I  = 1;
-   if (cpu6309) {
-      NM = 0;
-      FM = 0;
-      IL = 0;
-      DZ = 0;
+   ctx->DP = 0;
+   ctx->F  = 1;
+   ctx->I  = 1;
+   if (ctx->cpu6309) {
+      ctx->NM = 0;
+      ctx->FM = 0;
+      ctx->IL = 0;
+      ctx->DZ = 0;
    }
-   PC = (sample_q[num_cycles - 3].data << 8) + sample_q[num_cycles - 2].data;
+   ctx->PC = (sample_q[num_cycles - 3].data << 8) + sample_q[num_cycles - 2].data;
 }
 
 // Returns the old PC value
-static int interrupt_helper(sample_q_t *sample_q, int offset, int full, int vector) {
+static int interrupt_helper(em6809_ctx_t *ctx, sample_q_t *sample_q, int offset, int full, int vector) {
    sample_t *sample = sample_q->sample;
    // FIQ
    //  0 Opcode
@@ -887,85 +1042,85 @@ static int interrupt_helper(sample_q_t *sample_q, int offset, int full, int vect
    int i = sample_q->oi + offset;
 
    // The PC is pushed in all cases
-   int pc = push16s(sample + i);
+   int pc = push16s(ctx, sample + i);
    i += 2;
 
    // The full state is pushed in IRQ/NMI/SWI/SWI2/SWI3
    if (full) {
 
 
-      int u  = push16s(sample + i);
+      int u  = push16s(ctx, sample + i);
       i += 2;
-      if (U >= 0 && u != U) {
-         failflag |= FAIL_U;
+      if (ctx->U >= 0 && u != ctx->U) {
+         ctx->failflag |= FAIL_U;
       }
-      U = u;
+      ctx->U = u;
 
-      int y  = push16s(sample + i);
+      int y  = push16s(ctx, sample + i);
       i += 2;
-      if (Y >= 0 && y != Y) {
-         failflag |= FAIL_Y;
+      if (ctx->Y >= 0 && y != ctx->Y) {
+         ctx->failflag |= FAIL_Y;
       }
-      Y = y;
+      ctx->Y = y;
 
-      int x = push16s(sample + i);
+      int x = push16s(ctx, sample + i);
       i += 2;
-      if (X >= 0 && x != X) {
-         failflag |= FAIL_X;
+      if (ctx->X >= 0 && x != ctx->X) {
+         ctx->failflag |= FAIL_X;
       }
-      X = x;
+      ctx->X = x;
 
-      int dp = push8s(sample + i);
+      int dp = push8s(ctx, sample + i);
       i++;
-      if (DP >= 0 && dp != DP) {
-         failflag |= FAIL_DP;
+      if (ctx->DP >= 0 && dp != ctx->DP) {
+         ctx->failflag |= FAIL_DP;
       }
-      DP = dp;
+      ctx->DP = dp;
 
-      if (NM == 1) {
+      if (ctx->NM == 1) {
 
-         int f = push8s(sample + i);
+         int f = push8s(ctx, sample + i);
          i++;
-         if (ACCF >= 0 && f != ACCF) {
-            failflag |= FAIL_ACCF;
+         if (ctx->ACCF >= 0 && f != ctx->ACCF) {
+            ctx->failflag |= FAIL_ACCF;
          }
-         ACCF = f;
+         ctx->ACCF = f;
 
-         int e = push8s(sample + i);
+         int e = push8s(ctx, sample + i);
          i++;
-         if (ACCE >= 0 && e != ACCE) {
-            failflag |= FAIL_ACCE;
+         if (ctx->ACCE >= 0 && e != ctx->ACCE) {
+            ctx->failflag |= FAIL_ACCE;
          }
-         ACCE = e;
+         ctx->ACCE = e;
 
       }
 
-      int b = push8s(sample + i);
+      int b = push8s(ctx, sample + i);
       i++;
-      if (ACCB >= 0 && b != ACCB) {
-         failflag |= FAIL_ACCB;
+      if (ctx->ACCB >= 0 && b != ctx->ACCB) {
+         ctx->failflag |= FAIL_ACCB;
       }
-      ACCB = b;
+      ctx->ACCB = b;
 
-      int a = push8s(sample + i);
+      int a = push8s(ctx, sample + i);
       i++;
-      if (ACCA >= 0 && a != ACCA) {
-         failflag |= FAIL_ACCA;
+      if (ctx->ACCA >= 0 && a != ctx->ACCA) {
+         ctx->failflag |= FAIL_ACCA;
       }
-      ACCA = a;
+      ctx->ACCA = a;
       // Set E to indicate the full state was saved (apart from for XRES)
       if (vector != VEC_XRST) {
-         E = 1;
+         ctx->E = 1;
       }
    } else {
       // Clear E to indicate just PC/flags were saved
-      E = 0;
+      ctx->E = 0;
    }
 
    // The flags are pushed in all cases
-   int flags = push8s(sample + i);
-   check_FLAGS(flags);
-   set_FLAGS(flags);
+   int flags = push8s(ctx, sample + i);
+   check_FLAGS(ctx, flags);
+   set_FLAGS(ctx, flags);
 
    // The vector fetch is always at the end
    // (even for CWAI)
@@ -973,12 +1128,12 @@ static int interrupt_helper(sample_q_t *sample_q, int offset, int full, int vect
 
    // Is an illegal instruction trap?
    if (vector == VEC_IL) {
-      IL = 1;
+      ctx->IL = 1;
    }
 
    // Is it a division by zero trap?
    if (vector == VEC_DZ) {
-      DZ = 1;
+      ctx->DZ = 1;
    }
 
    // Mask off the LSB of the vector, which is used as a flag
@@ -986,17 +1141,17 @@ static int interrupt_helper(sample_q_t *sample_q, int offset, int full, int vect
 
    // Read the vector and compare against what's expected
    int vechi = sample[i].data;
-   memory_read(sample + i, vector_base + vector, MEM_POINTER);
+   mem_read(ctx, sample + i, ctx->vector_base + vector, MEM_POINTER);
    if (sample[i].addr >= 0 && (sample[i].addr != vector)) {
-      failflag |= FAIL_VECTOR;
+      ctx->failflag |= FAIL_VECTOR;
    }
    i++;
    int veclo = sample[i].data;
-   memory_read(sample + i, vector_base + vector + 1, MEM_POINTER);
+   mem_read(ctx, sample + i, ctx->vector_base + vector + 1, MEM_POINTER);
    if (sample[i].addr >= 0 && (sample[i].addr != vector + 1)) {
-      failflag  |= FAIL_VECTOR;
+      ctx->failflag  |= FAIL_VECTOR;
    }
-   PC = (vechi << 8) + veclo;
+   ctx->PC = (vechi << 8) + veclo;
 
    // FFF0 : reserved :
    // FFF2 : SWI3     : flags unchanged
@@ -1009,14 +1164,14 @@ static int interrupt_helper(sample_q_t *sample_q, int offset, int full, int vect
 
    switch (vector) {
    case VEC_IRQ:
-      I = 1;
+      ctx->I = 1;
       break;
    case VEC_FIQ:
    case VEC_SWI:
    case VEC_NMI:
    case VEC_RST:
-      I = 1;
-      F = 1;
+      ctx->I = 1;
+      ctx->F = 1;
       break;
    }
 
@@ -1025,31 +1180,33 @@ static int interrupt_helper(sample_q_t *sample_q, int offset, int full, int vect
 }
 
 
-static void em_6809_interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+static void em_6809_interrupt(em6809_ctx_t *ctx, sample_t *sample_q, int num_cycles, instruction_t *instruction) {
    // Calculate expected number of cycles in the interrupt dispatch,
    // taking account native mode on the 6309 pushing two extra bytes
    // (ACCE/ACCF)
    // (and one pipeline stall cycle ??)
-   int fast_c = (NM == 1) ? 13 : 10;
-   int full_c = (NM == 1) ? 22 : 19;
-   int offset = (NM == 1) ?  4 :  3;
+   int fast_c = (ctx->NM == 1) ? 13 : 10;
+   int full_c = (ctx->NM == 1) ? 22 : 19;
+   int offset = (ctx->NM == 1) ?  4 :  3;
    int pc;
    sample_q_t sample_ref;
    sample_ref.sample = sample_q;
    sample_ref.oi = 0;
    sample_ref.num_cycles = num_cycles;
    if (num_cycles == fast_c) {
-      pc = interrupt_helper(&sample_ref, offset, 0, VEC_FIQ);
+      pc = interrupt_helper(ctx, &sample_ref, offset, 0, VEC_FIQ);
    } else if (num_cycles == full_c && sample_q[full_c - 3].addr == VEC_IRQ) {
       // IRQ
-      pc = interrupt_helper(&sample_ref, offset, 1, VEC_IRQ);
+      pc = interrupt_helper(ctx, &sample_ref, offset, 1, VEC_IRQ);
    } else if (num_cycles == full_c && sample_q[full_c - 3].addr == VEC_NMI) {
       // NMI
-      pc = interrupt_helper(&sample_ref, offset, 1, VEC_NMI);
+      pc = interrupt_helper(ctx, &sample_ref, offset, 1, VEC_NMI);
    } else {
-      printf("*** could not determine interrupt type ***\n");
+      output_line("*** could not determine interrupt type ***");
       pc = -1;
    }
+   // The stacked PC is where the instructions run before this lead to
+   place_deferred(ctx, pc);
    instruction->pc = pc;
    instruction->length = 0;
    instruction->intr_seen = 1;
@@ -1059,49 +1216,59 @@ static inline int offset_address(int base, int offset) {
    return (base >= 0) ? (base + offset) & 0xffff : base;
 }
 
-static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *instruction) {
+static int em_6809_emulate(void *context, sample_t *sample_q, int num_samples, instruction_t *instruction) {
+   em6809_ctx_t *ctx = context;
    int num_cycles;
 
    instruction->intr_seen = 0;
    instruction->rst_seen = 0;
-   instruction->pc = PC;
+   instruction->pc = ctx->PC;
 
-   if ((num_cycles = em_6809_match_reset(sample_q, num_samples)) > 0) {
-      em_6809_reset(sample_q, num_cycles, instruction);
+   // Count any instructions run before the PC was known
+   int pc_unknown = ctx->PC < 0;
+   if (ctx->num_deferred && !pc_unknown) {
+      place_deferred(ctx, ctx->PC);
+   }
+
+   if ((num_cycles = em_6809_match_reset(ctx, sample_q, num_samples)) > 0) {
+      em_6809_reset(ctx, sample_q, num_cycles, instruction);
       return num_cycles;
    }
 
-   if ((num_cycles = em_6809_match_interrupt(sample_q, num_samples, PC)) > 0) {
-      em_6809_interrupt(sample_q, num_cycles, instruction);
+   if ((num_cycles = em_6809_match_interrupt(ctx, sample_q, num_samples, ctx->PC)) > 0) {
+      em_6809_interrupt(ctx, sample_q, num_cycles, instruction);
       return num_cycles;
    }
 
    int pb = 0;
    int index = 0;
-   opcode_t *instr = get_instruction(instr_table, sample_q);
+   opcode_t *instr = get_instruction(ctx, ctx->instr_table, sample_q);
    int mode = instr->mode;
 
    // Start with the base number of cycles from the instruction table
-   num_cycles = (NM == 1) ? instr->cycles_native : instr->cycles;
+   num_cycles = (ctx->NM == 1) ? instr->cycles_native : instr->cycles;
 
    // If we have fewer samples that this, then bail early to prevent suprious errors
    if (num_samples < num_cycles) {
-      failflag = 0;
+      ctx->failflag = 0;
       return CYCLES_TRUNCATED;
    }
 
    // Flag that an instruction marked as undocumented has been encoutered
    if (instr->undocumented) {
-      failflag |= FAIL_UNDOC;
+      ctx->failflag |= FAIL_UNDOC;
    }
 
+   // Coverage of the start of the instruction (including any prefix)
+   memory_mark_opcode(ctx->mem, ctx->PC);
+
    // Memory modelling of the prefix
    if (is_prefix(sample_q + index)) {
-      memory_read(sample_q + index, offset_address(PC, index), MEM_INSTR);
+      mem_read(ctx, sample_q + index, offset_address(ctx->PC, index), MEM_INSTR);
       index++;
       // On the 6809, additional prefixes are ignored
-      while (!cpu6309 && is_prefix(sample_q + index)) {
-         memory_read(sample_q + index, offset_address(PC, index), MEM_INSTR);
+      while (!ctx->cpu6309 && is_prefix(sample_q + index)) {
+         mem_read(ctx, sample_q + index, offset_address(ctx->PC, index), MEM_INSTR);
          index++;
          // But they do take an additional cycle
          num_cycles++;
@@ -1111,15 +1278,15 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
    int oi = index;
 
    // Memory modelling of the opcode
-   memory_read(sample_q + index, offset_address(PC, index), MEM_INSTR);
+   mem_read(ctx, sample_q + index, offset_address(ctx->PC, index), MEM_INSTR);
    index++;
 
    // If there is an immediate byte (AIM/EIM/OIM/TIM only), skip past it
    if (mode == DIRECTIM || mode == EXTENDEDIM || mode == INDEXEDIM) {
       // The immediate constant is held in the M register
-      M = sample_q[index].data;
+      ctx->M = sample_q[index].data;
       // Memory modelling
-      memory_read(sample_q + index, offset_address(PC, index), MEM_INSTR);
+      mem_read(ctx, sample_q + index, offset_address(ctx->PC, index), MEM_INSTR);
       index++;
       // Decrement the mode to get back to the base addressing mode
       mode--;
@@ -1135,7 +1302,7 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
    // If there is a post byte, skip past it
    if (mode == REGISTER || mode == INDEXED || mode == DIRECTBIT) {
       pb = sample_q[index].data;
-      memory_read(sample_q + index, offset_address(PC, index), MEM_INSTR);
+      mem_read(ctx, sample_q + index, offset_address(ctx->PC, index), MEM_INSTR);
       index++;
    }
 
@@ -1146,7 +1313,7 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
       if (pb & 0x80) {
          int type = pb & 0x0f;
          int disp_bytes = 0;
-         if (cpu6309) {
+         if (ctx->cpu6309) {
             if (type == 9 || type == 13 || pb == 0x9f || pb == 0xaf || pb == 0xb0) {
                disp_bytes = 2;
             } else if (type == 8 || type == 12) {
@@ -1161,7 +1328,7 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
          }
          // Memory modelling of the displacement bytes
          for (int i = 0; i < disp_bytes; i++) {
-            memory_read(sample_q + index + i, offset_address(PC, index + i), MEM_INSTR);
+            mem_read(ctx, sample_q + index + i, offset_address(ctx->PC, index + i), MEM_INSTR);
          }
          index += disp_bytes;
       }
@@ -1170,21 +1337,21 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
    case DIRECT:
    case RELATIVE_8:
    case IMMEDIATE_8:
-      memory_read(sample_q + index, offset_address(PC, index), MEM_INSTR);
+      mem_read(ctx, sample_q + index, offset_address(ctx->PC, index), MEM_INSTR);
       index++;
       break;
    case EXTENDED:
    case RELATIVE_16:
    case IMMEDIATE_16:
-      memory_read(sample_q + index    , offset_address(PC, index)    , MEM_INSTR);
-      memory_read(sample_q + index + 1, offset_address(PC, index + 1), MEM_INSTR);
+      mem_read(ctx, sample_q + index    , offset_address(ctx->PC, index)    , MEM_INSTR);
+      mem_read(ctx, sample_q + index + 1, offset_address(ctx->PC, index + 1), MEM_INSTR);
       index += 2;
       break;
    case IMMEDIATE_32:
-      memory_read(sample_q + index    , offset_address(PC, index)    , MEM_INSTR);
-      memory_read(sample_q + index + 1, offset_address(PC, index + 1), MEM_INSTR);
-      memory_read(sample_q + index + 2, offset_address(PC, index + 2), MEM_INSTR);
-      memory_read(sample_q + index + 3, offset_address(PC, index + 3), MEM_INSTR);
+      mem_read(ctx, sample_q + index    , offset_address(ctx->PC, index)    , MEM_INSTR);
+      mem_read(ctx, sample_q + index + 1, offset_address(ctx->PC, index + 1), MEM_INSTR);
+      mem_read(ctx, sample_q + index + 2, offset_address(ctx->PC, index + 2), MEM_INSTR);
+      mem_read(ctx, sample_q + index + 3, offset_address(ctx->PC, index + 3), MEM_INSTR);
       index += 4;
       break;
    default:
@@ -1205,21 +1372,21 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
 
    // Sanity check the instruction bytes have sequential addresses
    // which can help to avoid incorrect synchronization to the instruction stream
-   if (sample_q[0].addr >= 0 && async_pc_write == 0) {
+   if (sample_q[0].addr >= 0 && ctx->async_pc_write == 0) {
       for (int i = 1; i < instruction->length; i++) {
          if (sample_q[i].addr != ((sample_q[0].addr + i) & 15)) {
-            failflag |= FAIL_ADDR_INSTR;
+            ctx->failflag |= FAIL_ADDR_INSTR;
             break;
          }
       }
    }
-   async_pc_write = 0;
+   ctx->async_pc_write = 0;
 
    // In indexed mode, calculate the additional postbyte cycles
    int postbyte_cycles = 0;
    if (mode == INDEXED) {
-      if (cpu6309) {
-         if (NM == 1) {
+      if (ctx->cpu6309) {
+         if (ctx->NM == 1) {
             postbyte_cycles = postbyte_cycles_6309_nat[pb];
          } else {
             postbyte_cycles = postbyte_cycles_6309_emu[pb];
@@ -1230,12 +1397,13 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
       if (postbyte_cycles < 0) {
          postbyte_cycles = -postbyte_cycles;
          num_cycles += postbyte_cycles;
-         failflag |= FAIL_BADM;
-         if (cpu6309) {
+         ctx->failflag |= FAIL_BADM;
+         if (ctx->cpu6309) {
             // 21/23 cycles
             num_cycles = oi + postbyte_cycles;
             sample_ref.num_cycles = num_cycles;
-            interrupt_helper(&sample_ref, 5, 1, VEC_IL);
+            interrupt_helper(ctx, &sample_ref, 5, 1, VEC_IL);
+            ctx->num_deferred = 0;
             // TODO: validate actual
             return num_cycles;
          }
@@ -1244,7 +1412,7 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
       }
       // Again, if we have fewer samples than num_cycles, then bail early to prevent suprious errors
       if (num_samples < num_cycles) {
-         failflag = 0;
+         ctx->failflag = 0;
          return CYCLES_TRUNCATED;
       }
    }
@@ -1256,8 +1424,8 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
    }
 
    // Update the PC assuming not change of flow takes place
-   if (PC >= 0) {
-      PC = (PC + instruction->length) & 0xffff;
+   if (ctx->PC >= 0) {
+      ctx->PC = (ctx->PC + instruction->length) & 0xffff;
    }
 
    // Calculate the effective address (for additional memory reads)
@@ -1265,24 +1433,24 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
    ea_t ea = -1;
    switch (mode) {
    case RELATIVE_8:
-      if (PC >= 0) {
-         ea = (PC + (int8_t)sample_q[oi + 1].data) & 0xffff;
+      if (ctx->PC >= 0) {
+         ea = (ctx->PC + (int8_t)sample_q[oi + 1].data) & 0xffff;
       }
       break;
    case RELATIVE_16:
-      if (PC >= 0) {
-         ea = (PC + (sample_q[oi + 1].data << 8) + sample_q[oi + 2].data) & 0xffff;
+      if (ctx->PC >= 0) {
+         ea = (ctx->PC + (sample_q[oi + 1].data << 8) + sample_q[oi + 2].data) & 0xffff;
       }
       break;
    case DIRECT:
-      if (DP >= 0) {
-         ea = (DP << 8) + sample_q[oi + 1].data;
+      if (ctx->DP >= 0) {
+         ea = (ctx->DP << 8) + sample_q[oi + 1].data;
       }
       break;
    case DIRECTBIT:
       // There is a postbyte
-      if (DP >= 0) {
-         ea = (DP << 8) + sample_q[oi + 2].data;
+      if (ctx->DP >= 0) {
+         ea = (ctx->DP << 8) + sample_q[oi + 2].data;
       }
       break;
    case EXTENDED:
@@ -1290,7 +1458,7 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
       break;
    case INDEXED:
       {
-         int *reg = get_index_reg((pb >> 5) & 0x03);
+         int *reg = get_index_reg(ctx, (pb >> 5) & 0x03);
          if (!(pb & 0x80)) {       /* n4,R */
             if (*reg >= 0) {
                if (pb & 0x10) {
@@ -1300,10 +1468,10 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
                }
             }
          } else {
-            if (cpu6309 && ((pb & 0x1f) == 0x0f || (pb & 0x1f) == 0x10)) {
+            if (ctx->cpu6309 && ((pb & 0x1f) == 0x0f || (pb & 0x1f) == 0x10)) {
 
                // Extra 6309 W indexed modes
-               int W = pack(ACCE, ACCF);
+               int W = pack(ctx->ACCE, ctx->ACCF);
                if (W >= 0) {
                   switch ((pb >> 5) & 3) {
                   case 0:           /* ,W */
@@ -1315,22 +1483,22 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
                   case 2:           /* ,W++ */
                      ea = W;
                      W = (W + 2) & 0xffff;
-                     unpack(W, &ACCE, &ACCF);
+                     unpack(W, &ctx->ACCE, &ctx->ACCF);
                      break;
                   case 3:           /* ,--W */
                      W = (W - 2) & 0xffff;
                      ea = W;
-                     unpack(W, &ACCE, &ACCF);
+                     unpack(W, &ctx->ACCE, &ctx->ACCF);
                      break;
                   }
-               } else if (ACCF >= 0) {
+               } else if (ctx->ACCF >= 0) {
                   // If ACCF is defined (but ACCE is undefined) we can still correctly update ACCF
                   switch ((pb >> 5) & 3) {
                   case 2:           /* ,W++ */
-                     ACCF = (ACCF + 2) & 0xff;
+                     ctx->ACCF = (ctx->ACCF + 2) & 0xff;
                      break;
                   case 3:           /* ,--W */
-                     ACCF = (ACCF - 2) & 0xff;
+                     ctx->ACCF = (ctx->ACCF - 2) & 0xff;
                      break;
                   }
                }
@@ -1368,9 +1536,9 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
                   }
                   break;
                case 5:                 /* B,R */
-                  if (*reg >= 0 && ACCB >= 0) {
+                  if (*reg >= 0 && ctx->ACCB >= 0) {
                      // The accumulator is treated as a 8-bit signed offset (!!!)
-                     int offset = ACCB;
+                     int offset = ctx->ACCB;
                      if (offset & 0x80) {
                         offset -= 0x100;
                      }
@@ -1378,9 +1546,9 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
                   }
                   break;
                case 6:                 /* A,R */
-                  if (*reg >= 0 && ACCA >= 0) {
+                  if (*reg >= 0 && ctx->ACCA >= 0) {
                      // The accumulator is treated as a 8-bit signed offset (!!!)
-                     int offset = ACCA;
+                     int offset = ctx->ACCA;
                      if (offset & 0x80) {
                         offset -= 0x100;
                      }
@@ -1388,10 +1556,10 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
                   }
                   break;
                case 7:                 /* E,R */
-                  if (cpu6309) {
-                     if (*reg >= 0 && ACCE >= 0) {
+                  if (ctx->cpu6309) {
+                     if (*reg >= 0 && ctx->ACCE >= 0) {
                         // The accumulator is treated as a 8-bit signed offset (!!!)
-                        int offset = ACCE;
+                        int offset = ctx->ACCE;
                         if (offset & 0x80) {
                            offset -= 0x100;
                         }
@@ -1399,9 +1567,9 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
                      }
                   } else {
                      // Ref: David Flamand's Undocumented 6809 Paper
-                     if (*reg >= 0 && ACCA >= 0) {
+                     if (*reg >= 0 && ctx->ACCA >= 0) {
                         // The accumulator is treated as a 8-bit signed offset (!!!)
-                        int offset = ACCA;
+                        int offset = ctx->ACCA;
                         if (offset & 0x80) {
                            offset -= 0x100;
                         }
@@ -1420,10 +1588,10 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
                   }
                   break;
                case 10:                /* F,R */
-                  if (cpu6309) {
-                     if (*reg >= 0 && ACCF >= 0) {
+                  if (ctx->cpu6309) {
+                     if (*reg >= 0 && ctx->ACCF >= 0) {
                         // The accumulator is treated as a 8-bit signed offset (!!!)
-                        int offset = ACCF;
+                        int offset = ctx->ACCF;
                         if (offset & 0x80) {
                            offset -= 0x100;
                         }
@@ -1431,33 +1599,33 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
                      }
                   } else {
                      // Ref: David Flamand's Undocumented 6809 Paper
-                     if (PC >= 0) {
-                        ea = ((PC + 1) | 0x00ff) & 0xffff;
-                        if (ACCA >= 0) {
-                           ACCA &= sample_q[oi + 2].data;
+                     if (ctx->PC >= 0) {
+                        ea = ((ctx->PC + 1) | 0x00ff) & 0xffff;
+                        if (ctx->ACCA >= 0) {
+                           ctx->ACCA &= sample_q[oi + 2].data;
                         }
                      }
                   }
                   break;
                case 11:                /* D,R */
-                  if (*reg >= 0 && ACCA >= 0 && ACCB >= 0) {
-                     ea = (*reg + (ACCA << 8) + ACCB) & 0xffff;
+                  if (*reg >= 0 && ctx->ACCA >= 0 && ctx->ACCB >= 0) {
+                     ea = (*reg + (ctx->ACCA << 8) + ctx->ACCB) & 0xffff;
                   }
                   break;
                case 12:                /* n7,PCR */
-                  if (PC >= 0) {
-                     ea = (PC + (int8_t)(sample_q[oi + 2].data)) & 0xffff;
+                  if (ctx->PC >= 0) {
+                     ea = (ctx->PC + (int8_t)(sample_q[oi + 2].data)) & 0xffff;
                   }
                   break;
                case 13:                /* n15,PCR */
-                  if (PC >= 0) {
-                     ea = (PC + (sample_q[oi + 2].data << 8) + sample_q[oi + 3].data) & 0xffff;
+                  if (ctx->PC >= 0) {
+                     ea = (ctx->PC + (sample_q[oi + 2].data << 8) + sample_q[oi + 3].data) & 0xffff;
                   }
                   break;
                case 14:                /* W,R */
-                  if (cpu6309) {
-                     if (*reg >= 0 && ACCE >= 0 && ACCF >= 0) {
-                        ea = (*reg + (ACCE << 8) + ACCF) & 0xffff;
+                  if (ctx->cpu6309) {
+                     if (*reg >= 0 && ctx->ACCE >= 0 && ctx->ACCF >= 0) {
+                        ea = (*reg + (ctx->ACCE << 8) + ctx->ACCF) & 0xffff;
                      }
                   } else {
                      // Ref: David Flamand's Undocumented 6809 Paper
@@ -1478,11 +1646,11 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
                // - the first 2 skips the opcode and postbyte
                // - the final 2 steps back to the effective address read
                offset += oi;
-               memory_read(sample_q + offset    , ea, MEM_POINTER);
+               mem_read(ctx, sample_q + offset    , ea, MEM_POINTER);
                if (ea >= 0) {
                   ea = (ea + 1 ) & 0xffff;
                }
-               memory_read(sample_q + offset + 1, ea, MEM_POINTER);
+               mem_read(ctx, sample_q + offset + 1, ea, MEM_POINTER);
                ea = ((sample_q[offset].data << 8) + sample_q[offset + 1].data) & 0xffff;
             }
          }
@@ -1492,9 +1660,9 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
       break;
    }
    // Special Case XSTS/XSTU/XSTX/XSTY
-   if (PC >= 0 && (instr->op == &op_XSTS || instr->op == &op_XSTU || instr->op == &op_XSTX || instr->op == &op_XSTY)) {
+   if (ctx->PC >= 0 && (instr->op == &op_XSTS || instr->op == &op_XSTU || instr->op == &op_XSTX || instr->op == &op_XSTY)) {
       // The write happens to second byte of immediate data
-      ea = (PC - 1) & 0xffff;
+      ea = (ctx->PC - 1) & 0xffff;
    }
 
 #ifdef WORK_FORWARD_TO_OPERAND
@@ -1519,12 +1687,12 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
          oi += 2;
       } else {
          // [ <Prefix> ] <Opcode> <Direct> <Dummy> <Operand>
-         oi += (NM == 1) ? 2 : 3;
+         oi += (ctx->NM == 1) ? 2 : 3;
       }
       break;
    case DIRECTBIT:
       // [ <Prefix> ] <Opcode> <Postbyte> <Direct> <Dummy> <Operand>
-      oi += (NM == 1) ? 3 : 4;
+      oi += (ctx->NM == 1) ? 3 : 4;
       break;
    case EXTENDED:
       if (instr->mode == EXTENDEDIM) {
@@ -1533,7 +1701,7 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
          oi += 3;
       } else {
          // [ <Prefix> ] <Opcode> <Extended Hi> <Extended Lo> <Dummy> <Operand>
-         oi += (NM == 1) ? 3 : 4;
+         oi += (ctx->NM == 1) ? 3 : 4;
       }
       break;
    case INDEXED:
@@ -1555,7 +1723,7 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
          oi += postbyte_cycles + 3;
       } else {
          // [ <Prefix> ] <Opcode> <Postbyte> ... <Operand>
-         oi += postbyte_cycles + ((NM == 1) ? 3 : 3);
+         oi += postbyte_cycles + ((ctx->NM == 1) ? 3 : 3);
       }
       break;
    }
@@ -1570,7 +1738,7 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
       oi = num_cycles - 26;
    } else if (instr->op == &op_TST) {
       // There are two dead cycles at the end of TST in emul mode, and one in native mode
-      oi = num_cycles - ((NM == 1) ? 2 : 3);
+      oi = num_cycles - ((ctx->NM == 1) ? 2 : 3);
    } else if (mode == IMMEDIATE_8 || mode == IMMEDIATE_16 || mode == REGISTER) {
       // operand immediately follows the opcode
       oi++;
@@ -1585,7 +1753,7 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
       oi = num_cycles - 4;
    } else if (instr->op->size == SIZE_16) {
       // Double byte operand
-      if (instr->op->type == LOADOP || instr->op->type == STOREOP || NM == 1) {
+      if (instr->op->type == LOADOP || instr->op->type == STOREOP || ctx->NM == 1) {
          // No dead cycle at the end with LDD/LDS/LDU/LDX/LDY/STD/STS/STU/STX/STY/JSR
          oi = num_cycles - 2;
       } else {
@@ -1612,15 +1780,15 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
    // Memory modelling of the read operand
    if (instr->op->type == RMWOP || instr->op->type == LOADOP ||  instr->op->type == READOP) {
       if (instr->op->size == SIZE_32) {
-         memory_read(sample_q + oi    ,                ea,     MEM_DATA);
-         memory_read(sample_q + oi + 1, offset_address(ea, 1), MEM_DATA);
-         memory_read(sample_q + oi + 2, offset_address(ea, 2), MEM_DATA);
-         memory_read(sample_q + oi + 3, offset_address(ea, 3), MEM_DATA);
+         mem_read(ctx, sample_q + oi    ,                ea,     MEM_DATA);
+         mem_read(ctx, sample_q + oi + 1, offset_address(ea, 1), MEM_DATA);
+         mem_read(ctx, sample_q + oi + 2, offset_address(ea, 2), MEM_DATA);
+         mem_read(ctx, sample_q + oi + 3, offset_address(ea, 3), MEM_DATA);
       } else if (instr->op->size == SIZE_16) {
-         memory_read(sample_q + oi    ,                ea    , MEM_DATA);
-         memory_read(sample_q + oi + 1, offset_address(ea, 1), MEM_DATA);
+         mem_read(ctx, sample_q + oi    ,                ea    , MEM_DATA);
+         mem_read(ctx, sample_q + oi + 1, offset_address(ea, 1), MEM_DATA);
       } else {
-         memory_read(sample_q + oi    ,                ea    , MEM_DATA);
+         mem_read(ctx, sample_q + oi    ,                ea    , MEM_DATA);
       }
    }
 
@@ -1629,24 +1797,24 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
    if (instr->op->type == RMWOP || instr->op->type == STOREOP) {
       if (instr->op->size == SIZE_32) {
          operand2 = (sample_q[num_cycles - 4].data << 24) + (sample_q[num_cycles - 3].data << 16) + (sample_q[num_cycles - 2].data << 8) + sample_q[num_cycles - 1].data;
-         memory_write(sample_q + num_cycles - 4,                ea,     MEM_DATA);
-         memory_write(sample_q + num_cycles - 3, offset_address(ea, 1), MEM_DATA);
-         memory_write(sample_q + num_cycles - 2, offset_address(ea, 2), MEM_DATA);
-         memory_write(sample_q + num_cycles - 1, offset_address(ea, 3), MEM_DATA);
+         mem_write(ctx, sample_q + num_cycles - 4,                ea,     MEM_DATA);
+         mem_write(ctx, sample_q + num_cycles - 3, offset_address(ea, 1), MEM_DATA);
+         mem_write(ctx, sample_q + num_cycles - 2, offset_address(ea, 2), MEM_DATA);
+         mem_write(ctx, sample_q + num_cycles - 1, offset_address(ea, 3), MEM_DATA);
       } else if (instr->op->size == SIZE_16) {
          operand2 = (sample_q[num_cycles - 2].data << 8) + sample_q[num_cycles - 1].data;
-         memory_write(sample_q + num_cycles - 2,                ea,     MEM_DATA);
-         memory_write(sample_q + num_cycles - 1, offset_address(ea, 1), MEM_DATA);
+         mem_write(ctx, sample_q + num_cycles - 2,                ea,     MEM_DATA);
+         mem_write(ctx, sample_q + num_cycles - 1, offset_address(ea, 1), MEM_DATA);
       } else {
          operand2 = sample_q[num_cycles - 1].data;
-         memory_write(sample_q + num_cycles - 1,                ea    , MEM_DATA);
+         mem_write(ctx, sample_q + num_cycles - 1,                ea    , MEM_DATA);
       }
    }
 
    // Emulate the instruction, and check the result against what was seen on the bus
    if (instr->op->emulate) {
       sample_ref.num_cycles = num_cycles;
-      int result = instr->op->emulate(operand, ea, &sample_ref);
+      int result = instr->op->emulate(ctx, operand, ea, &sample_ref);
       num_cycles = sample_ref.num_cycles;
       if (instr->op->type == STOREOP || instr->op->type == RMWOP) {
          // WRTEOP:
@@ -1658,14 +1826,14 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
 
          // Check result of instruction against bye
          if (result >= 0 && result != operand2) {
-            failflag |= FAIL_RESULT;
+            ctx->failflag |= FAIL_RESULT;
          }
       }
    }
 
    if (instr->op->type == RMWOP && (instr->mode != DIRECTIM && instr->mode != EXTENDEDIM && instr->mode != INDEXEDIM)) {
       // M register usef for the result of the RMW operation
-      M = operand2;
+      ctx->M = operand2;
    }
 
    // At this point num_cycles is the expected number of cycles (ignoring LIC)
@@ -1678,8 +1846,8 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
    // SYNC. It causes the flags to be set incorrectly.
    //
    // If fail_syncbug=0 then we suppress the bug setting the flags to undefined
-   if (NM == 1 && !fail_syncbug && num_cycles == sample_ref.oi + 1 && sample_q[num_cycles].data == 0x13) {
-      set_NZVC_unknown();
+   if (ctx->NM == 1 && !ctx->fail_syncbug && num_cycles == sample_ref.oi + 1 && sample_q[num_cycles].data == 0x13) {
+      set_NZVC_unknown(ctx);
    }
 
    // If LIC is available, we return the actual number of cycles, and validate the estimate
@@ -1688,11 +1856,11 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
       // - TFM, when interrupted
       // - LDMD, when changing mode
       // - SYNC, because LIC occurs in the middle of the instruction
-      int actual_cycles = count_cycles_with_lic(&sample_ref);
+      int actual_cycles = count_cycles_with_lic(ctx, &sample_ref);
       // Validate the estimated number of cycles
       if (actual_cycles >= 0) {
-         if (show_cycle_errors && actual_cycles != num_cycles) {
-            failflag |= FAIL_CYCLES;
+         if (ctx->show_cycle_errors && actual_cycles != num_cycles) {
+            ctx->failflag |= FAIL_CYCLES;
          }
          num_cycles = actual_cycles;
       }
@@ -1700,140 +1868,278 @@ static int em_6809_emulate(sample_t *sample_q, int num_samples, instruction_t *i
 
    // TODO: is this needed?
    if (num_cycles == CYCLES_TRUNCATED) {
-      failflag = 0;
+      ctx->failflag = 0;
    }
 
 
    // Save store immediate group of this instruction, in case
    // next instruction is a store immediate
-   storeimm = instr->op->storeimm;
+   ctx->storeimm = instr->op->storeimm;
+
+   if (pc_unknown) {
+      defer_instruction(ctx, instr, pb, instruction);
+   }
 
    // Return a possibly updates estimate of the number of cycles
    return num_cycles;
 }
 
-static int em_6809_get_PC() {
-   return PC;
+static int em_6809_get_PC(void *context) {
+   em6809_ctx_t *ctx = context;
+   return ctx->PC;
+}
+
+static int em_6809_get_NM(void *context) {
+   em6809_ctx_t *ctx = context;
+   return ctx->NM;
 }
 
-static int em_6809_get_NM() {
-   return NM;
+static int em_6809_get_S(void *context) {
+   em6809_ctx_t *ctx = context;
+   return ctx->S;
 }
 
-static int em_6809_read_memory(int address) {
-   return memory_read_raw(address);
+static int em_6809_read_memory(void *context, int address) {
+   em6809_ctx_t *ctx = context;
+   return memory_read_raw(ctx->mem, address);
+}
+
+static int em_6809_disassemble(void *context, char *buffer, instruction_t *instruction) {
+   em6809_ctx_t *ctx = context;
+   if (!ctx->dis_cache) {
+      ctx->dis_cache = calloc(1, sizeof(dis_6809_cache_t));
+      if (!ctx->dis_cache) {
+         return dis_6809_disassemble(buffer, instruction, ctx->cpu6309, ctx->instr_table);
+      }
+   }
+   return dis_6809_disassemble_cached(ctx->dis_cache, buffer, instruction, ctx->cpu6309, ctx->instr_table);
+}
+
+// Indexes of the registers in a cpu_state_t snapshot
+enum {
+   ST_ACCA, ST_ACCB, ST_ACCE, ST_ACCF, ST_X, ST_Y, ST_U, ST_S, ST_DP, ST_M, ST_TV,
+   ST_E, ST_F, ST_H, ST_I, ST_N, ST_Z, ST_V, ST_C, ST_DZ, ST_IL, ST_FM, ST_NM, ST_CPU6309
+};
+
+static const char *const state_names[] = {
+   "A", "B", "ACCE", "ACCF", "X", "Y", "U", "S", "DP", "M", "TV",
+   "E", "F", "H", "I", "N", "Z", "V", "C", "DZ", "IL", "FM", "NM", "CPU6309",
+   NULL
+};
+
+static void em_6809_save_state(void *context, cpu_state_t *state) {
+   em6809_ctx_t *ctx = context;
+   int *r = state->reg;
+   r[ST_ACCA]    = ctx->ACCA;
+   r[ST_ACCB]    = ctx->ACCB;
+   r[ST_ACCE]    = ctx->ACCE;
+   r[ST_ACCF]    = ctx->ACCF;
+   r[ST_X]       = ctx->X;
+   r[ST_Y]       = ctx->Y;
+   r[ST_U]       = ctx->U;
+   r[ST_S]       = ctx->S;
+   r[ST_DP]      = ctx->DP;
+   r[ST_M]       = ctx->M;
+   r[ST_TV]      = ctx->TV;
+   r[ST_E]       = ctx->E;
+   r[ST_F]       = ctx->F;
+   r[ST_H]       = ctx->H;
+   r[ST_I]       = ctx->I;
+   r[ST_N]       = ctx->N;
+   r[ST_Z]       = ctx->Z;
+   r[ST_V]       = ctx->V;
+   r[ST_C]       = ctx->C;
+   r[ST_DZ]      = ctx->DZ;
+   r[ST_IL]      = ctx->IL;
+   r[ST_FM]      = ctx->FM;
+   r[ST_NM]      = ctx->NM;
+   r[ST_CPU6309] = ctx->cpu6309;
+}
+
+// The complete register state, as saved in a checkpoint (this is more than
+// a cpu_state_t, as it includes the PC and the hidden state carried from
+// one instruction to the next)
+
+static const size_t context_fields[] = {
+   offsetof(em6809_ctx_t, ACCA),
+   offsetof(em6809_ctx_t, ACCB),
+   offsetof(em6809_ctx_t, X),
+   offsetof(em6809_ctx_t, Y),
+   offsetof(em6809_ctx_t, S),
+   offsetof(em6809_ctx_t, U),
+   offsetof(em6809_ctx_t, DP),
+   offsetof(em6809_ctx_t, PC),
+   offsetof(em6809_ctx_t, M),
+   offsetof(em6809_ctx_t, E),
+   offsetof(em6809_ctx_t, F),
+   offsetof(em6809_ctx_t, H),
+   offsetof(em6809_ctx_t, I),
+   offsetof(em6809_ctx_t, N),
+   offsetof(em6809_ctx_t, Z),
+   offsetof(em6809_ctx_t, V),
+   offsetof(em6809_ctx_t, C),
+   offsetof(em6809_ctx_t, ACCE),
+   offsetof(em6809_ctx_t, ACCF),
+   offsetof(em6809_ctx_t, TV),
+   offsetof(em6809_ctx_t, NM),
+   offsetof(em6809_ctx_t, FM),
+   offsetof(em6809_ctx_t, IL),
+   offsetof(em6809_ctx_t, DZ),
+   offsetof(em6809_ctx_t, async_pc_write),
+   offsetof(em6809_ctx_t, storeimm),
+   offsetof(em6809_ctx_t, last_res16)
+};
+
+#define NUM_CONTEXT_FIELDS (sizeof(context_fields) / sizeof(context_fields[0]))
+
+_Static_assert((NUM_CONTEXT_FIELDS + 1) * sizeof(int32_t) <= MAX_CONTEXT_SIZE, "MAX_CONTEXT_SIZE is too small");
+
+// All of the fields are accessed as ints
+_Static_assert(sizeof(storeimm_t) == sizeof(int), "storeimm_t must be the size of an int");
+
+static int em_6809_save_context(void *context, uint8_t *buffer) {
+   em6809_ctx_t *ctx = context;
+   int32_t values[NUM_CONTEXT_FIELDS + 1];
+   values[0] = ctx->cpu6309;
+   for (size_t i = 0; i < NUM_CONTEXT_FIELDS; i++) {
+      values[i + 1] = *(int *)((char *)ctx + context_fields[i]);
+   }
+   memcpy(buffer, values, sizeof(values));
+   return sizeof(values);
+}
+
+// The context must have been initialized (by init) for the same CPU
+
+static int em_6809_load_context(void *context, const uint8_t *buffer, int len) {
+   em6809_ctx_t *ctx = context;
+   int32_t values[NUM_CONTEXT_FIELDS + 1];
+   if (len != sizeof(values)) {
+      return -1;
+   }
+   memcpy(values, buffer, sizeof(values));
+   if (values[0] != ctx->cpu6309) {
+      return -1;
+   }
+   for (size_t i = 0; i < NUM_CONTEXT_FIELDS; i++) {
+      *(int *)((char *)ctx + context_fields[i]) = values[i + 1];
+   }
+   ctx->failflag = 0;
+   ctx->num_deferred = 0;
+   return 0;
 }
 
-static char *em_6809_get_state(char *buffer) {
+static char *em_6809_get_state(char *buffer, const cpu_state_t *state) {
+   const int *r = state->reg;
    // 6809: A=?? B=?? X=???? Y=???? U=???? S=???? DP=?? E=? F=? H=? I=? N=? Z=? V=? C=?";
    // 6309: A=?? B=?? E=?? F=?? X=???? Y=???? U=???? S=???? DP=?? T=???? E=? F=? H=? I=? N=? Z=? V=? C=? DZ=? IL=? FM=? NM=?"
    char *bp = buffer;
-   strcpy(bp, cpu_state);
+   strcpy(bp, r[ST_CPU6309] ? cpu_6309_state : cpu_6809_state);
    bp += 2;
-   if (ACCA >= 0) {
-      write_hex2(bp, ACCA);
+   if (r[ST_ACCA] >= 0) {
+      write_hex2(bp, r[ST_ACCA]);
    }
    bp += 5;
-   if (ACCB >= 0) {
-      write_hex2(bp, ACCB);
+   if (r[ST_ACCB] >= 0) {
+      write_hex2(bp, r[ST_ACCB]);
    }
    bp += 5;
-   if (cpu6309) {
-      if (ACCE >= 0) {
-         write_hex2(bp, ACCE);
+   if (r[ST_CPU6309]) {
+      if (r[ST_ACCE] >= 0) {
+         write_hex2(bp, r[ST_ACCE]);
       }
       bp += 5;
-      if (ACCF >= 0) {
-         write_hex2(bp, ACCF);
+      if (r[ST_ACCF] >= 0) {
+         write_hex2(bp, r[ST_ACCF]);
       }
       bp += 5;
    }
-   if (X >= 0) {
-      write_hex4(bp, X);
+   if (r[ST_X] >= 0) {
+      write_hex4(bp, r[ST_X]);
    }
    bp += 7;
-   if (Y >= 0) {
-      write_hex4(bp, Y);
+   if (r[ST_Y] >= 0) {
+      write_hex4(bp, r[ST_Y]);
    }
    bp += 7;
-   if (U >= 0) {
-      write_hex4(bp, U);
+   if (r[ST_U] >= 0) {
+      write_hex4(bp, r[ST_U]);
    }
    bp += 7;
-   if (S >= 0) {
-      write_hex4(bp, S);
+   if (r[ST_S] >= 0) {
+      write_hex4(bp, r[ST_S]);
    }
    bp += 8; // One extra as DP is a two-character name
-   if (DP >= 0) {
-      write_hex2(bp, DP);
+   if (r[ST_DP] >= 0) {
+      write_hex2(bp, r[ST_DP]);
    }
    bp += 5;
-   if (cpu6309) {
-      if (M >= 0) {
-         write_hex2(bp, M);
+   if (r[ST_CPU6309]) {
+      if (r[ST_M] >= 0) {
+         write_hex2(bp, r[ST_M]);
       }
       bp += 5;
-      if (TV >= 0) {
-         write_hex4(bp, TV);
+      if (r[ST_TV] >= 0) {
+         write_hex4(bp, r[ST_TV]);
       }
       bp += 7;
    }
-   if (E >= 0) {
-      *bp = '0' + E;
+   if (r[ST_E] >= 0) {
+      *bp = '0' + r[ST_E];
    }
    bp += 4;
-   if (F >= 0) {
-      *bp = '0' + F;
+   if (r[ST_F] >= 0) {
+      *bp = '0' + r[ST_F];
    }
    bp += 4;
-   if (H >= 0) {
-      *bp = '0' + H;
+   if (r[ST_H] >= 0) {
+      *bp = '0' + r[ST_H];
    }
    bp += 4;
-   if (I >= 0) {
-      *bp = '0' + I;
+   if (r[ST_I] >= 0) {
+      *bp = '0' + r[ST_I];
    }
    bp += 4;
-   if (N >= 0) {
-      *bp = '0' + N;
+   if (r[ST_N] >= 0) {
+      *bp = '0' + r[ST_N];
    }
    bp += 4;
-   if (Z >= 0) {
-      *bp = '0' + Z;
+   if (r[ST_Z] >= 0) {
+      *bp = '0' + r[ST_Z];
    }
    bp += 4;
-   if (V >= 0) {
-      *bp = '0' + V;
+   if (r[ST_V] >= 0) {
+      *bp = '0' + r[ST_V];
    }
    bp += 4;
-   if (C >= 0) {
-      *bp = '0' + C;
+   if (r[ST_C] >= 0) {
+      *bp = '0' + r[ST_C];
    }
-   if (cpu6309) {
+   if (r[ST_CPU6309]) {
       bp += 5;
-      if (DZ >= 0) {
-         *bp = '0' + DZ;
+      if (r[ST_DZ] >= 0) {
+         *bp = '0' + r[ST_DZ];
       }
       bp += 5;
-      if (IL >= 0) {
-         *bp = '0' + IL;
+      if (r[ST_IL] >= 0) {
+         *bp = '0' + r[ST_IL];
       }
       bp += 5;
-      if (FM >= 0) {
-         *bp = '0' + FM;
+      if (r[ST_FM] >= 0) {
+         *bp = '0' + r[ST_FM];
       }
       bp += 5;
-      if (NM >= 0) {
-         *bp = '0' + NM;
+      if (r[ST_NM] >= 0) {
+         *bp = '0' + r[ST_NM];
       }
    }
    bp += 1;
    return bp;
 }
 
-static uint32_t em_6809_get_and_clear_fail() {
-   uint32_t ret = failflag;
-   failflag = 0;
+static uint32_t em_6809_get_and_clear_fail(void *context) {
+   em6809_ctx_t *ctx = context;
+   uint32_t ret = ctx->failflag;
+   ctx->failflag = 0;
    return ret;
 }
 
@@ -1859,364 +2165,371 @@ static int em_6809_write_fail(char *bp, uint32_t fail) {
 }
 
 cpu_emulator_t em_6809 = {
+   .create = em_6809_create,
    .init = em_6809_init,
+   .destroy = em_6809_destroy,
    .emulate = em_6809_emulate,
-   .disassemble = dis_6809_disassemble,
+   .disassemble = em_6809_disassemble,
    .get_PC = em_6809_get_PC,
    .get_NM = em_6809_get_NM,
+   .get_S = em_6809_get_S,
    .read_memory = em_6809_read_memory,
+   .save_state = em_6809_save_state,
+   .save_context = em_6809_save_context,
+   .load_context = em_6809_load_context,
    .get_state = em_6809_get_state,
    .get_and_clear_fail = em_6809_get_and_clear_fail,
    .write_fail = em_6809_write_fail,
+   .state_names = state_names,
 };
 
 // ====================================================================
 // Instruction helpers
 // ====================================================================
 
-static int add_helper(int val, int cin, operand_t operand) {
+static int add_helper(em6809_ctx_t *ctx, int val, int cin, operand_t operand) {
    if (val >= 0 && cin >= 0 && operand >= 0) {
       int tmp = val + operand + cin;
       // The carry flag is bit 8 of the result
-      C = (tmp >> 8) & 1;
+      ctx->C = (tmp >> 8) & 1;
       // The overflow flag is: IF ((a^b^res^(res>>1))&0x80) SEV else CLV
-      V = (((val ^ operand ^ tmp) >> 7) & 1) ^ C;
+      ctx->V = (((val ^ operand ^ tmp) >> 7) & 1) ^ ctx->C;
       // The half carry flag is: IF ((a^b^res)&0x10) SEH else CLH
-      H =  ((val ^ operand ^ tmp) >> 4) & 1;
+      ctx->H =  ((val ^ operand ^ tmp) >> 4) & 1;
       // Truncate the result to 8 bits
       tmp &= 0xff;
       // Set the flags
-      set_NZ(tmp);
+      set_NZ(ctx, tmp);
       // Return the 8-bit result
       return tmp;
    } else {
-      set_HNZVC_unknown();
+      set_HNZVC_unknown(ctx);
       return -1;
    }
 }
 
-static int add16_helper(int val, int cin, int operand) {
+static int add16_helper(em6809_ctx_t *ctx, int val, int cin, int operand) {
    if (val >= 0 && cin >= 0 && operand >= 0) {
       // Perform the addition (there is no carry in)
       int tmp = val + operand + cin;
       // The carry flag is bit 16 of the result
-      C = (tmp >> 16) & 1;
+      ctx->C = (tmp >> 16) & 1;
       // The overflow flag is: IF ((a^b^res^(res>>1))&0x80) SEV else CLV
-      V = (((val ^ operand ^ tmp) >> 15) & 1) ^ C;
+      ctx->V = (((val ^ operand ^ tmp) >> 15) & 1) ^ ctx->C;
       // Truncate the result to 16 bits
       tmp &= 0xffff;
       // Set the flags
-      set_NZ16(tmp);
+      set_NZ16(ctx, tmp);
       // Used for the weird flags on store immediate
-      last_res16 = tmp;
+      ctx->last_res16 = tmp;
       // Return the 16-bit result
       return tmp;
    } else {
-      set_NZVC_unknown();
-      last_res16 = -1;
+      set_NZVC_unknown(ctx);
+      ctx->last_res16 = -1;
       return -1;
    }
 }
 
-static int and_helper(int val, operand_t operand) {
+static int and_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
       val &= operand;
-      set_NZ(val);
+      set_NZ(ctx, val);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
+   ctx->V = 0;
    return val;
 }
 
-static int and16_helper(int val, operand_t operand) {
+static int and16_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
       val &= operand;
-      set_NZ16(val);
+      set_NZ16(ctx, val);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
+   ctx->V = 0;
    return val;
 }
 
-static int asl_helper(int val) {
+static int asl_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
-      C = (val >> 7) & 1;
+      ctx->C = (val >> 7) & 1;
       // V is the xor of bits 7,6 of val
-      V = ((val >> 6) & 1) ^ C;
+      ctx->V = ((val >> 6) & 1) ^ ctx->C;
       val = (val << 1) & 0xff;
-      set_NZ(val);
+      set_NZ(ctx, val);
    } else {
-      set_NZVC_unknown();
+      set_NZVC_unknown(ctx);
    }
    // The datasheet says the half-carry flag is undefined, but in practice
    // it seems to be unchanged (i.e. no errors). Verified on 6309.
    return val;
 }
 
-static int asl16_helper(int val) {
+static int asl16_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
-      C = (val >> 15) & 1;
+      ctx->C = (val >> 15) & 1;
       // V is the xor of bits 15,14 of val
-      V = ((val >> 14) & 1) ^ C;
+      ctx->V = ((val >> 14) & 1) ^ ctx->C;
       val = (val << 1) & 0xffff;
-      set_NZ16(val);
+      set_NZ16(ctx, val);
    } else {
-      set_NZVC_unknown();
+      set_NZVC_unknown(ctx);
    }
    return val;
 }
 
-static int asr_helper(int val) {
+static int asr_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
-      C = val & 1;
+      ctx->C = val & 1;
       val = (val & 0x80) | (val >> 1);
-      set_NZ(val);
+      set_NZ(ctx, val);
    } else {
-      set_NZC_unknown();
+      set_NZC_unknown(ctx);
    }
    // The datasheet says the half-carry flag is undefined, but in practice
    // it seems to be unchanged (i.e. no errors). Verified on 6309.
    return val;
 }
 
-static int asr16_helper(int val) {
+static int asr16_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
-      C = val & 1;
+      ctx->C = val & 1;
       val = (val & 0x8000) | (val >> 1);
-      set_NZ16(val);
+      set_NZ16(ctx, val);
    } else {
-      set_NZC_unknown();
+      set_NZC_unknown(ctx);
    }
    return val;
 }
 
-static void bit_helper(int val, operand_t operand) {
+static void bit_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
-      set_NZ(val & operand);
+      set_NZ(ctx, val & operand);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
+   ctx->V = 0;
 }
 
-static void bit16_helper(int val, operand_t operand) {
+static void bit16_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
-      set_NZ16(val & operand);
+      set_NZ16(ctx, val & operand);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
+   ctx->V = 0;
 }
 
-static int clr_helper() {
-   N = 0;
-   Z = 1;
-   C = 0;
-   V = 0;
+static int clr_helper(em6809_ctx_t *ctx) {
+   ctx->N = 0;
+   ctx->Z = 1;
+   ctx->C = 0;
+   ctx->V = 0;
    return 0;
 }
 
-static void cmp_helper(int val, operand_t operand) {
+static void cmp_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
       int tmp = val - operand;
       // The carry flag is bit 8 of the result
-      C = (tmp >> 8) & 1;
+      ctx->C = (tmp >> 8) & 1;
       // The overflow flag is: IF ((a^b^res^(res>>1))&0x80) SEV else CLV
-      V = (((val ^ operand ^ tmp) >> 7) & 1) ^ C;
+      ctx->V = (((val ^ operand ^ tmp) >> 7) & 1) ^ ctx->C;
       tmp &= 0xff;
-      set_NZ(tmp);
+      set_NZ(ctx, tmp);
    } else {
-      set_NZVC_unknown();
+      set_NZVC_unknown(ctx);
    }
    // The datasheet says the half-carry flag is undefined, but in practice
    // it seems to be unchanged (i.e. no errors). Verified on 6309.
 }
 
-static void cmp16_helper(int val, operand_t operand) {
+static void cmp16_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
       int tmp = val - operand;
       // The carry flag is bit 16 of the result
-      C = (tmp >> 16) & 1;
+      ctx->C = (tmp >> 16) & 1;
       // The overflow flag is: IF ((a^b^res^(res>>1))&0x8000) SEV else CLV
-      V = (((val ^ operand ^ tmp) >> 15) & 1) ^ C;
+      ctx->V = (((val ^ operand ^ tmp) >> 15) & 1) ^ ctx->C;
       tmp &= 0xffff;
-      set_NZ16(tmp);
+      set_NZ16(ctx, tmp);
       // Used for the weird flags on store immediate
-      last_res16 = tmp;
+      ctx->last_res16 = tmp;
    } else {
-      set_NZVC_unknown();
-      last_res16 = -1;
+      set_NZVC_unknown(ctx);
+      ctx->last_res16 = -1;
    }
 }
 
-static int com_helper(int val) {
+static int com_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
       val ^= 0xff;
-      set_NZ(val);
+      set_NZ(ctx, val);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
-   C = 1;
+   ctx->V = 0;
+   ctx->C = 1;
    return val;
 }
 
-static int com16_helper(int val) {
+static int com16_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
       val ^= 0xffff;
-      set_NZ16(val);
+      set_NZ16(ctx, val);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
-   C = 1;
+   ctx->V = 0;
+   ctx->C = 1;
    return val;
 }
 
-static int dec_helper(int val) {
+static int dec_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
       val = (val - 1) & 0xff;
-      set_NZ(val);
+      set_NZ(ctx, val);
       // V indicates signed overflow, which onlt happens when going from 0x80->0x7f
-      V = (val == 0x7f);
+      ctx->V = (val == 0x7f);
    } else {
       val = -1;
-      set_NZV_unknown();
+      set_NZV_unknown(ctx);
    }
    return val;
 }
 
-static int dec16_helper(int val) {
+static int dec16_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
       val = (val - 1) & 0xffff;
-      set_NZ16(val);
+      set_NZ16(ctx, val);
       // V indicates signed overflow, which onlt happens when going from 0x8000->0x7fff
-      V = (val == 0x7fff);
+      ctx->V = (val == 0x7fff);
    } else {
       val = -1;
-      set_NZV_unknown();
+      set_NZV_unknown(ctx);
    }
    return val;
 }
 
-static int eor_helper(int val, operand_t operand) {
+static int eor_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
       val ^= operand;
-      set_NZ(val);
+      set_NZ(ctx, val);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
+   ctx->V = 0;
    return val;
 }
 
-static int eor16_helper(int val, operand_t operand) {
+static int eor16_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
       val ^= operand;
-      set_NZ16(val);
+      set_NZ16(ctx, val);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
+   ctx->V = 0;
    return val;
 }
 
-static int inc_helper(int val) {
+static int inc_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
       val = (val + 1) & 0xff;
-      set_NZ(val);
+      set_NZ(ctx, val);
       // V indicates signed overflow, which only happens when going from 127->128
-      V = (val == 0x80);
+      ctx->V = (val == 0x80);
    } else {
       val = -1;
-      set_NZV_unknown();
+      set_NZV_unknown(ctx);
    }
    return val;
 }
 
-static int inc16_helper(int val) {
+static int inc16_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
       val = (val + 1) & 0xffff;
-      set_NZ16(val);
+      set_NZ16(ctx, val);
       // V indicates signed overflow, which only happens when going from 127->128
-      V = (val == 0x8000);
+      ctx->V = (val == 0x8000);
    } else {
       val = -1;
-      set_NZV_unknown();
+      set_NZV_unknown(ctx);
    }
    return val;
 }
 
-static int ld_helper(int val) {
+static int ld_helper(em6809_ctx_t *ctx, int val) {
    val &= 0xff;
-   set_NZ(val);
-   V = 0;
+   set_NZ(ctx, val);
+   ctx->V = 0;
    return val;
 }
 
-static int ld16_helper(int val) {
+static int ld16_helper(em6809_ctx_t *ctx, int val) {
    val &= 0xffff;
-   set_NZ16(val);
-   V = 0;
+   set_NZ16(ctx, val);
+   ctx->V = 0;
    return val;
 }
 
-static int lsr_helper(int val) {
+static int lsr_helper(em6809_ctx_t *ctx, int val) {
    if (val >= 0) {
-      C = val & 1;
+      ctx->C = val & 1;
       val >>= 1;
-      Z = (val == 0);
+      ctx->Z = (val == 0);
    } else {
-      C = -1;
-      Z = -1;
+      ctx->C = -1;
+      ctx->Z = -1;
    }
-   N = 0;
+   ctx->N = 0;
    return val;
 }
 
-static int neg_helper(int val) {
-   V = (val == 0x80);
-   C = (val != 0x00);
+static int neg_helper(em6809_ctx_t *ctx, int val) {
+   ctx->V = (val == 0x80);
+   ctx->C = (val != 0x00);
    val = (-val) & 0xff;
-   set_NZ(val);
+   set_NZ(ctx, val);
    // The datasheet says the half-carry flag is undefined, but in practice
    // it seems to be unchanged (i.e. no errors). Verified on 6309.
    return val;
 }
 
-static int neg16_helper(int val) {
-   V = (val == 0x8000);
-   C = (val != 0x0000);
+static int neg16_helper(em6809_ctx_t *ctx, int val) {
+   ctx->V = (val == 0x8000);
+   ctx->C = (val != 0x0000);
    val = (-val) & 0xffff;
-   set_NZ16(val);
+   set_NZ16(ctx, val);
    return val;
 }
 
-static int or_helper(int val, operand_t operand) {
+static int or_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
       val |= operand;
-      set_NZ(val);
+      set_NZ(ctx, val);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
+   ctx->V = 0;
    return val;
 }
 
-static int or16_helper(int val, operand_t operand) {
+static int or16_helper(em6809_ctx_t *ctx, int val, operand_t operand) {
    if (val >= 0 && operand >= 0) {
       val |= operand;
-      set_NZ16(val);
+      set_NZ16(ctx, val);
    } else {
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
    }
-   V = 0;
+   ctx->V = 0;
    return val;
 }
 
-static void push_helper(sample_q_t *sample_q, int system) {
+static void push_helper(em6809_ctx_t *ctx, sample_q_t *sample_q, int system) {
    //  0 opcode
    //  1 postbyte
    //  2 ---
@@ -2236,18 +2549,18 @@ static void push_helper(sample_q_t *sample_q, int system) {
    // 16 Flags  skipped if bit 0=0
    sample_t *sample = sample_q->sample + sample_q->oi;
    int *us;
-   int (*push8)(sample_t *);
-   int (*push16)(sample_t *);
+   int (*push8)(em6809_ctx_t *, sample_t *);
+   int (*push16)(em6809_ctx_t *, sample_t *);
    int fail_us;
    if (system) {
       push8 = push8s;
       push16 = push16s;
-      us = &U;
+      us = &ctx->U;
       fail_us = FAIL_U;
    } else {
       push8 = push8u;
       push16 = push16u;
-      us = &S;
+      us = &ctx->S;
       fail_us = FAIL_S;
    }
    int pb = sample[1].data;
@@ -2258,72 +2571,72 @@ static void push_helper(sample_q_t *sample_q, int system) {
       return;
    }
    int tmp;
-   int i = (NM == 1) ? 4 : 5;
+   int i = (ctx->NM == 1) ? 4 : 5;
    if (pb & 0x80) {
-      tmp = push16(sample + i);
+      tmp = push16(ctx, sample + i);
       i += 2;
-      if (PC >= 0 && PC != tmp) {
-         failflag |= FAIL_PC;
+      if (ctx->PC >= 0 && ctx->PC != tmp) {
+         ctx->failflag |= FAIL_PC;
       }
-      PC = tmp;
+      ctx->PC = tmp;
    }
    if (pb & 0x40) {
-      tmp = push16(sample + i);
+      tmp = push16(ctx, sample + i);
       i += 2;
       if (*us >= 0 && *us != tmp) {
-         failflag |= fail_us;
+         ctx->failflag |= fail_us;
       }
       *us = tmp;
    }
    if (pb & 0x20) {
-      tmp = push16(sample + i);
+      tmp = push16(ctx, sample + i);
       i += 2;
-      if (Y >= 0 && Y != tmp) {
-         failflag |= FAIL_Y;
+      if (ctx->Y >= 0 && ctx->Y != tmp) {
+         ctx->failflag |= FAIL_Y;
       }
-      Y = tmp;
+      ctx->Y = tmp;
    }
    if (pb & 0x10) {
-      tmp = push16(sample + i);
+      tmp = push16(ctx, sample + i);
       i += 2;
-      if (X >= 0 && X != tmp) {
-         failflag |= FAIL_X;
+      if (ctx->X >= 0 && ctx->X != tmp) {
+         ctx->failflag |= FAIL_X;
       }
-      X = tmp;
+      ctx->X = tmp;
    }
    if (pb & 0x08) {
-      tmp = push8(sample + i);
+      tmp = push8(ctx, sample + i);
       i++;
-      if (DP >= 0 && DP != tmp) {
-         failflag |= FAIL_DP;
+      if (ctx->DP >= 0 && ctx->DP != tmp) {
+         ctx->failflag |= FAIL_DP;
       }
-      DP = tmp;
+      ctx->DP = tmp;
    }
    if (pb & 0x04) {
-      tmp = push8(sample + i);
+      tmp = push8(ctx, sample + i);
       i++;
-      if (ACCB >= 0 && ACCB != tmp) {
-         failflag |= FAIL_ACCB;
+      if (ctx->ACCB >= 0 && ctx->ACCB != tmp) {
+         ctx->failflag |= FAIL_ACCB;
       }
-      ACCB = tmp;
+      ctx->ACCB = tmp;
    }
    if (pb & 0x02) {
-      tmp = push8(sample + i);
+      tmp = push8(ctx, sample + i);
       i++;
-      if (ACCA >= 0 && ACCA != tmp) {
-         failflag |= FAIL_ACCA;
+      if (ctx->ACCA >= 0 && ctx->ACCA != tmp) {
+         ctx->failflag |= FAIL_ACCA;
       }
-      ACCA = tmp;
+      ctx->ACCA = tmp;
    }
    if (pb & 0x01) {
-      tmp = push8(sample + i);
+      tmp = push8(ctx, sample + i);
       i++;
-      check_FLAGS(tmp);
-      set_FLAGS(tmp);
+      check_FLAGS(ctx, tmp);
+      set_FLAGS(ctx, tmp);
    }
 }
 
-static void pull_helper(sample_q_t *sample_q, int system) {
+static void pull_helper(em6809_ctx_t *ctx, sample_q_t *sample_q, int system) {
    //  0 opcode
    //  1 postbyte
    //  2 ---
@@ -2343,16 +2656,16 @@ static void pull_helper(sample_q_t *sample_q, int system) {
    // 16 --
    sample_t *sample = sample_q->sample + sample_q->oi;
    int *us;
-   int (*pop8)(sample_t *);
-   int (*pop16)(sample_t *);
+   int (*pop8)(em6809_ctx_t *, sample_t *);
+   int (*pop16)(em6809_ctx_t *, sample_t *);
    if (system) {
       pop8 = pop8s;
       pop16 = pop16s;
-      us = &U;
+      us = &ctx->U;
    } else {
       pop8 = pop8u;
       pop16 = pop16u;
-      us = &S;
+      us = &ctx->S;
    }
 
    int pb = sample[1].data;
@@ -2363,197 +2676,197 @@ static void pull_helper(sample_q_t *sample_q, int system) {
       return;
    }
    int tmp;
-   int i = (NM == 1) ? 3 : 4;
+   int i = (ctx->NM == 1) ? 3 : 4;
    if (pb & 0x01) {
-      tmp = pop8(sample + i);
+      tmp = pop8(ctx, sample + i);
       i++;
-      set_FLAGS(tmp);
+      set_FLAGS(ctx, tmp);
    }
    if (pb & 0x02) {
-      tmp = pop8(sample + i);
+      tmp = pop8(ctx, sample + i);
       i++;
-      ACCA = tmp;
+      ctx->ACCA = tmp;
    }
    if (pb & 0x04) {
-      tmp = pop8(sample + i);
+      tmp = pop8(ctx, sample + i);
       i++;
-      ACCB = tmp;
+      ctx->ACCB = tmp;
    }
    if (pb & 0x08) {
-      tmp = pop8(sample + i);
+      tmp = pop8(ctx, sample + i);
       i++;
-      DP = tmp;
+      ctx->DP = tmp;
    }
    if (pb & 0x10) {
-      tmp = pop16(sample + i);
+      tmp = pop16(ctx, sample + i);
       i += 2;
-      X = tmp;
+      ctx->X = tmp;
    }
    if (pb & 0x20) {
-      tmp = pop16(sample + i);
+      tmp = pop16(ctx, sample + i);
       i += 2;
-      Y = tmp;
+      ctx->Y = tmp;
    }
    if (pb & 0x40) {
-      tmp = pop16(sample + i);
+      tmp = pop16(ctx, sample + i);
       i += 2;
       *us = tmp;
    }
    if (pb & 0x80) {
-      tmp = pop16(sample + i);
+      tmp = pop16(ctx, sample + i);
       i += 2;
-      PC = tmp;
+      ctx->PC = tmp;
    }
 }
 
-static int rol_helper(int val) {
-   if (val >= 0 && C >= 0) {
-      int tmp = (val << 1) + C;
+static int rol_helper(em6809_ctx_t *ctx, int val) {
+   if (val >= 0 && ctx->C >= 0) {
+      int tmp = (val << 1) + ctx->C;
       // C is bit 7 of val
-      C = (val >> 7) & 1;
+      ctx->C = (val >> 7) & 1;
       // V is the xor of bits 7,6 of val
-      V = ((val >> 6) & 1) ^ C;
+      ctx->V = ((val >> 6) & 1) ^ ctx->C;
       // truncate to 8 bits
       val = tmp & 0xff;
-      set_NZ(val);
+      set_NZ(ctx, val);
    } else {
       val = -1;
-      set_NZVC_unknown();
+      set_NZVC_unknown(ctx);
    }
    return val;
 }
 
-static int rol16_helper(int val) {
-   if (val >= 0 && C >= 0) {
-      int tmp = (val << 1) + C;
+static int rol16_helper(em6809_ctx_t *ctx, int val) {
+   if (val >= 0 && ctx->C >= 0) {
+      int tmp = (val << 1) + ctx->C;
       // C is bit 15 of val
-      C = (val >> 15) & 1;
+      ctx->C = (val >> 15) & 1;
       // V is the xor of bits 15,14 of val
-      V = ((val >> 14) & 1) ^ C;
+      ctx->V = ((val >> 14) & 1) ^ ctx->C;
       // truncate to 8 bits
       val = tmp & 0xffff;
-      set_NZ16(val);
+      set_NZ16(ctx, val);
    } else {
       val = -1;
-      set_NZVC_unknown();
+      set_NZVC_unknown(ctx);
    }
    return val;
 }
 
-static int ror_helper(int val) {
-   if (val >= 0 && C >= 0) {
-      int tmp = (val >> 1) + (C << 7);
+static int ror_helper(em6809_ctx_t *ctx, int val) {
+   if (val >= 0 && ctx->C >= 0) {
+      int tmp = (val >> 1) + (ctx->C << 7);
       // C is bit 0 of val (V is unaffected)
-      C = val & 1;
+      ctx->C = val & 1;
       // truncate to 8 bits
       val = tmp & 0xff;
-      set_NZ(val);
+      set_NZ(ctx, val);
    } else {
       val = -1;
-      set_NZC_unknown();
+      set_NZC_unknown(ctx);
    }
    return val;
 }
 
-static int ror16_helper(int val) {
-   if (val >= 0 && C >= 0) {
-      int tmp = (val >> 1) + (C << 15);
+static int ror16_helper(em6809_ctx_t *ctx, int val) {
+   if (val >= 0 && ctx->C >= 0) {
+      int tmp = (val >> 1) + (ctx->C << 15);
       // C is bit 0 of val (V is unaffected)
-      C = val & 1;
+      ctx->C = val & 1;
       // truncate to 8 bits
       val = tmp & 0xffff;
-      set_NZ16(val);
+      set_NZ16(ctx, val);
    } else {
       val = -1;
-      set_NZC_unknown();
+      set_NZC_unknown(ctx);
    }
    return val;
 }
 
-static int st_helper(int val, operand_t operand, int fail) {
+static int st_helper(em6809_ctx_t *ctx, int val, operand_t operand, int fail) {
    if (val >= 0 && operand >= 0) {
       if (operand != val) {
-         failflag |= fail;
+         ctx->failflag |= fail;
       }
    }
-   V = 0;
-   set_NZ(operand);
+   ctx->V = 0;
+   set_NZ(ctx, operand);
    return operand;
 }
 
-static int st16_helper(int val, operand_t operand, int fail) {
+static int st16_helper(em6809_ctx_t *ctx, int val, operand_t operand, int fail) {
    if (val >= 0 && operand >= 0) {
       if (operand != val) {
-         failflag |= fail;
+         ctx->failflag |= fail;
       }
    }
-   V = 0;
-   set_NZ16(operand);
+   ctx->V = 0;
+   set_NZ16(ctx, operand);
    return operand;
 }
 
-static int sub_helper(int val, int cin, operand_t operand) {
+static int sub_helper(em6809_ctx_t *ctx, int val, int cin, operand_t operand) {
    if (val >= 0 && cin >= 0  && operand >= 0) {
       int tmp = val - operand - cin;
       // The carry flag is bit 8 of the result
-      C = (tmp >> 8) & 1;
+      ctx->C = (tmp >> 8) & 1;
       // The overflow flag is: IF ((a^b^res^(res>>1))&0x80) SEV else CLV
-      V = (((val ^ operand ^ tmp) >> 7) & 1) ^ C;
+      ctx->V = (((val ^ operand ^ tmp) >> 7) & 1) ^ ctx->C;
       // Truncate the result to 8 bits
       tmp &= 0xff;
       // Set the flags
-      set_NZ(tmp);
+      set_NZ(ctx, tmp);
       // Save the result back to the register
       return tmp;
    } else {
-      set_NZVC_unknown();
+      set_NZVC_unknown(ctx);
       return -1;
    }
    // The datasheet says the half-carry flag is undefined, but in practice
    // it seems to be unchanged (i.e. no errors). Verified on 6309.
 }
 
-static int sub16_helper(int val, int cin, operand_t operand) {
+static int sub16_helper(em6809_ctx_t *ctx, int val, int cin, operand_t operand) {
    if (val >= 0 && cin >= 0 && operand >= 0) {
       int tmp = val - operand - cin;
       // The carry flag is bit 16 of the result
-      C = (tmp >> 16) & 1;
+      ctx->C = (tmp >> 16) & 1;
       // The overflow flag is: IF ((a^b^res^(res>>1))&0x8000) SEV else CLV
-      V = (((val ^ operand ^ tmp) >> 15) & 1) ^ C;
+      ctx->V = (((val ^ operand ^ tmp) >> 15) & 1) ^ ctx->C;
       // Truncate the result to 16 bits
       tmp &= 0xffff;
       // Set the flags
-      set_NZ16(tmp);
+      set_NZ16(ctx, tmp);
       // Save the result back to the register
       return tmp;
    } else {
-      set_NZVC_unknown();
+      set_NZVC_unknown(ctx);
       return -1;
    }
    // The datasheet says the half-carry flag is undefined, but in practice
    // it seems to be unchanged (i.e. no errors). Verified on 6309.
 }
 
-static int xnc_helper(int val) {
-   if (C == 0) {
-      return neg_helper(val);
-   } else if (C == 1) {
-      return com_helper(val);
+static int xnc_helper(em6809_ctx_t *ctx, int val) {
+   if (ctx->C == 0) {
+      return neg_helper(ctx, val);
+   } else if (ctx->C == 1) {
+      return com_helper(ctx, val);
    } else {
-      set_NZVC_unknown();
+      set_NZVC_unknown(ctx);
       return -1;
    }
 }
 
-static int xdec_helper(int val) {
-   C = (val != 0);
-   return dec_helper(val);
+static int xdec_helper(em6809_ctx_t *ctx, int val) {
+   ctx->C = (val != 0);
+   return dec_helper(ctx, val);
 }
 
-static int xclr_helper() {
-   N = 0;
-   Z = 1;
-   V = 0;
+static int xclr_helper(em6809_ctx_t *ctx) {
+   ctx->N = 0;
+   ctx->Z = 1;
+   ctx->V = 0;
    // Unlike CLR, C is unchanged
    return 0;
 }
@@ -2562,349 +2875,349 @@ static int xclr_helper() {
 // Common 6809/6309 Instructions
 // ====================================================================
 
-static int op_fn_ABX(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_ABX(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // X = X + B
-   if (X >= 0 && ACCB >= 0) {
+   if (ctx->X >= 0 && ctx->ACCB >= 0) {
       // Here ABBC is treated as an 8-bit unsigned value
-      X = (X + ACCB) & 0xffff;
+      ctx->X = (ctx->X + ctx->ACCB) & 0xffff;
    } else {
-      X = -1;
+      ctx->X = -1;
    }
    return -1;
 }
 
-static int op_fn_ADCA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = add_helper(ACCA, C, operand);
+static int op_fn_ADCA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = add_helper(ctx, ctx->ACCA, ctx->C, operand);
    return -1;
 }
 
-static int op_fn_ADCB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = add_helper(ACCB, C, operand);
+static int op_fn_ADCB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = add_helper(ctx, ctx->ACCB, ctx->C, operand);
    return -1;
 }
 
-static int op_fn_ADDA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = add_helper(ACCA, 0, operand);
+static int op_fn_ADDA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = add_helper(ctx, ctx->ACCA, 0, operand);
    return -1;
 }
 
-static int op_fn_ADDB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = add_helper(ACCB, 0, operand);
+static int op_fn_ADDB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = add_helper(ctx, ctx->ACCB, 0, operand);
    return -1;
 }
 
-static int op_fn_ADDD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = add16_helper(D, 0, operand);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_ADDD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = add16_helper(ctx, D, 0, operand);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_ANDA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = and_helper(ACCA, operand);
+static int op_fn_ANDA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = and_helper(ctx, ctx->ACCA, operand);
    return -1;
 }
 
-static int op_fn_ANDB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = and_helper(ACCB, operand);
+static int op_fn_ANDB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = and_helper(ctx, ctx->ACCB, operand);
    return -1;
 }
 
-static int op_fn_ANDC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_ANDC(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    if (!(operand & 0x80)) {
-      E = 0;
+      ctx->E = 0;
    }
    if (!(operand & 0x40)) {
-      F = 0;
+      ctx->F = 0;
    }
    if (!(operand & 0x20)) {
-      H = 0;
+      ctx->H = 0;
    }
    if (!(operand & 0x10)) {
-      I = 0;
+      ctx->I = 0;
    }
    if (!(operand & 0x08)) {
-      N = 0;
+      ctx->N = 0;
    }
    if (!(operand & 0x04)) {
-      Z = 0;
+      ctx->Z = 0;
    }
    if (!(operand & 0x02)) {
-      V = 0;
+      ctx->V = 0;
    }
    if (!(operand & 0x01)) {
-      C = 0;
+      ctx->C = 0;
    }
    return -1;
 }
 
-static int op_fn_ASL(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return asl_helper(operand);
+static int op_fn_ASL(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return asl_helper(ctx, operand);
 }
 
-static int op_fn_ASLA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = asl_helper(ACCA);
+static int op_fn_ASLA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = asl_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_ASLB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = asl_helper(ACCB);
+static int op_fn_ASLB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = asl_helper(ctx, ctx->ACCB);
    return -1;
 }
 
-static int op_fn_ASR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return asr_helper(operand);
+static int op_fn_ASR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return asr_helper(ctx, operand);
 }
 
-static int op_fn_ASRA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = asr_helper(ACCA);
+static int op_fn_ASRA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = asr_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_ASRB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = asr_helper(ACCB);
+static int op_fn_ASRB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = asr_helper(ctx, ctx->ACCB);
    return -1;
 }
 
 // On a 6809 or a 6309 in emulated mode, a taken long branch adds one cycle
-static inline void add_branch_taken_penalty(sample_q_t *sample_q) {
-   if (NM !=1 && sample_q->sample->data == 0x10) {
+static inline void add_branch_taken_penalty(em6809_ctx_t *ctx, sample_q_t *sample_q) {
+   if (ctx->NM !=1 && sample_q->sample->data == 0x10) {
       sample_q->num_cycles++;
    }
 }
 
-static int op_fn_BCC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (C < 0) {
-      PC = -1;
-   } else if (C == 0) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BCC(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->C < 0) {
+      ctx->PC = -1;
+   } else if (ctx->C == 0) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BEQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (Z < 0) {
-      PC = -1;
-   } else if (Z == 1) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BEQ(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->Z < 0) {
+      ctx->PC = -1;
+   } else if (ctx->Z == 1) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BGE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (N < 0 || V < 0) {
-      PC = -1;
-   } else if (N == V) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BGE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->N < 0 || ctx->V < 0) {
+      ctx->PC = -1;
+   } else if (ctx->N == ctx->V) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BGT(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (Z < 0 || N < 0 || V < 0) {
-      PC = -1;
-   } else if (Z == 0 && N == V) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BGT(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->Z < 0 || ctx->N < 0 || ctx->V < 0) {
+      ctx->PC = -1;
+   } else if (ctx->Z == 0 && ctx->N == ctx->V) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BHI(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (Z < 0 || C < 0) {
-      PC = -1;
-   } else if (Z == 0 && C == 0) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BHI(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->Z < 0 || ctx->C < 0) {
+      ctx->PC = -1;
+   } else if (ctx->Z == 0 && ctx->C == 0) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BITA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   bit_helper(ACCA, operand);
+static int op_fn_BITA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   bit_helper(ctx, ctx->ACCA, operand);
    return -1;
 }
 
-static int op_fn_BITB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   bit_helper(ACCB, operand);
+static int op_fn_BITB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   bit_helper(ctx, ctx->ACCB, operand);
    return -1;
 }
 
-static int op_fn_BLE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (Z < 0 || N < 0 || V < 0) {
-      PC = -1;
-   } else if (Z == 1 || N != V) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BLE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->Z < 0 || ctx->N < 0 || ctx->V < 0) {
+      ctx->PC = -1;
+   } else if (ctx->Z == 1 || ctx->N != ctx->V) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BLO(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (C < 0) {
-      PC = -1;
-   } else if (C == 1) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BLO(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->C < 0) {
+      ctx->PC = -1;
+   } else if (ctx->C == 1) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BLS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (Z < 0 || C < 0) {
-      PC = -1;
-   } else if (Z == 1 || C == 1) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BLS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->Z < 0 || ctx->C < 0) {
+      ctx->PC = -1;
+   } else if (ctx->Z == 1 || ctx->C == 1) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BLT(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (N < 0 || V < 0) {
-      PC = -1;
-   } else if (N != V) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BLT(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->N < 0 || ctx->V < 0) {
+      ctx->PC = -1;
+   } else if (ctx->N != ctx->V) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BMI(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (N < 0) {
-      PC = -1;
-   } else if (N == 1) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BMI(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->N < 0) {
+      ctx->PC = -1;
+   } else if (ctx->N == 1) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BNE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (Z < 0) {
-      PC = -1;
-   } else if (Z == 0) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BNE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->Z < 0) {
+      ctx->PC = -1;
+   } else if (ctx->Z == 0) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BPL(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (N < 0) {
-      PC = -1;
-   } else if (N == 0) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BPL(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->N < 0) {
+      ctx->PC = -1;
+   } else if (ctx->N == 0) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BRA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   PC = ea;
+static int op_fn_BRA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->PC = ea;
    return -1;
 }
 
-static int op_fn_BRN(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_BRN(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    return -1;
 }
 
-static int op_fn_BSR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   push16s(sample_q->sample + sample_q->num_cycles - 2);
-   PC = ea;
+static int op_fn_BSR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   push16s(ctx, sample_q->sample + sample_q->num_cycles - 2);
+   ctx->PC = ea;
    return -1;
 }
 
-static int op_fn_BVC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (V < 0) {
-      PC = -1;
-   } else if (V == 0) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BVC(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->V < 0) {
+      ctx->PC = -1;
+   } else if (ctx->V == 0) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_BVS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (V < 0) {
-      PC = -1;
-   } else if (V == 1) {
-      PC = ea;
-      add_branch_taken_penalty(sample_q);
+static int op_fn_BVS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->V < 0) {
+      ctx->PC = -1;
+   } else if (ctx->V == 1) {
+      ctx->PC = ea;
+      add_branch_taken_penalty(ctx, sample_q);
    }
    return -1;
 }
 
-static int op_fn_CLR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return clr_helper();
+static int op_fn_CLR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return clr_helper(ctx);
 }
 
-static int op_fn_CLRA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = clr_helper();
+static int op_fn_CLRA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = clr_helper(ctx);
    return -1;
 }
 
-static int op_fn_CLRB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = clr_helper();
+static int op_fn_CLRB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = clr_helper(ctx);
    return -1;
 }
 
-static int op_fn_CMPA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp_helper(ACCA, operand);
+static int op_fn_CMPA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp_helper(ctx, ctx->ACCA, operand);
    return -1;
 }
 
-static int op_fn_CMPB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp_helper(ACCB, operand);
+static int op_fn_CMPB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp_helper(ctx, ctx->ACCB, operand);
    return -1;
 }
 
-static int op_fn_CMPD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp16_helper(pack(ACCA, ACCB), operand);
+static int op_fn_CMPD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp16_helper(ctx, pack(ctx->ACCA, ctx->ACCB), operand);
    return -1;
 }
 
-static int op_fn_CMPS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp16_helper(S, operand);
+static int op_fn_CMPS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp16_helper(ctx, ctx->S, operand);
    return -1;
 }
 
-static int op_fn_CMPU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp16_helper(U, operand);
+static int op_fn_CMPU(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp16_helper(ctx, ctx->U, operand);
    return -1;
 }
 
-static int op_fn_CMPX(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp16_helper(X, operand);
+static int op_fn_CMPX(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp16_helper(ctx, ctx->X, operand);
    return -1;
 }
 
-static int op_fn_CMPY(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp16_helper(Y, operand);
+static int op_fn_CMPY(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp16_helper(ctx, ctx->Y, operand);
    return -1;
 }
 
-static int op_fn_COM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return com_helper(operand);
+static int op_fn_COM(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return com_helper(ctx, operand);
 }
 
-static int op_fn_COMA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = com_helper(ACCA);
+static int op_fn_COMA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = com_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_COMB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = com_helper(ACCB);
+static int op_fn_COMB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = com_helper(ctx, ctx->ACCB);
    return -1;
 }
 
-static int op_fn_CWAI(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_CWAI(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
 
    // CC = CC & immediate operand
-   op_fn_ANDC(operand, ea, sample_q);
+   op_fn_ANDC(ctx, operand, ea, sample_q);
 
    // Look ahead for the vector fetch
    sample_t *sample = sample_q->sample;
@@ -2935,20 +3248,20 @@ static int op_fn_CWAI(operand_t operand, ea_t ea, sample_q_t *sample_q) {
       vec = VEC_IRQ;
    }
    // The full state is always stacked
-   interrupt_helper(sample_q, 4, 1, vec);
+   interrupt_helper(ctx, sample_q, 4, 1, vec);
    return -1;
 }
 
-static int op_fn_DAA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (ACCA >= 0 && H >= 0 && C >= 0) {
+static int op_fn_DAA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->ACCA >= 0 && ctx->H >= 0 && ctx->C >= 0) {
       int correction = 0x00;
-      if (H == 1 || (ACCA & 0x0f) > 0x09) {
+      if (ctx->H == 1 || (ctx->ACCA & 0x0f) > 0x09) {
          correction |= 0x06;
       }
-      if (C == 1 || (ACCA & 0xf0) > 0x90 || ((ACCA & 0xf0) > 0x80 && (ACCA & 0x0f) > 0x09)) {
+      if (ctx->C == 1 || (ctx->ACCA & 0xf0) > 0x90 || ((ctx->ACCA & 0xf0) > 0x80 && (ctx->ACCA & 0x0f) > 0x09)) {
          correction |= 0x60;
       }
-      if (cpu6309 && C == 1 && ACCA >= 0x80 && ACCA <= 0x99) {
+      if (ctx->cpu6309 && ctx->C == 1 && ctx->ACCA >= 0x80 && ctx->ACCA <= 0x99) {
 
          // This difference from the 6809 is not widely known
 
@@ -3009,27 +3322,27 @@ static int op_fn_DAA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
          // I haven't worked out a pattern here, but this logic is correct on an exhaustive test
 
                                     // 6809 correction  6309 correction
-         if (ACCA == 0x99) {
-            correction = 0x68 - H;  // 0x60/0x66   ->   0x68/0x67
-         } else if (ACCA == 0x98) {
+         if (ctx->ACCA == 0x99) {
+            correction = 0x68 - ctx->H;  // 0x60/0x66   ->   0x68/0x67
+         } else if (ctx->ACCA == 0x98) {
             correction = 0x68;      // 0x60/0x66   ->   0x68/0x68
-         } else if (ACCA >= 0x90) {
+         } else if (ctx->ACCA >= 0x90) {
             correction += 0x10;     // 0x60/0x66   ->   0x70/0x76
          } else {
             correction += 0x20;     // 0x60/0x66   ->   0x80/0x86
          }
       }
-      int tmp = ACCA + correction;
+      int tmp = ctx->ACCA + correction;
       // C is apparently only ever set by DAA, never cleared
-      C |= (tmp >> 8) & 1;
+      ctx->C |= (tmp >> 8) & 1;
       // V is is calculated as follows on both the 6809 and the 6309
-      V = ((tmp >> 7) & 1) ^ C;
+      ctx->V = ((tmp >> 7) & 1) ^ ctx->C;
       tmp &= 0xff;
-      set_NZ(tmp);
-      ACCA = tmp;
+      set_NZ(ctx, tmp);
+      ctx->ACCA = tmp;
    } else {
-      ACCA = -1;
-      set_NZC_unknown();
+      ctx->ACCA = -1;
+      set_NZC_unknown(ctx);
    }
    // The datasheet says V is 0; this reference says V is undefined:
    // https://colorcomputerarchive.com/repo/Documents/Books/Motorola%206809%20and%20Hitachi%206309%20Programming%20Reference%20(Darren%20Atkinson).pdf
@@ -3048,40 +3361,40 @@ static int op_fn_DAA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
    return -1;
 }
 
-static int op_fn_DEC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return dec_helper(operand);
+static int op_fn_DEC(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return dec_helper(ctx, operand);
 }
 
-static int op_fn_DECA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = dec_helper(ACCA);
+static int op_fn_DECA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = dec_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_DECB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = dec_helper(ACCB);
+static int op_fn_DECB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = dec_helper(ctx, ctx->ACCB);
    return -1;
 }
 
-static int op_fn_EORA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = eor_helper(ACCA, operand);
+static int op_fn_EORA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = eor_helper(ctx, ctx->ACCA, operand);
    return -1;
 }
 
-static int op_fn_EORB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = eor_helper(ACCB, operand);
+static int op_fn_EORB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = eor_helper(ctx, ctx->ACCB, operand);
    return -1;
 }
 
 // Operand is the postbyte
-static int op_fn_EXG(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_EXG(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    int reg1 = (operand >> 4) & 15;
    int reg2 = operand & 15;
 
-   if (cpu6309) {
-      int tmp1 = get_regp(reg1);
-      int tmp2 = get_regp(reg2);
-      set_regp(reg1, tmp2);
-      set_regp(reg2, tmp1);
+   if (ctx->cpu6309) {
+      int tmp1 = get_regp(ctx, reg1);
+      int tmp2 = get_regp(ctx, reg2);
+      set_regp(ctx, reg1, tmp2);
+      set_regp(ctx, reg2, tmp1);
    } else {
       // According to Atkinson, page 66, there is a 6809 corner case where:
       //   EXC A,D
@@ -3133,238 +3446,238 @@ static int op_fn_EXG(operand_t operand, ea_t ea, sample_q_t *sample_q) {
       //    A -> D    (   D = FFAA )
       // temp -> A    (   A = BB   )
 
-      int tmp = get_regp(reg2);
-      set_regp(reg2, get_regp(reg1));
+      int tmp = get_regp(ctx, reg2);
+      set_regp(ctx, reg2, get_regp(ctx, reg1));
       // Special case reg2 (8 bits) => reg1 (16 bits)
       if (tmp >= 0 && reg2 >= 8 && reg1 < 8) {
          tmp |= 0xFF00;
       }
-      set_regp(reg1, tmp);
+      set_regp(ctx, reg1, tmp);
    }
    return -1;
 }
 
-static int op_fn_INC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return inc_helper(operand);
+static int op_fn_INC(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return inc_helper(ctx, operand);
 }
 
-static int op_fn_INCA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = inc_helper(ACCA);
+static int op_fn_INCA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = inc_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_INCB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = inc_helper(ACCB);
+static int op_fn_INCB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = inc_helper(ctx, ctx->ACCB);
    return -1;
 }
 
-static int op_fn_JMP(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   PC = ea;
+static int op_fn_JMP(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->PC = ea;
    return -1;
 }
 
-static int op_fn_JSR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   push16s(sample_q->sample + sample_q->num_cycles - 2);
-   PC = ea;
+static int op_fn_JSR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   push16s(ctx, sample_q->sample + sample_q->num_cycles - 2);
+   ctx->PC = ea;
    return -1;
 }
 
-static int op_fn_LDA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = ld_helper(operand);
+static int op_fn_LDA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = ld_helper(ctx, operand);
    return -1;
 }
 
-static int op_fn_LDB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = ld_helper(operand);
+static int op_fn_LDB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = ld_helper(ctx, operand);
    return -1;
 }
 
-static int op_fn_LDD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int tmp = ld16_helper(operand);
-   ACCA = (tmp >> 8) & 0xff;
-   ACCB = tmp & 0xff;
+static int op_fn_LDD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int tmp = ld16_helper(ctx, operand);
+   ctx->ACCA = (tmp >> 8) & 0xff;
+   ctx->ACCB = tmp & 0xff;
    return -1;
 }
 
-static int op_fn_LDS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   S = ld16_helper(operand);
+static int op_fn_LDS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->S = ld16_helper(ctx, operand);
    return -1;
 }
 
-static int op_fn_LDU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   U = ld16_helper(operand);
+static int op_fn_LDU(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->U = ld16_helper(ctx, operand);
    return -1;
 }
 
-static int op_fn_LDX(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   X = ld16_helper(operand);
+static int op_fn_LDX(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->X = ld16_helper(ctx, operand);
    return -1;
 }
 
-static int op_fn_LDY(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   Y = ld16_helper(operand);
+static int op_fn_LDY(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->Y = ld16_helper(ctx, operand);
    return -1;
 }
 
-static int op_fn_LEAS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   S = ea;
+static int op_fn_LEAS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->S = ea;
    return -1;
 }
 
-static int op_fn_LEAU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   U = ea;
+static int op_fn_LEAU(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->U = ea;
    return -1;
 }
 
-static int op_fn_LEAX(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   X = ea;
-   Z = (X == 0);
+static int op_fn_LEAX(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->X = ea;
+   ctx->Z = (ctx->X == 0);
    return -1;
 }
 
-static int op_fn_LEAY(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   Y = ea;
-   Z = (Y == 0);
+static int op_fn_LEAY(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->Y = ea;
+   ctx->Z = (ctx->Y == 0);
    return -1;
 }
 
-static int op_fn_LSR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return lsr_helper(operand);
+static int op_fn_LSR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return lsr_helper(ctx, operand);
 }
 
-static int op_fn_LSRA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = lsr_helper(ACCA);
+static int op_fn_LSRA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = lsr_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_LSRB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = lsr_helper(ACCB);
+static int op_fn_LSRB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = lsr_helper(ctx, ctx->ACCB);
    return -1;
 }
 
-static int op_fn_MUL(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_MUL(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // M register
-   M = ACCB;
+   ctx->M = ctx->ACCB;
    // D = A * B (unsigned)
-   if (ACCA >= 0 && ACCB >= 0) {
-      uint16_t tmp = ACCA * ACCB;
-      ACCA = (tmp >> 8) & 0xff;
-      ACCB = tmp & 0xff;
-      Z = (tmp == 0);
-      C = (ACCB >> 7) & 1;
+   if (ctx->ACCA >= 0 && ctx->ACCB >= 0) {
+      uint16_t tmp = ctx->ACCA * ctx->ACCB;
+      ctx->ACCA = (tmp >> 8) & 0xff;
+      ctx->ACCB = tmp & 0xff;
+      ctx->Z = (tmp == 0);
+      ctx->C = (ctx->ACCB >> 7) & 1;
    } else {
-      ACCA = -1;
-      ACCB = -1;
-      Z = -1;
-      C = -1;
+      ctx->ACCA = -1;
+      ctx->ACCB = -1;
+      ctx->Z = -1;
+      ctx->C = -1;
    }
    return -1;
 }
 
-static int op_fn_NEG(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return neg_helper(operand);
+static int op_fn_NEG(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return neg_helper(ctx, operand);
 }
 
-static int op_fn_NEGA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = neg_helper(ACCA);
+static int op_fn_NEGA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = neg_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_NEGB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = neg_helper(ACCB);
+static int op_fn_NEGB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = neg_helper(ctx, ctx->ACCB);
    return -1;
 }
 
-static int op_fn_NOP(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_NOP(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    return -1;
 }
 
-static int op_fn_ORA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = or_helper(ACCA, operand);
+static int op_fn_ORA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = or_helper(ctx, ctx->ACCA, operand);
    return -1;
 }
 
-static int op_fn_ORB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = or_helper(ACCB, operand);
+static int op_fn_ORB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = or_helper(ctx, ctx->ACCB, operand);
    return -1;
 }
 
-static int op_fn_ORCC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_ORCC(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    if (operand & 0x80) {
-      E = 1;
+      ctx->E = 1;
    }
    if (operand & 0x40) {
-      F = 1;
+      ctx->F = 1;
    }
    if (operand & 0x20) {
-      H = 1;
+      ctx->H = 1;
    }
    if (operand & 0x10) {
-      I = 1;
+      ctx->I = 1;
    }
    if (operand & 0x08) {
-      N = 1;
+      ctx->N = 1;
    }
    if (operand & 0x04) {
-      Z = 1;
+      ctx->Z = 1;
    }
    if (operand & 0x02) {
-      V = 1;
+      ctx->V = 1;
    }
    if (operand & 0x01) {
-      C = 1;
+      ctx->C = 1;
    }
    return -1;
 }
 
-static int op_fn_PSHS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   push_helper(sample_q, 1); // 1 = PSHS
+static int op_fn_PSHS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   push_helper(ctx, sample_q, 1); // 1 = PSHS
    return -1;
 }
 
-static int op_fn_PSHU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   push_helper(sample_q, 0); // 0 = PSHU
+static int op_fn_PSHU(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   push_helper(ctx, sample_q, 0); // 0 = PSHU
    return -1;
 }
-static int op_fn_PULS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   pull_helper(sample_q, 1); // 1 = PULS
+static int op_fn_PULS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   pull_helper(ctx, sample_q, 1); // 1 = PULS
    return -1;
 }
 
-static int op_fn_PULU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   pull_helper(sample_q, 0); // 0 = PULU
+static int op_fn_PULU(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   pull_helper(ctx, sample_q, 0); // 0 = PULU
    return -1;
 }
 
-static int op_fn_ROL(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return rol_helper(operand);
+static int op_fn_ROL(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return rol_helper(ctx, operand);
 }
 
-static int op_fn_ROLA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = rol_helper(ACCA);
+static int op_fn_ROLA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = rol_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_ROLB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = rol_helper(ACCB);
+static int op_fn_ROLB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = rol_helper(ctx, ctx->ACCB);
    return -1;
 }
 
-static int op_fn_ROR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return ror_helper(operand);
+static int op_fn_ROR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return ror_helper(ctx, operand);
 }
 
-static int op_fn_RORA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = ror_helper(ACCA);
+static int op_fn_RORA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = ror_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_RORB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = ror_helper(ACCB);
+static int op_fn_RORB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = ror_helper(ctx, ctx->ACCB);
    return -1;
 }
 
-static int op_fn_RTI(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_RTI(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // E = 0
    //   0 Opcode
    //   1 ---
@@ -3395,147 +3708,147 @@ static int op_fn_RTI(operand_t operand, ea_t ea, sample_q_t *sample_q) {
    int i = 2;
 
    // Do the flags first, as the stacked E indicates how much to restore
-   set_FLAGS(sample[i++].data);
+   set_FLAGS(ctx, sample[i++].data);
 
    // Update the register state
-   if (E == 1) {
-      ACCA = sample[i++].data;
-      ACCB = sample[i++].data;
-      if (NM == 1) {
-         ACCE = sample[i++].data;
-         ACCF = sample[i++].data;
+   if (ctx->E == 1) {
+      ctx->ACCA = sample[i++].data;
+      ctx->ACCB = sample[i++].data;
+      if (ctx->NM == 1) {
+         ctx->ACCE = sample[i++].data;
+         ctx->ACCF = sample[i++].data;
       }
-      DP = sample[i++].data;
-      X  = sample[i++].data << 8;
-      X |= sample[i++].data;
-      Y  = sample[i++].data << 8;
-      Y |= sample[i++].data;
-      U  = sample[i++].data << 8;
-      U |= sample[i++].data;
+      ctx->DP = sample[i++].data;
+      ctx->X  = sample[i++].data << 8;
+      ctx->X |= sample[i++].data;
+      ctx->Y  = sample[i++].data << 8;
+      ctx->Y |= sample[i++].data;
+      ctx->U  = sample[i++].data << 8;
+      ctx->U |= sample[i++].data;
       // RTI takes 9 additional cycles if E = 1 (and two more if in native mode)
-      sample_q->num_cycles += (NM == 1) ? 11 : 9;
+      sample_q->num_cycles += (ctx->NM == 1) ? 11 : 9;
    }
-   PC  = sample[i++].data << 8;
-   PC |= sample[i++].data;
+   ctx->PC  = sample[i++].data << 8;
+   ctx->PC |= sample[i++].data;
 
    // Memory modelling
    for (int j = 2; j < i; j++) {
-      pop8s(sample + j);
+      pop8s(ctx, sample + j);
    }
    return -1;
 }
 
-static int op_fn_RTS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_RTS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    sample_t *sample = sample_q->sample + sample_q->oi;
-   PC = pop16s(sample + 2);
+   ctx->PC = pop16s(ctx, sample + 2);
    return -1;
 }
 
-static int op_fn_SBCA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = sub_helper(ACCA, C, operand);
+static int op_fn_SBCA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = sub_helper(ctx, ctx->ACCA, ctx->C, operand);
    return -1;
 }
 
-static int op_fn_SBCB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = sub_helper(ACCB, C, operand);
+static int op_fn_SBCB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = sub_helper(ctx, ctx->ACCB, ctx->C, operand);
    return -1;
 }
 
-static int op_fn_SEX(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   if (ACCB >= 0) {
-      if (ACCB & 0x80) {
-         ACCA = 0xff;
+static int op_fn_SEX(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   if (ctx->ACCB >= 0) {
+      if (ctx->ACCB & 0x80) {
+         ctx->ACCA = 0xff;
       } else {
-         ACCA = 0x00;
+         ctx->ACCA = 0x00;
       }
-      set_NZ(ACCB);
+      set_NZ(ctx, ctx->ACCB);
    } else {
-      ACCA = -1;
-      set_NZ_unknown();
+      ctx->ACCA = -1;
+      set_NZ_unknown(ctx);
    }
    // Tests show V is not cleared (contrary to some documentation)
    return -1;
 }
 
-static int op_fn_STA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = st_helper(ACCA, operand, FAIL_ACCA);
+static int op_fn_STA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = st_helper(ctx, ctx->ACCA, operand, FAIL_ACCA);
    return operand;
 }
 
-static int op_fn_STB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = st_helper(ACCB, operand, FAIL_ACCB);
+static int op_fn_STB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = st_helper(ctx, ctx->ACCB, operand, FAIL_ACCB);
    return operand;
 }
 
-static int op_fn_STD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_STD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // Do a bit more work here to correctly set the failute code
    int fail = 0;
-   if (ACCA >= 0 && ACCA != ((operand >> 8) & 0xff)) {
+   if (ctx->ACCA >= 0 && ctx->ACCA != ((operand >> 8) & 0xff)) {
       fail |= FAIL_ACCA;
    }
-   if (ACCB >= 0 && ACCB != (operand & 0xff)) {
+   if (ctx->ACCB >= 0 && ctx->ACCB != (operand & 0xff)) {
       fail |= FAIL_ACCB;
    }
-   int D = pack(ACCA, ACCB);
-   D = st16_helper(D, operand, fail);
-   unpack(D, &ACCA, &ACCB);
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = st16_helper(ctx, D, operand, fail);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return operand;
 }
 
-static int op_fn_STS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   S = st16_helper(S, operand, FAIL_S);
+static int op_fn_STS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->S = st16_helper(ctx, ctx->S, operand, FAIL_S);
    return operand;
 }
 
-static int op_fn_STU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   U = st16_helper(U, operand, FAIL_U);
+static int op_fn_STU(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->U = st16_helper(ctx, ctx->U, operand, FAIL_U);
    return operand;
 }
 
-static int op_fn_STX(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   X = st16_helper(X, operand, FAIL_X);
+static int op_fn_STX(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->X = st16_helper(ctx, ctx->X, operand, FAIL_X);
    return operand;
 }
 
-static int op_fn_STY(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   Y = st16_helper(Y, operand, FAIL_Y);
+static int op_fn_STY(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->Y = st16_helper(ctx, ctx->Y, operand, FAIL_Y);
    return operand;
 }
 
-static int op_fn_SUBA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = sub_helper(ACCA, 0, operand);
+static int op_fn_SUBA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = sub_helper(ctx, ctx->ACCA, 0, operand);
    return -1;
 }
 
-static int op_fn_SUBB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = sub_helper(ACCB, 0, operand);
+static int op_fn_SUBB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = sub_helper(ctx, ctx->ACCB, 0, operand);
    return -1;
 }
 
-static int op_fn_SUBD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = sub16_helper(D, 0, operand);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_SUBD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = sub16_helper(ctx, D, 0, operand);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
 
-static int op_fn_SWI(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   interrupt_helper(sample_q, 3, 1, VEC_SWI);
+static int op_fn_SWI(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   interrupt_helper(ctx, sample_q, 3, 1, VEC_SWI);
    return -1;
 }
 
-static int op_fn_SWI2(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   interrupt_helper(sample_q, 3, 1, VEC_SWI2);
+static int op_fn_SWI2(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   interrupt_helper(ctx, sample_q, 3, 1, VEC_SWI2);
    return -1;
 }
 
-static int op_fn_SWI3(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   interrupt_helper(sample_q, 3, 1, VEC_SWI3);
+static int op_fn_SWI3(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   interrupt_helper(ctx, sample_q, 3, 1, VEC_SWI3);
    return -1;
 }
 
-static int op_fn_SYNC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_SYNC(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // SYNC, look ahead for sync acknowledge
    sample_t *sample = sample_q->sample;
    int num_samples = sample_q->num_samples;
@@ -3554,32 +3867,32 @@ static int op_fn_SYNC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 }
 
 // Operand is the postbyte
-static int op_fn_TFR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_TFR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    int reg1 = (operand >> 4) & 15;
    int reg2 = operand  & 15;
-   set_regp(reg2, get_regp(reg1));
+   set_regp(ctx, reg2, get_regp(ctx, reg1));
    return -1;
 }
 
-static int op_fn_TST(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_NZ(operand);
-   V = 0;
+static int op_fn_TST(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_NZ(ctx, operand);
+   ctx->V = 0;
    return -1;
 }
 
-static int op_fn_TSTA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_NZ(ACCA);
-   V = 0;
+static int op_fn_TSTA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_NZ(ctx, ctx->ACCA);
+   ctx->V = 0;
    return -1;
 }
 
-static int op_fn_TSTB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_NZ(ACCB);
-   V = 0;
+static int op_fn_TSTB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_NZ(ctx, ctx->ACCB);
+   ctx->V = 0;
    return -1;
 }
 
-static int op_fn_UU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_UU(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    return -1;
 }
 
@@ -3590,7 +3903,7 @@ static int op_fn_UU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 // Much of the information on the undocumented instructions comes from here:
 // https://colorcomputerarchive.com/repo/Documents/Books/Motorola%206809%20and%20Hitachi%206309%20Programming%20Reference%20(Darren%20Atkinson).pdf
 
-static int op_fn_XX(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_XX(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    return -1;
 }
 
@@ -3598,17 +3911,17 @@ static int op_fn_XX(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 // Carry bit in CC is 0, and as a COM instruction when the Carry bit
 // is 1
 
-static int op_fn_XNC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return xnc_helper(operand);
+static int op_fn_XNC(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return xnc_helper(ctx, operand);
 }
 
-static int op_fn_XNCA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = xnc_helper(ACCA);
+static int op_fn_XNCA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = xnc_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_XNCB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = xnc_helper(ACCB);
+static int op_fn_XNCB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = xnc_helper(ctx, ctx->ACCB);
    return -1;
 }
 
@@ -3618,18 +3931,18 @@ static int op_fn_XNCB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 // test purposes. Its causes the CPU to halt execution and enter a
 // mode in which the Address lines are incrementally strobed.
 
-static int op_fn_XHCF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_XHCF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    sample_t *samples = sample_q->sample;
    // Ignore the opcode
    int i = sample_q->oi + 1;
-   if (PC >= 0) {
+   if (ctx->PC >= 0) {
       // Set back the PC to the start of the instruction, so HCF re-executes
-      PC = (PC - i) & 0xffff;
+      ctx->PC = (ctx->PC - i) & 0xffff;
    }
    // Read 64K - i bytes starting at PC + i
    while (i < 0x10000) {
-      int addr = (PC >= 0) ? ((PC + i) & 0xffff) : -1;
-      memory_read(samples + i, addr, MEM_DATA);
+      int addr = (ctx->PC >= 0) ? ((ctx->PC + i) & 0xffff) : -1;
+      mem_read(ctx, samples + i, addr, MEM_DATA);
       i++;
    }
    // Force the number of cycles to 64K
@@ -3658,100 +3971,100 @@ static int op_fn_XHCF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 //
 // Execution of this opcode takes 3 MPU cycles.
 
-static int op_fn_X18(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_X18(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    uint8_t b = (sample_q->sample + sample_q->oi + 1)->data;
-   int tmp1 = (b & 0x01) ? C : 0;
-   int tmp2 = (b & 0x04) ? Z : 0;
-   E = (b & 0x40) ? F : 0; // Bit 7
-   F = (b & 0x20) ? H : 0;
-   H = (b & 0x10) ? I : 0;
-   I = (b & 0x08) ? N : 0;
-   N = (b & 0x04) ? Z : 0;
-   Z = (b & 0x02) ? V : 0;
-   V = (tmp1 == 1 || tmp2 == 1) ? 1 : (tmp1 == 0 && tmp2 == 0) ? 0 : -1;
-   C = 0;                  // Bit 0
+   int tmp1 = (b & 0x01) ? ctx->C : 0;
+   int tmp2 = (b & 0x04) ? ctx->Z : 0;
+   ctx->E = (b & 0x40) ? ctx->F : 0; // Bit 7
+   ctx->F = (b & 0x20) ? ctx->H : 0;
+   ctx->H = (b & 0x10) ? ctx->I : 0;
+   ctx->I = (b & 0x08) ? ctx->N : 0;
+   ctx->N = (b & 0x04) ? ctx->Z : 0;
+   ctx->Z = (b & 0x02) ? ctx->V : 0;
+   ctx->V = (tmp1 == 1 || tmp2 == 1) ? 1 : (tmp1 == 0 && tmp2 == 0) ? 0 : -1;
+   ctx->C = 0;                  // Bit 0
    return -1;
 }
 
-static void set_storeimm_flags_lea(int r) {
+static void set_storeimm_flags_lea(em6809_ctx_t *ctx, int r) {
    if (r < 0) {
-      set_NZV_unknown();
+      set_NZV_unknown(ctx);
    } else {
       r = (r | (r >> 8)) & 0xff;
-      set_NZ((r - 1) & 0xFF);
-      V = (r == 0x80);
+      set_NZ(ctx, (r - 1) & 0xFF);
+      ctx->V = (r == 0x80);
    }
 }
 
-static void set_storeimm_flags(int op0) {
+static void set_storeimm_flags(em6809_ctx_t *ctx, int op0) {
    // V is 0, with a few exceptions
-   V = 0;
+   ctx->V = 0;
    if (op0 == 0x10 || op0 == 0x11) {
       // If there is a prefix, the behaviour is as expected
-      N = 1;
-      Z = 0;
+      ctx->N = 1;
+      ctx->Z = 0;
    } else {
       // If there is no prefix, then  the flags depend on the previous instruction
-      switch (storeimm) {
+      switch (ctx->storeimm) {
       case GRP_DEFAULT:
-         N = 1;
-         Z = 0;
+         ctx->N = 1;
+         ctx->Z = 0;
          break;
       case GRP_N0_Z1:
-         N = 0;
-         Z = 1;
+         ctx->N = 0;
+         ctx->Z = 1;
          break;
       case GRP_A_00:
-         if (ACCA < 0) {
-            set_NZ_unknown();
+         if (ctx->ACCA < 0) {
+            set_NZ_unknown(ctx);
          } else {
-            set_NZ(ACCA);
+            set_NZ(ctx, ctx->ACCA);
          }
          break;
       case GRP_A_FF:
-         if (ACCA < 0) {
-            set_NZ_unknown();
+         if (ctx->ACCA < 0) {
+            set_NZ_unknown(ctx);
          } else {
-            Z = (ACCA == 0xFF);
-            N = (ACCA < 0x80);
+            ctx->Z = (ctx->ACCA == 0xFF);
+            ctx->N = (ctx->ACCA < 0x80);
          }
          break;
       case GRP_A_01:
-         if (ACCA < 0) {
-            set_NZV_unknown();
+         if (ctx->ACCA < 0) {
+            set_NZV_unknown(ctx);
          } else {
-            set_NZ((ACCA - 1) & 0xFF);
-            V = (ACCA == 0x80);
+            set_NZ(ctx, (ctx->ACCA - 1) & 0xFF);
+            ctx->V = (ctx->ACCA == 0x80);
          }
          break;
       case GRP_B_01:
-         if (ACCB < 0) {
-            set_NZV_unknown();
+         if (ctx->ACCB < 0) {
+            set_NZV_unknown(ctx);
          } else {
-            set_NZ((ACCB - 1) & 0xFF);
-            V = (ACCB == 0x80);
+            set_NZ(ctx, (ctx->ACCB - 1) & 0xFF);
+            ctx->V = (ctx->ACCB == 0x80);
          }
          break;
       case GRP_R16_01:
-         if (last_res16 < 0) {
-            set_NZV_unknown();
+         if (ctx->last_res16 < 0) {
+            set_NZV_unknown(ctx);
          } else {
-            int tmp = last_res16 >> 8;
-            set_NZ((tmp - 1) & 0xFF);
-            V = (tmp == 0x80);
+            int tmp = ctx->last_res16 >> 8;
+            set_NZ(ctx, (tmp - 1) & 0xFF);
+            ctx->V = (tmp == 0x80);
          }
          break;
       case GRP_LEAU:
-         set_storeimm_flags_lea(U);
+         set_storeimm_flags_lea(ctx, ctx->U);
          break;
       case GRP_LEAS:
-         set_storeimm_flags_lea(S);
+         set_storeimm_flags_lea(ctx, ctx->S);
          break;
       case GRP_LEAX:
-         set_storeimm_flags_lea(X);
+         set_storeimm_flags_lea(ctx, ctx->X);
          break;
       case GRP_LEAY:
-         set_storeimm_flags_lea(Y);
+         set_storeimm_flags_lea(ctx, ctx->Y);
          break;
       }
    }
@@ -3772,13 +4085,13 @@ static void set_storeimm_flags(int op0) {
 // DMB: $10 $3E invokes the SWI2 trap (so is the same as SWI2)
 //      $11 $3e invokes the FIQ trap
 
-static int op_fn_XRES(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   interrupt_helper(sample_q, 3, 1, VEC_XRST);
+static int op_fn_XRES(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   interrupt_helper(ctx, sample_q, 3, 1, VEC_XRST);
    return -1;
 }
 
-static int op_fn_XFIQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   interrupt_helper(sample_q, 3, 1, VEC_FIQ);
+static int op_fn_XFIQ(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   interrupt_helper(ctx, sample_q, 3, 1, VEC_FIQ);
    return -1;
 }
 
@@ -3791,13 +4104,13 @@ static int op_fn_XFIQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 //
 // Each ofthese opcodes execute in 2 MPU cycles.
 
-static int op_fn_X87(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_storeimm_flags(sample_q->sample->data);
+static int op_fn_X87(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_storeimm_flags(ctx, sample_q->sample->data);
    return -1;
 }
 
-static int op_fn_XC7(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_storeimm_flags(sample_q->sample->data);
+static int op_fn_XC7(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_storeimm_flags(ctx, sample_q->sample->data);
    return -1;
 }
 
@@ -3813,22 +4126,22 @@ static int op_fn_XC7(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 //
 // Each of these opcodes execute in 3 MPU cycles.
 
-static int op_fn_XSTX(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_storeimm_flags(sample_q->sample->data);
-   if (X & 0xff) {
-      Z = 0;
+static int op_fn_XSTX(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_storeimm_flags(ctx, sample_q->sample->data);
+   if (ctx->X & 0xff) {
+      ctx->Z = 0;
    }
-   V = 0;
-   return X & 0xff;
+   ctx->V = 0;
+   return ctx->X & 0xff;
 }
 
-static int op_fn_XSTU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_storeimm_flags(sample_q->sample->data);
-   if (U & 0xff) {
-      Z = 0;
+static int op_fn_XSTU(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_storeimm_flags(ctx, sample_q->sample->data);
+   if (ctx->U & 0xff) {
+      ctx->Z = 0;
    }
-   V = 0;
-   return U & 0xff;
+   ctx->V = 0;
+   return ctx->U & 0xff;
 }
 
 // Opcodes $108F and $10CF are STY Immediate and STS Immediate
@@ -3842,55 +4155,55 @@ static int op_fn_XSTU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 //
 // Each of these opcodes execute in 3 MPU cycles.
 
-static int op_fn_XSTS(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_XSTS(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // There is a prefix, so no complex flag behaviour
-   N = 1;
-   Z = 0;
-   V = 0;
-   return S & 0xff;
+   ctx->N = 1;
+   ctx->Z = 0;
+   ctx->V = 0;
+   return ctx->S & 0xff;
 }
 
-static int op_fn_XSTY(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_XSTY(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // There is a prefix, so no complex flag behaviour
-   N = 1;
-   Z = 0;
-   V = 0;
-   return Y & 0xff;
+   ctx->N = 1;
+   ctx->Z = 0;
+   ctx->V = 0;
+   return ctx->Y & 0xff;
 }
 
-static int op_fn_XCLRA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = xclr_helper(ACCA);
+static int op_fn_XCLRA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = xclr_helper(ctx);
    return -1;
 }
 
-static int op_fn_XCLRB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = xclr_helper(ACCB);
+static int op_fn_XCLRB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = xclr_helper(ctx);
    return -1;
 }
 
-static int op_fn_XDEC(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   return xdec_helper(operand);
+static int op_fn_XDEC(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   return xdec_helper(ctx, operand);
 }
 
-static int op_fn_XDECA(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = xdec_helper(ACCA);
+static int op_fn_XDECA(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = xdec_helper(ctx, ctx->ACCA);
    return -1;
 }
 
-static int op_fn_XDECB(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCB = xdec_helper(ACCB);
+static int op_fn_XDECB(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCB = xdec_helper(ctx, ctx->ACCB);
    return -1;
 }
 
-static int op_fn_XADDD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   add16_helper(pack(ACCA, ACCB), 0, operand);
+static int op_fn_XADDD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   add16_helper(ctx, pack(ctx->ACCA, ctx->ACCB), 0, operand);
    return -1;
 }
 
-static int op_fn_XADDU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_XADDU(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // This one took some figuring out!
-   int tmpU = (U >= 0) ? (U | 0xff00) : -1;
-   add16_helper(tmpU, 0, operand);
+   int tmpU = (ctx->U >= 0) ? (ctx->U | 0xff00) : -1;
+   add16_helper(ctx, tmpU, 0, operand);
    return -1;
 }
 
@@ -3901,8 +4214,8 @@ static int op_fn_XADDU(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 
 // The value of the PC seen in the register addressing is one cycle
 // ahead due to pipelining (even in emulation mode)
-static inline int get_r_pc() {
-   return PC < 0 ? -1 : (PC + 1) & 0xFFFF;
+static inline int get_r_pc(em6809_ctx_t *ctx) {
+   return ctx->PC < 0 ? -1 : (ctx->PC + 1) & 0xFFFF;
 }
 
 // Used in ADCR/ADDR/ANDR/CMPR/EORR/ORRR/SBCR/SUBR on the 6309 only
@@ -3913,7 +4226,7 @@ static inline int get_r_pc() {
 // These rules are different to EXN/TRF
 
 // r0 is the right operand
-static int get_r0(int pb) {
+static int get_r0(em6809_ctx_t *ctx, int pb) {
    int ret;
    int src = (pb >> 4) & 0xf;
    int dst = pb & 0xf;
@@ -3921,42 +4234,42 @@ static int get_r0(int pb) {
       // dst is 8 bits
       switch(src) {
          // src is 16 bits, demote to 8 bits
-      case  0: ret = ACCB;                        break;
-      case  1: ret = ( X < 0) ? -1 : ( X & 0xff); break;
-      case  2: ret = ( Y < 0) ? -1 : ( Y & 0xff); break;
-      case  3: ret = ( U < 0) ? -1 : ( U & 0xff); break;
-      case  4: ret = ( S < 0) ? -1 : ( S & 0xff); break;
-      case  5: ret = get_r_pc() & 0xff;           break;
-      case  6: ret = ACCF;                        break;
-      case  7: ret = (TV < 0) ? -1 : (TV & 0xff); break;
+      case  0: ret = ctx->ACCB;                        break;
+      case  1: ret = ( ctx->X < 0) ? -1 : ( ctx->X & 0xff); break;
+      case  2: ret = ( ctx->Y < 0) ? -1 : ( ctx->Y & 0xff); break;
+      case  3: ret = ( ctx->U < 0) ? -1 : ( ctx->U & 0xff); break;
+      case  4: ret = ( ctx->S < 0) ? -1 : ( ctx->S & 0xff); break;
+      case  5: ret = get_r_pc(ctx) & 0xff;           break;
+      case  6: ret = ctx->ACCF;                        break;
+      case  7: ret = (ctx->TV < 0) ? -1 : (ctx->TV & 0xff); break;
          // src is 8 bits
-      case  8: ret = ACCA;                        break;
-      case  9: ret = ACCB;                        break;
-      case 10: ret = get_FLAGS();                 break;
-      case 11: ret = DP;                          break;
-      case 14: ret = ACCE;                        break;
-      case 15: ret = ACCF;                        break;
+      case  8: ret = ctx->ACCA;                        break;
+      case  9: ret = ctx->ACCB;                        break;
+      case 10: ret = get_FLAGS(ctx);                 break;
+      case 11: ret = ctx->DP;                          break;
+      case 14: ret = ctx->ACCE;                        break;
+      case 15: ret = ctx->ACCF;                        break;
       default: ret = 0;
       }
    } else {
       // dst is 16 bits
       switch(src) {
          // src is 16 bits
-      case  0: ret = pack(ACCA, ACCB);            break;
-      case  1: ret = X;                           break;
-      case  2: ret = Y;                           break;
-      case  3: ret = U;                           break;
-      case  4: ret = S;                           break;
-      case  5: ret = get_r_pc();                  break;
-      case  6: ret = pack(ACCE, ACCF);            break;
-      case  7: ret = TV;                          break;
+      case  0: ret = pack(ctx->ACCA, ctx->ACCB);            break;
+      case  1: ret = ctx->X;                           break;
+      case  2: ret = ctx->Y;                           break;
+      case  3: ret = ctx->U;                           break;
+      case  4: ret = ctx->S;                           break;
+      case  5: ret = get_r_pc(ctx);                  break;
+      case  6: ret = pack(ctx->ACCE, ctx->ACCF);            break;
+      case  7: ret = ctx->TV;                          break;
          // src is 8 bits, promote to 16 bits
-      case  8: ret = pack(ACCA, ACCB);            break;
-      case  9: ret = pack(ACCA, ACCB);            break;
-      case 10: ret = get_FLAGS();                 break;
-      case 11: ret = pack(DP, M);                 break;
-      case 14: ret = pack(ACCE, ACCF);            break;
-      case 15: ret = pack(ACCE, ACCF);            break;
+      case  8: ret = pack(ctx->ACCA, ctx->ACCB);            break;
+      case  9: ret = pack(ctx->ACCA, ctx->ACCB);            break;
+      case 10: ret = get_FLAGS(ctx);                 break;
+      case 11: ret = pack(ctx->DP, ctx->M);                 break;
+      case 14: ret = pack(ctx->ACCE, ctx->ACCF);            break;
+      case 15: ret = pack(ctx->ACCE, ctx->ACCF);            break;
       default: ret = 0;
       }
    }
@@ -3964,24 +4277,24 @@ static int get_r0(int pb) {
 }
 
 // r1 is the left operand
-static int get_r1(int pb) {
+static int get_r1(em6809_ctx_t *ctx, int pb) {
    int ret;
    int dst = pb & 0xf;
    switch(dst) {
-   case  0: ret = pack(ACCA, ACCB);            break;
-   case  1: ret = X;                           break;
-   case  2: ret = Y;                           break;
-   case  3: ret = U;                           break;
-   case  4: ret = S;                           break;
-   case  5: ret = get_r_pc();                  break;
-   case  6: ret = pack(ACCE, ACCF);            break;
-   case  7: ret = TV;                          break;
-   case  8: ret = ACCA;                        break;
-   case  9: ret = ACCB;                        break;
-   case 10: ret = get_FLAGS();                 break;
-   case 11: ret = DP;                          break;
-   case 14: ret = ACCE;                        break;
-   case 15: ret = ACCF;                        break;
+   case  0: ret = pack(ctx->ACCA, ctx->ACCB);            break;
+   case  1: ret = ctx->X;                           break;
+   case  2: ret = ctx->Y;                           break;
+   case  3: ret = ctx->U;                           break;
+   case  4: ret = ctx->S;                           break;
+   case  5: ret = get_r_pc(ctx);                  break;
+   case  6: ret = pack(ctx->ACCE, ctx->ACCF);            break;
+   case  7: ret = ctx->TV;                          break;
+   case  8: ret = ctx->ACCA;                        break;
+   case  9: ret = ctx->ACCB;                        break;
+   case 10: ret = get_FLAGS(ctx);                 break;
+   case 11: ret = ctx->DP;                          break;
+   case 14: ret = ctx->ACCE;                        break;
+   case 15: ret = ctx->ACCF;                        break;
    default: ret = 0;
    }
    return ret;
@@ -3992,72 +4305,72 @@ static int get_r1(int pb) {
 // The register addressing mode instructions cannot safely write to
 // the PC. What seem to happen in practice is the PC is updated on the
 // 2nd byte of the next instruction.
-static void set_r1(int pb, int val) {
+static void set_r1(em6809_ctx_t *ctx, int pb, int val) {
    int dst = pb & 0xf;
    switch(dst) {
-   case  0: unpack(val, &ACCA, &ACCB);   break;
-   case  1: X  = val;                    break;
-   case  2: Y  = val;                    break;
-   case  3: U  = val;                    break;
-   case  4: S  = val;                    break;
-   case  5: PC = -1; async_pc_write = 1; break;
-   case  6: unpack(val, &ACCE, &ACCF);   break;
-   case  7: TV = val;                    break;
-   case  8: ACCA = val;                  break;
-   case  9: ACCB = val;                  break;
-   case 10: set_FLAGS(val);              break;
-   case 11: DP = val;                    break;
-   case 14: ACCE = val;                  break;
-   case 15: ACCF = val;                  break;
-   }
-}
-
-static void set_Arithmetic_R_result(operand_t operand, int result) {
+   case  0: unpack(val, &ctx->ACCA, &ctx->ACCB);   break;
+   case  1: ctx->X  = val;                    break;
+   case  2: ctx->Y  = val;                    break;
+   case  3: ctx->U  = val;                    break;
+   case  4: ctx->S  = val;                    break;
+   case  5: ctx->PC = -1; ctx->async_pc_write = 1; break;
+   case  6: unpack(val, &ctx->ACCE, &ctx->ACCF);   break;
+   case  7: ctx->TV = val;                    break;
+   case  8: ctx->ACCA = val;                  break;
+   case  9: ctx->ACCB = val;                  break;
+   case 10: set_FLAGS(ctx, val);              break;
+   case 11: ctx->DP = val;                    break;
+   case 14: ctx->ACCE = val;                  break;
+   case 15: ctx->ACCF = val;                  break;
+   }
+}
+
+static void set_Arithmetic_R_result(em6809_ctx_t *ctx, operand_t operand, int result) {
    // See page 143 of Atkinson
-   int tmpC = C;
-   int tmpN = N;
-   int tmpV = V;
-   int tmpZ = Z;
-   C = 0;
-   N = 0;
-   V = 0;
-   Z = 0;
-   set_r1(operand, result);
+   int tmpC = ctx->C;
+   int tmpN = ctx->N;
+   int tmpV = ctx->V;
+   int tmpZ = ctx->Z;
+   ctx->C = 0;
+   ctx->N = 0;
+   ctx->V = 0;
+   ctx->Z = 0;
+   set_r1(ctx, operand, result);
    if (tmpC == 1) {
-      C = 1;
+      ctx->C = 1;
    }
    if (tmpN == 1) {
-      N = 1;
+      ctx->N = 1;
    }
    if (tmpV == 1) {
-      V = 1;
+      ctx->V = 1;
    }
    if (tmpZ == 1) {
-      Z = 1;
+      ctx->Z = 1;
    }
 }
 
-static void set_Logical_R_result(operand_t operand, int result) {
+static void set_Logical_R_result(em6809_ctx_t *ctx, operand_t operand, int result) {
    // See page 143 of Atkinson
-   int tmpN = N;
-   int tmpV = V;
-   int tmpZ = Z;
-   N = 0;
-   V = 0;
-   Z = 0;
-   set_r1(operand, result);
+   int tmpN = ctx->N;
+   int tmpV = ctx->V;
+   int tmpZ = ctx->Z;
+   ctx->N = 0;
+   ctx->V = 0;
+   ctx->Z = 0;
+   set_r1(ctx, operand, result);
    if (tmpN == 1) {
-      N = 1;
+      ctx->N = 1;
    }
    if (tmpV == 1) {
-      V = 1;
+      ctx->V = 1;
    }
    if (tmpZ == 1) {
-      Z = 1;
+      ctx->Z = 1;
    }
 }
 
-static void directbit_helper(operand_t operand, sample_q_t *sample_q) {
+static void directbit_helper(em6809_ctx_t *ctx, operand_t operand, sample_q_t *sample_q) {
    // Pickout the opcode and the postbyte from the samples
    sample_t *sample = sample_q->sample + sample_q->oi;
    int opcode = sample[0].data;
@@ -4068,7 +4381,7 @@ static void directbit_helper(operand_t operand, sample_q_t *sample_q) {
 
    // A destination regnum of 3 is (as far as we know) a NOP
    if (reg_num == 3) {
-      failflag |= FAIL_UNDOC;
+      ctx->failflag |= FAIL_UNDOC;
       return;
    }
 
@@ -4081,9 +4394,9 @@ static void directbit_helper(operand_t operand, sample_q_t *sample_q) {
    // Extract register bit, which can be 0, 1 or -1
    int reg_bit;
    switch (reg_num) {
-   case 0: reg_bit = get_FLAG(reg_bitnum);                       break;
-   case 1: reg_bit = (ACCA < 0) ? -1 : (ACCA >> reg_bitnum) & 1; break;
-   case 2: reg_bit = (ACCB < 0) ? -1 : (ACCB >> reg_bitnum) & 1; break;
+   case 0: reg_bit = get_FLAG(ctx, reg_bitnum);                       break;
+   case 1: reg_bit = (ctx->ACCA < 0) ? -1 : (ctx->ACCA >> reg_bitnum) & 1; break;
+   case 2: reg_bit = (ctx->ACCB < 0) ? -1 : (ctx->ACCB >> reg_bitnum) & 1; break;
    }
 
    // Compute the bit operation, allowing for reg_bit to be unknown
@@ -4134,326 +4447,326 @@ static void directbit_helper(operand_t operand, sample_q_t *sample_q) {
    int reg_mask = 0xff ^ (1 << reg_bitnum);
    switch (reg_num) {
    case 0:
-      set_FLAG(reg_bitnum, reg_bit);
+      set_FLAG(ctx, reg_bitnum, reg_bit);
       break;
    case 1:
       if (reg_bit >= 0) {
-         ACCA = (ACCA & reg_mask) | (reg_bit << reg_bitnum);
+         ctx->ACCA = (ctx->ACCA & reg_mask) | (reg_bit << reg_bitnum);
       } else {
-         ACCA = -1;
+         ctx->ACCA = -1;
       }
       break;
    case 2:
       if (reg_bit >= 0) {
-         ACCB = (ACCB & reg_mask) | (reg_bit << reg_bitnum);
+         ctx->ACCB = (ctx->ACCB & reg_mask) | (reg_bit << reg_bitnum);
       } else {
-         ACCB = -1;
+         ctx->ACCB = -1;
       }
       break;
    }
 }
 
-static void set_q_nz(uint32_t val) {
-   ACCA = (val >> 24) & 0xff;
-   ACCB = (val >> 16) & 0xff;
-   ACCE = (val >>  8) & 0xff;
-   ACCF =  val        & 0xff;
-   N    = (val >> 31) & 1;
+static void set_q_nz(em6809_ctx_t *ctx, uint32_t val) {
+   ctx->ACCA = (val >> 24) & 0xff;
+   ctx->ACCB = (val >> 16) & 0xff;
+   ctx->ACCE = (val >>  8) & 0xff;
+   ctx->ACCF =  val        & 0xff;
+   ctx->N    = (val >> 31) & 1;
    // 6309 bug: Z is set based only on the top 16 bits
-   Z    = (ACCA == 0 && ACCB == 0);
+   ctx->Z    = (ctx->ACCA == 0 && ctx->ACCB == 0);
 }
 
-static void set_q_nz_unknown() {
-   ACCA = -1;
-   ACCB = -1;
-   ACCE = -1;
-   ACCF = -1;
-   N    = -1;
-   Z    = -1;
+static void set_q_nz_unknown(em6809_ctx_t *ctx) {
+   ctx->ACCA = -1;
+   ctx->ACCB = -1;
+   ctx->ACCE = -1;
+   ctx->ACCF = -1;
+   ctx->N    = -1;
+   ctx->Z    = -1;
 }
 
-static void pushw_helper(sample_q_t *sample_q, int system) {
+static void pushw_helper(em6809_ctx_t *ctx, sample_q_t *sample_q, int system) {
    sample_t *sample = sample_q->sample + sample_q->oi;
-   int (*push8)(sample_t *) = system ? push8s : push8u;
-   int f = push8(sample + 3);
-   if (ACCF >= 0 && ACCF != f) {
-      failflag |= FAIL_ACCF;
+   int (*push8)(em6809_ctx_t *, sample_t *) = system ? push8s : push8u;
+   int f = push8(ctx, sample + 3);
+   if (ctx->ACCF >= 0 && ctx->ACCF != f) {
+      ctx->failflag |= FAIL_ACCF;
    }
-   ACCF = f;
-   int e = push8(sample + 4);
-   if (ACCE >= 0 && ACCE != e) {
-      failflag |= FAIL_ACCE;
+   ctx->ACCF = f;
+   int e = push8(ctx, sample + 4);
+   if (ctx->ACCE >= 0 && ctx->ACCE != e) {
+      ctx->failflag |= FAIL_ACCE;
    }
-   ACCE = e;
+   ctx->ACCE = e;
 }
 
-static void pullw_helper(sample_q_t *sample_q, int system) {
+static void pullw_helper(em6809_ctx_t *ctx, sample_q_t *sample_q, int system) {
    sample_t *sample = sample_q->sample + sample_q->oi;
-   int (*pop8)(sample_t *) = system ? pop8s : pop8u;
-   ACCE = pop8(sample + 3);
-   ACCF = pop8(sample + 4);
+   int (*pop8)(em6809_ctx_t *, sample_t *) = system ? pop8s : pop8u;
+   ctx->ACCE = pop8(ctx, sample + 3);
+   ctx->ACCF = pop8(ctx, sample + 4);
 }
 
 // ====================================================================
 // 6309 Instructions
 // ====================================================================
 
-static int op_fn_ADCD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = add16_helper(D, C, operand);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_ADCD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = add16_helper(ctx, D, ctx->C, operand);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_ADCR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_ADCR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // r1 := r1 + r0 + C
-   int r0 = get_r0(operand);
-   int r1 = get_r1(operand);
+   int r0 = get_r0(ctx, operand);
+   int r1 = get_r1(ctx, operand);
    int result;
    // Save H, as it's not affected by ADDR
-   int tmpH = H;
+   int tmpH = ctx->H;
    if ((operand & 0x0f) < 8) {
-      result = add16_helper(r1, C, r0);
+      result = add16_helper(ctx, r1, ctx->C, r0);
    } else {
-      result = add_helper(r1, C, r0);
+      result = add_helper(ctx, r1, ctx->C, r0);
    }
    // Restore H
-   H = tmpH;
-   set_Arithmetic_R_result(operand, result);
+   ctx->H = tmpH;
+   set_Arithmetic_R_result(ctx, operand, result);
    return -1;
 }
 
-static int op_fn_ADDE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCE = add_helper(ACCE, 0, operand);
+static int op_fn_ADDE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCE = add_helper(ctx, ctx->ACCE, 0, operand);
    return -1;
 }
 
-static int op_fn_ADDF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCF = add_helper(ACCF, 0, operand);
+static int op_fn_ADDF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCF = add_helper(ctx, ctx->ACCF, 0, operand);
    return -1;
 }
 
-static int op_fn_ADDR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_ADDR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // r1 := r1 + r0
-   int r0 = get_r0(operand);
-   int r1 = get_r1(operand);
+   int r0 = get_r0(ctx, operand);
+   int r1 = get_r1(ctx, operand);
    int result;
    // Save H, as it's not affected by ADDR
-   int tmpH = H;
+   int tmpH = ctx->H;
    if ((operand & 0x0f) < 8) {
-      result = add16_helper(r1, 0, r0);
+      result = add16_helper(ctx, r1, 0, r0);
    } else {
-      result = add_helper(r1, 0, r0);
+      result = add_helper(ctx, r1, 0, r0);
    }
    // Restore H
-   H = tmpH;
-   set_Arithmetic_R_result(operand, result);
+   ctx->H = tmpH;
+   set_Arithmetic_R_result(ctx, operand, result);
    return -1;
 }
 
-static int op_fn_ADDW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   W = add16_helper(W, 0, operand);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_ADDW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   W = add16_helper(ctx, W, 0, operand);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_AIM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_AIM(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // oi points to the immediate byte
    sample_t *sample = sample_q->sample + sample_q->oi;
-   return and_helper(operand, sample->data);
+   return and_helper(ctx, operand, sample->data);
 }
 
-static int op_fn_ANDD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = and16_helper(D, operand);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_ANDD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = and16_helper(ctx, D, operand);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_ANDR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_ANDR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // r1 := r1 & r0
-   int r0 = get_r0(operand);
-   int r1 = get_r1(operand);
+   int r0 = get_r0(ctx, operand);
+   int r1 = get_r1(ctx, operand);
    int result;
    if ((operand & 0x0f) < 8) {
-      result = and16_helper(r1, r0);
+      result = and16_helper(ctx, r1, r0);
    } else {
-      result = and_helper(r1, r0);
+      result = and_helper(ctx, r1, r0);
    }
-   set_Logical_R_result(operand, result);
+   set_Logical_R_result(ctx, operand, result);
    return -1;
 }
 
-static int op_fn_ASLD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = asl16_helper(D);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_ASLD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = asl16_helper(ctx, D);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_ASRD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = asr16_helper(D);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_ASRD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = asr16_helper(ctx, D);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_BAND(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   directbit_helper(operand, sample_q);
+static int op_fn_BAND(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   directbit_helper(ctx, operand, sample_q);
    return -1;
 }
 
-static int op_fn_BEOR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   directbit_helper(operand, sample_q);
+static int op_fn_BEOR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   directbit_helper(ctx, operand, sample_q);
    return -1;
 }
 
-static int op_fn_BIAND(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   directbit_helper(operand, sample_q);
+static int op_fn_BIAND(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   directbit_helper(ctx, operand, sample_q);
    return -1;
 }
 
-static int op_fn_BIEOR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   directbit_helper(operand, sample_q);
+static int op_fn_BIEOR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   directbit_helper(ctx, operand, sample_q);
    return -1;
 }
 
-static int op_fn_BIOR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   directbit_helper(operand, sample_q);
+static int op_fn_BIOR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   directbit_helper(ctx, operand, sample_q);
    return -1;
 }
 
-static int op_fn_BITD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   bit16_helper(D, operand);
+static int op_fn_BITD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   bit16_helper(ctx, D, operand);
    return -1;
 }
 
-static int op_fn_BITMD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_BITMD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // M register
-   M = operand;
+   ctx->M = operand;
    int b7 = 0;
    if (operand & 0x80) {
-      b7 = DZ;
-      DZ = 0;
+      b7 = ctx->DZ;
+      ctx->DZ = 0;
    }
    int b6 = 0;
    if (operand & 0x40) {
-      b6 = IL;
-      IL = 0;
+      b6 = ctx->IL;
+      ctx->IL = 0;
    }
    if (b6 == 0 && b7 == 0) {
-      Z = 1;
+      ctx->Z = 1;
    } else if (b6 == 1 || b7 == 1) {
-      Z = 0;
+      ctx->Z = 0;
    } else {
-      Z = -1;
+      ctx->Z = -1;
    }
    return -1;
 }
 
-static int op_fn_BOR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   directbit_helper(operand, sample_q);
+static int op_fn_BOR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   directbit_helper(ctx, operand, sample_q);
    return -1;
 }
 
-static int op_fn_CLRD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCA = ACCB = clr_helper();
+static int op_fn_CLRD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCA = ctx->ACCB = clr_helper(ctx);
    return -1;
 }
 
-static int op_fn_CLRE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCE = clr_helper();
+static int op_fn_CLRE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCE = clr_helper(ctx);
    return -1;
 }
 
-static int op_fn_CLRF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCF = clr_helper();
+static int op_fn_CLRF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCF = clr_helper(ctx);
    return -1;
 }
 
-static int op_fn_CLRW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCE = ACCF = clr_helper();
+static int op_fn_CLRW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCE = ctx->ACCF = clr_helper(ctx);
    return -1;
 }
 
-static int op_fn_CMPE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp_helper(ACCE, operand);
+static int op_fn_CMPE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp_helper(ctx, ctx->ACCE, operand);
    return -1;
 }
 
-static int op_fn_CMPF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp_helper(ACCF, operand);
+static int op_fn_CMPF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp_helper(ctx, ctx->ACCF, operand);
    return -1;
 }
 
-static int op_fn_CMPR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_CMPR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // r1 := r1 & r0
-   int r0 = get_r0(operand);
-   int r1 = get_r1(operand);
+   int r0 = get_r0(ctx, operand);
+   int r1 = get_r1(ctx, operand);
    if ((operand & 0x0f) < 8) {
-      cmp16_helper(r1, r0);
+      cmp16_helper(ctx, r1, r0);
    } else {
-      cmp_helper(r1, r0);
+      cmp_helper(ctx, r1, r0);
    }
    return -1;
 }
 
-static int op_fn_CMPW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   cmp16_helper(pack(ACCE, ACCF), operand);
+static int op_fn_CMPW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   cmp16_helper(ctx, pack(ctx->ACCE, ctx->ACCF), operand);
    return -1;
 }
 
-static int op_fn_COMD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = com16_helper(D);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_COMD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = com16_helper(ctx, D);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_COME(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCE = com_helper(ACCE);
+static int op_fn_COME(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCE = com_helper(ctx, ctx->ACCE);
    return -1;
 }
 
-static int op_fn_COMF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCF = com_helper(ACCF);
+static int op_fn_COMF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCF = com_helper(ctx, ctx->ACCF);
    return -1;
 }
 
-static int op_fn_COMW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   W = com16_helper(W);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_COMW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   W = com16_helper(ctx, W);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_DECD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = dec16_helper(D);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_DECD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = dec16_helper(ctx, D);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_DECE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCE = dec_helper(ACCE);
+static int op_fn_DECE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCE = dec_helper(ctx, ctx->ACCE);
    return -1;
 }
 
-static int op_fn_DECF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCF = dec_helper(ACCF);
+static int op_fn_DECF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCF = dec_helper(ctx, ctx->ACCF);
    return -1;
 }
 
-static int op_fn_DECW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   W = dec16_helper(W);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_DECW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   W = dec16_helper(ctx, W);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_DIVD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_DIVD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // The cycle times vary depending on the values of the dividend and divisor
    //
    // e.g. DIVD &81 in Native mode, with &81 containing &10
@@ -4488,20 +4801,20 @@ static int op_fn_DIVD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 
    if (operand == 0) {
       // It seems Z is set in this case
-      Z = 1;
-      N = 0;
-      V = 0;
+      ctx->Z = 1;
+      ctx->N = 0;
+      ctx->V = 0;
       // Cycle correction
-      if (NM != 1) {
+      if (ctx->NM != 1) {
          cycle_correction -= 2; // 27 to 25
       }
       trap = 1;
-   } else if (ACCA < 0 || ACCB < 0) {
-      ACCA = -1;
-      ACCB = -1;
-      set_NZVC_unknown();
+   } else if (ctx->ACCA < 0 || ctx->ACCB < 0) {
+      ctx->ACCA = -1;
+      ctx->ACCB = -1;
+      set_NZVC_unknown(ctx);
    } else {
-      int a = (ACCA << 8) + ACCB; // 0x0000-0xFFFF
+      int a = (ctx->ACCA << 8) + ctx->ACCB; // 0x0000-0xFFFF
       int b = operand;            // 0x00-0xFF
       // Twos-complement a negative dividend
       if (a >= 0x8000) {
@@ -4523,13 +4836,13 @@ static int op_fn_DIVD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
       int remainder = a % b;
       if (quotient > 255) {
          // A range overflow has occurred
-         V = 1;
-         C = 0;
-         Z = 0;
+         ctx->V = 1;
+         ctx->C = 0;
+         ctx->Z = 0;
          // Undocumented: D = dividend magnitude, N = dividend sign
-         N = signr;
-         ACCA = (a >> 8) & 0xff;
-         ACCB =  a       & 0xff;
+         ctx->N = signr;
+         ctx->ACCA = (a >> 8) & 0xff;
+         ctx->ACCB =  a       & 0xff;
          cycle_correction -= 13;
       } else {
          // Handle the remainder...
@@ -4537,23 +4850,23 @@ static int op_fn_DIVD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
             // The remainer sign correction happens regarless of two-complement overflow
             remainder = 0x100 - remainder;
          }
-         ACCA = remainder & 0xff;
+         ctx->ACCA = remainder & 0xff;
          // Handle the quotient...
-         C = quotient & 1;
+         ctx->C = quotient & 1;
          if (quotient > 127) {
             // A two-complement overflow has occurred, set overflow
-            V = 1;
+            ctx->V = 1;
             cycle_correction -= 1;
          } else {
             // The quotient is valid, clear overflow
-            V = 0;
+            ctx->V = 0;
             // The quotient sign correction only happens in this case
             if (quotient > 0 && signq) {
                quotient = 0x100 - quotient;
             }
          }
-         ACCB = quotient & 0xff;
-         set_NZ(ACCB);
+         ctx->ACCB = quotient & 0xff;
+         set_NZ(ctx, ctx->ACCB);
       }
    }
    // Correct the number of cycles
@@ -4561,14 +4874,14 @@ static int op_fn_DIVD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // Throw a trap if division by zero
    if (trap) {
       // Set bit 0 of the vector to differentiate DZ Trap from IL Trap
-      interrupt_helper(sample_q, sample_q->num_cycles - ((NM == 1) ? 18 : 16) - sample_q->oi, 1, VEC_DZ);
+      interrupt_helper(ctx, sample_q, sample_q->num_cycles - ((ctx->NM == 1) ? 18 : 16) - sample_q->oi, 1, VEC_DZ);
    }
    // M register
-   M = signq ? 0xff : 0x00;
+   ctx->M = signq ? 0xff : 0x00;
    return -1;
 }
 
-static int op_fn_DIVQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_DIVQ(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // The cycle times vary depending on the values of the dividend and divisor
    //
    // The rule for dynamic part of the cycle count seems to be:
@@ -4585,23 +4898,23 @@ static int op_fn_DIVQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 
    if (operand == 0) {
       // It seems Z is set in this case
-      Z = 1;
-      N = 0;
-      V = 0;
-      if (NM == 1) {
+      ctx->Z = 1;
+      ctx->N = 0;
+      ctx->V = 0;
+      if (ctx->NM == 1) {
          cycle_correction -= 8; // 35 to 27
       } else {
          cycle_correction -= 10; // 36 to 26
       }
       trap = 1;
-   } else if (ACCA < 0 || ACCB < 0 || ACCE < 0 || ACCF < 0) {
-      ACCA = -1;
-      ACCB = -1;
-      ACCE = -1;
-      ACCF = -1;
-      set_NZVC_unknown();
+   } else if (ctx->ACCA < 0 || ctx->ACCB < 0 || ctx->ACCE < 0 || ctx->ACCF < 0) {
+      ctx->ACCA = -1;
+      ctx->ACCB = -1;
+      ctx->ACCE = -1;
+      ctx->ACCF = -1;
+      set_NZVC_unknown(ctx);
    } else {
-      uint32_t a = (ACCA << 24) + (ACCB << 16) + (ACCE << 8) + ACCF; // 0x00000000-0xFFFFFFFF
+      uint32_t a = (ctx->ACCA << 24) + (ctx->ACCB << 16) + (ctx->ACCE << 8) + ctx->ACCF; // 0x00000000-0xFFFFFFFF
       uint32_t b = operand; // 0x0000-0xFFFF
       // Twos-complement a negative dividend
       if (a >= 0x80000000) {
@@ -4623,15 +4936,15 @@ static int op_fn_DIVQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
       uint32_t remainder = a % b;
       if (quotient > 65535) {
          // A range overflow has occurred
-         V = 1;
-         C = 0;
-         Z = 0;
+         ctx->V = 1;
+         ctx->C = 0;
+         ctx->Z = 0;
          // Undocumented: D = dividend magnitude, N = dividend sign
-         N = signr;
-         ACCA = (a >> 24) & 0xff;
-         ACCB = (a >> 16) & 0xff;
-         ACCE = (a >>  8) & 0xff;
-         ACCF =  a        & 0xff;
+         ctx->N = signr;
+         ctx->ACCA = (a >> 24) & 0xff;
+         ctx->ACCB = (a >> 16) & 0xff;
+         ctx->ACCE = (a >>  8) & 0xff;
+         ctx->ACCF =  a        & 0xff;
          cycle_correction -= 21;
       } else {
          // Handle the remainder...
@@ -4639,25 +4952,25 @@ static int op_fn_DIVQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
             // The remainer sign correction happens regarless of two-complement overflow
             remainder = 0x10000 - remainder;
          }
-         ACCA = (remainder >> 8) & 0xff;
-         ACCB =  remainder       & 0xff;
+         ctx->ACCA = (remainder >> 8) & 0xff;
+         ctx->ACCB =  remainder       & 0xff;
          // Handle the quotient...
-         C = quotient & 1;
+         ctx->C = quotient & 1;
          if (quotient > 32767) {
             // A two-complement overflow has occurred, set overflow
-            V = 1;
+            ctx->V = 1;
             // Note: Unlike DIVD, no cycle is saved in this case
          } else {
             // The quotient is valid, clear overflow
-            V = 0;
+            ctx->V = 0;
             // The quotient sign correction only happens in this case
             if (quotient > 0 && signq) {
                quotient = 0x10000 - quotient;
             }
          }
-         ACCE = (quotient >> 8) & 0xff;
-         ACCF =  quotient       & 0xff;
-         set_NZ16(quotient);
+         ctx->ACCE = (quotient >> 8) & 0xff;
+         ctx->ACCF =  quotient       & 0xff;
+         set_NZ16(ctx, quotient);
       }
    }
    // Correct the number of cycles
@@ -4666,129 +4979,129 @@ static int op_fn_DIVQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // Throw a trap if division by zero
    if (trap) {
       // Set bit 0 of the vector to differentiate DZ Trap from IL Trap
-      interrupt_helper(sample_q, sample_q->num_cycles - ((NM == 1) ? 18 : 16) - sample_q->oi, 1, VEC_DZ);
+      interrupt_helper(ctx, sample_q, sample_q->num_cycles - ((ctx->NM == 1) ? 18 : 16) - sample_q->oi, 1, VEC_DZ);
    }
    // M register
-   M = signq ? 0xff : 0x00;
+   ctx->M = signq ? 0xff : 0x00;
    return -1;
 }
 
-static int op_fn_EIM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_EIM(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // oi points to the immediate byte
    sample_t *sample = sample_q->sample + sample_q->oi;
-   return eor_helper(operand, sample->data);
+   return eor_helper(ctx, operand, sample->data);
 }
 
-static int op_fn_EORD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = eor16_helper(D, operand);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_EORD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = eor16_helper(ctx, D, operand);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_EORR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_EORR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // r1 := r1 ^ r0
-   int r0 = get_r0(operand);
-   int r1 = get_r1(operand);
+   int r0 = get_r0(ctx, operand);
+   int r1 = get_r1(ctx, operand);
    int result;
    if ((operand & 0x0f) < 8) {
-      result = eor16_helper(r1, r0);
+      result = eor16_helper(ctx, r1, r0);
    } else {
-      result = eor_helper(r1, r0);
+      result = eor_helper(ctx, r1, r0);
    }
-   set_Logical_R_result(operand, result);
+   set_Logical_R_result(ctx, operand, result);
    return -1;
 }
 
-static int op_fn_INCD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D  = inc16_helper(D);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_INCD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D  = inc16_helper(ctx, D);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_INCE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCE = inc_helper(ACCE);
+static int op_fn_INCE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCE = inc_helper(ctx, ctx->ACCE);
    return -1;
 }
 
-static int op_fn_INCF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCF = inc_helper(ACCF);
+static int op_fn_INCF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCF = inc_helper(ctx, ctx->ACCF);
    return -1;
 }
 
-static int op_fn_INCW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   W = inc16_helper(W);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_INCW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   W = inc16_helper(ctx, W);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_LDBT(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   directbit_helper(operand, sample_q);
+static int op_fn_LDBT(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   directbit_helper(ctx, operand, sample_q);
    return -1;
 }
 
-static int op_fn_LDE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCE = ld_helper(operand);
+static int op_fn_LDE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCE = ld_helper(ctx, operand);
    return -1;
 }
 
-static int op_fn_LDF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCF = ld_helper(operand);
+static int op_fn_LDF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCF = ld_helper(ctx, operand);
    return -1;
 }
 
-static int op_fn_LDMD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_LDMD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // The instruction cycle count of LDMD is always 5 cycles. However,
    // when NM toggles, the position of LIC moves, so the cycle count
    // inferred from LIC needs to be adjusted. Otherwise we would see
    // false cycle count errors. Note: emulate() disables the LIC based
    // cycle count check for LDMD.
-   if (sample_q->sample->lic >= 0 && NM >= 0) {
-      int correction = NM - (operand & 1);
-      if (sample_q->num_cycles != count_cycles_with_lic(sample_q) + correction) {
-         failflag |= FAIL_CYCLES;
+   if (sample_q->sample->lic >= 0 && ctx->NM >= 0) {
+      int correction = ctx->NM - (operand & 1);
+      if (sample_q->num_cycles != count_cycles_with_lic(ctx, sample_q) + correction) {
+         ctx->failflag |= FAIL_CYCLES;
       }
    }
-   FM = (operand >> 1) & 1;
-   NM =  operand       & 1;
+   ctx->FM = (operand >> 1) & 1;
+   ctx->NM =  operand       & 1;
    return -1;
 }
 
-static int op_fn_LDQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_q_nz((uint32_t) operand);
+static int op_fn_LDQ(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_q_nz(ctx, (uint32_t) operand);
    // Random testing showed V is not cleared
    // V = 0;
    return -1;
 }
 
-static int op_fn_LDW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = ld16_helper(operand);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_LDW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = ld16_helper(ctx, operand);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_LSRD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = lsr_helper(D);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_LSRD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = lsr_helper(ctx, D);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_LSRW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   W = lsr_helper(W);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_LSRW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   W = lsr_helper(ctx, W);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_MULD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_MULD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // Q = D * imm16 (signed)
    int cycle_correction = 0;
    int sign = 0; // Set if the result will be negative
-   if (ACCA >= 0 && ACCB >= 0) {
-      int a = (ACCA << 8) + ACCB; // 0x0000-0xFFFF
+   if (ctx->ACCA >= 0 && ctx->ACCB >= 0) {
+      int a = (ctx->ACCA << 8) + ctx->ACCB; // 0x0000-0xFFFF
       int b = operand;            // 0x0000-0xFFFF
       // Twos-complement the first operand
       if (a >= 0x8000) {
@@ -4811,151 +5124,151 @@ static int op_fn_MULD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
          // There is a one cycle penatly here
          cycle_correction++;
       }
-      set_q_nz(result);
+      set_q_nz(ctx, result);
    } else {
-      set_q_nz_unknown();
+      set_q_nz_unknown(ctx);
    }
    // Correct the number of cycles
    sample_q->num_cycles += cycle_correction;
    // M register
-   M = sign ? 0xff : 0x00;
+   ctx->M = sign ? 0xff : 0x00;
    return -1;
 }
 
-static int op_fn_NEGD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = neg16_helper(D);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_NEGD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = neg16_helper(ctx, D);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_OIM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_OIM(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // oi points to the immediate byte
    sample_t *sample = sample_q->sample + sample_q->oi;
-   return or_helper(operand, sample->data);
+   return or_helper(ctx, operand, sample->data);
 }
 
-static int op_fn_ORD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = or16_helper(D, operand);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_ORD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = or16_helper(ctx, D, operand);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_ORR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_ORR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // r1 := r1 | r0
-   int r0 = get_r0(operand);
-   int r1 = get_r1(operand);
+   int r0 = get_r0(ctx, operand);
+   int r1 = get_r1(ctx, operand);
    int result;
    if ((operand & 0x0f) < 8) {
-      result = or16_helper(r1, r0);
+      result = or16_helper(ctx, r1, r0);
    } else {
-      result = or_helper(r1, r0);
+      result = or_helper(ctx, r1, r0);
    }
-   set_Logical_R_result(operand, result);
+   set_Logical_R_result(ctx, operand, result);
    return -1;
 }
 
-static int op_fn_PSHSW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   pushw_helper(sample_q, 1);
+static int op_fn_PSHSW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   pushw_helper(ctx, sample_q, 1);
    return -1;
 }
 
-static int op_fn_PSHUW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   pushw_helper(sample_q, 0);
+static int op_fn_PSHUW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   pushw_helper(ctx, sample_q, 0);
    return -1;
 }
 
-static int op_fn_PULSW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   pullw_helper(sample_q, 1);
+static int op_fn_PULSW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   pullw_helper(ctx, sample_q, 1);
    return -1;
 }
 
-static int op_fn_PULUW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   pullw_helper(sample_q, 0);
+static int op_fn_PULUW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   pullw_helper(ctx, sample_q, 0);
    return -1;
 }
 
-static int op_fn_ROLD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = rol16_helper(D);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_ROLD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = rol16_helper(ctx, D);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_ROLW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   W = rol16_helper(W);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_ROLW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   W = rol16_helper(ctx, W);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_RORD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = ror16_helper(D);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_RORD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = ror16_helper(ctx, D);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_RORW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   W = ror16_helper(W);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_RORW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   W = ror16_helper(ctx, W);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_SBCD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   D = sub16_helper(D, C, operand);
-   unpack(D, &ACCA, &ACCB);
+static int op_fn_SBCD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   D = sub16_helper(ctx, D, ctx->C, operand);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
    return -1;
 }
 
-static int op_fn_SBCR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_SBCR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // r1 := r1 - r0 - C
-   int r0 = get_r0(operand);
-   int r1 = get_r1(operand);
+   int r0 = get_r0(ctx, operand);
+   int r1 = get_r1(ctx, operand);
    int result;
    if ((operand & 0x0f) < 8) {
-      result = sub16_helper(r1, C, r0);
+      result = sub16_helper(ctx, r1, ctx->C, r0);
    } else {
-      result = sub_helper(r1, C, r0);
+      result = sub_helper(ctx, r1, ctx->C, r0);
    }
-   set_Arithmetic_R_result(operand, result);
+   set_Arithmetic_R_result(ctx, operand, result);
    return -1;
 }
 
-static int op_fn_SEXW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_SEXW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // Sign extend 16-bit value in W to 32-bit value in Q
    // W =           ACCE ACCF
    // Q = ACCA ACCB ACCE ACCF
-   if (ACCE >= 0) {
-      if (ACCE & 0x80) {
-         ACCA = 0xff;
-         ACCB = 0xff;
-         N = 1;
+   if (ctx->ACCE >= 0) {
+      if (ctx->ACCE & 0x80) {
+         ctx->ACCA = 0xff;
+         ctx->ACCB = 0xff;
+         ctx->N = 1;
       } else {
-         ACCA = 0x00;
-         ACCB = 0x00;
-         N = 0;
+         ctx->ACCA = 0x00;
+         ctx->ACCB = 0x00;
+         ctx->N = 0;
       }
       // By calculating the flags this way, we can be slightly less pessimistic
-      if (ACCF >= 0) {
-         Z = (ACCE == 0 && ACCF == 0);
+      if (ctx->ACCF >= 0) {
+         ctx->Z = (ctx->ACCE == 0 && ctx->ACCF == 0);
       } else {
-         Z = -1;
+         ctx->Z = -1;
       }
    } else {
-      ACCA = -1;
-      ACCB = -1;
-      set_NZ_unknown();
+      ctx->ACCA = -1;
+      ctx->ACCB = -1;
+      set_NZ_unknown(ctx);
    }
    // V flag is not affected, see:
    // https://github.com/mamedev/mame/blob/ab6237da/src/devices/cpu/m6809/hd6309.cpp#L108
    return -1;
 }
 
-static int op_fn_STBT(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_STBT(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // Pickout the postbyte from the samples
    sample_t *sample = sample_q->sample + sample_q->oi;
    int postbyte = sample[1].data;
@@ -4968,91 +5281,91 @@ static int op_fn_STBT(operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // Extract register bit, which can be 0, 1 or -1
    int reg_bit;
    switch (reg_num) {
-   case 0: reg_bit = get_FLAG(reg_bitnum);                       break;
-   case 1: reg_bit = (ACCA < 0) ? -1 : (ACCA >> reg_bitnum) & 1; break;
-   case 2: reg_bit = (ACCB < 0) ? -1 : (ACCB >> reg_bitnum) & 1; break;
-   case 3: reg_bit = 0; failflag |= FAIL_UNDOC;                ; break;
+   case 0: reg_bit = get_FLAG(ctx, reg_bitnum);                       break;
+   case 1: reg_bit = (ctx->ACCA < 0) ? -1 : (ctx->ACCA >> reg_bitnum) & 1; break;
+   case 2: reg_bit = (ctx->ACCB < 0) ? -1 : (ctx->ACCB >> reg_bitnum) & 1; break;
+   case 3: reg_bit = 0; ctx->failflag |= FAIL_UNDOC;                ; break;
    }
 
    if (reg_bit >= 0) {
       // Calculate the value that is expected to be written back
       int ret = (operand & (0xff ^ (1 << mem_bitnum))) | (reg_bit << mem_bitnum);
-      set_NZ(ret);
+      set_NZ(ctx, ret);
       return ret;
    } else {
       // No memory modelling is possible
-      set_NZ_unknown();
+      set_NZ_unknown(ctx);
       return -1;
    }
 }
 
-static int op_fn_STE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCE = st_helper(ACCE, operand, FAIL_ACCE);
+static int op_fn_STE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCE = st_helper(ctx, ctx->ACCE, operand, FAIL_ACCE);
    return -1;
 }
 
-static int op_fn_STF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCF = st_helper(ACCF, operand, FAIL_ACCF);
+static int op_fn_STF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCF = st_helper(ctx, ctx->ACCF, operand, FAIL_ACCF);
    return -1;
 }
 
-static int op_fn_STQ(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_STQ(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    uint32_t result = (uint32_t) operand;
-   if (ACCF >= 0 && (uint32_t)ACCF != (result & 0xff)) {
-      failflag |= FAIL_ACCF;
+   if (ctx->ACCF >= 0 && (uint32_t)ctx->ACCF != (result & 0xff)) {
+      ctx->failflag |= FAIL_ACCF;
    }
-   if (ACCE >= 0 && (uint32_t)ACCE != ((result >> 8) & 0xff)) {
-      failflag |= FAIL_ACCE;
+   if (ctx->ACCE >= 0 && (uint32_t)ctx->ACCE != ((result >> 8) & 0xff)) {
+      ctx->failflag |= FAIL_ACCE;
    }
-   if (ACCB >= 0 && (uint32_t)ACCB != ((result >> 16) & 0xff)) {
-      failflag |= FAIL_ACCB;
+   if (ctx->ACCB >= 0 && (uint32_t)ctx->ACCB != ((result >> 16) & 0xff)) {
+      ctx->failflag |= FAIL_ACCB;
    }
-   if (ACCA >= 0 && (uint32_t)ACCA != ((result >> 24) & 0xff)) {
-      failflag |= FAIL_ACCA;
+   if (ctx->ACCA >= 0 && (uint32_t)ctx->ACCA != ((result >> 24) & 0xff)) {
+      ctx->failflag |= FAIL_ACCA;
    }
-   set_q_nz(result);
+   set_q_nz(ctx, result);
    return -1;
 }
 
-static int op_fn_STW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   W = st16_helper(W, operand, FAIL_ACCE | FAIL_ACCF);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_STW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   W = st16_helper(ctx, W, operand, FAIL_ACCE | FAIL_ACCF);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_SUBE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCE = sub_helper(ACCE, 0, operand);
+static int op_fn_SUBE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCE = sub_helper(ctx, ctx->ACCE, 0, operand);
    return -1;
 }
 
-static int op_fn_SUBF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   ACCF = sub_helper(ACCF, 0, operand);
+static int op_fn_SUBF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   ctx->ACCF = sub_helper(ctx, ctx->ACCF, 0, operand);
    return -1;
 }
 
-static int op_fn_SUBR(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_SUBR(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // r1 := r1 + r0
-   int r0 = get_r0(operand);
-   int r1 = get_r1(operand);
+   int r0 = get_r0(ctx, operand);
+   int r1 = get_r1(ctx, operand);
    int result;
    if ((operand & 0x0f) < 8) {
-      result = sub16_helper(r1, 0, r0);
+      result = sub16_helper(ctx, r1, 0, r0);
    } else {
-      result = sub_helper(r1, 0, r0);
+      result = sub_helper(ctx, r1, 0, r0);
    }
-   set_Arithmetic_R_result(operand, result);
+   set_Arithmetic_R_result(ctx, operand, result);
    return -1;
 }
 
-static int op_fn_SUBW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   W = sub16_helper(W, 0, operand);
-   unpack(W, &ACCE, &ACCF);
+static int op_fn_SUBW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   W = sub16_helper(ctx, W, 0, operand);
+   unpack(W, &ctx->ACCE, &ctx->ACCF);
    return -1;
 }
 
-static int op_fn_TFM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_TFM(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // 1138 TFM r0+, r1+
    // 1139 TFM r0-, r1-
    // 113A TFM r0+, r1
@@ -5066,38 +5379,38 @@ static int op_fn_TFM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
    int r1 = postbyte & 0xf;
 
    // The number of bytes expected to be transferred is in W
-   int W = pack(ACCE, ACCF);
+   int W = pack(ctx->ACCE, ctx->ACCF);
 
    // Only D, X, Y, U, S are legal, anything else causes an illegal instruction trap
    if (r0 > 4 || r1 > 4) {
       // Random testing showed Z set based on W even in the failed case=0 in the failed case
-      Z = (W < 0) ? -1 : (W == 0);
-      failflag |= FAIL_BADM;
+      ctx->Z = (W < 0) ? -1 : (W == 0);
+      ctx->failflag |= FAIL_BADM;
       // Illegal index register takes 25/23 (without additional prefixes)
-      sample_q->num_cycles += (NM == 1) ? 19 : 17;
-      interrupt_helper(sample_q, 6, 1, VEC_IL);
+      sample_q->num_cycles += (ctx->NM == 1) ? 19 : 17;
+      interrupt_helper(ctx, sample_q, 6, 1, VEC_IL);
       return -1;
    }
 
-   int D = pack(ACCA, ACCB);
+   int D = pack(ctx->ACCA, ctx->ACCB);
 
    // Get reg0 (the source address)
    int *reg0;
    switch (r0) {
-   case 1:  reg0 = &X;  break;
-   case 2:  reg0 = &Y;  break;
-   case 3:  reg0 = &U;  break;
-   case 4:  reg0 = &S;  break;
+   case 1:  reg0 = &ctx->X;  break;
+   case 2:  reg0 = &ctx->Y;  break;
+   case 3:  reg0 = &ctx->U;  break;
+   case 4:  reg0 = &ctx->S;  break;
    default: reg0 = &D;  break;
    }
 
    // Get reg1 (the destination address) [ which may be the same as the source! ]
    int *reg1;
    switch (r1) {
-   case 1:  reg1 = &X;  break;
-   case 2:  reg1 = &Y;  break;
-   case 3:  reg1 = &U;  break;
-   case 4:  reg1 = &S;  break;
+   case 1:  reg1 = &ctx->X;  break;
+   case 2:  reg1 = &ctx->Y;  break;
+   case 3:  reg1 = &ctx->U;  break;
+   case 4:  reg1 = &ctx->S;  break;
    default: reg1 = &D;  break;
    }
 
@@ -5249,16 +5562,16 @@ static int op_fn_TFM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // Handle the case where the common actions when TFM is interrupted in either mode
    if (interrupted) {
       // In native mode, the interrupted PC write is expected at offset 4, so we adjust num_cycles so this is true
-      if (NM == 1) {
+      if (ctx->NM == 1) {
          sample_q->num_cycles--;
       }
 
       // set the PC back three cycles (the length of TFM), so the TFM re-executes after the RTI
-      if (PC >= 0) {
-         PC = (PC - 3) & 0xffff;
+      if (ctx->PC >= 0) {
+         ctx->PC = (ctx->PC - 3) & 0xffff;
       }
       // cancel the num_cycles warning
-      failflag &= ~FAIL_CYCLES;
+      ctx->failflag &= ~FAIL_CYCLES;
    }
 
    // Memory modelling of reads and writes
@@ -5273,15 +5586,15 @@ static int op_fn_TFM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
 
    if (num_bytes > 0) {
       for (int i = 0; i < num_bytes; i++) {
-         memory_read(rd_sample, *reg0, MEM_DATA);
+         mem_read(ctx, rd_sample, *reg0, MEM_DATA);
          rd_sample += 3;
          *reg0 = offset_address(*reg0, r0inc);
-         memory_write(wr_sample, *reg1, MEM_DATA);
+         mem_write(ctx, wr_sample, *reg1, MEM_DATA);
          wr_sample += 3;
          *reg1 = offset_address(*reg1, r1inc);
       }
       // M Register
-      M = (rd_sample - 3)->data;
+      ctx->M = (rd_sample - 3)->data;
    } else if (num_bytes < 0) {
       if (r0inc) {
          *reg0 = -1;
@@ -5290,58 +5603,58 @@ static int op_fn_TFM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
          *reg1 = -1;
       }
       // M Register
-      M = -1;
+      ctx->M = -1;
    }
 
    // In case D has been involved, we push the value back to ACCA/B
-   unpack(D, &ACCA, &ACCB);
+   unpack(D, &ctx->ACCA, &ctx->ACCB);
 
    // Update the final value of W
    if (W >= 0 && num_bytes >= 0) {
       W -= num_bytes;
-      unpack(W, &ACCE, &ACCF);
-      Z = (W == 0);
+      unpack(W, &ctx->ACCE, &ctx->ACCF);
+      ctx->Z = (W == 0);
    }
 
    return -1;
 }
 
-static int op_fn_TIM(operand_t operand, ea_t ea, sample_q_t *sample_q) {
+static int op_fn_TIM(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
    // oi points to the immediate byte
    sample_t *sample = sample_q->sample + sample_q->oi;
-   set_NZ(operand & sample->data);
-   V = 0;
+   set_NZ(ctx, operand & sample->data);
+   ctx->V = 0;
    return -1;
 }
 
-static int op_fn_TRAP(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   interrupt_helper(sample_q, 4, 1, VEC_IL);
+static int op_fn_TRAP(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   interrupt_helper(ctx, sample_q, 4, 1, VEC_IL);
    return -1;
 }
 
-static int op_fn_TSTD(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int D = pack(ACCA, ACCB);
-   set_NZ16(D);
-   V = 0;
+static int op_fn_TSTD(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int D = pack(ctx->ACCA, ctx->ACCB);
+   set_NZ16(ctx, D);
+   ctx->V = 0;
    return -1;
 }
 
-static int op_fn_TSTE(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_NZ(ACCE);
-   V = 0;
+static int op_fn_TSTE(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_NZ(ctx, ctx->ACCE);
+   ctx->V = 0;
    return -1;
 }
 
-static int op_fn_TSTF(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   set_NZ(ACCF);
-   V = 0;
+static int op_fn_TSTF(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   set_NZ(ctx, ctx->ACCF);
+   ctx->V = 0;
    return -1;
 }
 
-static int op_fn_TSTW(operand_t operand, ea_t ea, sample_q_t *sample_q) {
-   int W = pack(ACCE, ACCF);
-   set_NZ16(W);
-   V = 0;
+static int op_fn_TSTW(em6809_ctx_t *ctx, operand_t operand, ea_t ea, sample_q_t *sample_q) {
+   int W = pack(ctx->ACCE, ctx->ACCF);
+   set_NZ16(ctx, W);
+   ctx->V = 0;
    return -1;
 }
 
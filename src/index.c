@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "defs.h"
+#include "state.h"
+#include "index.h"
+
+// With --index=FILE, a decode from the start of the capture writes an index
+// of checkpoints, one every --index-interval instructions. Each checkpoint
+// holds everything needed to carry on decoding from that instruction: its
+// sample number, the emulator state and the memory model.
+//
+// A later decode with --from-sample or --from-pc-occurrence then starts at
+// the nearest checkpoint before the target, rather than at the start of the
+// capture, with the output muted until the target is reached.
+//
+// To find the k'th occurrence of a PC, each checkpoint also records how
+// many times each PC was executed since the previous one. The last entry
+// (written at the end of the decode) has these counts, but no state.
+//
+// The index is written in the host's byte order, as it's tied to a capture
+// on the same machine.
+//
+// Index:
+//    index_header_t
+//    index_entry_t, index_count_t[num_pcs], state[state_len] (repeated)
+//
+// where the state is a checkpoint, as written by state_write()
+
+#define INDEX_MAGIC      "D6809IDX"
+#define INDEX_VERSION    1
+#define INDEX_BYTE_ORDER 0x01020304
+
+typedef struct {
+   char     magic[8];
+   uint32_t version;
+   uint32_t byte_order;
+   int32_t  cpu;
+   int32_t  machine;
+   int32_t  sample_size;      // 1 (--byte) or 2 bytes
+   uint32_t interval;
+} index_header_t;
+
+typedef struct {
+   uint64_t sample;           // Sample number of the next instruction
+   uint64_t offset;           // Byte offset of that sample in the capture
+   uint64_t num_instructions; // Number of instructions decoded before it
+   uint32_t num_pcs;          // Number of index_count_t that follow
+   uint32_t state_len;        // Length of the state that follows them
+} index_entry_t;
+
+typedef struct {
+   uint32_t pc;
+   uint32_t count;
+} index_count_t;
+
+static FILE *index_file = NULL;
+static int index_failed;
+static int sample_size;
+static int interval;
+
+// Instructions since the last checkpoint, and the executions of each PC
+static int since_checkpoint;
+static uint32_t pc_counts[0x10000];
+
+// The sample number of the last instruction
+static uint64_t last_sample;
+
+static void index_error(const char *msg, const char *filename) {
+   fprintf(stderr, "index %s: %s\n", filename, msg);
+}
+
+// ====================================================================
+// Building
+// ====================================================================
+
+static int write_counts() {
+   for (int pc = 0; pc < 0x10000; pc++) {
+      if (pc_counts[pc]) {
+         index_count_t count = { pc, pc_counts[pc] };
+         if (fwrite(&count, sizeof(count), 1, index_file) != 1) {
+            return -1;
+         }
+         pc_counts[pc] = 0;
+      }
+   }
+   return 0;
+}
+
+// Writes an entry, followed by the state if em isn't NULL
+
+static int write_entry(uint64_t sample, uint64_t num_instructions, cpu_emulator_t *em, void *em_ctx, memory_t *mem) {
+   index_entry_t entry;
+   entry.sample = sample;
+   entry.offset = sample * sample_size;
+   entry.num_instructions = num_instructions;
+   entry.num_pcs = 0;
+   entry.state_len = 0;
+   for (int pc = 0; pc < 0x10000; pc++) {
+      if (pc_counts[pc]) {
+         entry.num_pcs++;
+      }
+   }
+   long start = ftell(index_file);
+   if (start < 0 || fwrite(&entry, sizeof(entry), 1, index_file) != 1 || write_counts() < 0) {
+      return -1;
+   }
+   if (em) {
+      long state = ftell(index_file);
+      if (state < 0 || state_write(index_file, em, em_ctx, mem) < 0) {
+         return -1;
+      }
+      // Go back and fill in the length of the state
+      long end = ftell(index_file);
+      entry.state_len = end - state;
+      if (end < 0 || fseek(index_file, start, SEEK_SET) ||
+          fwrite(&entry, sizeof(entry), 1, index_file) != 1 || fseek(index_file, end, SEEK_SET)) {
+         return -1;
+      }
+   }
+   return 0;
+}
+
+static void write_failed() {
+   perror("failed to write index");
+   fclose(index_file);
+   index_file = NULL;
+   index_failed = 1;
+}
+
+int index_create(arguments_t *args) {
+   index_failed = 0;
+   index_file = fopen(args->index_file, "wb");
+   if (!index_file) {
+      perror("failed to create index");
+      return -1;
+   }
+   sample_size = args->byte ? 1 : 2;
+   interval = args->index_interval;
+   index_header_t header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+   header.version = INDEX_VERSION;
+   header.byte_order = INDEX_BYTE_ORDER;
+   header.cpu = args->cpu_type;
+   header.machine = args->machine;
+   header.sample_size = sample_size;
+   header.interval = interval;
+   if (fwrite(&header, sizeof(header), 1, index_file) != 1) {
+      write_failed();
+      return -1;
+   }
+   // The first instruction gets a checkpoint
+   since_checkpoint = interval;
+   memset(pc_counts, 0, sizeof(pc_counts));
+   return 0;
+}
+
+// Called before each instruction is emulated, when its state can be saved
+
+void index_begin_instruction(uint64_t sample, uint64_t num_instructions, cpu_emulator_t *em, void *em_ctx, memory_t *mem) {
+   last_sample = sample;
+   if (!index_file || since_checkpoint++ < interval) {
+      return;
+   }
+   since_checkpoint = 1;
+   if (write_entry(sample, num_instructions, em, em_ctx, mem) < 0) {
+      write_failed();
+   }
+}
+
+void index_end_instruction(int pc) {
+   if (pc >= 0) {
+      pc_counts[pc]++;
+   }
+}
+
+// Returns -1 if the index couldn't be written, which has already been
+// reported
+
+int index_close(uint64_t num_instructions) {
+   if (!index_file) {
+      return index_failed ? -1 : 0;
+   }
+   // The counts since the last checkpoint, which also marks the index as complete
+   if (write_entry(last_sample, num_instructions, NULL, NULL, NULL) < 0) {
+      write_failed();
+      return -1;
+   }
+   int failed = fclose(index_file) != 0;
+   if (failed) {
+      perror("failed to write index");
+   }
+   index_file = NULL;
+   return failed ? -1 : 0;
+}
+
+// ====================================================================
+// Seeking
+// ====================================================================
+
+// Finds the checkpoint to start from, and loads its state. If there is no
+// suitable checkpoint, pos->found is zero and the decode should start from
+// the beginning.
+
+int index_seek(arguments_t *args, cpu_emulator_t *em, void *em_ctx, memory_t *mem, index_position_t *pos) {
+   const char *filename = args->index_file;
+   FILE *file = fopen(filename, "rb");
+   if (!file) {
+      perror("failed to open index");
+      return -1;
+   }
+   index_header_t header;
+   if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) ||
+       header.version != INDEX_VERSION || header.byte_order != INDEX_BYTE_ORDER) {
+      index_error("not a (supported) index", filename);
+      fclose(file);
+      return -1;
+   }
+   if (header.cpu != (int) args->cpu_type || header.machine != (int) args->machine || header.sample_size != (args->byte ? 1 : 2)) {
+      index_error("was built with a different --cpu, --machine or --byte", filename);
+      fclose(file);
+      return -1;
+   }
+
+   // The best checkpoint so far (at or after --skip, as the samples before
+   // that aren't read), and the executions of from_pc before it
+   long best = -1;
+   index_entry_t best_entry;
+   uint64_t best_count = 0;
+
+   uint64_t count = 0;
+   int reached = 0;
+   int complete = 0;
+   index_entry_t entry;
+   while (!reached && !complete && fread(&entry, sizeof(entry), 1, file) == 1) {
+      if (args->from_sample >= 0 && entry.sample >= (uint64_t) args->from_sample) {
+         // A checkpoint exactly at the sample is used
+         if (entry.sample > (uint64_t) args->from_sample || !entry.state_len) {
+            reached = 1;
+            break;
+         }
+      }
+      uint32_t i;
+      for (i = 0; i < entry.num_pcs; i++) {
+         index_count_t c;
+         if (fread(&c, sizeof(c), 1, file) != 1) {
+            break;
+         }
+         if ((int) c.pc == args->from_pc) {
+            // The occurrence is before this entry
+            if (count + c.count >= args->from_occurrence) {
+               reached = 1;
+            }
+            count += c.count;
+         }
+      }
+      if (reached || i < entry.num_pcs) {
+         break;
+      }
+      if (!entry.state_len) {
+         complete = 1;
+      } else if (entry.sample >= (uint64_t) args->skip) {
+         best = ftell(file);
+         best_entry = entry;
+         best_count = count;
+      }
+      if (fseek(file, entry.state_len, SEEK_CUR)) {
+         break;
+      }
+   }
+
+   // If the index is incomplete (e.g. the decode that built it was
+   // interrupted) the target may still be after the last checkpoint
+   if (!reached && complete) {
+      if (args->from_sample >= 0) {
+         index_error("the sample is beyond the end of the capture", filename);
+      } else {
+         fprintf(stderr, "index %s: %04X is only executed %"PRIu64" times\n", filename, args->from_pc, count);
+      }
+      fclose(file);
+      return -1;
+   }
+
+   pos->found = best >= 0;
+   pos->sample = 0;
+   pos->num_instructions = 0;
+   pos->occurrence = args->from_occurrence;
+   if (pos->found) {
+      if (fseek(file, best, SEEK_SET) || state_read(file, em, em_ctx, mem) < 0) {
+         index_error("failed to load checkpoint", filename);
+         fclose(file);
+         return -1;
+      }
+      pos->sample = best_entry.sample;
+      pos->num_instructions = best_entry.num_instructions;
+      pos->occurrence -= best_count;
+   }
+   fclose(file);
+   return 0;
+}
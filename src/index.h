@@ -0,0 +1,32 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <inttypes.h>
+
+#include "defs.h"
+
+#define DEFAULT_INDEX_INTERVAL 1000000
+
+// Building an index, during a decode from the start of the capture
+
+int index_create(arguments_t *args);
+
+void index_begin_instruction(uint64_t sample, uint64_t num_instructions, cpu_emulator_t *em, void *em_ctx, memory_t *mem);
+
+void index_end_instruction(int pc);
+
+int index_close(uint64_t num_instructions);
+
+// Using an index, to start decoding part way through the capture
+
+typedef struct {
+   int      found;            // Set if there is a checkpoint to start from
+   uint64_t sample;           // Sample number of the checkpoint
+   uint64_t num_instructions; // Instructions decoded before it
+   uint64_t occurrence;       // With --from-pc-occurrence, the occurrence of
+                              // the pc counting from the checkpoint
+} index_position_t;
+
+int index_seek(arguments_t *args, cpu_emulator_t *em, void *em_ctx, memory_t *mem, index_position_t *pos);
+
+#endif
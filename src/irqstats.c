@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "defs.h"
+#include "output.h"
+#include "irqstats.h"
+
+// With --irq-stats, each interrupt taken is measured, and at the end of the
+// capture there is a summary for each vector (FIRQ, IRQ and NMI) of:
+//
+// - the dispatch latency: the cycles from the point the interrupt could be
+//   taken (the end of the instruction it interrupted, or the wake up from a
+//   CWAI) until the first instruction of the handler
+//
+// - the service time: the cycles from the start of the dispatch until the
+//   end of the matching RTI (including any nested interrupts)
+//
+// - the nesting depth (1 if no other interrupt was being serviced)
+//
+// The request line itself isn't captured, so the time an interrupt was
+// pending (e.g. while masked) can't be seen. After SYNC, the dispatch is a
+// separate interrupt sequence, so the latency is measured from the wake up
+// in the same way as after any other instruction.
+//
+// The values are kept in log-scaled histograms: exact up to 15, then eight
+// buckets per power of two, so p50 and p99 are within 12.5%.
+
+#define EXACT_BUCKETS  16
+#define SUB_BUCKETS    8
+#define NUM_BUCKETS    (EXACT_BUCKETS + (64 - 4) * SUB_BUCKETS)
+
+// Vectors are identified by the low nibble of their address (as on the
+// address bus), with one more for the unknown vector
+#define NUM_VECTORS    17
+#define VEC_UNKNOWN    16
+
+#define MAX_FRAMES     32
+
+// Cycles from the CWAI wake up to the handler (the vector fetch and a dead cycle)
+#define CWAI_LATENCY   3
+
+typedef struct {
+   uint64_t count;
+   uint64_t sum;
+   uint64_t max;
+   uint64_t buckets[NUM_BUCKETS];
+} histogram_t;
+
+typedef struct {
+   histogram_t latency;
+   histogram_t service;
+   histogram_t nesting;
+} vector_stats_t;
+
+typedef struct {
+   int vector;
+   uint64_t start;            // Total cycles at the start of the dispatch
+   int s;                     // The stack pointer after the interrupt (or -1)
+} irq_frame_t;
+
+static cpu_emulator_t *em;
+static void *em_ctx;
+
+static vector_stats_t *stats;
+
+static irq_frame_t frames[MAX_FRAMES];
+static int depth;
+
+static uint64_t total_cycles;
+
+// ====================================================================
+// Histograms
+// ====================================================================
+
+static int get_bucket(uint64_t value) {
+   if (value < EXACT_BUCKETS) {
+      return value;
+   }
+   int e = 63 - __builtin_clzll(value);
+   return EXACT_BUCKETS + (e - 4) * SUB_BUCKETS + ((value >> (e - 3)) & (SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_lower(int bucket) {
+   if (bucket < EXACT_BUCKETS) {
+      return bucket;
+   }
+   int e = (bucket - EXACT_BUCKETS) / SUB_BUCKETS + 4;
+   int m = (bucket - EXACT_BUCKETS) % SUB_BUCKETS;
+   return (uint64_t) (SUB_BUCKETS + m) << (e - 3);
+}
+
+static uint64_t bucket_upper(int bucket) {
+   return bucket + 1 < NUM_BUCKETS ? bucket_lower(bucket + 1) - 1 : UINT64_MAX;
+}
+
+static void add_value(histogram_t *h, uint64_t value) {
+   h->count++;
+   h->sum += value;
+   if (value > h->max) {
+      h->max = value;
+   }
+   h->buckets[get_bucket(value)]++;
+}
+
+// The upper bound of the bucket the percentile falls in (or the maximum if
+// that's lower)
+
+static uint64_t get_percentile(histogram_t *h, int percent) {
+   uint64_t rank = (h->count * percent + 99) / 100;
+   uint64_t seen = 0;
+   for (int b = 0; b < NUM_BUCKETS; b++) {
+      seen += h->buckets[b];
+      if (seen >= rank && seen > 0) {
+         uint64_t upper = bucket_upper(b);
+         return upper < h->max ? upper : h->max;
+      }
+   }
+   return h->max;
+}
+
+static void report_histogram(const char *name, histogram_t *h) {
+   output_printf("   %-8s %10"PRIu64" %8"PRIu64" %8"PRIu64" %8"PRIu64" %10.1f\n", name, h->count,
+                 get_percentile(h, 50), get_percentile(h, 99), h->max, h->count ? (double) h->sum / h->count : 0.0);
+}
+
+// Shows the histogram with a row per power of two
+
+static void report_rows(const char *name, histogram_t *h) {
+   uint64_t rows[65];
+   memset(rows, 0, sizeof(rows));
+   uint64_t most = 0;
+   for (int b = 0; b < NUM_BUCKETS; b++) {
+      uint64_t lower = bucket_lower(b);
+      int row = lower ? 64 - __builtin_clzll(lower) : 0;
+      rows[row] += h->buckets[b];
+      if (rows[row] > most) {
+         most = rows[row];
+      }
+   }
+   output_printf("   %s:\n", name);
+   for (int row = 0; row < 65; row++) {
+      if (!rows[row]) {
+         continue;
+      }
+      uint64_t lower = row ? (uint64_t) 1 << (row - 1) : 0;
+      uint64_t upper = row ? (lower << 1) - 1 : 0;
+      char range[48];
+      if (lower == upper) {
+         sprintf(range, "%"PRIu64, lower);
+      } else {
+         sprintf(range, "%"PRIu64"..%"PRIu64, lower, upper);
+      }
+      char bar[41];
+      int len = (int) ((rows[row] * 40 + most - 1) / most);
+      memset(bar, '#', len);
+      bar[len] = 0;
+      output_printf("   %24s %10"PRIu64"  %s\n", range, rows[row], bar);
+   }
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+int irqstats_init(arguments_t *args, cpu_emulator_t *emulator, void *emulator_ctx) {
+   em = emulator;
+   em_ctx = emulator_ctx;
+   stats = calloc(NUM_VECTORS, sizeof(vector_stats_t));
+   if (!stats) {
+      fprintf(stderr, "failed to allocate interrupt stats\n");
+      return -1;
+   }
+   return 0;
+}
+
+// Called after each instruction (or interrupt or reset sequence)
+
+void irqstats_instruction(instruction_t *instruction, sample_t *sample_q, int num_cycles) {
+   if (instruction->rst_seen) {
+      depth = 0;
+      total_cycles += num_cycles;
+      return;
+   }
+
+   int i = 0;
+   while (i < instruction->length - 1 && (instruction->instr[i] == 0x10 || instruction->instr[i] == 0x11)) {
+      i++;
+   }
+   int opcode = instruction->length ? instruction->instr[i] : -1;
+
+   // An interrupt sequence, or a CWAI, ends with the vector fetch and a
+   // dead cycle
+   if (instruction->intr_seen || opcode == 0x3c) {
+      int vector = sample_q[num_cycles - 3].addr;
+      if (vector < 0) {
+         // The FIRQ sequence is shorter; a CWAI is assumed to be woken by an IRQ
+         if (instruction->intr_seen) {
+            vector = (num_cycles < 19) ? 0x6 : VEC_UNKNOWN;
+         } else {
+            vector = 0x8;
+         }
+      }
+      int latency = instruction->intr_seen ? num_cycles : CWAI_LATENCY;
+      vector_stats_t *vs = stats + vector;
+      add_value(&vs->latency, latency);
+      add_value(&vs->nesting, depth + 1);
+      if (depth < MAX_FRAMES) {
+         frames[depth].vector = vector;
+         frames[depth].start = total_cycles + num_cycles - latency;
+         frames[depth].s = em->get_S(em_ctx);
+         depth++;
+      }
+   }
+
+   total_cycles += num_cycles;
+
+   // Pop the interrupts that the RTI has gone above (or if the stack
+   // pointer isn't known, just the last one)
+   if (opcode == 0x3b && depth > 0) {
+      int s = em->get_S(em_ctx);
+      while (depth > 0) {
+         irq_frame_t *frame = frames + depth - 1;
+         if (s >= 0 && frame->s >= 0 && frame->s >= s) {
+            break;
+         }
+         add_value(&stats[frame->vector].service, total_cycles - frame->start);
+         depth--;
+         if (s < 0 || frame->s < 0) {
+            break;
+         }
+      }
+   }
+}
+
+void irqstats_report() {
+   for (int v = 0; v < NUM_VECTORS; v++) {
+      vector_stats_t *vs = stats + v;
+      if (!vs->latency.count) {
+         continue;
+      }
+      char name[32];
+      switch (v) {
+      case 0x6:
+         strcpy(name, "FIRQ");
+         break;
+      case 0x8:
+         strcpy(name, "IRQ");
+         break;
+      case 0xC:
+         strcpy(name, "NMI");
+         break;
+      case VEC_UNKNOWN:
+         strcpy(name, "unknown vector");
+         break;
+      default:
+         sprintf(name, "vector FFF%X", v);
+         break;
+      }
+      output_printf("irq-stats: %s: %"PRIu64" taken\n", name, vs->latency.count);
+      output_printf("                 count      p50      p99      max       mean\n");
+      report_histogram("latency", &vs->latency);
+      report_histogram("service", &vs->service);
+      report_histogram("nesting", &vs->nesting);
+      report_rows("latency (cycles)", &vs->latency);
+      report_rows("service (cycles)", &vs->service);
+      report_rows("nesting depth", &vs->nesting);
+   }
+}
@@ -0,0 +1,12 @@
+#ifndef IRQSTATS_H
+#define IRQSTATS_H
+
+#include "defs.h"
+
+int irqstats_init(arguments_t *args, cpu_emulator_t *em, void *em_ctx);
+
+void irqstats_instruction(instruction_t *instruction, sample_t *sample_q, int num_cycles);
+
+void irqstats_report();
+
+#endif
@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "defs.h"
+#include "capture.h"
+#include "output.h"
+#include "state.h"
+#include "jobs.h"
+
+// With --jobs=N, a mapped capture is split into N chunks that are decoded
+// in parallel by forked worker processes, each with its own emulator and
+// its own synchronize_to_stream().
+//
+// Each worker starts JOBS_OVERLAP samples before its chunk, so it has
+// locked on to the instruction stream by the time the chunk starts, and
+// carries on JOBS_OVERLAP samples past the end. Within these overlaps the
+// output is grouped per instruction, tagged with the instruction's sample
+// number and a hash of the emulator state after it. At the first
+// instruction past the end of its chunk, the worker also saves the
+// emulator state (and memory model) as a checkpoint.
+//
+// The parent then stitches the chunks together, in order, at the first
+// instruction after each boundary where both chunks agree on the sample
+// number and the emulator state. From there on the later chunk's emulation
+// is the same as the earlier one's, so its output is the same as a serial
+// decode's. If they never agree (e.g. the later chunk never finds out a
+// register that the earlier one knows), the later chunk is decoded again,
+// by another worker, starting from the earlier chunk's checkpoint, so the
+// chunks are joined there instead. In the worst case, that makes the
+// decode serial, but the output is always the same.
+//
+// Sample numbers (as in the output) include any --skip, whereas the chunks
+// are relative to it.
+
+#define JOBS_OVERLAP (256 * 1024)
+
+// Outside of the overlaps, the output of many instructions is grouped
+#define GROUP_TEXT_SIZE (64 * 1024)
+
+typedef struct {
+   uint64_t first; // First sample of the chunk
+   uint64_t end;   // First sample of the next chunk
+   FILE    *file;
+   FILE    *state; // Checkpoint: the sample number, then the state before it
+   pid_t    pid;
+} chunk_t;
+
+// An instruction of the earlier chunk, after a boundary
+typedef struct {
+   uint64_t sample;
+   uint64_t hash;
+   long     offset;
+} tail_t;
+
+static chunk_t *chunks;
+static int num_chunks;
+
+static arguments_t *run_args;
+static jobs_decode_fn run_decode;
+static uint64_t length;
+static uint64_t skip;
+
+// In a worker, the samples that are grouped per instruction
+static uint64_t head_start = 0;
+static uint64_t head_end   = 0;
+static uint64_t tail_start = UINT64_MAX;
+
+// In a worker, where to save the checkpoint (or NULL once it's been saved)
+static FILE *state_file = NULL;
+
+// In a worker, the sample number of the last instruction, and the number of
+// instructions in the current group
+static uint64_t last_sample = 0;
+static uint32_t group_count = 0;
+
+static inline int in_overlap(uint64_t sample) {
+   return (sample >= head_start && sample < head_end) || sample >= tail_start;
+}
+
+// The hash covers the whole emulator context, not just the registers
+// shown, so that matching states really do decode the same from there on
+
+static uint64_t hash_state(int pc, const uint8_t *context, int len) {
+   // FNV-1a
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   const uint8_t *p = (const uint8_t *) &pc;
+   for (size_t i = 0; i < sizeof(pc); i++) {
+      hash = (hash ^ p[i]) * 0x100000001b3ULL;
+   }
+   for (int i = 0; i < len; i++) {
+      hash = (hash ^ context[i]) * 0x100000001b3ULL;
+   }
+   // Zero means no hash
+   return hash ? hash : 1;
+}
+
+// ====================================================================
+// Worker
+// ====================================================================
+
+// Decodes chunk k, from the start of its head overlap, or if resume is
+// given (the previous chunk's checkpoint, taken at sample resume_sample)
+// from there
+
+static void run_worker(int k, FILE *resume, uint64_t resume_sample) {
+   chunk_t *chunk = chunks + k;
+   uint64_t start = k > 0 ? chunk->first - JOBS_OVERLAP : 0;
+   uint64_t stop = k < num_chunks - 1 ? chunk->end + JOBS_OVERLAP : length;
+   if (resume) {
+      start = resume_sample;
+      if (fseek(resume, sizeof(uint64_t), SEEK_SET) < 0) {
+         _exit(1);
+      }
+   } else if (k > 0) {
+      head_start = chunk->first;
+      head_end   = chunk->first + JOBS_OVERLAP;
+   }
+   if (k < num_chunks - 1) {
+      tail_start = chunk->end;
+      state_file = chunk->state;
+   }
+   capture_set_range(start, stop - start, run_args->byte ? 1 : 2);
+   output_start_groups(chunk->file);
+   (*run_decode)(start, resume);
+   // Anything after the last instruction
+   output_group(UINT64_MAX, 0, group_count);
+   fflush(chunk->file);
+   if (state_file || (chunk->state && fflush(chunk->state))) {
+      // The checkpoint wasn't saved
+      _exit(1);
+   }
+   _exit(ferror(chunk->file) ? 1 : 0);
+}
+
+// Called before each instruction, with the emulator in the state before it
+
+void jobs_begin_instruction(uint64_t sample, cpu_emulator_t *em, void *em_ctx, memory_t *mem) {
+   sample -= skip;
+   // Start a new group on entering an overlap
+   if (in_overlap(sample) && group_count > 0) {
+      output_group(last_sample, 0, group_count);
+      group_count = 0;
+   }
+   if (state_file && sample >= tail_start) {
+      if (fwrite(&sample, sizeof(sample), 1, state_file) != 1 || state_write(state_file, em, em_ctx, mem) < 0) {
+         _exit(1);
+      }
+      state_file = NULL;
+   }
+}
+
+void jobs_end_instruction(uint64_t sample, int pc, cpu_emulator_t *em, void *em_ctx) {
+   sample -= skip;
+   last_sample = sample;
+   group_count++;
+   if (in_overlap(sample)) {
+      uint8_t context[MAX_CONTEXT_SIZE];
+      int len = em->save_context(em_ctx, context);
+      output_group(sample, hash_state(pc, context, len), group_count);
+      group_count = 0;
+   } else if (output_group_pending() >= GROUP_TEXT_SIZE) {
+      output_group(sample, 0, group_count);
+      group_count = 0;
+   }
+}
+
+// ====================================================================
+// Stitching
+// ====================================================================
+
+static int read_group(FILE *file, output_group_t *group, long *offset) {
+   *offset = ftell(file);
+   return fread(group, sizeof(output_group_t), 1, file) == 1;
+}
+
+static void skip_text(FILE *file, output_group_t *group) {
+   fseek(file, group->len, SEEK_CUR);
+}
+
+static void copy_text(FILE *file, output_group_t *group) {
+   char buffer[GROUP_TEXT_SIZE];
+   size_t len = group->len;
+   while (len > 0) {
+      size_t n = fread(buffer, 1, len < sizeof(buffer) ? len : sizeof(buffer), file);
+      if (n == 0) {
+         break;
+      }
+      output_write(buffer, n);
+      len -= n;
+   }
+}
+
+static int wait_chunk(int k) {
+   int status;
+   if (waitpid(chunks[k].pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+      fprintf(stderr, "--jobs worker for chunk %d failed\n", k);
+      return -1;
+   }
+   chunks[k].pid = 0;
+   rewind(chunks[k].file);
+   return 0;
+}
+
+// Creates chunk k's files, and starts its worker
+
+static int start_chunk(int k, FILE *resume, uint64_t resume_sample) {
+   chunk_t *chunk = chunks + k;
+   chunk->file = tmpfile();
+   if (!chunk->file) {
+      perror("failed to create --jobs chunk file");
+      return -1;
+   }
+   if (k < num_chunks - 1) {
+      chunk->state = tmpfile();
+      if (!chunk->state) {
+         perror("failed to create --jobs checkpoint file");
+         return -1;
+      }
+   }
+   chunk->pid = fork();
+   if (chunk->pid == 0) {
+      run_worker(k, resume, resume_sample);
+   } else if (chunk->pid < 0) {
+      perror("failed to start --jobs worker");
+      chunk->pid = 0;
+      return -1;
+   }
+   return 0;
+}
+
+static void close_chunk(int k) {
+   if (chunks[k].file) {
+      fclose(chunks[k].file);
+      chunks[k].file = NULL;
+   }
+   if (chunks[k].state) {
+      fclose(chunks[k].state);
+      chunks[k].state = NULL;
+   }
+}
+
+// Decodes chunk k again, starting from chunk k - 1's checkpoint. Returns the
+// sample number of the last instruction to take from chunk k - 1.
+
+static int redo_chunk(int k, uint64_t *stitch_sample) {
+   FILE *resume = chunks[k - 1].state;
+   uint64_t sample;
+   rewind(resume);
+   if (fread(&sample, sizeof(sample), 1, resume) != 1) {
+      fprintf(stderr, "failed to read --jobs checkpoint for chunk %d\n", k - 1);
+      return -1;
+   }
+   close_chunk(k);
+   if (start_chunk(k, resume, sample) < 0 || wait_chunk(k) < 0) {
+      return -1;
+   }
+   *stitch_sample = sample - 1;
+   return 0;
+}
+
+// Returns the sample number of the last instruction to take from the
+// earlier chunk; the later chunk continues with the instruction after it.
+// Returns UINT64_MAX if the chunks never agree.
+
+static uint64_t find_stitch(int k, tail_t *tail, size_t num_tail) {
+   FILE *file = chunks[k].file;
+   uint64_t boundary = chunks[k].first;
+   output_group_t group;
+   long offset;
+   size_t i = 0;
+   while (read_group(file, &group, &offset)) {
+      skip_text(file, &group);
+      if (group.sample < boundary || group.hash == 0) {
+         continue;
+      }
+      if (group.sample >= boundary + JOBS_OVERLAP) {
+         break;
+      }
+      while (i < num_tail && tail[i].sample < group.sample) {
+         i++;
+      }
+      if (i == num_tail) {
+         break;
+      }
+      if (tail[i].sample == group.sample && tail[i].hash == group.hash) {
+         return group.sample;
+      }
+   }
+   return UINT64_MAX;
+}
+
+static int stitch(uint64_t *num_instructions) {
+   uint64_t total = 0;
+   uint64_t stitch_sample = 0;
+   tail_t *tail = NULL;
+   size_t tail_size = 0;
+   if (wait_chunk(0) < 0) {
+      return -1;
+   }
+   for (int k = 0; k < num_chunks; k++) {
+      FILE *file = chunks[k].file;
+      int last = (k == num_chunks - 1);
+      size_t num_tail = 0;
+      output_group_t group;
+      long offset;
+      while (read_group(file, &group, &offset)) {
+         if (k > 0 && group.sample <= stitch_sample) {
+            // Already covered by the previous chunk
+            skip_text(file, &group);
+         } else if (last || group.sample < chunks[k].end) {
+            copy_text(file, &group);
+            total += group.count;
+         } else {
+            // After the boundary, so remember it for stitching
+            if (group.sample != UINT64_MAX) {
+               if (num_tail == tail_size) {
+                  tail_size = tail_size ? 2 * tail_size : 4096;
+                  tail = realloc(tail, tail_size * sizeof(tail_t));
+                  if (!tail) {
+                     fprintf(stderr, "failed to allocate --jobs stitching buffer\n");
+                     return -1;
+                  }
+               }
+               tail[num_tail].sample = group.sample;
+               tail[num_tail].hash   = group.hash;
+               tail[num_tail].offset = offset;
+               num_tail++;
+            }
+            skip_text(file, &group);
+         }
+      }
+      if (!last) {
+         if (wait_chunk(k + 1) < 0) {
+            free(tail);
+            return -1;
+         }
+         stitch_sample = find_stitch(k + 1, tail, num_tail);
+         if (stitch_sample == UINT64_MAX && redo_chunk(k + 1, &stitch_sample) < 0) {
+            free(tail);
+            return -1;
+         }
+         rewind(chunks[k + 1].file);
+         // Output the earlier chunk up to the stitch
+         if (num_tail > 0) {
+            fseek(file, tail[0].offset, SEEK_SET);
+            while (read_group(file, &group, &offset) && group.sample <= stitch_sample) {
+               copy_text(file, &group);
+               total += group.count;
+            }
+         }
+      }
+      close_chunk(k);
+   }
+   free(tail);
+   *num_instructions = total;
+   return 0;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+// Returns the number of chunks decoded, zero if the capture can't be
+// split (so should be decoded serially), or -1 on failure.
+
+int jobs_run(arguments_t *args, jobs_decode_fn decode_chunk, uint64_t *num_instructions) {
+   run_args   = args;
+   run_decode = decode_chunk;
+   length     = capture_length(args->byte ? 1 : 2);
+   skip       = args->skip;
+
+   // Each chunk must be at least twice the overlap
+   uint64_t max_chunks = length / (2 * JOBS_OVERLAP);
+   num_chunks = (uint64_t) args->jobs < max_chunks ? args->jobs : (int) max_chunks;
+   if (num_chunks < 2) {
+      return 0;
+   }
+
+   chunks = calloc(num_chunks, sizeof(chunk_t));
+   if (!chunks) {
+      return 0;
+   }
+   for (int k = 0; k < num_chunks; k++) {
+      chunks[k].first = length * k / num_chunks;
+      chunks[k].end   = length * (k + 1) / num_chunks;
+   }
+
+   // Nothing buffered should be written twice
+   output_flush();
+
+   int ret = 0;
+   for (int k = 0; k < num_chunks; k++) {
+      if (start_chunk(k, NULL, 0) < 0) {
+         ret = -1;
+         break;
+      }
+   }
+
+   if (ret == 0 && stitch(num_instructions) == 0) {
+      ret = num_chunks;
+   } else {
+      ret = -1;
+   }
+
+   // Clean up after any failure
+   for (int k = 0; k < num_chunks; k++) {
+      if (chunks[k].pid > 0) {
+         kill(chunks[k].pid, SIGKILL);
+         waitpid(chunks[k].pid, NULL, 0);
+      }
+      close_chunk(k);
+   }
+   free(chunks);
+   chunks = NULL;
+   return ret;
+}
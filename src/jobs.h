@@ -0,0 +1,19 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "defs.h"
+
+// Decodes the samples of one chunk, sample first onwards (after any skip),
+// starting from the emulator state in the given file (if not NULL)
+typedef void (*jobs_decode_fn)(uint64_t first, FILE *state);
+
+int jobs_run(arguments_t *args, jobs_decode_fn decode_chunk, uint64_t *num_instructions);
+
+void jobs_begin_instruction(uint64_t sample, cpu_emulator_t *em, void *em_ctx, memory_t *mem);
+
+void jobs_end_instruction(uint64_t sample, int pc, cpu_emulator_t *em, void *em_ctx);
+
+#endif
@@ -4,10 +4,29 @@
 #include <argp.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include "defs.h"
 #include "em_6809.h"
 #include "memory.h"
+#include "capture.h"
+#include "output.h"
+#include "spsc.h"
+#include "jobs.h"
+#include "trace.h"
+#include "index.h"
+#include "state.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "irqstats.h"
+#include "timeline.h"
+#include "coverage.h"
 
 // #define DEBUG_SYNC
 
@@ -27,11 +46,50 @@
 
 #define DEFAULT_BLOCK (8*1024*1024)
 
-// Sample buffer base and rd/wr pointers
+// Sample ring buffer base and rd/wr pointers
+//
+// The ring is mapped twice, back to back, so sample_q[i] and
+// sample_q[i + ring_size] are the same sample. Any run of up to
+// ring_size samples starting at sample_rd is then contiguous, and
+// the decoder can look ahead across the wrap without any copying.
 static sample_t *sample_q;
 static sample_t *sample_wr;
 static sample_t *sample_rd;
 
+// Ring size (in samples), and whether the second mapping is a true alias
+// (if not, each sample is written to both halves)
+static size_t ring_size;
+static int ring_aliased;
+
+// Total number of samples written to and read from the ring
+static uint64_t num_wr;
+static uint64_t num_rd;
+
+// Most samples just need to be stored in the ring. Until num_wr reaches
+// wr_check, queue_sample() does only that (see set_wr_check()).
+static uint64_t wr_check;
+
+// Sample count of the first sample written to the ring
+static uint64_t sample_q_count;
+
+// The ring has a small guard band after the last sample, which is cleared
+// at the end of the stream, so instructions that look slightly beyond the
+// end see the same (zero) samples however much the ring has wrapped.
+
+#define TAIL_GUARD (4 * LONGEST_INSTRUCTION)
+
+// With --pipeline, the samples are extracted on one thread and emulated on
+// another, and the ring is the queue between them. The ring is then a block
+// larger, so extraction can run a block ahead of the emulation. The writer
+// publishes num_wr every PUBLISH_INTERVAL samples (and at the end of the
+// stream), and the reader publishes num_rd after each block.
+
+#define PUBLISH_INTERVAL 4096 // Must be a power of 2
+
+static atomic_uint_fast64_t pipe_wr;
+static atomic_uint_fast64_t pipe_rd;
+static atomic_int           pipe_eof;
+
 // Small skew buffer to allow the data bus samples to be taken early or late
 
 #define SKEW_BUFFER_SIZE  32 // Must be a power of 2
@@ -47,11 +105,18 @@ static sample_t *sample_rd;
 // to a value of undefined (?).
 #define UNDEFINED -1
 
-#define BUFSIZE 8192
-
-uint8_t buffer8[BUFSIZE];
+const char *output_format_names[] = {
+   "text",
+   "binary",
+   0
+};
 
-uint16_t buffer[BUFSIZE];
+const char *heatmap_format_names[] = {
+   "csv",
+   "pages",
+   "binary",
+   0
+};
 
 const char *machine_names[] = {
    "default",
@@ -74,23 +139,43 @@ const char default_fwa[] = "\?\?-\?\?:\?\?\?\?\?\?\?\?:\?\?:\?\? = \?\?\?\?\?\?\
 
 static char fwabuf[80];
 
-static char disbuf[1024];
-
 static cpu_emulator_t *em;
 
+// The emulator and memory model used for decoding (sync trials have their own)
+static void *em_ctx;
+
+static memory_t *mem;
 
-// This is a global, so it's visible to the emulator functions
 arguments_t arguments;
 
-// This is a global, so it's visible to the emulator functions
 int triggered = 0;
 
-// indicate state prediction failed
-uint32_t failflag = 0;
-
 // count of total number of instructions
 uint64_t num_instructions = 0;
 
+// With --from-sample or --from-pc-occurrence, the output is muted until the
+// target instruction is reached (seek_occurrence counts down the executions
+// of from_pc)
+static int seeking = 0;
+static uint64_t seek_occurrence;
+
+// Set when decoding starts from an index checkpoint, or a saved state,
+// which is already synchronized to the instruction stream
+static int resumed = 0;
+
+// With --load-state, any samples left over from the previous capture are
+// decoded first
+static state_position_t start_position;
+
+// With --save-state, the emulator state before each instruction near the
+// end of the capture is kept (along with a memory snapshot), so if the last
+// instruction is cut off, the state before it is saved along with its
+// samples
+static uint8_t end_context[MAX_CONTEXT_SIZE];
+static int end_context_len;
+static state_position_t end_position;
+static int end_cut_off = 0;
+
 // ====================================================================
 // Argp processing
 // ====================================================================
@@ -108,6 +193,9 @@ FILENAME must be a binary capture file containing:\n\
 \n\
 If FILENAME is omitted, stdin is read instead.\n\
 \n\
+The capture may be gzip, zstd or lz4 compressed (if support for these was\n\
+available at build time), in which case it is decompressed on the fly.\n\
+\n\
 The default sample bit assignments for the 6809 signals are:\n\
  - data: bit  0 (assumes 8 consecutive bits)\n\
  -  rnw: bit  8\n\
@@ -127,6 +215,81 @@ instruction stream.\n\
 \n\
 If --debug=1 is specified, each instruction is preceeded by it\'s sample values.\n\
 \n\
+With --pipeline, reading the capture, extracting the bus samples, emulating\n\
+and formatting the output each run on a separate thread. The output is the\n\
+same as without it.\n\
+\n\
+With --jobs=N, a capture file is split into N chunks which are decoded in\n\
+parallel, and stitched back together where the decoders agree on the\n\
+instruction boundary and emulator state. Where they don't, the later chunk\n\
+is decoded again from the state at the end of the earlier one, so the output\n\
+is the same as a serial decode. This needs an uncompressed capture file (not\n\
+stdin), and can't be used with --clke, --trigger, --pipeline or memory\n\
+modelling.\n\
+\n\
+With --output-format=binary, the output is a compact binary trace, with a\n\
+record for every instruction, including the register state. Any other\n\
+output (e.g. memory logging) is included as text records. The format is\n\
+described in src/trace.h, along with functions for reading it. This can't\n\
+be used with --jobs.\n\
+\n\
+With --index=FILE, an index of checkpoints (one every --index-interval\n\
+instructions) is written while decoding. A later decode of the same capture\n\
+with --index=FILE and --from-sample=HEX, or --from-pc-occurrence=ADDR,K (the\n\
+K\'th execution of ADDR), starts at the nearest checkpoint, and the output\n\
+starts at that instruction. This can't be used with --clke, --trigger or\n\
+--jobs.\n\
+\n\
+With --save-state=FILE, the emulator and memory model state at the end of\n\
+the capture is saved. Decoding the next capture (e.g. the next segment of a\n\
+long capture) with --load-state=FILE then carries on from there, without\n\
+having to synchronize to the instruction stream again. These can't be used\n\
+with --jobs, and --load-state can't be used with --trigger or --index.\n\
+\n\
+With --profile[=N], nothing is output for each instruction. Instead the\n\
+executions and cycles of each instruction (by address, and on the Beeb by\n\
+sideways ROM) are counted, and the top N (default 50, or 0 for all) are\n\
+listed at the end, most cycles first. The inclusive cycles of an\n\
+instruction add the cycles of any interrupts taken at it, up to the RTI.\n\
+This can't be used with --jobs.\n\
+\n\
+With --callgraph=FILE, the calls and returns are followed instead, and the\n\
+cycles of each chain of calls are written to FILE as collapsed stacks (the\n\
+input to flame graph tools). Interrupts are shown as separate chains. The\n\
+top N functions (as for --profile) are listed at the end, with their\n\
+exclusive and inclusive cycles. This can't be used with --jobs either.\n\
+\n\
+With --irq-stats, the interrupts taken are measured instead, and for each\n\
+vector (FIRQ, IRQ and NMI) log-scaled histograms of the dispatch latency\n\
+(from the end of the interrupted instruction, or the CWAI wake up, to the\n\
+handler), the service time (to the end of the RTI) and the nesting depth\n\
+are shown at the end, with p50, p99 and max. This can't be used with --jobs.\n\
+\n\
+With --heatmap=FILE, the reads and writes of each memory location are counted\n\
+by access type (instruction, pointer, data and stack), and written to FILE\n\
+at the end. Banked memory (e.g. sideways ROM) is counted by bank. With\n\
+--heatmap-format=csv (the default) there is a row for each location that\n\
+was accessed, with pages there is a row for each 256-byte page, and binary\n\
+is a compact form described in src/memory.c. Instructions run before the PC\n\
+is known are counted once it is, if they led to it in sequence, but those\n\
+followed by a jump or branch that leaves the PC unknown aren't counted (nor\n\
+are accesses to unknown addresses). This can't be used with --jobs.\n\
+\n\
+With --timeline=FILE, a timeline of the interrupts (until their RTI), SYNC\n\
+and CWAI waits and resets is written to FILE as it's decoded, in the Chrome\n\
+trace event format (for chrome://tracing or Perfetto), timed in samples.\n\
+With --timeline-symbols=FILE (lines of a hex address and a name), calls to\n\
+those addresses are shown too, until they return. This can't be used with\n\
+--jobs.\n\
+\n\
+With --coverage=FILE, the locations executed (as opcodes or operands) and\n\
+read as data are recorded, and at the end the coverage of the ROM image in\n\
+FILE is shown, overall and for each 1KB, with the ranges never executed.\n\
+The ROM is at the top of memory unless --coverage-addr=HEX is given (on the\n\
+Beeb a sideways ROM is given with its bank, e.g. F-8000). As with\n\
+--heatmap, code run while the PC is unknown may be missed. This can't be\n\
+used with --jobs.\n\
+\n\
 The --mem= option controls the memory access logging and modelling. The value\n\
 is three hex nibbles: WRM, where W controls write logging, R controls read\n\
 logging, and M controls modelling.\n\
@@ -165,7 +328,7 @@ enum {
    KEY_TRIGGER = 't',
    KEY_CYCLES = 'y',
    KEY_SAMPLES = 'Y',
-   KEY_VECRST = 1,
+   KEY_VECRST = 256,           // Above the characters, so there are no short options
    KEY_MEM,
    KEY_REG_S,
    KEY_REG_U,
@@ -186,7 +349,25 @@ enum {
    KEY_BS,
    KEY_BA,
    KEY_ADDR,
-   KEY_CLKE
+   KEY_CLKE,
+   KEY_PIPELINE,
+   KEY_JOBS,
+   KEY_OUTPUT_FORMAT,
+   KEY_INDEX,
+   KEY_INDEX_INTERVAL,
+   KEY_FROM_SAMPLE,
+   KEY_FROM_PC,
+   KEY_SAVE_STATE,
+   KEY_LOAD_STATE,
+   KEY_PROFILE,
+   KEY_CALLGRAPH,
+   KEY_IRQ_STATS,
+   KEY_HEATMAP,
+   KEY_HEATMAP_FORMAT,
+   KEY_TIMELINE,
+   KEY_TIMELINE_SYMBOLS,
+   KEY_COVERAGE,
+   KEY_COVERAGE_ADDR
 };
 
 
@@ -227,6 +408,14 @@ static struct argp_option options[] = {
    { "skip",          KEY_SKIP,     "HEX", OPTION_ARG_OPTIONAL, "Skip the first n samples",                          GROUP_GENERAL},
    { "block",        KEY_BLOCK,     "HEX", OPTION_ARG_OPTIONAL, "Set the buffer block size (default=800000)",        GROUP_GENERAL},
    { "skew",          KEY_SKEW,    "SKEW", OPTION_ARG_OPTIONAL, "Skew the data bus by +/- n samples",                GROUP_GENERAL},
+   { "pipeline",  KEY_PIPELINE,         0,                   0, "Decode using a pipeline of threads",                GROUP_GENERAL},
+   { "jobs",          KEY_JOBS,       "N",                   0, "Decode in N chunks in parallel",                    GROUP_GENERAL},
+   { "index",        KEY_INDEX,    "FILE",                   0, "Write (or with --from-..., use) an index",          GROUP_GENERAL},
+   { "index-interval", KEY_INDEX_INTERVAL, "N",               0, "Instructions per index checkpoint (default 1000000)", GROUP_GENERAL},
+   { "from-sample", KEY_FROM_SAMPLE, "HEX",                   0, "Start the output at sample n, using the index",     GROUP_GENERAL},
+   { "from-pc-occurrence", KEY_FROM_PC, "ADDR,K",             0, "Start the output at the k'th execution of addr",    GROUP_GENERAL},
+   { "save-state", KEY_SAVE_STATE, "FILE",                   0, "Save the state at the end of the capture",          GROUP_GENERAL},
+   { "load-state", KEY_LOAD_STATE, "FILE",                   0, "Carry on from a saved state",                       GROUP_GENERAL},
 
    { 0, 0, 0, 0, "Register options:", GROUP_REGISTER},
    { "reg_s",        KEY_REG_S,     "HEX", OPTION_ARG_OPTIONAL, "Initial value of the S register",                   GROUP_REGISTER},
@@ -251,6 +440,16 @@ static struct argp_option options[] = {
    { "fundoc",      KEY_FUNDOC,         0,                   0, "Fail on undocumented instruction",                  GROUP_OUTPUT},
    { "fbadmode",  KEY_FBADMODE,         0,                   0, "Fail on undefined index addressing mode",           GROUP_OUTPUT},
    { "fsyncbug",  KEY_FSYNCBUG,         0,                   0, "Fail on incorrect flags after sync bug",            GROUP_OUTPUT},
+   { "output-format", KEY_OUTPUT_FORMAT, "FORMAT",            0, "Output format (text or binary)",                    GROUP_OUTPUT},
+   { "profile",    KEY_PROFILE,       "N", OPTION_ARG_OPTIONAL, "Profile, listing the top N instructions (default 50)", GROUP_OUTPUT},
+   { "callgraph", KEY_CALLGRAPH,   "FILE",                   0, "Profile by call chain, writing collapsed stacks",   GROUP_OUTPUT},
+   { "irq-stats", KEY_IRQ_STATS,        0,                   0, "Show interrupt latency and service time statistics", GROUP_OUTPUT},
+   { "heatmap",     KEY_HEATMAP,   "FILE",                   0, "Count the memory accesses, writing them to FILE",   GROUP_OUTPUT},
+   { "heatmap-format", KEY_HEATMAP_FORMAT, "FORMAT",         0, "Heatmap format (csv, pages or binary)",             GROUP_OUTPUT},
+   { "timeline",   KEY_TIMELINE,   "FILE",                   0, "Write a timeline (Chrome trace event JSON)",        GROUP_OUTPUT},
+   { "timeline-symbols", KEY_TIMELINE_SYMBOLS, "FILE",       0, "Show calls to these symbols in the timeline",       GROUP_OUTPUT},
+   { "coverage",   KEY_COVERAGE,   "FILE",                   0, "Show the coverage of the ROM image in FILE",        GROUP_OUTPUT},
+   { "coverage-addr", KEY_COVERAGE_ADDR, "[B-]HEX",          0, "Address (and bank) of the coverage ROM",            GROUP_OUTPUT},
 
    { 0, 0, 0, 0, "Signal defintion options:", GROUP_SIGDEFS},
 
@@ -426,12 +625,118 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
       }
       argp_error(state, "unsupported machine type");
       break;
+   case KEY_OUTPUT_FORMAT:
+      i = 0;
+      while (output_format_names[i]) {
+         if (strcasecmp(arg, output_format_names[i]) == 0) {
+            arguments->output_format = i;
+            return 0;
+         }
+         i++;
+      }
+      argp_error(state, "unsupported output format");
+      break;
    case KEY_DEBUG:
       arguments->debug = atoi(arg);
       break;
    case KEY_BYTE:
       arguments->byte = 1;
       break;
+   case KEY_PIPELINE:
+      arguments->pipeline = 1;
+      break;
+   case KEY_JOBS:
+      arguments->jobs = atoi(arg);
+      if (arguments->jobs < 1) {
+         argp_error(state, "--jobs must be at least 1");
+      }
+      break;
+   case KEY_INDEX:
+      arguments->index_file = arg;
+      break;
+   case KEY_INDEX_INTERVAL:
+      arguments->index_interval = atoi(arg);
+      if (arguments->index_interval < 1) {
+         argp_error(state, "--index-interval must be at least 1");
+      }
+      break;
+   case KEY_FROM_SAMPLE:
+      arguments->from_sample = strtoll(arg, (char **)NULL, 16);
+      if (arguments->from_sample < 0) {
+         argp_error(state, "--from-sample must not be negative");
+      }
+      break;
+   case KEY_FROM_PC:
+      {
+         char *addr  = strtok(arg, ",");
+         char *count = strtok(NULL, ",");
+         if (!addr || !count) {
+            argp_error(state, "--from-pc-occurrence needs an address and a count");
+         }
+         arguments->from_pc = strtol(addr, (char **)NULL, 16) & 0xffff;
+         arguments->from_occurrence = strtoull(count, (char **)NULL, 10);
+         if (arguments->from_occurrence < 1) {
+            argp_error(state, "--from-pc-occurrence count must be at least 1");
+         }
+      }
+      break;
+   case KEY_SAVE_STATE:
+      arguments->save_state = arg;
+      break;
+   case KEY_LOAD_STATE:
+      arguments->load_state = arg;
+      break;
+   case KEY_COVERAGE:
+      arguments->coverage_file = arg;
+      break;
+   case KEY_COVERAGE_ADDR:
+      if (strchr(arg, '-')) {
+         arguments->coverage_bank = strtol(arg, (char **)NULL, 16);
+         arg = strchr(arg, '-') + 1;
+         if (arguments->coverage_bank < 0 || arguments->coverage_bank > 15) {
+            argp_error(state, "--coverage-addr bank must be 0-F");
+         }
+      }
+      arguments->coverage_addr = strtol(arg, (char **)NULL, 16);
+      if (arguments->coverage_addr < 0 || arguments->coverage_addr > 0xffff) {
+         argp_error(state, "--coverage-addr must be 0000-FFFF");
+      }
+      break;
+   case KEY_TIMELINE:
+      arguments->timeline_file = arg;
+      break;
+   case KEY_TIMELINE_SYMBOLS:
+      arguments->timeline_symbols = arg;
+      break;
+   case KEY_HEATMAP:
+      arguments->heatmap_file = arg;
+      break;
+   case KEY_HEATMAP_FORMAT:
+      i = 0;
+      while (heatmap_format_names[i]) {
+         if (strcasecmp(arg, heatmap_format_names[i]) == 0) {
+            arguments->heatmap_format = i;
+            return 0;
+         }
+         i++;
+      }
+      argp_error(state, "unsupported heatmap format");
+      break;
+   case KEY_IRQ_STATS:
+      arguments->irq_stats = 1;
+      break;
+   case KEY_CALLGRAPH:
+      arguments->callgraph_file = arg;
+      break;
+   case KEY_PROFILE:
+      arguments->profile = 1;
+      if (arg && strlen(arg) > 0) {
+         arguments->profile_top = atoi(arg);
+         if (arguments->profile_top < 0) {
+            argp_error(state, "--profile must not be negative");
+         }
+      }
+      break;
    case KEY_QUIET:
       arguments->show_address = 0;
       arguments->show_hex = 0;
@@ -513,12 +818,20 @@ static struct argp argp = { options, parse_opt, args_doc, doc, 0, 0, 0 };
 // ====================================================================
 
 
+static inline uint64_t get_sample_index(sample_t *sample) {
+   return sample_q_count + num_rd + (sample - sample_rd);
+}
+
+static inline uint32_t get_sample_count(sample_t *sample) {
+   return get_sample_index(sample);
+}
+
 static void dump_samples(sample_t *sample_q, int n) {
    char buffer[100];
    for (int i = 0; i < n; i++) {
       sample_t *sample = sample_q + i;
       char *bp = buffer;
-      write_hex8(bp, sample->sample_count);
+      write_hex8(bp, get_sample_count(sample));
       bp += 8;
       *bp++ = ' ';
       write_hex2(bp, i);
@@ -536,7 +849,7 @@ static void dump_samples(sample_t *sample_q, int n) {
       *bp++ = ' ';
       *bp++ = sample->addr >= 0 ? sample->addr + (sample->addr < 10 ? '0' : 'A' - 10) : '?';
       *bp++ = 0;
-      puts(buffer);
+      output_line(buffer);
    }
 }
 
@@ -587,14 +900,14 @@ int write_s(char *buffer, const char *s) {
 
 static char *get_fwa(int a_sign, int a_exp, int a_mantissa, int a_round, int a_overflow) {
    strcpy(fwabuf, default_fwa);
-   int sign     = em->read_memory(a_sign);
-   int exp      = em->read_memory(a_exp);
-   int man1     = em->read_memory(a_mantissa);
-   int man2     = em->read_memory(a_mantissa + 1);
-   int man3     = em->read_memory(a_mantissa + 2);
-   int man4     = em->read_memory(a_mantissa + 3);
-   int round    = em->read_memory(a_round);
-   int overflow = a_overflow >= 0 ? em->read_memory(a_overflow) : -1;
+   int sign     = em->read_memory(em_ctx, a_sign);
+   int exp      = em->read_memory(em_ctx, a_exp);
+   int man1     = em->read_memory(em_ctx, a_mantissa);
+   int man2     = em->read_memory(em_ctx, a_mantissa + 1);
+   int man3     = em->read_memory(em_ctx, a_mantissa + 2);
+   int man4     = em->read_memory(em_ctx, a_mantissa + 3);
+   int round    = em->read_memory(em_ctx, a_round);
+   int overflow = a_overflow >= 0 ? em->read_memory(em_ctx, a_overflow) : -1;
    if (sign >= 0) {
       write_hex2(fwabuf + OFFSET_SIGN, sign);
    }
@@ -651,17 +964,190 @@ static char *get_fwa(int a_sign, int a_exp, int a_mantissa, int a_round, int a_o
    return fwabuf;
 }
 
+// Everything needed to format the output line for one instruction, so
+// the formatting can be deferred to another thread (with --pipeline)
+
+typedef struct {
+   instruction_t instruction;
+   cpu_state_t   state;
+   uint64_t      sample_count;
+   uint32_t      fail;
+   int           num_cycles;
+   char          bankid[2];
+   char          fwa[100]; // Only present with --bbcfwa
+} instr_record_t;
+
+static int format_instruction(char *buffer, const void *record) {
+   const instr_record_t *r = record;
+   instruction_t instruction = r->instruction;
+   int fail = r->fail;
+   int pc = instruction.pc;
+   char *bp = buffer;
+   int numchars = 0;
+
+   // Show cumulative sample number
+   if (arguments.show_samplenums) {
+      bp += sprintf(bp, "%08X", (uint32_t) r->sample_count);
+      *bp++ = ' ';
+      *bp++ = ':';
+      *bp++ = ' ';
+   }
+   // Show address
+   if (fail || arguments.show_address) {
+      if (arguments.show_romno) {
+         *bp++ = r->bankid[0];
+         *bp++ = r->bankid[1];
+      }
+      if (pc < 0) {
+         *bp++ = '?';
+         *bp++ = '?';
+         *bp++ = '?';
+         *bp++ = '?';
+      } else {
+         write_hex4(bp, pc);
+         bp += 4;
+      }
+      *bp++ = ' ';
+      *bp++ = ':';
+      *bp++ = ' ';
+   }
+   // Show hex bytes
+   if (fail || arguments.show_hex) {
+      for (int i = 0; i < instruction.length; i++) {
+         write_hex2(bp, instruction.instr[i]);
+         bp += 2;
+         *bp++ = ' ';
+      }
+      for (int i = 0; i < 3 * (5 - instruction.length); i++) {
+         *bp++ = ' ';
+      }
+      *bp++ = ':';
+      *bp++ = ' ';
+   }
+
+   // Show instruction disassembly
+   if (fail || arguments.show_something) {
+      if (instruction.rst_seen) {
+         numchars = write_s(bp, "RESET !!");
+      } else if (instruction.intr_seen) {
+         numchars = write_s(bp, "INTERRUPT !!");
+      } else {
+         numchars = em->disassemble(em_ctx, bp, &instruction);
+      }
+      bp += numchars;
+   }
+
+   // Pad if there is more to come
+   if (fail || arguments.show_cycles || arguments.show_state || arguments.show_bbcfwa) {
+      while (numchars++ < 20) {
+         *bp++ = ' ';
+      }
+   }
+   // Show cycles (don't include with fail as it is inconsistent depending on whether rdy is present)
+   if (arguments.show_cycles) {
+      *bp++ = ' ';
+      *bp++ = ':';
+      bp += sprintf(bp, "%4d", r->num_cycles);
+   }
+   // Show register state
+   if (fail || arguments.show_state) {
+      *bp++ = ' ';
+      *bp++ = ':';
+      *bp++ = ' ';
+      bp = em->get_state(bp, &r->state);
+   }
+   // Show BBC floating point work area FWA, FWB
+   if (arguments.show_bbcfwa) {
+      bp += write_s(bp, r->fwa);
+   }
+   // Show any errors
+   if (fail) {
+      bp += em->write_fail(bp, fail);
+   }
+   return bp - buffer;
+}
+
+// With --output-format=binary, each record is instead encoded as a trace
+// record, delta encoded against the previous one
+
+static trace_encoder_t trace_encoder;
+
+static int format_binary(char *buffer, const void *record) {
+   const instr_record_t *r = record;
+   const instruction_t *instruction = &r->instruction;
+   trace_record_t t;
+   t.flags = (instruction->intr_seen ? TRACE_INTERRUPT : 0) | (instruction->rst_seen ? TRACE_RESET : 0);
+   t.sample = r->sample_count;
+   t.pc = instruction->pc;
+   t.length = instruction->length;
+   memcpy(t.bytes, instruction->instr, sizeof(t.bytes));
+   t.cycles = r->num_cycles;
+   t.fail = r->fail;
+   for (int i = 0; i < trace_encoder.num_regs; i++) {
+      t.regs[i] = r->state.reg[i];
+   }
+   return trace_encode_instruction(&trace_encoder, (uint8_t *)buffer, &t);
+}
+
+// What the memory model counts while decoding (see memory_set_counting())
+
+static int get_counting() {
+   return (arguments.heatmap_file ? COUNT_ACCESSES : 0) | (arguments.coverage_file ? COUNT_COVERAGE : 0);
+}
+
 static int analyze_instruction(sample_t *sample_q, int num_samples) {
    static int interrupt_depth = 0;
    static int skipping_interrupted = 0;
 
-   int oldpc = em->get_PC();
+   if (arguments.jobs > 1) {
+      jobs_begin_instruction(get_sample_index(sample_q), em, em_ctx, mem);
+   }
 
-   instruction_t instruction;
+   if (arguments.index_file) {
+      if (seeking) {
+         if (arguments.from_sample >= 0 && get_sample_index(sample_q) >= (uint64_t) arguments.from_sample) {
+            seeking = 0;
+            output_set_muted(0);
+            memory_set_counting(mem, get_counting());
+         }
+      } else {
+         index_begin_instruction(get_sample_index(sample_q), num_instructions, em, em_ctx, mem);
+      }
+   }
 
-   int num_cycles = em->emulate(sample_q, num_samples, &instruction);
+   int oldpc = em->get_PC(em_ctx);
 
-   if (num_cycles == CYCLES_TRUNCATED) {
+   // Less than a block of samples is only left at the end of the capture
+   int near_end = arguments.save_state && num_samples <= arguments.block;
+   if (near_end) {
+      end_context_len = em->save_context(em_ctx, end_context);
+      memory_snapshot(mem);
+      output_hold();
+   }
+
+   instr_record_t r;
+
+   instruction_t *instruction = &r.instruction;
+
+   int num_cycles = em->emulate(em_ctx, sample_q, num_samples, instruction);
+
+   // An instruction that uses every remaining sample (e.g. a CWAI or SYNC
+   // still waiting at the end of the capture) may also have been cut off
+   int cut_off = num_cycles == CYCLES_TRUNCATED || (near_end && num_cycles >= num_samples);
+   if (near_end) {
+      output_release(!cut_off);
+   }
+   if (cut_off) {
+      if (near_end) {
+         // Go back to before the instruction (discarding anything it
+         // logged), so it can be decoded again from the saved state
+         em->load_context(em_ctx, end_context, end_context_len);
+         memory_rollback(mem);
+         end_cut_off = 1;
+         end_position.sample = get_sample_index(sample_q);
+         end_position.pending = sample_q;
+         end_position.num_pending = num_samples;
+      }
       // Silently consume all remaining samples
       return num_samples;
    } else if (num_cycles <= 0) {
@@ -672,21 +1158,36 @@ static int analyze_instruction(sample_t *sample_q, int num_samples) {
    // Sanity check the pc prediction has not gone awry
    // (e.g. in JSR the emulation can use the stacked PC)
 
-   int pc = instruction.pc;
+   int pc = instruction->pc;
+
+   if (arguments.index_file) {
+      if (seeking) {
+         if (pc >= 0 && pc == arguments.from_pc && --seek_occurrence == 0) {
+            seeking = 0;
+            output_set_muted(0);
+            memory_set_counting(mem, get_counting());
+         }
+      } else {
+         index_end_instruction(pc);
+      }
+   }
+
+   uint32_t fail = 0;
 
    if (pc >= 0) {
       if (triggered && oldpc >= 0 && oldpc != pc) {
-         failflag |= FAIL_PC;
-         printf("pc: prediction failed at %04X old pc was %04X\n", pc, oldpc);
+         fail |= FAIL_PC;
+         output_printf("pc: prediction failed at %04X old pc was %04X\n", pc, oldpc);
       }
    }
 
    if (!triggered && pc >= 0 && pc == arguments.trigger_start) {
       triggered = 1;
-      printf("start trigger hit at sample %08x\n", sample_q->sample_count);
-      memory_set_modelling ( arguments.mem_model       & 0x0f);
-      memory_set_rd_logging((arguments.mem_model >> 4) & 0x0f);
-      memory_set_wr_logging((arguments.mem_model >> 8) & 0x0f);
+      output_printf("start trigger hit at sample %08x\n", get_sample_count(sample_q));
+      memory_set_modelling (mem,  arguments.mem_model       & 0x0f);
+      memory_set_rd_logging(mem, (arguments.mem_model >> 4) & 0x0f);
+      memory_set_wr_logging(mem, (arguments.mem_model >> 8) & 0x0f);
+      memory_set_counting  (mem, get_counting());
    }
    if (triggered && (arguments.debug & 1)) {
       dump_samples(sample_q, num_cycles);
@@ -697,116 +1198,70 @@ static int analyze_instruction(sample_t *sample_q, int num_samples) {
       if (interrupt_depth == 0) {
          skipping_interrupted = 0;
       }
-      if (instruction.intr_seen) {
+      if (instruction->intr_seen) {
          interrupt_depth++;
          skipping_interrupted = 1;
-      } else if (interrupt_depth > 0 && instruction.instr[0] == 0x3b) {
+      } else if (interrupt_depth > 0 && instruction->instr[0] == 0x3b) {
          // RTI seen
          interrupt_depth--;
       }
    }
 
-   int fail = em->get_and_clear_fail() & arguments.fail_mask;
+   fail = (fail | em->get_and_clear_fail(em_ctx)) & arguments.fail_mask;
 
-   // Try to minimise the calls to printf as these are quite expensive
+   // Capture just the state the output line needs; the line itself is
+   // formatted by format_instruction(), either now or on another thread
 
-   char *bp = disbuf;
+   if (arguments.timeline_file && triggered && !skipping_interrupted && !seeking) {
+      timeline_instruction(instruction, get_sample_index(sample_q), sample_q, num_cycles);
+   }
 
-   if ((fail | arguments.show_something) && triggered && !skipping_interrupted) {
-      int numchars = 0;
-      // Show cumulative sample number
-      if (arguments.show_samplenums) {
-         bp += sprintf(bp, "%08X", sample_q->sample_count);
-         *bp++ = ' ';
-         *bp++ = ':';
-         *bp++ = ' ';
-      }
-      // Show address
-      if (fail || arguments.show_address) {
-         if (arguments.show_romno) {
-            bp += write_bankid(bp, pc);
-         }
-         if (pc < 0) {
-            *bp++ = '?';
-            *bp++ = '?';
-            *bp++ = '?';
-            *bp++ = '?';
-         } else {
-            write_hex4(bp, pc);
-            bp += 4;
+   if (arguments.profile || arguments.callgraph_file || arguments.irq_stats) {
+      if (triggered && !skipping_interrupted && !seeking) {
+         int bank = memory_get_bank(mem, pc);
+         if (arguments.profile) {
+            profile_instruction(instruction, num_cycles, bank);
          }
-         *bp++ = ' ';
-         *bp++ = ':';
-         *bp++ = ' ';
-      }
-      // Show hex bytes
-      if (fail || arguments.show_hex) {
-         for (int i = 0; i < instruction.length; i++) {
-            write_hex2(bp, instruction.instr[i]);
-            bp += 2;
-            *bp++ = ' ';
+         if (arguments.callgraph_file) {
+            callgraph_instruction(instruction, num_cycles, bank);
          }
-         for (int i = 0; i < 3 * (5 - instruction.length); i++) {
-            *bp++ = ' ';
+         if (arguments.irq_stats) {
+            irqstats_instruction(instruction, sample_q, num_cycles);
          }
-         *bp++ = ':';
-         *bp++ = ' ';
       }
-
-      // Show instruction disassembly
-      if (fail || arguments.show_something) {
-         if (instruction.rst_seen) {
-            numchars = write_s(bp, "RESET !!");
-         } else if (instruction.intr_seen) {
-            numchars = write_s(bp, "INTERRUPT !!");
-         } else {
-            numchars = em->disassemble(bp, &instruction);
-         }
-         bp += numchars;
-      }
-
-      // Pad if there is more to come
-      if (fail || arguments.show_cycles || arguments.show_state || arguments.show_bbcfwa) {
-         while (numchars++ < 20) {
-            *bp++ = ' ';
-         }
-      }
-      // Show cycles (don't include with fail as it is inconsistent depending on whether rdy is present)
-      if (arguments.show_cycles) {
-         *bp++ = ' ';
-         *bp++ = ':';
-         bp += sprintf(bp, "%4d", num_cycles);
+   } else if ((fail | arguments.show_something) && triggered && !skipping_interrupted) {
+      r.sample_count = get_sample_index(sample_q);
+      r.fail = fail;
+      r.num_cycles = num_cycles;
+      if (arguments.show_romno) {
+         write_bankid(mem, r.bankid, pc);
       }
-      // Show register state
       if (fail || arguments.show_state) {
-         *bp++ = ' ';
-         *bp++ = ':';
-         *bp++ = ' ';
-         bp = em->get_state(bp);
+         em->save_state(em_ctx, &r.state);
       }
-      // Show BBC floating point work area FWA, FWB
       if (arguments.show_bbcfwa) {
-         bp += sprintf(bp, " : FWA %s", get_fwa(0x2e, 0x30, 0x31, 0x35, 0x2f));
-         bp += sprintf(bp, " : FWB %s", get_fwa(0x3b, 0x3c, 0x3d, 0x41,   -1));
-      }
-      // Show any errors
-      if (fail) {
-         bp += em->write_fail(bp, fail);
+         int n = sprintf(r.fwa, " : FWA %s", get_fwa(0x2e, 0x30, 0x31, 0x35, 0x2f));
+         sprintf(r.fwa + n, " : FWB %s", get_fwa(0x3b, 0x3c, 0x3d, 0x41,   -1));
+         output_record(&r, sizeof(r));
+      } else {
+         output_record(&r, offsetof(instr_record_t, fwa));
       }
-      // End the line
-      *bp++ = 0;
-      puts(disbuf);
    }
 
    if (triggered) {
       num_instructions++;
    }
 
+   if (arguments.jobs > 1) {
+      jobs_end_instruction(get_sample_index(sample_q), pc, em, em_ctx);
+   }
+
    if (triggered && pc >= 0 && pc == arguments.trigger_stop) {
       triggered = 0;
-      printf("stop trigger hit at sample %08x\n", sample_q->sample_count);
-      memory_set_rd_logging(0);
-      memory_set_wr_logging(0);
+      output_printf("stop trigger hit at sample %08x\n", get_sample_count(sample_q));
+      memory_set_rd_logging(mem, 0);
+      memory_set_wr_logging(mem, 0);
+      memory_set_counting  (mem, 0);
    }
 
    return num_cycles;
@@ -816,22 +1271,36 @@ static int analyze_instruction(sample_t *sample_q, int num_samples) {
 // Helper to run the emulation for N cycles
 // ====================================================================
 
-int run_emulation_for_n_cycles(sample_t *sample, int num_samples, int run_cycles, int nm) {
-   // Save the exising value of NM
-   int saved_nm = arguments.reg_nm;
+// The sync trials have their own emulator, and memory model (with
+// modelling off). The memory model is rolled back to a snapshot after each
+// trial, rather than being recreated.
 
-   // Save the existing modelling state
-   int saved_mem_modelling  = memory_get_modelling();
-   int saved_mem_rd_logging = memory_get_rd_logging();
-   int saved_mem_wr_logging = memory_get_wr_logging();
+static memory_t *trial_mem;
+static void *trial_ctx;
 
-   // Initialize the emulator
-   arguments.reg_nm = nm;
-   em->init(&arguments);
-   memory_init(&arguments);
-   memory_set_modelling(0);
-   memory_set_rd_logging(0);
-   memory_set_wr_logging(0);
+static void create_trial_emulator() {
+   trial_mem = memory_create(&arguments);
+   memory_snapshot(trial_mem);
+   trial_ctx = em->create(&arguments, trial_mem);
+}
+
+static void destroy_trial_emulator() {
+   em->destroy(trial_ctx);
+   memory_destroy(trial_mem);
+   trial_ctx = NULL;
+   trial_mem = NULL;
+}
+
+// Stops early, returning a count greater than error_limit, once the error
+// count exceeds error_limit
+
+int run_emulation_for_n_cycles(sample_t *sample, int num_samples, int run_cycles, int nm, int error_limit) {
+   // Nothing from a trial run should appear in the output
+   int saved_muted = output_set_muted(1);
+
+   arguments_t args = arguments;
+   args.reg_nm = nm;
+   em->init(trial_ctx, &args, trial_mem);
 
    // Run the emulator for SYNC_WINDOWS cycles
    int error_count = 0;
@@ -840,30 +1309,25 @@ int run_emulation_for_n_cycles(sample_t *sample, int num_samples, int run_cycles
    while (sample_tmp < sample + run_cycles ) {
       instruction_t instruction;
       // TODO: We should properly calculate the number of remaining samples, to cope with very small traces
-      int num_cycles = em->emulate(sample_tmp, run_cycles, &instruction);
+      int num_cycles = em->emulate(trial_ctx, sample_tmp, run_cycles, &instruction);
       if (num_cycles == CYCLES_TRUNCATED) {
          break;
       } else if (num_cycles <= 0) {
          num_cycles = 1;
       }
       sample_tmp += num_cycles;
-      if (failflag & arguments.fail_mask) {
+      if (em->get_and_clear_fail(trial_ctx) & arguments.fail_mask) {
          error_count++;
-         failflag = 0;
       }
       instr_count++;
+      if (error_count > error_limit) {
+         break;
+      }
    }
 
-   // Tear down the memory model
-   memory_destroy();
-
-   // Restore the original memory modelling values
-   memory_set_modelling(saved_mem_modelling);
-   memory_set_rd_logging(saved_mem_rd_logging);
-   memory_set_wr_logging(saved_mem_wr_logging);
+   memory_rollback(trial_mem);
 
-   // Restore the original value of NM
-   arguments.reg_nm = saved_nm;
+   output_set_muted(saved_muted);
 
    // If we get a very small number of instructions, artificially
    // boost the error count. This prevents incorrectly syncing to a HCF
@@ -881,13 +1345,140 @@ int run_emulation_for_n_cycles(sample_t *sample, int num_samples, int run_cycles
 // ====================================================================
 
 
-sample_t *synchronize_to_stream(sample_t *sample, int num_samples) {
+// Each sync trial runs the emulation from one candidate sample offset, in
+// one of the modes (nm). The result is the trial with the fewest errors,
+// with ties going to the earliest sample (and then to emulation mode),
+// which is the trial with the lowest rank.
+//
+// This is found by branch and bound: a trial is abandoned as soon as its
+// error count exceeds the best so far, and not run at all once a trial of
+// lower rank has had zero errors. The trials are run in order of a cheap
+// plausibility score, and then of rank, so a good bound is usually found
+// early on. A trial with the fewest errors is never abandoned, so the
+// result doesn't depend on the order.
+
+typedef struct {
+   sample_t *sample;
+   int num_samples;
+   int nm;
+   int rank;
+   int score;
+} sync_trial_t;
+
+typedef struct {
+   atomic_int error_best;           // Fewest errors of any completed trial
+   atomic_int zero_rank;            // Lowest rank of a trial with zero errors
+   int errors[2 * SYNC_RANGE];      // Error count of each trial (or INT_MAX if not run)
+} sync_results_t;
+
+static void reset_sync_results(sync_results_t *results) {
+   atomic_init(&results->error_best, INT_MAX);
+   atomic_init(&results->zero_rank, INT_MAX);
+   for (int i = 0; i < 2 * SYNC_RANGE; i++) {
+      results->errors[i] = INT_MAX;
+   }
+}
+
+static void atomic_min(atomic_int *value, int x) {
+   int current = atomic_load(value);
+   while (x < current && !atomic_compare_exchange_weak(value, &current, x)) {
+   }
+}
 
-   // The best sampling offset, in emulated and native modes
-   sample_t *sample_best[2] = {NULL,       NULL};
-   int        error_best[2] = {INT_MAX, INT_MAX};
+static void run_sync_trial(sync_trial_t *trials, int i, sync_results_t *results) {
+   sync_trial_t *trial = trials + i;
+   if (atomic_load(&results->zero_rank) < trial->rank) {
+      // A trial of lower rank can't be beaten
+      results->errors[i] = INT_MAX;
+      return;
+   }
+   int error_limit = atomic_load(&results->error_best);
+   int error_count = run_emulation_for_n_cycles(trial->sample, trial->num_samples, SYNC_WINDOW, trial->nm, error_limit);
+#ifdef DEBUG_SYNC
+   fprintf(stderr, "nm=%d offset %3d (score %2d) had %d errors%s\n", trial->nm, trial->rank >> 1, trial->score, error_count,
+           error_count > error_limit ? " (abandoned)" : "");
+#endif
+   results->errors[i] = error_count;
+   if (error_count <= error_limit) {
+      atomic_min(&results->error_best, error_count);
+      if (error_count == 0) {
+         atomic_min(&results->zero_rank, trial->rank);
+      }
+   }
+}
+
+// A cheap score of how implausible it is that an instruction starts at a
+// sample (lower is better). The opcode fetch and the cycle that follows it
+// (an operand fetch, or a dummy read) are both reads, and the latter is
+// from the next address.
+
+static int sync_plausibility(sample_t *sample, int num_samples) {
+   int score = 0;
+   if (num_samples < 2) {
+      return score;
+   }
+   if (sample[0].rnw == 0) {
+      score++;
+   }
+   if (sample[1].rnw == 0) {
+      score++;
+   }
+   if (sample[0].addr >= 0 && sample[1].addr >= 0 && sample[1].addr != ((sample[0].addr + 1) & 15)) {
+      score++;
+   }
+   return score;
+}
 
-   memory_destroy();
+static int compare_sync_trials(const void *a, const void *b) {
+   const sync_trial_t *ta = a;
+   const sync_trial_t *tb = b;
+   if (ta->score != tb->score) {
+      return ta->score < tb->score ? -1 : 1;
+   }
+   return ta->rank - tb->rank;
+}
+
+static void run_sync_trials(sync_trial_t *trials, int first, int num_trials, sync_results_t *results) {
+   long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+   if (num_workers > num_trials - first) {
+      num_workers = num_trials - first;
+   }
+   if (num_workers > 1) {
+      pid_t pids[num_workers];
+      int failed = 0;
+      output_flush();
+      for (int w = 0; w < num_workers; w++) {
+         pids[w] = fork();
+         if (pids[w] == 0) {
+            for (int i = first + w; i < num_trials; i += num_workers) {
+               run_sync_trial(trials, i, results);
+            }
+            _exit(0);
+         } else if (pids[w] < 0) {
+            failed = 1;
+         }
+      }
+      for (int w = 0; w < num_workers; w++) {
+         int status;
+         if (pids[w] < 0 || waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            failed = 1;
+         }
+      }
+      if (!failed) {
+         return;
+      }
+      // Fall back to running the trials here (any bound already found
+      // still holds)
+   }
+   for (int i = first; i < num_trials; i++) {
+      run_sync_trial(trials, i, results);
+   }
+}
+
+sample_t *synchronize_to_stream(sample_t *sample, int num_samples) {
+
+   sync_trial_t trials[2 * SYNC_RANGE];
+   int num_trials = 0;
 
    // If reg_nm has been set as a parameter, we can limit the search range
    // cpu6309  nm   start end
@@ -907,10 +1498,6 @@ sample_t *synchronize_to_stream(sample_t *sample, int num_samples) {
 
    for (int nm = nm_start; nm <= nm_end; nm++) {
 
-#ifdef DEBUG_SYNC
-      fprintf(stderr, "Testing with nm=%d\n", nm);
-#endif
-
       // Reset back to the start of the sample data
       sample_t *sample_rd = sample;
 
@@ -919,7 +1506,7 @@ sample_t *synchronize_to_stream(sample_t *sample, int num_samples) {
       if (sample->lic >= 0) {
 
          // Step forward to the first sample with LIC == 1
-         while (!sample_rd->lic) {
+         while (offset < SYNC_RANGE && offset < num_samples && !sample_rd->lic) {
             sample_rd++;
             offset++;
          }
@@ -929,19 +1516,19 @@ sample_t *synchronize_to_stream(sample_t *sample, int num_samples) {
             offset++;
          }
 
-         // In the middle of something big!
-         if (offset >= SYNC_RANGE) {
+         // In the middle of something big (or LIC never goes high)!
+         if (offset >= SYNC_RANGE || offset >= num_samples) {
             offset = 0;
             sample_rd = sample;
          }
 
          // Run the emulation for SYNC_WINDOW cycles
-         int error_count = run_emulation_for_n_cycles(sample_rd, num_samples - offset, SYNC_WINDOW, nm);
-#ifdef DEBUG_SYNC
-         fprintf(stderr, "Offset %3d had %d errors\n", offset, error_count);
-#endif
-         error_best[nm] = error_count;
-         sample_best[nm] = sample_rd;
+         trials[num_trials].sample = sample_rd;
+         trials[num_trials].num_samples = num_samples - offset;
+         trials[num_trials].nm = nm;
+         trials[num_trials].rank = 2 * (sample_rd - sample) + nm;
+         trials[num_trials].score = 0;
+         num_trials++;
 
       } else {
 
@@ -952,92 +1539,313 @@ sample_t *synchronize_to_stream(sample_t *sample, int num_samples) {
             offset++;
          }
 
-         // Iterate through the SYNC_RANGE possibe starting offsets
-         for (int i = 0; i < SYNC_RANGE && error_best[nm] > 0; i++) {
-            int error_count = run_emulation_for_n_cycles(sample_rd, num_samples - offset - i, SYNC_WINDOW, nm);
-#ifdef DEBUG_SYNC
-            fprintf(stderr, "Offset %3d had %d errors\n", offset + i, error_count);
-#endif
-            if (error_count < error_best[nm]) {
-               error_best[nm] = error_count;
-               sample_best[nm] = sample_rd;
-            }
+         // Try each of the SYNC_RANGE possibe starting offsets
+         for (int i = 0; i < SYNC_RANGE; i++) {
+            trials[num_trials].sample = sample_rd;
+            trials[num_trials].num_samples = num_samples - offset - i;
+            trials[num_trials].nm = nm;
+            trials[num_trials].rank = 2 * (sample_rd - sample) + nm;
+            trials[num_trials].score = 0;
+            num_trials++;
             sample_rd++;
          }
       }
    }
 
+   // Shared, so the results can be written by worker processes
+   sync_results_t *results = mmap(NULL, sizeof(sync_results_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (results == MAP_FAILED) {
+      fprintf(stderr, "failed to allocate sync results\n");
+      exit(1);
+   }
+
+   reset_sync_results(results);
+
+   create_trial_emulator();
+
+   // Sampling usually starts on an instruction boundary, so the lowest
+   // ranked trial is run first, on its own. If it has zero errors, no other
+   // trial can beat it.
+   qsort(trials, num_trials, sizeof(sync_trial_t), compare_sync_trials);
+   run_sync_trial(trials, 0, results);
+
+   if (num_trials > 1 && atomic_load(&results->zero_rank) == INT_MAX) {
+      // Try the most plausible of the rest first, so the bound tightens early
+      for (int i = 1; i < num_trials; i++) {
+         trials[i].score = sync_plausibility(trials[i].sample, trials[i].num_samples);
+      }
+      qsort(trials + 1, num_trials - 1, sizeof(sync_trial_t), compare_sync_trials);
+      run_sync_trials(trials, 1, num_trials, results);
+   }
+
+   // Pick the trial with the fewest errors, and then the lowest rank
+   int best = 0;
+   for (int i = 1; i < num_trials; i++) {
+      if (results->errors[i] < results->errors[best] ||
+          (results->errors[i] == results->errors[best] && trials[i].rank < trials[best].rank)) {
+         best = i;
+      }
+   }
+   sample_t *sample_best = trials[best].sample;
+
+   destroy_trial_emulator();
+
+   munmap(results, sizeof(sync_results_t));
+
+   // Unless nm was specified by the user
    int nm = arguments.reg_nm;
-   // If nm was not specified by the user, then use a heuristic of fewest errors
    if (nm < 0) {
-      if (error_best[0] < error_best[1]) {
-         nm = 0;
-      } else if (error_best[0] > error_best[1]) {
-         nm = 1;
-      } else {
-         nm = (sample_best[1] < sample_best[0]);
-      }
+      nm = trials[best].nm;
    }
 
 #ifdef DEBUG_SYNC
-   fprintf(stderr, "Best is nm=%d offset=%ld\n", nm, sample_best[nm] - sample);
+   fprintf(stderr, "Best is nm=%d offset=%ld\n", nm, sample_best - sample);
 #endif
 
    // Initialize for real
    arguments.reg_nm = nm;
-   em->init(&arguments);
-   memory_init(&arguments);
+   em->init(em_ctx, &arguments, mem);
+   memory_init(mem, &arguments);
 
-   return sample_best[nm];
+   return sample_best;
 }
 
 // ====================================================================
 // Queue a large number of samples so the decoders can lookahead
 // ====================================================================
 
-void queue_sample(sample_t *sample) {
+static sample_t *ring_alloc(size_t size) {
+   size_t bytes = size * sizeof(sample_t);
+   // Back the ring with a shared memory object, so it can be mapped twice
+   int fd = -1;
+#ifdef __linux__
+   fd = memfd_create("decode6809", 0);
+#else
+   char name[64];
+   sprintf(name, "/decode6809.%d", (int) getpid());
+   fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+   if (fd >= 0) {
+      shm_unlink(name);
+   }
+#endif
+   if (fd >= 0) {
+      uint8_t *base = NULL;
+      if (ftruncate(fd, bytes) == 0) {
+         // Reserve a window for both mappings, then overlay the two views
+         base = mmap(NULL, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+         if (base != MAP_FAILED) {
+            if (mmap(base,         bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+                mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+               munmap(base, 2 * bytes);
+               base = NULL;
+            }
+         } else {
+            base = NULL;
+         }
+      }
+      close(fd);
+      if (base) {
+         ring_aliased = 1;
+         return (sample_t *)base;
+      }
+   }
+   // Fall back to writing every sample twice
+   ring_aliased = 0;
+   return calloc(2 * size, sizeof(sample_t));
+}
+
+// Allocate the sample ring, for decoding from sample number first
+static int ring_init(uint64_t first) {
+   // Just over 2 blocks, or 3 blocks with --pipeline, plus the guard band,
+   // rounded up to whole pages
+   size_t page = sysconf(_SC_PAGESIZE) / sizeof(sample_t);
+   ring_size = ((arguments.pipeline ? 3 : 2) * (size_t) arguments.block + 1 + TAIL_GUARD + page - 1) / page * page;
+   sample_q = ring_alloc(ring_size);
+   if (!sample_q) {
+      fprintf(stderr, "failed to allocate sample buffer\n");
+      return -1;
+   }
+   sample_rd = sample_q;
+   sample_wr = sample_q;
+   sample_q_count = first;
+   wr_check = 0;
+   return 0;
+}
+
+static inline void advance_rd(int n) {
+   sample_rd += n;
+   num_rd += n;
+   if (sample_rd >= sample_q + ring_size) {
+      sample_rd -= ring_size;
+   }
+}
+
+// Clear the guard band after the last sample written
+static void clear_tail_guard() {
+   sample_t *sample = sample_wr;
+   for (int i = 0; i < TAIL_GUARD; i++) {
+      memset(sample, 0, sizeof(sample_t));
+      if (!ring_aliased) {
+         memset(sample + ring_size, 0, sizeof(sample_t));
+      }
+      if (++sample == sample_q + ring_size) {
+         sample = sample_q;
+      }
+   }
+}
+
+// Wait until the emulation thread has freed enough space in the ring
+static uint64_t wait_for_space() {
+   int spins = 0;
+   uint64_t limit;
+   atomic_store_explicit(&pipe_wr, num_wr, memory_order_release);
+   while (num_wr + TAIL_GUARD >= (limit = atomic_load_explicit(&pipe_rd, memory_order_acquire) + ring_size)) {
+      spsc_backoff(&spins);
+   }
+   return limit;
+}
+
+// Works out when queue_sample_full() is next needed: when a sample is
+// written to the end of the ring, the ring is about to be full (--pipeline),
+// num_wr is to be published (--pipeline) or a block can be consumed. If the
+// ring isn't aliased, every sample is written twice, so it's always needed.
+
+static void set_wr_check(uint64_t num_block, uint64_t wr_limit) {
+   if (!ring_aliased) {
+      wr_check = 0;
+      return;
+   }
+   uint64_t check = num_wr + (sample_q + ring_size - sample_wr) - 1;
+   uint64_t next;
+   if (arguments.pipeline) {
+      next = wr_limit > TAIL_GUARD ? wr_limit - TAIL_GUARD : 0;
+      if (next < check) {
+         check = next;
+      }
+      next = ((num_wr + PUBLISH_INTERVAL) & ~(uint64_t) (PUBLISH_INTERVAL - 1)) - 1;
+   } else {
+      next = num_block + 2 * (uint64_t) arguments.block;
+   }
+   wr_check = next < check ? next : check;
+}
+
+static void queue_sample_full(sample_t *sample) {
    static int synced = 0;
+   static uint64_t num_block = 0;
+   static uint64_t wr_limit = 0;
    int block = arguments.block;
 
    // At the end of the stream, allow the buffered samples to drain
    if (sample->type == LAST) {
+      clear_tail_guard();
+      if (arguments.pipeline) {
+         // Leave the draining to consume_samples()
+         atomic_store_explicit(&pipe_wr, num_wr, memory_order_release);
+         atomic_store_explicit(&pipe_eof, 1, memory_order_release);
+         return;
+      }
       // Try to synchronize to the instruction stream
-      if (!synced) {
-         sample_rd = synchronize_to_stream(sample_rd, sample_wr - sample_rd);
+      if (!synced && !resumed) {
+         advance_rd(synchronize_to_stream(sample_rd, num_wr - num_rd) - sample_rd);
       }
       // Drain the queue when the LAST marker is seen
-      while (sample_rd < sample_wr) {
-         sample_rd += analyze_instruction(sample_rd, sample_wr - sample_rd);
+      while (num_rd < num_wr) {
+         advance_rd(analyze_instruction(sample_rd, num_wr - num_rd));
       }
       return;
    }
 
+   // With --pipeline, never overwrite samples the emulation still needs
+   if (arguments.pipeline && num_wr + TAIL_GUARD >= wr_limit) {
+      wr_limit = wait_for_space();
+   }
+
    // Make a copy of the sample structure
-   *sample_wr++ = *sample;
+   *sample_wr = *sample;
+   if (!ring_aliased) {
+      sample_wr[ring_size] = *sample;
+   }
+   if (++sample_wr == sample_q + ring_size) {
+      sample_wr = sample_q;
+   }
+   num_wr++;
+
+   if (arguments.pipeline) {
+      if ((num_wr & (PUBLISH_INTERVAL - 1)) == 0) {
+         atomic_store_explicit(&pipe_wr, num_wr, memory_order_release);
+      }
+      set_wr_check(num_block, wr_limit);
+      return;
+   }
+
+   // When we have two full blocks, we can start to consume the first,
+   // always leaving at least one block of lookahead. The ring holds
+   // slightly more than two blocks, so nothing unread is overwritten.
+   if (num_wr > num_block + 2 * block) {
+      // Try to synchronize to the instruction stream
+      if (!synced && !resumed) {
+         advance_rd(synchronize_to_stream(sample_rd, num_wr - num_rd) - sample_rd);
+         synced = 1;
+      }
+      while (num_rd < num_block + block) {
+         advance_rd(analyze_instruction(sample_rd, num_wr - num_rd));
+      }
+      num_block += block;
+   }
+   set_wr_check(num_block, wr_limit);
+}
+
+static inline void queue_sample(sample_t *sample) {
+   if (num_wr < wr_check && sample->type != LAST) {
+      *sample_wr++ = *sample;
+      num_wr++;
+   } else {
+      queue_sample_full(sample);
+   }
+}
 
-   // Sample_q is NOT a circular buffer!
-   //
-   // When we have two full blocks, we can start to consume the first. Once the first is
-   // consumed, we can move everything back in the block.
-   if (sample_wr > sample_q + 2 * block) {
+// The emulation side of --pipeline, which consumes the ring in exactly the
+// same block sized steps as queue_sample() does, so the output is the same.
+
+static void consume_samples() {
+   int synced = resumed;
+   uint64_t num_block = 0;
+   int block = arguments.block;
+
+   for (;;) {
+      // Wait for two full blocks, or the end of the stream
+      uint64_t target = num_block + 2 * (uint64_t) block + 1;
+      uint64_t wr;
+      int spins = 0;
+      for (;;) {
+         int eof = atomic_load_explicit(&pipe_eof, memory_order_acquire);
+         wr = atomic_load_explicit(&pipe_wr, memory_order_acquire);
+         if (wr >= target || eof) {
+            break;
+         }
+         spsc_backoff(&spins);
+      }
+      if (wr < target) {
+         // Try to synchronize to the instruction stream
+         if (!synced) {
+            advance_rd(synchronize_to_stream(sample_rd, wr - num_rd) - sample_rd);
+         }
+         // Drain the queue
+         while (num_rd < wr) {
+            advance_rd(analyze_instruction(sample_rd, wr - num_rd));
+         }
+         return;
+      }
       // Try to synchronize to the instruction stream
       if (!synced) {
-         sample_rd = synchronize_to_stream(sample_rd, sample_wr - sample_rd);
+         advance_rd(synchronize_to_stream(sample_rd, target - num_rd) - sample_rd);
          synced = 1;
       }
-      while (sample_rd < sample_q + block) {
-         sample_rd += analyze_instruction(sample_rd, sample_wr - sample_rd);
+      while (num_rd < num_block + block) {
+         advance_rd(analyze_instruction(sample_rd, target - num_rd));
       }
-      // The first block has been processed, so move everything down a block
-      //printf("Block processed\n");
-      //printf("  sample_wr = %ld\n", sample_wr - sample_q);
-      //printf("  sample_rd = %ld\n", sample_rd - sample_q);
-      memmove(sample_q, sample_q + block, sizeof(sample_t) * (sample_wr - sample_q - block));
-      sample_rd -= block;
-      sample_wr -= block;
-      //printf("Block consumed\n");
-      //printf("  sample_wr = %ld\n", sample_wr - sample_q);
-      //printf("  sample_rd = %ld\n", sample_rd - sample_q);
+      num_block += block;
+      atomic_store_explicit(&pipe_rd, num_rd, memory_order_release);
    }
 }
 
@@ -1045,34 +1853,56 @@ void queue_sample(sample_t *sample) {
 // Input file processing and bus cycle extraction
 // ====================================================================
 
-void decode(FILE *stream) {
+// Filling in the sample_t bitfields (see defs.h) one pin at a time is slow,
+// so in the word sampling modes the sample for each of the 65536 words is
+// built once, using the pin mappings
+
+static sample_t word_samples[0x10000];
+
+static void unpack_words(sample_t s) {
+   for (int word = 0; word < 0x10000; word++) {
+      if (arguments.idx_rnw >= 0) {
+         s.rnw = (word >> arguments.idx_rnw) & 1;
+      }
+      if (arguments.idx_lic >= 0) {
+         s.lic = (word >> arguments.idx_lic) & 1;
+      }
+      if (arguments.idx_bs >= 0) {
+         s.bs = (word >> arguments.idx_bs) & 1;
+      }
+      if (arguments.idx_ba >= 0) {
+         s.ba = (word >> arguments.idx_ba) & 1;
+      }
+      if (arguments.idx_addr >= 0) {
+         s.addr = (word >> arguments.idx_addr) & 15;
+      }
+      s.data = (word >> arguments.idx_data) & 255;
+      word_samples[word] = s;
+   }
+}
+
+void decode() {
 
    // Pin mappings into the 16 bit words
    int idx_data  = arguments.idx_data;
-   int idx_rnw   = arguments.idx_rnw;
-   int idx_lic   = arguments.idx_lic;
-   int idx_bs    = arguments.idx_bs;
-   int idx_ba    = arguments.idx_ba;
-   int idx_addr  = arguments.idx_addr;
    int idx_clke  = arguments.idx_clke;
 
    // The structured bus sample we will pass on to the next level of processing
    sample_t s;
 
-   // Skip the start of the file, if required
-   if (arguments.skip) {
-      fseek(stream, arguments.skip * (arguments.byte ? 1 : 2), SEEK_SET);
-   }
-
    // Common to all sampling modes
    s.type = NORMAL;
-   s.sample_count = arguments.skip;
    s.rnw  = -1;
    s.lic  = -1;
    s.bs   = -1;
    s.ba   = -1;
    s.addr = -1;
 
+   // Any samples left over from the previous capture (see --load-state)
+   for (int i = 0; i < start_position.num_pending; i++) {
+      queue_sample(start_position.pending + i);
+   }
+
    if (arguments.byte) {
 
       // ------------------------------------------------------------
@@ -1084,13 +1914,12 @@ void decode(FILE *stream) {
       // as disconnected, by being set to -1.
 
       // Read the capture file, and queue structured sampled for the decoder
-      int num;
-      while ((num = fread(buffer8, sizeof(uint8_t), BUFSIZE, stream)) > 0) {
-         uint8_t *sampleptr = &buffer8[0];
+      const uint8_t *sampleptr;
+      size_t num;
+      while ((num = capture_read((const void **)&sampleptr, sizeof(uint8_t))) > 0) {
          while (num-- > 0) {
             s.data = *sampleptr++;
             queue_sample(&s);
-            s.sample_count++;
          }
       }
 
@@ -1108,29 +1937,12 @@ void decode(FILE *stream) {
       // cycle.
 
       // Read the capture file, and queue structured sampled for the decoder
-      int num;
-      while ((num = fread(buffer, sizeof(uint16_t), BUFSIZE, stream)) > 0) {
-         uint16_t *sampleptr = &buffer[0];
+      unpack_words(s);
+      const uint16_t *sampleptr;
+      size_t num;
+      while ((num = capture_read((const void **)&sampleptr, sizeof(uint16_t))) > 0) {
          while (num-- > 0) {
-            uint16_t sample = *sampleptr++;
-            if (idx_rnw >= 0) {
-               s.rnw = (sample >> idx_rnw ) & 1;
-            }
-            if (idx_lic >= 0) {
-               s.lic = (sample >> idx_lic) & 1;
-            }
-            if (idx_bs >= 0) {
-               s.bs = (sample >> idx_bs) & 1;
-            }
-            if (idx_ba >= 0) {
-               s.ba = (sample >> idx_ba) & 1;
-            }
-            if (idx_addr >= 0) {
-               s.addr = (sample >> idx_addr) & 15;
-            }
-            s.data = (sample >> idx_data) & 255;
-            queue_sample(&s);
-            s.sample_count++;
+            queue_sample(word_samples + *sampleptr++);
          }
       }
 
@@ -1173,9 +1985,10 @@ void decode(FILE *stream) {
       }
 
       // Read the capture file, and queue structured sampled for the decoder
-      int num;
-      while ((num = fread(buffer, sizeof(uint16_t), BUFSIZE, stream)) > 0) {
-         uint16_t *sampleptr = &buffer[0];
+      unpack_words(s);
+      const uint16_t *sampleptr;
+      size_t num;
+      while ((num = capture_read((const void **)&sampleptr, sizeof(uint16_t))) > 0) {
          while (num-- > 0) {
 
             skew_buffer[wr_index] = *sampleptr++;
@@ -1188,27 +2001,13 @@ void decode(FILE *stream) {
                last_clke = pin_clke;
                if (pin_clke) {
                   // Sample control signals after rising edge of CLKE
-                  if (idx_rnw >= 0) {
-                     s.rnw = (sample >> idx_rnw ) & 1;
-                  }
-                  if (idx_lic >= 0) {
-                     s.lic = (sample >> idx_lic) & 1;
-                  }
-                  if (idx_bs >= 0) {
-                     s.bs = (sample >> idx_bs) & 1;
-                  }
-                  if (idx_ba >= 0) {
-                     s.ba = (sample >> idx_ba) & 1;
-                  }
-                  if (idx_addr >= 0) {
-                     s.addr = (sample >> idx_addr) & 15;
-                  }
+                  // (the data is replaced at the falling edge)
+                  s = word_samples[sample];
                } else {
                   // Sample the data skewed (--skew=) relative to the falling edge of CLKE
                   s.data = (data_sample >> idx_data) & 255;
                   queue_sample(&s);
-                  s.sample_count++;
-               }
+                     }
             }
             // Increment the circular buffer pointers in lock-step to keey the skew constant
             wr_index      = (wr_index      + 1) & (SKEW_BUFFER_SIZE - 1);
@@ -1223,6 +2022,28 @@ void decode(FILE *stream) {
    queue_sample(&s);
 }
 
+static void *decode_thread(void *arg) {
+   decode();
+   return NULL;
+}
+
+// Decode one chunk, in a --jobs worker process
+static void decode_chunk(uint64_t first, FILE *state) {
+   // Carry on from the end of the previous chunk
+   if (state) {
+      if (state_read(state, em, em_ctx, mem) < 0) {
+         exit(1);
+      }
+      resumed = 1;
+   }
+   // The ring is allocated here, as it's shared memory, and each worker
+   // needs its own
+   if (ring_init(arguments.skip + first) < 0) {
+      exit(1);
+   }
+   decode();
+}
+
 
 // ====================================================================
 // Main program entry point
@@ -1243,6 +2064,27 @@ int main(int argc, char *argv[]) {
    arguments.trigger_stop     = UNSPECIFIED;
    arguments.trigger_skipint  = 0;
    arguments.filename         = NULL;
+   arguments.pipeline         = 0;
+   arguments.jobs             = 1;
+   arguments.output_format    = OUTPUT_TEXT;
+   arguments.index_file       = NULL;
+   arguments.index_interval   = DEFAULT_INDEX_INTERVAL;
+   arguments.from_sample      = -1;
+   arguments.from_pc          = -1;
+   arguments.from_occurrence  = 0;
+   arguments.save_state       = NULL;
+   arguments.load_state       = NULL;
+   arguments.profile          = 0;
+   arguments.profile_top      = DEFAULT_PROFILE_TOP;
+   arguments.callgraph_file   = NULL;
+   arguments.irq_stats        = 0;
+   arguments.heatmap_file     = NULL;
+   arguments.heatmap_format   = HEATMAP_CSV;
+   arguments.timeline_file    = NULL;
+   arguments.timeline_symbols = NULL;
+   arguments.coverage_file    = NULL;
+   arguments.coverage_addr    = UNDEFINED;
+   arguments.coverage_bank    = UNDEFINED;
 
    // Register options
    arguments.reg_s            = UNSPECIFIED;
@@ -1279,12 +2121,12 @@ int main(int argc, char *argv[]) {
       triggered = 1;
    }
 
-   arguments.show_something = arguments.show_samplenums | arguments.show_address | arguments.show_hex | arguments.show_instruction | arguments.show_state | arguments.show_bbcfwa | arguments.show_cycles ;
+   // A binary trace has a record, including the state, for every instruction
+   if (arguments.output_format == OUTPUT_BINARY) {
+      arguments.show_state = 1;
+   }
 
-   // Allocate sample buffer (3 blocks)
-   sample_q = malloc(arguments.block * sizeof(sample_t) * 3);
-   sample_rd = sample_q;
-   sample_wr = sample_q;
+   arguments.show_something = arguments.show_samplenums | arguments.show_address | arguments.show_hex | arguments.show_instruction | arguments.show_state | arguments.show_bbcfwa | arguments.show_cycles ;
 
    // Normally the data file should be 16 bit samples. In byte mode
    // the data file is 8 bit samples, and all the control signals are
@@ -1346,6 +2188,81 @@ int main(int argc, char *argv[]) {
       }
    }
 
+   if (arguments.jobs > 1) {
+      if (arguments.pipeline) {
+         fprintf(stderr, "--jobs is incompatible with --pipeline\n");
+         return 1;
+      }
+      if (arguments.idx_clke != UNSPECIFIED) {
+         fprintf(stderr, "--jobs is incompatible with --clke, as chunks can't be aligned to bus cycles\n");
+         return 1;
+      }
+      if (arguments.trigger_start != UNSPECIFIED || arguments.trigger_stop != UNSPECIFIED || arguments.trigger_skipint) {
+         fprintf(stderr, "--jobs is incompatible with --trigger\n");
+         return 1;
+      }
+      if (arguments.output_format == OUTPUT_BINARY) {
+         fprintf(stderr, "--jobs is incompatible with --output-format=binary, as records are delta encoded\n");
+         return 1;
+      }
+      if ((arguments.mem_model & 0x0f) || arguments.show_romno) {
+         fprintf(stderr, "--jobs is incompatible with memory modelling (--mem) and -r, as the chunks' memory models can't be compared\n");
+         return 1;
+      }
+   }
+
+   if (arguments.from_sample >= 0 || arguments.from_pc >= 0) {
+      if (!arguments.index_file) {
+         fprintf(stderr, "--from-sample and --from-pc-occurrence need an --index\n");
+         return 1;
+      }
+      if (arguments.from_sample >= 0 && arguments.from_pc >= 0) {
+         fprintf(stderr, "--from-sample is incompatible with --from-pc-occurrence\n");
+         return 1;
+      }
+   }
+
+   if (arguments.index_file) {
+      if (arguments.idx_clke != UNSPECIFIED) {
+         fprintf(stderr, "--index is incompatible with --clke, as checkpoints can't be aligned to bus cycles\n");
+         return 1;
+      }
+      if (arguments.trigger_start != UNSPECIFIED || arguments.trigger_stop != UNSPECIFIED || arguments.trigger_skipint) {
+         fprintf(stderr, "--index is incompatible with --trigger\n");
+         return 1;
+      }
+      if (arguments.jobs > 1) {
+         fprintf(stderr, "--index is incompatible with --jobs\n");
+         return 1;
+      }
+   }
+
+   if (arguments.load_state) {
+      if (arguments.trigger_start != UNSPECIFIED || arguments.trigger_stop != UNSPECIFIED || arguments.trigger_skipint) {
+         fprintf(stderr, "--load-state is incompatible with --trigger\n");
+         return 1;
+      }
+      if (arguments.index_file) {
+         fprintf(stderr, "--load-state is incompatible with --index\n");
+         return 1;
+      }
+   }
+
+   if (arguments.jobs > 1 && (arguments.profile || arguments.callgraph_file || arguments.irq_stats || arguments.heatmap_file || arguments.timeline_file || arguments.coverage_file)) {
+      fprintf(stderr, "--jobs is incompatible with --profile, --callgraph, --irq-stats, --heatmap, --timeline and --coverage\n");
+      return 1;
+   }
+
+   if (arguments.timeline_symbols && !arguments.timeline_file) {
+      fprintf(stderr, "--timeline-symbols needs a --timeline\n");
+      return 1;
+   }
+
+   if (arguments.jobs > 1 && (arguments.save_state || arguments.load_state)) {
+      fprintf(stderr, "--jobs is incompatible with --save-state and --load-state\n");
+      return 1;
+   }
+
    if (arguments.cpu_type != CPU_6309 && arguments.cpu_type != CPU_6309E) {
       if (arguments.reg_nm != UNSPECIFIED) {
          fprintf(stderr, "--reg_nm= can only be used when the CPU is a 6309/6309E\n");
@@ -1359,8 +2276,7 @@ int main(int argc, char *argv[]) {
 
 
    // Initialize memory modelling
-   // (em->init actually mallocs the memory)
-   memory_init(&arguments);
+   mem = memory_create(&arguments);
 
    // Turn on memory write logging if show rom bank option (-r) is selected
    if (arguments.show_romno) {
@@ -1368,9 +2284,10 @@ int main(int argc, char *argv[]) {
    }
 
    if (triggered) {
-      memory_set_modelling ( arguments.mem_model       & 0x0f);
-      memory_set_rd_logging((arguments.mem_model >> 4) & 0x0f);
-      memory_set_wr_logging((arguments.mem_model >> 8) & 0x0f);
+      memory_set_modelling (mem,  arguments.mem_model       & 0x0f);
+      memory_set_rd_logging(mem, (arguments.mem_model >> 4) & 0x0f);
+      memory_set_wr_logging(mem, (arguments.mem_model >> 8) & 0x0f);
+      memory_set_counting  (mem, get_counting());
    }
 
    // Implement default pins mapping for unspecified pins
@@ -1464,22 +2381,151 @@ int main(int argc, char *argv[]) {
 
    em = &em_6809;
 
-   em->init(&arguments);
-
-   FILE *stream;
-   if (!arguments.filename || !strcmp(arguments.filename, "-")) {
-      stream = stdin;
+   if (arguments.output_format == OUTPUT_BINARY) {
+      uint8_t header[TRACE_MAX_HEADER];
+      int n = trace_encode_header(&trace_encoder, header, arguments.cpu_type, arguments.machine, em->state_names);
+      output_init(&arguments, format_binary, header, n);
    } else {
-      stream = fopen(arguments.filename, "r");
-      if (stream == NULL) {
-         perror("failed to open capture file");
-         return 2;
+      output_init(&arguments, format_instruction, NULL, 0);
+   }
+
+   em_ctx = em->create(&arguments, mem);
+
+   // Start from the nearest checkpoint in the index, if there is one, or
+   // from a saved state
+   uint64_t first = 0;
+   uint64_t first_count = arguments.skip;
+   if (arguments.load_state) {
+      if (state_load(&arguments, &start_position, em, em_ctx, mem) < 0) {
+         output_close();
+         return 1;
+      }
+      // Carry on numbering the samples from the previous capture
+      first_count = start_position.sample;
+      num_instructions = start_position.num_instructions;
+      resumed = 1;
+   } else if (arguments.from_sample >= 0 || arguments.from_pc >= 0) {
+      index_position_t pos;
+      if (index_seek(&arguments, em, em_ctx, mem, &pos) < 0) {
+         output_close();
+         return 1;
       }
+      if (pos.found) {
+         first = pos.sample - arguments.skip;
+         first_count = pos.sample;
+         num_instructions = pos.num_instructions;
+         resumed = 1;
+      }
+      seek_occurrence = pos.occurrence;
+      seeking = 1;
+      output_set_muted(1);
+      memory_set_counting(mem, 0);
+   } else if (arguments.index_file && index_create(&arguments) < 0) {
+      output_close();
+      return 1;
+   }
+   if (arguments.save_state && state_create(&arguments) < 0) {
+      output_close();
+      return 1;
    }
 
-   decode(stream);
-   fclose(stream);
-   printf("num_instructions = %"PRIu64"\n", num_instructions);
+   if ((arguments.profile && profile_init(&arguments, em, em_ctx) < 0) ||
+       (arguments.callgraph_file && callgraph_init(&arguments, em, em_ctx) < 0) ||
+       (arguments.irq_stats && irqstats_init(&arguments, em, em_ctx) < 0) ||
+       (arguments.timeline_file && timeline_open(&arguments, em, em_ctx) < 0) ||
+       (arguments.coverage_file && coverage_init(&arguments, mem) < 0)) {
+      output_close();
+      return 1;
+   }
 
-   return 0;
+   // Created now, so a bad path isn't only found at the end of the capture
+   FILE *heatmap = NULL;
+   if (arguments.heatmap_file) {
+      heatmap = fopen(arguments.heatmap_file, arguments.heatmap_format == HEATMAP_BINARY ? "wb" : "w");
+      if (!heatmap) {
+         perror("failed to create heatmap");
+         output_close();
+         return 1;
+      }
+   }
+
+   if (capture_open(&arguments, first) < 0) {
+      output_close();
+      return 2;
+   }
+
+   int chunks = 0;
+   if (arguments.jobs > 1) {
+      chunks = jobs_run(&arguments, decode_chunk, &num_instructions);
+      if (chunks < 0) {
+         capture_close();
+         output_close();
+         return 1;
+      } else if (chunks == 0) {
+         fprintf(stderr, "--jobs needs a larger, uncompressed, capture file; decoding serially\n");
+         arguments.jobs = 1;
+      }
+   }
+
+   if (!chunks) {
+      if (ring_init(first_count) < 0) {
+         capture_close();
+         output_close();
+         return 1;
+      }
+      pthread_t extractor;
+      if (arguments.pipeline && pthread_create(&extractor, NULL, decode_thread, NULL) == 0) {
+         consume_samples();
+         pthread_join(extractor, NULL);
+      } else {
+         arguments.pipeline = 0;
+         decode();
+      }
+   }
+   int read_failed = capture_close() < 0;
+   int write_failed = 0;
+   if (arguments.save_state) {
+      if (!end_cut_off) {
+         end_position.sample = sample_q_count + num_wr;
+         end_position.num_pending = 0;
+      }
+      end_position.num_instructions = num_instructions;
+      if (state_save(&arguments, &end_position, em, em_ctx, mem) < 0) {
+         write_failed = 1;
+      }
+   }
+   free(start_position.pending);
+   if (seeking) {
+      output_set_muted(0);
+      fprintf(stderr, "the --from-... instruction was not reached\n");
+   } else if (arguments.index_file && index_close(num_instructions) < 0) {
+      write_failed = 1;
+   }
+   if (arguments.profile) {
+      profile_report();
+   }
+   if (arguments.callgraph_file && callgraph_report() < 0) {
+      write_failed = 1;
+   }
+   if (arguments.irq_stats) {
+      irqstats_report();
+   }
+   if (heatmap && memory_write_heatmap(mem, heatmap, &arguments) < 0) {
+      write_failed = 1;
+   }
+   if (arguments.timeline_file && timeline_close() < 0) {
+      write_failed = 1;
+   }
+   if (arguments.coverage_file) {
+      coverage_report();
+   }
+   output_printf("num_instructions = %"PRIu64"\n", num_instructions);
+   output_close();
+
+   // The capture ended early, so the output is incomplete
+   if (read_failed) {
+      return 2;
+   }
+   // The index, the state or a report couldn't be written
+   return write_failed ? 1 : 0;
 }
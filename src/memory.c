@@ -1,51 +1,133 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "defs.h"
 #include "memory.h"
-
-// Main Memory
-
-static int *memory        = NULL;
-static int mem_model      = 0;
-static int mem_rd_logging = 0;
-static int mem_wr_logging = 0;
+#include "output.h"
 
 // Standard sideways ROM (upto 16 banks)
 #define SWROM_SIZE          0x4000
 #define SWROM_NUM_BANKS     16
-static int *swrom         = NULL;
-static int rom_latch      = -1;
-
-static char buffer[256];
-
-// Machine specific memory rd/wr handlers
-static void (*memory_read_fn)(int data, int ea);
-static int (*memory_write_fn)(int data, int ea);
-
-// Machine specific address display handler (to allow SW Rom bank on the Beeb to be shown)
-static int (*addr_display_fn)(char *bp, int ea);
+#define SWROM_BASE          0x10000
+
+// Memory is allocated in blocks, the first time each block is modified
+#define BLOCK_SHIFT         14
+#define BLOCK_SIZE          (1 << BLOCK_SHIFT)
+
+// A byte per location, and a bitmap of which locations are known
+typedef struct {
+   uint8_t data[BLOCK_SIZE];
+   uint64_t known[BLOCK_SIZE / 64];
+} mem_block_t;
+
+// Reads and writes of each access type
+#define NUM_COUNTERS        8
+
+// Coverage bitmaps: first bytes of instructions, all bytes of instructions,
+// and bytes read as anything else
+#define COVERAGE_OPCODE     0
+#define COVERAGE_INSTR      1
+#define COVERAGE_DATA       2
+#define NUM_COVERAGE        3
+
+// Granularity of the snapshot journal
+#define PAGE_SHIFT          8
+#define PAGE_SIZE           (1 << PAGE_SHIFT)
+
+typedef struct {
+   int page;
+   uint8_t data[PAGE_SIZE];
+   uint64_t known[PAGE_SIZE / 64];
+} journal_entry_t;
+
+typedef enum {
+   PAGE_RAM,   // Reads are verified, and writes are recorded
+   PAGE_ROM,   // Reads are verified, and writes are ignored
+   PAGE_IO     // Accesses go to the machine specific IO handlers
+} page_type_t;
+
+// Pages that aren't modelled (e.g. an unknown ROM bank) have a base of -1
+
+typedef struct {
+   page_type_t type;
+   int base;   // Location in the model of the start of the page
+} page_t;
+
+// All of the memory model's state lives here, so several models can exist
+// in one process (e.g. one per sync trial)
+
+struct memory {
+
+   // Main Memory (followed by any sideways ROM), as a table of blocks
+   // (NULL until first modified)
+   mem_block_t **blocks;
+   int num_blocks;
+   int mem_model;
+   int mem_rd_logging;
+   int mem_wr_logging;
+
+   // Sideways ROM (Beeb), located at SWROM_BASE in memory
+   int rom_latch;
+
+   // MMU (SBC09)
+   int mmu0[4];
+   int mmu_enabled;
+
+   // Page table, and the machine specific handler that fills it in
+   page_t pages[0x100];
+   void (*map_fn)(memory_t *mem);
+
+   // Machine specific IO page rd/wr handlers (or NULL if IO is ignored)
+   uint32_t (*io_read_fn)(memory_t *mem, int data, int ea);
+   int (*io_write_fn)(memory_t *mem, int data, int ea);
+
+   // Machine specific address display handler (to allow SW Rom bank on the Beeb to be shown)
+   int (*addr_display_fn)(memory_t *mem, char *bp, int ea);
+
+   // Machine specific display of a location in the model (for the heatmap)
+   int (*location_display_fn)(memory_t *mem, char *bp, int location);
+
+   // Heatmap and coverage (see memory_set_counting()): read and write
+   // counters, and coverage bitmaps, for each location, or NULL if they
+   // have never been enabled
+   uint64_t (*heatmap)[NUM_COUNTERS];
+   uint64_t *coverage[NUM_COVERAGE];
+   int num_locations;
+   int counting;
+
+   // Snapshot (see memory_snapshot()): a flag per page that's been saved in
+   // the journal, or NULL if there is no snapshot
+   uint8_t *dirty;
+   journal_entry_t *journal;
+   int journal_len;
+   int journal_size;
+   int saved_rom_latch;
+   int saved_mmu0[4];
+   int saved_mmu_enabled;
+};
 
 #define TO_HEX(value) ((value) + ((value) < 10 ? '0' : 'A' - 10))
 
-int write_bankid(char *bp, int ea) {
+int write_bankid(memory_t *mem, char *bp, int ea) {
    if (ea < 0x8000 || ea >= 0xc000) {
       *bp++ = ' ';
       *bp++ = ' ';
-   } else if (rom_latch < 0) {
+   } else if (mem->rom_latch < 0) {
       *bp++ = '?';
       *bp++ = '-';
    } else {
-      *bp++ = TO_HEX(rom_latch);
+      *bp++ = TO_HEX(mem->rom_latch);
       *bp++ = '-';
    }
   return 2;
 }
 
-static inline void log_memory_access(char *msg, int data, int ea, int ignored) {
+static inline void log_memory_access(memory_t *mem, char *msg, int data, int ea, int ignored) {
+   char buffer[256];
    char *bp = buffer;
    bp += write_s(bp, msg);
-   bp += addr_display_fn(bp, ea);
+   bp += mem->addr_display_fn(mem, bp, ea);
    bp += write_s(bp, " = ");
    write_hex2(bp, data);
    bp += 2;
@@ -55,14 +137,15 @@ static inline void log_memory_access(char *msg, int data, int ea, int ignored) {
       bp += write_s(bp, " (ignored)");
    }
    *bp++ = 0;
-   puts(buffer);
+   output_line(buffer);
 }
 
 
-static inline void log_memory_fail(int ea, int expected, int actual) {
+static inline void log_memory_fail(memory_t *mem, int ea, int expected, int actual) {
+   char buffer[256];
    char *bp = buffer;
    bp += write_s(bp, "memory modelling failed at ");
-   bp += addr_display_fn(bp, ea);
+   bp += mem->addr_display_fn(mem, bp, ea);
    bp += write_s(bp, ": expected ");
    write_hex2(bp, expected);
    bp += 2;
@@ -70,82 +153,203 @@ static inline void log_memory_fail(int ea, int expected, int actual) {
    write_hex2(bp, actual);
    bp += 2;
    *bp++ = 0;
-   puts(buffer);
+   output_line(buffer);
+}
+
+static void init_ram(memory_t *mem, int size) {
+   // Everything starts off unknown
+   mem->num_blocks = size >> BLOCK_SHIFT;
+   mem->blocks = calloc(mem->num_blocks, sizeof(mem_block_t *));
+   if (!mem->blocks) {
+      fprintf(stderr, "failed to allocate memory model\n");
+      exit(1);
+   }
+}
+
+static mem_block_t *alloc_block(memory_t *mem, int b) {
+   mem_block_t *block = calloc(1, sizeof(mem_block_t));
+   if (!block) {
+      fprintf(stderr, "failed to allocate memory model\n");
+      exit(1);
+   }
+   mem->blocks[b] = block;
+   return block;
+}
+
+// Returns the block containing location i, allocating it if necessary
+
+static inline mem_block_t *get_block_for_write(memory_t *mem, int i) {
+   mem_block_t *block = mem->blocks[i >> BLOCK_SHIFT];
+   return block ? block : alloc_block(mem, i >> BLOCK_SHIFT);
+}
+
+static inline int is_known(mem_block_t *block, int i) {
+   i &= BLOCK_SIZE - 1;
+   return (block->known[i >> 6] >> (i & 63)) & 1;
+}
+
+// ==================================================
+// Snapshot Journal
+// ==================================================
+
+// While there is a snapshot, a page is saved in the journal before it's
+// first modified, so a rollback only has to restore the pages that were
+// touched since.
+
+static void journal_page(memory_t *mem, mem_block_t *block, int page) {
+   if (mem->journal_len == mem->journal_size) {
+      mem->journal_size = mem->journal_size ? 2 * mem->journal_size : 16;
+      mem->journal = realloc(mem->journal, mem->journal_size * sizeof(journal_entry_t));
+      if (!mem->journal) {
+         fprintf(stderr, "failed to allocate memory journal\n");
+         exit(1);
+      }
+   }
+   journal_entry_t *entry = mem->journal + mem->journal_len++;
+   entry->page = page;
+   int offset = (page << PAGE_SHIFT) & (BLOCK_SIZE - 1);
+   memcpy(entry->data, block->data + offset, sizeof(entry->data));
+   memcpy(entry->known, block->known + offset / 64, sizeof(entry->known));
+   mem->dirty[page] = 1;
 }
 
-static int *init_ram(int size) {
-   int *ram =  malloc(size * sizeof(int));
-   for (int i = 0; i < size; i++) {
-      ram[i] = -1;
+// All modifications to the modelled memory go through here
+
+static inline void store(memory_t *mem, mem_block_t *block, int i, int data) {
+   if (mem->dirty) {
+      int page = i >> PAGE_SHIFT;
+      if (!mem->dirty[page]) {
+         journal_page(mem, block, page);
+      }
+   }
+   i &= BLOCK_SIZE - 1;
+   block->data[i] = data;
+   block->known[i >> 6] |= (uint64_t) 1 << (i & 63);
+}
+
+static inline void write_location(memory_t *mem, int i, int data) {
+   store(mem, get_block_for_write(mem, i), i, data);
+}
+
+// Checks the data read from a location against the model (unless it's IO,
+// which can read back anything), and then updates the model
+
+static inline uint32_t verify(memory_t *mem, int i, int data, int ea, int is_io) {
+   uint32_t fail = 0;
+   mem_block_t *block = get_block_for_write(mem, i);
+   int expected = block->data[i & (BLOCK_SIZE - 1)];
+   if (is_known(block, i) & (expected != data) & !is_io) {
+      log_memory_fail(mem, ea, expected, data);
+      fail = FAIL_MEMORY;
+   }
+   store(mem, block, i, data);
+   return fail;
+}
+
+static void free_journal(memory_t *mem) {
+   free(mem->dirty);
+   free(mem->journal);
+   mem->dirty = NULL;
+   mem->journal = NULL;
+   mem->journal_len = 0;
+   mem->journal_size = 0;
+}
+
+// ==================================================
+// Page Table
+// ==================================================
+
+// The hot path looks up each access in a table with an entry per 256-byte
+// page of the address space. Each machine fills in the table when the
+// memory model is initialized, and again whenever its banking changes.
+
+static inline void map_page(memory_t *mem, int page, page_type_t type, int base) {
+   mem->pages[page].type = type;
+   mem->pages[page].base = base;
+}
+
+// Maps the pages from first to last onto consecutive locations, starting at base
+
+static void map_pages(memory_t *mem, int first, int last, page_type_t type, int base) {
+   for (int page = first; page <= last; page++) {
+      map_page(mem, page, type, base);
+      if (base >= 0) {
+         base += 0x100;
+      }
    }
-   return ram;
 }
 
 // ==================================================
 // Default Memory Handlers
 // ==================================================
 
-static int addr_display_default(char *bp, int ea) {
+static int addr_display_default(memory_t *mem, char *bp, int ea) {
    write_hex4(bp, ea);
    return 4;
 }
 
-static void memory_read_default(int data, int ea) {
-   if (memory[ea] >= 0 && memory[ea] != data) {
-      log_memory_fail(ea, memory[ea], data);
-      failflag |= FAIL_MEMORY;
-   }
-   memory[ea] = data;
+// Locations in the model are the same as addresses (or past the end of the
+// model for the unmapped pages, see count_access())
+
+static int location_display_default(memory_t *mem, char *bp, int location) {
+   write_hex4(bp, location & 0xffff);
+   return 4;
 }
 
-static int memory_write_default(int data, int ea) {
-   memory[ea] = data;
-   return 0;
+static void map_default(memory_t *mem) {
+   map_pages(mem, 0x00, 0xff, PAGE_RAM, 0);
 }
 
-static void init_default(arguments_t *args) {
-   memory = init_ram(0x10000);
-   memory_read_fn  = memory_read_default;
-   memory_write_fn = memory_write_default;
-   addr_display_fn = addr_display_default;
+static void init_default(memory_t *mem, arguments_t *args) {
+   init_ram(mem, 0x10000);
+   mem->map_fn          = map_default;
+   mem->io_read_fn      = NULL;
+   mem->io_write_fn     = NULL;
+   mem->addr_display_fn = addr_display_default;
+   mem->location_display_fn = location_display_default;
 }
 
 // ==================================================
 // Dragon Memory Handlers
 // ==================================================
 
-static void memory_read_dragon(int data, int ea) {
-   if (memory[ea] >= 0 && memory[ea] != data && (ea < 0xff00 || ea >= 0xfff0)) {
-      log_memory_fail(ea, memory[ea], data);
-      failflag |= FAIL_MEMORY;
-   }
-   memory[ea] = data;
+static void map_dragon(memory_t *mem) {
+   map_pages(mem, 0x00, 0xfe, PAGE_RAM, 0);
+   map_page (mem, 0xff, PAGE_IO, 0xff00);
+}
+
+static uint32_t io_read_dragon(memory_t *mem, int data, int ea) {
+   // IO can read back anything, but the vectors are at 0xfff0-0xffff
+   return verify(mem, ea, data, ea, ea < 0xfff0);
 }
 
-static void init_dragon(arguments_t *args) {
-   memory = init_ram(0x10000);
-   memory_read_fn  = memory_read_dragon;
-   memory_write_fn = memory_write_default;
-   addr_display_fn = addr_display_default;
+static int io_write_dragon(memory_t *mem, int data, int ea) {
+   write_location(mem, ea, data);
+   return 0;
+}
+
+static void init_dragon(memory_t *mem, arguments_t *args) {
+   init_ram(mem, 0x10000);
+   mem->map_fn          = map_dragon;
+   mem->io_read_fn      = io_read_dragon;
+   mem->io_write_fn     = io_write_dragon;
+   mem->addr_display_fn = addr_display_default;
+   mem->location_display_fn = location_display_default;
 }
 
 // ==================================================
 // SBC09 Memory Handlers
 // ==================================================
 
-static int mmu_disabled[4] = { 0x80, 0x81, 0x00, 0x01 };
-
-static int mmu0[4] = { 0xff, 0xff, 0xff, 0xff };
+static const int mmu_disabled[4] = { 0x80, 0x81, 0x00, 0x01 };
 
-static int mmu_enabled = 0;
-
-static int get_block(int ea) {
+static int get_block(memory_t *mem, int ea) {
    if (ea < 0) {
       fprintf(stderr, "EA should never be undefined; exiting\n");
       exit(1);
    } else if (ea < 0xfc00 || ea >= 0xff00) {
-      if (mmu_enabled) {
-         return mmu0[(ea >> 14) & 3];
+      if (mem->mmu_enabled) {
+         return mem->mmu0[(ea >> 14) & 3];
       } else {
          return mmu_disabled[(ea >> 14) & 3];
       }
@@ -154,8 +358,8 @@ static int get_block(int ea) {
    }
 }
 
-static int addr_display_sbc09(char *bp, int ea) {
-   int block = get_block(ea);
+static int addr_display_sbc09(memory_t *mem, char *bp, int ea) {
+   int block = get_block(mem, ea);
    if (block >= 0) {
       write_hex2(bp, block);
       bp += 2;
@@ -168,220 +372,631 @@ static int addr_display_sbc09(char *bp, int ea) {
    }
 }
 
-static inline int *get_memptr_sbc09(int ea) {
-   int block = get_block(ea);
-   return memory + (block << 14) + (ea & 0x3FFF);
+static int location_display_sbc09(memory_t *mem, char *bp, int location) {
+   if (location >= mem->num_blocks << BLOCK_SHIFT) {
+      // IO
+      write_hex4(bp, location & 0xffff);
+      return 4;
+   }
+   write_hex2(bp, location >> 14);
+   bp += 2;
+   *bp++ = ':';
+   write_hex4(bp, location & 0x3fff);
+   return 7;
 }
 
-
-static void memory_read_sbc09(int data, int ea) {
-   if (ea < 0xfc00 || ea >= 0xff00) {
-      int *memptr = get_memptr_sbc09(ea);
-      if (memptr) {
-         if (*memptr >= 0 && *memptr != data) {
-            log_memory_fail(ea, *memptr, data);
-            failflag |= FAIL_MEMORY;
-         }
-         *memptr = data;
+static void map_sbc09(memory_t *mem) {
+   for (int page = 0x00; page <= 0xff; page++) {
+      int block = get_block(mem, page << 8);
+      if (block >= 0) {
+         map_page(mem, page, PAGE_RAM, (block << 14) + ((page << 8) & 0x3FFF));
+      } else {
+         map_page(mem, page, PAGE_IO, -1);
       }
    }
 }
 
-static int memory_write_sbc09(int data, int ea) {
-   if (ea < 0xfc00 || ea >= 0xff00) {
-      int *memptr = get_memptr_sbc09(ea);
-      if (memptr) {
-         *memptr = data;
-      }
-   } else if (ea == 0xfe0e) {
+static int io_write_sbc09(memory_t *mem, int data, int ea) {
+   if (ea == 0xfe0e) {
       if (data & 0x10) {
-         printf("*** MMU Enabled ***\n");
-         mmu_enabled = 1;
+         output_line("*** MMU Enabled ***");
+         mem->mmu_enabled = 1;
+         map_sbc09(mem);
       }
    } else if (ea == 0xfe0f) {
       if (data & 0x10) {
-         printf("*** MMU Disabled ***\n");
-         mmu_enabled = 0;
+         output_line("*** MMU Disabled ***");
+         mem->mmu_enabled = 0;
+         map_sbc09(mem);
       }
    } else if (ea >= 0xfe10 && ea <= 0xfe13) {
-      mmu0[ea & 3] = data;
+      mem->mmu0[ea & 3] = data;
+      if (mem->mmu_enabled) {
+         map_sbc09(mem);
+      }
    }
    return 0;
 }
 
-static void init_sbc09(arguments_t *args) {
+static void init_sbc09(memory_t *mem, arguments_t *args) {
    // For now, lets just model 256 x 16K blocks
-   memory = init_ram(0x100 * 0x4000);
-   memory_read_fn  = memory_read_sbc09;
-   memory_write_fn = memory_write_sbc09;
-   addr_display_fn = addr_display_sbc09;
+   init_ram(mem, 0x100 * 0x4000);
+   mem->map_fn          = map_sbc09;
+   mem->io_read_fn      = NULL;
+   mem->io_write_fn     = io_write_sbc09;
+   mem->addr_display_fn = addr_display_sbc09;
+   mem->location_display_fn = location_display_sbc09;
+   mem->mmu_enabled = 0;
+   for (int i = 0; i < 4; i++) {
+      mem->mmu0[i] = 0xff;
+   }
 }
 
 // ==================================================
 // Beeb Memory Handlers
 // ==================================================
 
-static int addr_display_beeb(char *bp, int ea) {
-   write_bankid(bp, ea);
+static int addr_display_beeb(memory_t *mem, char *bp, int ea) {
+   write_bankid(mem, bp, ea);
    write_hex4(bp + 2, ea);
    return 6;
 }
 
-static inline void set_rom_latch(int data) {
-   rom_latch = data;
+static int location_display_beeb(memory_t *mem, char *bp, int location) {
+   if (location >= mem->num_blocks << BLOCK_SHIFT) {
+      // The paged ROM wasn't known
+      int ea = location & 0xffff;
+      if (ea >= 0x8000 && ea < 0xc000) {
+         *bp++ = '?';
+         *bp++ = '-';
+         write_hex4(bp, ea);
+         return 6;
+      }
+      write_hex4(bp, ea);
+      return 4;
+   } else if (location >= SWROM_BASE) {
+      *bp++ = TO_HEX((location - SWROM_BASE) >> 14);
+      *bp++ = '-';
+      write_hex4(bp, 0x8000 + (location & 0x3fff));
+      return 6;
+   }
+   write_hex4(bp, location);
+   return 4;
 }
 
-static inline int *get_memptr_beeb(int ea) {
-   if (ea < 0) {
-      fprintf(stderr, "EA should never be undefined; exiting\n");
-      exit(1);
-   }
-   if (ea >= 0x8000 && ea < 0xC000) {
-      if (rom_latch >= 0) {
-         return swrom + (rom_latch << 14) + (ea & 0x3FFF);
-      } else {
-         return NULL;
-      }
+static void map_beeb(memory_t *mem) {
+   map_pages(mem, 0x00, 0x7f, PAGE_RAM, 0x0000);
+   if (mem->rom_latch >= 0) {
+      map_pages(mem, 0x80, 0xbf, PAGE_ROM, SWROM_BASE + (mem->rom_latch << 14));
    } else {
-      return memory + ea;
+      // The paged ROM is unknown, so isn't modelled
+      map_pages(mem, 0x80, 0xbf, PAGE_ROM, -1);
    }
+   map_pages(mem, 0xc0, 0xfb, PAGE_ROM, 0xc000);
+   map_pages(mem, 0xfc, 0xfe, PAGE_IO,  0xfc00);
+   map_page (mem, 0xff,       PAGE_ROM, 0xff00);
 }
 
-static void memory_read_beeb(int data, int ea) {
-   if (ea < 0xfc00 || ea >= 0xff00) {
-      int *memptr = get_memptr_beeb(ea);
-      if (memptr) {
-         if (*memptr >= 0 && *memptr != data) {
-            log_memory_fail(ea, *memptr, data);
-            failflag |= FAIL_MEMORY;
-         }
-         *memptr = data;
-      }
-   }
+static inline void set_rom_latch(memory_t *mem, int data) {
+   mem->rom_latch = data;
+   map_beeb(mem);
 }
 
-static int memory_write_beeb(int data, int ea) {
+// IO reads aren't modelled, but writes are recorded
+
+static int io_write_beeb(memory_t *mem, int data, int ea) {
    if (ea == 0xfe30) {
-      set_rom_latch(data & 0xf);
-   }
-   if ((ea >= 0x8000 && ea < 0xfc00) || (ea >= 0xff00)) {
-      return 1;
-   }
-   int *memptr = get_memptr_beeb(ea);
-   if (memptr) {
-      *memptr = data;
+      set_rom_latch(mem, data & 0xf);
    }
+   write_location(mem, ea, data);
    return 0;
 }
 
-static void init_beeb(arguments_t *args) {
-   memory = init_ram(0x10000);
-   swrom = init_ram(SWROM_NUM_BANKS * SWROM_SIZE);
-   memory_read_fn  = memory_read_beeb;
-   memory_write_fn = memory_write_beeb;
-   addr_display_fn = addr_display_beeb;
+static void init_beeb(memory_t *mem, arguments_t *args) {
+   init_ram(mem, SWROM_BASE + SWROM_NUM_BANKS * SWROM_SIZE);
+   mem->map_fn          = map_beeb;
+   mem->io_read_fn      = NULL;
+   mem->io_write_fn     = io_write_beeb;
+   mem->addr_display_fn = addr_display_beeb;
+   mem->location_display_fn = location_display_beeb;
+   mem->rom_latch = -1;
    if (args->rom_latch >= 0 && args->rom_latch <= 15) {
-      rom_latch = args->rom_latch;
+      mem->rom_latch = args->rom_latch;
+   }
+}
+
+static void free_ram(memory_t *mem) {
+   free_journal(mem);
+   for (int b = 0; b < mem->num_blocks; b++) {
+      free(mem->blocks[b]);
    }
+   free(mem->blocks);
+   mem->blocks = NULL;
+   mem->num_blocks = 0;
 }
 
 // ==================================================
 // Public Methods
 // ==================================================
 
-void memory_init(arguments_t *args) {
+// Creates a memory model with modelling and logging turned off
+
+memory_t *memory_create(arguments_t *args) {
+   memory_t *mem = calloc(1, sizeof(memory_t));
+   if (!mem) {
+      fprintf(stderr, "failed to allocate memory model\n");
+      exit(1);
+   }
+   memory_init(mem, args);
+   return mem;
+}
+
+// Sets all of memory back to unknown, and discards any snapshot (the
+// modelling and logging settings are unchanged)
+
+void memory_init(memory_t *mem, arguments_t *args) {
+   free_ram(mem);
    // Setup the machine specific memory read/write handler
    switch (args->machine) {
    case MACHINE_DRAGON32:
-      init_dragon(args);
+      init_dragon(mem, args);
       break;
    case MACHINE_BEEB:
-      init_beeb(args);
+      init_beeb(mem, args);
       break;
    case MACHINE_SBC09:
-      init_sbc09(args);
+      init_sbc09(mem, args);
       break;
    default:
-      init_default(args);
+      init_default(mem, args);
       break;
    }
+   mem->map_fn(mem);
+}
+
+// Takes a snapshot of the modelled memory (and of the banking state), which
+// memory_rollback() can go back to any number of times. Replacing a
+// snapshot only has to forget the pages modified since it was taken, so a
+// snapshot can cheaply be taken before every instruction.
+
+void memory_snapshot(memory_t *mem) {
+   if (mem->dirty) {
+      for (int i = 0; i < mem->journal_len; i++) {
+         mem->dirty[mem->journal[i].page] = 0;
+      }
+      mem->journal_len = 0;
+   } else {
+      mem->dirty = calloc(mem->num_blocks << (BLOCK_SHIFT - PAGE_SHIFT), 1);
+      if (!mem->dirty) {
+         fprintf(stderr, "failed to allocate memory journal\n");
+         exit(1);
+      }
+   }
+   mem->saved_rom_latch = mem->rom_latch;
+   mem->saved_mmu_enabled = mem->mmu_enabled;
+   memcpy(mem->saved_mmu0, mem->mmu0, sizeof(mem->mmu0));
+}
+
+// Undoes all changes since memory_snapshot(), in time proportional to the
+// number of pages modified
+
+void memory_rollback(memory_t *mem) {
+   if (!mem->dirty) {
+      return;
+   }
+   for (int i = 0; i < mem->journal_len; i++) {
+      journal_entry_t *entry = mem->journal + i;
+      // The block was allocated before the page was journalled
+      mem_block_t *block = mem->blocks[entry->page >> (BLOCK_SHIFT - PAGE_SHIFT)];
+      int offset = (entry->page << PAGE_SHIFT) & (BLOCK_SIZE - 1);
+      memcpy(block->data + offset, entry->data, sizeof(entry->data));
+      memcpy(block->known + offset / 64, entry->known, sizeof(entry->known));
+      mem->dirty[entry->page] = 0;
+   }
+   mem->journal_len = 0;
+   mem->rom_latch = mem->saved_rom_latch;
+   mem->mmu_enabled = mem->saved_mmu_enabled;
+   memcpy(mem->mmu0, mem->saved_mmu0, sizeof(mem->mmu0));
+   mem->map_fn(mem);
+}
+
+// Writes the modelled memory, and the banking state, to a checkpoint. Only
+// the blocks that have been modified are written.
+
+int memory_save(memory_t *mem, FILE *file) {
+   int32_t header[7];
+   header[0] = mem->num_blocks;
+   header[1] = mem->rom_latch;
+   header[2] = mem->mmu_enabled;
+   for (int i = 0; i < 4; i++) {
+      header[3 + i] = mem->mmu0[i];
+   }
+   if (fwrite(header, sizeof(header), 1, file) != 1) {
+      return -1;
+   }
+   for (int32_t b = 0; b < mem->num_blocks; b++) {
+      if (mem->blocks[b]) {
+         if (fwrite(&b, sizeof(b), 1, file) != 1 || fwrite(mem->blocks[b], sizeof(mem_block_t), 1, file) != 1) {
+            return -1;
+         }
+      }
+   }
+   int32_t end = -1;
+   return fwrite(&end, sizeof(end), 1, file) == 1 ? 0 : -1;
+}
+
+// Replaces the modelled memory with that from a checkpoint, which must be of
+// the same machine. Any snapshot is discarded.
+
+int memory_load(memory_t *mem, FILE *file) {
+   int32_t header[7];
+   if (fread(header, sizeof(header), 1, file) != 1 || header[0] != mem->num_blocks) {
+      return -1;
+   }
+   free_journal(mem);
+   for (int b = 0; b < mem->num_blocks; b++) {
+      free(mem->blocks[b]);
+      mem->blocks[b] = NULL;
+   }
+   mem->rom_latch = header[1];
+   mem->mmu_enabled = header[2];
+   for (int i = 0; i < 4; i++) {
+      mem->mmu0[i] = header[3 + i];
+   }
+   mem->map_fn(mem);
+   for (;;) {
+      int32_t b;
+      if (fread(&b, sizeof(b), 1, file) != 1) {
+         return -1;
+      }
+      if (b < 0) {
+         return 0;
+      }
+      if (b >= mem->num_blocks || mem->blocks[b]) {
+         return -1;
+      }
+      if (fread(alloc_block(mem, b), sizeof(mem_block_t), 1, file) != 1) {
+         return -1;
+      }
+   }
+}
+
+void memory_destroy(memory_t *mem) {
+   free_ram(mem);
+   free(mem->heatmap);
+   for (int i = 0; i < NUM_COVERAGE; i++) {
+      free(mem->coverage[i]);
+   }
+   free(mem);
+}
+
+void memory_set_modelling(memory_t *mem, int bitmask) {
+   mem->mem_model = bitmask;
 }
 
-void memory_destroy() {
-   if (swrom) {
-      free(swrom);
+void memory_set_rd_logging(memory_t *mem, int bitmask) {
+   mem->mem_rd_logging = bitmask;
+}
+
+void memory_set_wr_logging(memory_t *mem, int bitmask) {
+   mem->mem_wr_logging = bitmask;
+}
+
+
+// Sets what's counted (COUNT_xxx), allocating the counters the first time
+// (the untouched pages of which the OS doesn't have to provide)
+
+void memory_set_counting(memory_t *mem, int bitmask) {
+   mem->num_locations = (mem->num_blocks << BLOCK_SHIFT) + 0x10000;
+   if ((bitmask & COUNT_ACCESSES) && !mem->heatmap) {
+      mem->heatmap = calloc(mem->num_locations, sizeof(*mem->heatmap));
+      if (!mem->heatmap) {
+         fprintf(stderr, "failed to allocate heatmap\n");
+         exit(1);
+      }
    }
-   if (memory) {
-      free(memory);
+   if ((bitmask & COUNT_COVERAGE) && !mem->coverage[0]) {
+      for (int i = 0; i < NUM_COVERAGE; i++) {
+         mem->coverage[i] = calloc(mem->num_locations / 64, sizeof(uint64_t));
+         if (!mem->coverage[i]) {
+            fprintf(stderr, "failed to allocate coverage\n");
+            exit(1);
+         }
+      }
    }
+   mem->counting = bitmask;
 }
 
-void memory_set_modelling(int bitmask) {
-   mem_model = bitmask;
+int memory_get_modelling(memory_t *mem) {
+   return mem->mem_model;
 }
 
-void memory_set_rd_logging(int bitmask) {
-   mem_rd_logging = bitmask;
+int memory_get_rd_logging(memory_t *mem) {
+   return mem->mem_rd_logging;
 }
 
-void memory_set_wr_logging(int bitmask) {
-   mem_wr_logging = bitmask;
+int memory_get_wr_logging(memory_t *mem) {
+   return mem->mem_wr_logging;
 }
 
+// ==================================================
+// Heatmap and Coverage
+// ==================================================
+
+// Accesses are counted by location in the model, so the counts follow the
+// banking (e.g. each sideways ROM, or each SBC09 MMU block, has its own).
+// Pages that aren't in the model (e.g. an unknown paged ROM) are counted
+// by address, after the end of the model.
 
-int memory_get_modelling() {
-   return mem_model;
+static inline int get_location(memory_t *mem, int ea) {
+   page_t *page = mem->pages + (ea >> 8);
+   return page->base >= 0 ? page->base + (ea & 0xff) : (mem->num_blocks << BLOCK_SHIFT) + ea;
 }
 
-int memory_get_rd_logging() {
-   return mem_rd_logging;
+static inline void set_covered(memory_t *mem, int location, int bitmap) {
+   mem->coverage[bitmap][location >> 6] |= (uint64_t) 1 << (location & 63);
+}
+
+static inline void count_access(memory_t *mem, int ea, int counter) {
+   int location = get_location(mem, ea);
+   if (mem->counting & COUNT_ACCESSES) {
+      mem->heatmap[location][counter]++;
+   }
+   if ((mem->counting & COUNT_COVERAGE) && counter < 4) {
+      set_covered(mem, location, counter == MEM_INSTR ? COVERAGE_INSTR : COVERAGE_DATA);
+   }
 }
 
-int memory_get_wr_logging() {
-   return mem_wr_logging;
+// Marks the first byte of an instruction (when counting COUNT_COVERAGE)
+
+void memory_mark_opcode(memory_t *mem, int ea) {
+   if ((mem->counting & COUNT_COVERAGE) && ea >= 0) {
+      set_covered(mem, get_location(mem, ea), COVERAGE_OPCODE);
+   }
 }
 
-void memory_read(sample_t *sample, int ea, mem_access_t type) {
+// Counts an instruction that ran before its address was known, once it is,
+// as if its bytes had been fetched then (see em_6809.c)
+
+void memory_count_instruction(memory_t *mem, int ea, int length) {
+   if (mem->counting && ea >= 0) {
+      memory_mark_opcode(mem, ea);
+      for (int i = 0; i < length; i++) {
+         count_access(mem, (ea + i) & 0xffff, MEM_INSTR);
+      }
+   }
+}
+
+// The location of an address in paged ROM bank (see memory_get_bank()), or
+// if bank is -1 in whatever is mapped there now. Returns -1 if the address
+// isn't in that bank.
+
+int memory_get_location(memory_t *mem, int bank, int ea) {
+   if (ea < 0 || ea > 0xffff) {
+      return -1;
+   }
+   if (bank < 0) {
+      return get_location(mem, ea);
+   }
+   if (memory_get_bank(mem, ea) < 0 || bank >= SWROM_NUM_BANKS) {
+      return -1;
+   }
+   return SWROM_BASE + bank * SWROM_SIZE + (ea & (SWROM_SIZE - 1));
+}
+
+// Returns how a location was covered (COVERED_xxx), or 0 if coverage was
+// never turned on
+
+int memory_get_coverage(memory_t *mem, int location) {
+   if (!mem->coverage[0] || location < 0 || location >= mem->num_locations) {
+      return 0;
+   }
+   uint64_t bit = (uint64_t) 1 << (location & 63);
+   int covered = 0;
+   if (mem->coverage[COVERAGE_OPCODE][location >> 6] & bit) {
+      covered |= COVERED_OPCODE;
+   } else if (mem->coverage[COVERAGE_INSTR][location >> 6] & bit) {
+      covered |= COVERED_OPERAND;
+   }
+   if (mem->coverage[COVERAGE_DATA][location >> 6] & bit) {
+      covered |= COVERED_DATA;
+   }
+   return covered;
+}
+
+// Returns any prediction failures (FAIL_xxx)
+
+uint32_t memory_read(memory_t *mem, sample_t *sample, int ea, mem_access_t type) {
+   uint32_t fail = 0;
    if (sample->rnw == 0) {
-      failflag |= FAIL_RNW;
+      fail |= FAIL_RNW;
    }
    // If the effective address is unknown, we can't do any modelling
    if (ea < 0) {
-      return;
+      return fail;
    }
    int data = sample->data;
-   validate_address(sample, ea, 1 << type);
+   fail |= validate_address(sample, ea, 1 << type);
+   if (mem->counting) {
+      count_access(mem, ea, type);
+   }
    // Log memory read
-   if (mem_rd_logging & (1 << type)) {
-      log_memory_access("Rd: ", data, ea, 0);
+   if (mem->mem_rd_logging & (1 << type)) {
+      log_memory_access(mem, "Rd: ", data, ea, 0);
    }
-   // Delegate memory read to machine specific handler
-   if (mem_model & (1 << type)) {
-      (*memory_read_fn)(data, ea);
+   // Verify the read against the model
+   if (mem->mem_model & (1 << type)) {
+      page_t *page = mem->pages + (ea >> 8);
+      if (page->type == PAGE_IO) {
+         if (mem->io_read_fn) {
+            fail |= mem->io_read_fn(mem, data, ea);
+         }
+      } else if (page->base >= 0) {
+         fail |= verify(mem, page->base + (ea & 0xff), data, ea, 0);
+      }
    }
+   return fail;
 }
 
-void memory_write(sample_t *sample, int ea, mem_access_t type) {
+uint32_t memory_write(memory_t *mem, sample_t *sample, int ea, mem_access_t type) {
+   uint32_t fail = 0;
    if (sample->rnw == 1) {
-      failflag |= FAIL_RNW;
+      fail |= FAIL_RNW;
    }
    // If the effective address is unknown, we can't do any modelling
    if (ea < 0) {
-      return;
+      return fail;
    }
    int data = sample->data;
-   validate_address(sample, ea, 1 << type);
-   // Delegate memory write to machine specific handler
+   fail |= validate_address(sample, ea, 1 << type);
+   if (mem->counting) {
+      count_access(mem, ea, 4 + type);
+   }
+   // Record the write in the model
    int ignored = 0;
-   if (mem_model & (1 << type)) {
-      ignored = (*memory_write_fn)(data, ea);
+   if (mem->mem_model & (1 << type)) {
+      page_t *page = mem->pages + (ea >> 8);
+      if (page->type == PAGE_RAM) {
+         write_location(mem, page->base + (ea & 0xff), data);
+      } else if (page->type == PAGE_ROM) {
+         ignored = 1;
+      } else if (mem->io_write_fn) {
+         ignored = mem->io_write_fn(mem, data, ea);
+      }
    }
    // Log memory write
-   if (mem_wr_logging & (1 << type)) {
-      log_memory_access("Wr: ", data, ea, ignored);
+   if (mem->mem_wr_logging & (1 << type)) {
+      log_memory_access(mem, "Wr: ", data, ea, ignored);
    }
+   return fail;
+}
+
+// Returns -1 if the location is unknown
+
+int memory_read_raw(memory_t *mem, int ea) {
+   mem_block_t *block = mem->blocks[ea >> BLOCK_SHIFT];
+   return block && is_known(block, ea) ? block->data[ea & (BLOCK_SIZE - 1)] : -1;
 }
 
-int memory_read_raw(int ea) {
-   return memory[ea];
+// The paged ROM an address is in: -1 if the address isn't paged, 0-15 for a
+// BBC sideways ROM, or 16 if the ROM latch isn't known yet
+
+int memory_get_bank(memory_t *mem, int ea) {
+   if (mem->map_fn != map_beeb || ea < 0x8000 || ea >= 0xc000) {
+      return -1;
+   }
+   return mem->rom_latch < 0 ? 16 : mem->rom_latch;
+}
+
+// Writes the heatmap, as CSV (a row per location, or per page, with any
+// accesses) or binary:
+//
+//    heatmap_header_t
+//    uint32_t location, uint32_t mask, uint64_t count (one per bit set in
+//    mask, for counters 0 to 7) (repeated)
+//
+// Counters 0-3 are reads, and 4-7 are writes, each by mem_access_t. The
+// locations at or after model_size are unmapped addresses (model_size +
+// address), and the rest are machine specific (e.g. on the Beeb, sideways
+// ROM n is at 0x10000 + n * 0x4000). Like an index, it's written in the
+// host's byte order.
+
+#define HEATMAP_MAGIC      "D6809HMP"
+#define HEATMAP_VERSION    1
+#define HEATMAP_BYTE_ORDER 0x01020304
+
+typedef struct {
+   char     magic[8];
+   uint32_t version;
+   uint32_t byte_order;
+   int32_t  machine;
+   uint32_t model_size;
+} heatmap_header_t;
+
+static const char *const counter_names[NUM_COUNTERS] = {
+   "instr_rd", "pointer_rd", "data_rd", "stack_rd",
+   "instr_wr", "pointer_wr", "data_wr", "stack_wr"
+};
+
+static int write_heatmap_csv(memory_t *mem, FILE *file, int page_shift) {
+   fputs(page_shift ? "page" : "address", file);
+   for (int c = 0; c < NUM_COUNTERS; c++) {
+      fprintf(file, ",%s", counter_names[c]);
+   }
+   fputc('\n', file);
+   int step = 1 << page_shift;
+   int len = mem->heatmap ? mem->num_locations : 0;
+   for (int start = 0; start < len; start += step) {
+      uint64_t counts[NUM_COUNTERS] = { 0 };
+      uint64_t any = 0;
+      for (int location = start; location < start + step; location++) {
+         for (int c = 0; c < NUM_COUNTERS; c++) {
+            counts[c] += mem->heatmap[location][c];
+            any |= mem->heatmap[location][c];
+         }
+      }
+      if (!any) {
+         continue;
+      }
+      char name[16];
+      name[mem->location_display_fn(mem, name, start)] = 0;
+      fputs(name, file);
+      for (int c = 0; c < NUM_COUNTERS; c++) {
+         fprintf(file, ",%"PRIu64, counts[c]);
+      }
+      fputc('\n', file);
+   }
+   return ferror(file) ? -1 : 0;
+}
+
+static int write_heatmap_binary(memory_t *mem, FILE *file, int machine) {
+   heatmap_header_t header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, HEATMAP_MAGIC, sizeof(header.magic));
+   header.version = HEATMAP_VERSION;
+   header.byte_order = HEATMAP_BYTE_ORDER;
+   header.machine = machine;
+   header.model_size = mem->num_blocks << BLOCK_SHIFT;
+   if (fwrite(&header, sizeof(header), 1, file) != 1) {
+      return -1;
+   }
+   int len = mem->heatmap ? mem->num_locations : 0;
+   for (int location = 0; location < len; location++) {
+      uint32_t record[2] = { location, 0 };
+      for (int c = 0; c < NUM_COUNTERS; c++) {
+         if (mem->heatmap[location][c]) {
+            record[1] |= 1 << c;
+         }
+      }
+      if (!record[1]) {
+         continue;
+      }
+      if (fwrite(record, sizeof(record), 1, file) != 1) {
+         return -1;
+      }
+      for (int c = 0; c < NUM_COUNTERS; c++) {
+         if (mem->heatmap[location][c] && fwrite(&mem->heatmap[location][c], sizeof(uint64_t), 1, file) != 1) {
+            return -1;
+         }
+      }
+   }
+   return 0;
+}
+
+// Writes the heatmap to the file (which has been opened for the format
+// in args, before the decode) and closes it. If counting was never turned
+// on, the heatmap is empty.
+
+int memory_write_heatmap(memory_t *mem, FILE *file, arguments_t *args) {
+   int ret;
+   if (args->heatmap_format == HEATMAP_BINARY) {
+      ret = write_heatmap_binary(mem, file, args->machine);
+   } else {
+      ret = write_heatmap_csv(mem, file, args->heatmap_format == HEATMAP_PAGES ? 8 : 0);
+   }
+   if (fclose(file) || ret < 0) {
+      perror("failed to write heatmap");
+      return -1;
+   }
+   return 0;
 }
@@ -1,6 +1,8 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stdio.h>
+
 #include "defs.h"
 
 typedef enum {
@@ -10,28 +12,61 @@ typedef enum {
    MEM_STACK    = 3,
 } mem_access_t;
 
-void memory_init(arguments_t *args);
+// What memory_set_counting() counts
+#define COUNT_ACCESSES   1   // Reads and writes of each location (--heatmap)
+#define COUNT_COVERAGE   2   // Which locations are executed or read (--coverage)
+
+// How a location was covered (see memory_get_coverage())
+#define COVERED_OPCODE   1
+#define COVERED_OPERAND  2
+#define COVERED_DATA     4
+
+memory_t *memory_create(arguments_t *args);
+
+void memory_init(memory_t *mem, arguments_t *args);
+
+void memory_destroy(memory_t *mem);
+
+void memory_snapshot(memory_t *mem);
+
+void memory_rollback(memory_t *mem);
+
+int memory_save(memory_t *mem, FILE *file);
+
+int memory_load(memory_t *mem, FILE *file);
+
+void memory_set_modelling(memory_t *mem, int bitmask);
+
+void memory_set_rd_logging(memory_t *mem, int bitmask);
+
+void memory_set_wr_logging(memory_t *mem, int bitmask);
+
+void memory_set_counting(memory_t *mem, int bitmask);
+
+int memory_write_heatmap(memory_t *mem, FILE *file, arguments_t *args);
+
+void memory_mark_opcode(memory_t *mem, int ea);
 
-void memory_set_modelling(int bitmask);
+void memory_count_instruction(memory_t *mem, int ea, int length);
 
-void memory_set_rd_logging(int bitmask);
+int memory_get_location(memory_t *mem, int bank, int ea);
 
-void memory_set_wr_logging(int bitmask);
+int memory_get_coverage(memory_t *mem, int location);
 
-int memory_get_modelling();
+int memory_get_modelling(memory_t *mem);
 
-int memory_get_rd_logging();
+int memory_get_rd_logging(memory_t *mem);
 
-int memory_get_wr_logging();
+int memory_get_wr_logging(memory_t *mem);
 
-void memory_read(sample_t *sample, int ea, mem_access_t type);
+uint32_t memory_read(memory_t *mem, sample_t *sample, int ea, mem_access_t type);
 
-void memory_write(sample_t *sample, int ea, mem_access_t type);
+uint32_t memory_write(memory_t *mem, sample_t *sample, int ea, mem_access_t type);
 
-int memory_read_raw(int ea);
+int memory_read_raw(memory_t *mem, int ea);
 
-void memory_destroy();
+int write_bankid(memory_t *mem, char *bp, int ea);
 
-int write_bankid(char *bp, int ea);
+int memory_get_bank(memory_t *mem, int ea);
 
 #endif
@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "defs.h"
+#include "output.h"
+#include "spsc.h"
+#include "trace.h"
+
+// All of the decoder's output goes through here.
+//
+// Normally each line is appended to the sink as soon as it's produced. The
+// sink is a large buffer that's written to stdout with write(), bypassing
+// stdio (and its locking). Only one thread ever appends to it: the decoder,
+// or with --pipeline, the formatter.
+//
+// With --pipeline, output is instead appended to large batches that are
+// handed to a formatter thread. A batch holds a sequence of entries, each
+// either plain text, or an instruction record that the formatter turns
+// into text using the same format function as the immediate path. The
+// output is therefore byte-identical, whichever thread formats it.
+//
+// With --output-format=binary, the format function produces a binary trace
+// record rather than a line, and any other text is wrapped in a text
+// record (see trace.h).
+//
+// In a --jobs worker, output is instead collected into groups, each tagged
+// with the sample number of the instruction that ends it, and written to
+// the worker's chunk file for the parent to stitch together.
+
+#define SINK_SIZE   (1024 * 1024)
+
+#define BATCH_SIZE  (256 * 1024)
+#define NUM_BATCHES 16
+
+// Longest line the format function can produce
+#define LINE_SIZE   1024
+
+typedef enum {
+   ENTRY_TEXT,
+   ENTRY_RECORD
+} entry_type_t;
+
+typedef struct {
+   uint32_t type;
+   uint32_t len;
+} entry_t;
+
+typedef struct {
+   size_t len;
+   char   data[BATCH_SIZE];
+} batch_t;
+
+// Entries are padded, so the records that follow them stay aligned
+#define ENTRY_ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+static output_format_fn format_fn;
+
+static char  *sink_buf = NULL;
+static size_t sink_len = 0;
+static int    sink_failed = 0;
+
+// Set if stdout is a terminal, so output appears as it's produced
+static int    sink_interactive = 0;
+
+// Set if writing a binary trace
+static int    binary = 0;
+
+static int deferred = 0;
+
+// Output is discarded while muted (e.g. during sync trials)
+static int muted = 0;
+
+static char line[LINE_SIZE];
+
+// The batch currently being filled
+static batch_t *batch;
+
+// Batches waiting to be formatted, and batches free to be filled
+static spsc_t full_q;
+static spsc_t free_q;
+
+static pthread_t formatter;
+
+// Text held back by output_hold(), as pieces each preceded by its length
+static int    holding   = 0;
+static char  *held_buf  = NULL;
+static size_t held_len  = 0;
+static size_t held_size = 0;
+
+// The chunk file (in a --jobs worker), and the text of the current group
+static FILE  *group_file = NULL;
+static char  *group_buf  = NULL;
+static size_t group_len  = 0;
+static size_t group_size = 0;
+
+// ====================================================================
+// Sink
+// ====================================================================
+
+static void sink_write_fd(const char *s, size_t len) {
+   while (len > 0 && !sink_failed) {
+      ssize_t n = write(STDOUT_FILENO, s, len);
+      if (n < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         // Discard the rest of the output, as stdio would
+         perror("failed to write output");
+         sink_failed = 1;
+      } else {
+         s += n;
+         len -= n;
+      }
+   }
+}
+
+static void sink_flush() {
+   sink_write_fd(sink_buf, sink_len);
+   sink_len = 0;
+}
+
+static void sink_write(const char *s, size_t len) {
+   if (!sink_buf) {
+      // Should only happen before output_init()
+      fwrite(s, 1, len, stdout);
+      return;
+   }
+   if (sink_len + len > SINK_SIZE) {
+      sink_flush();
+      if (len > SINK_SIZE / 2) {
+         // Too big to be worth copying
+         sink_write_fd(s, len);
+         return;
+      }
+   }
+   memcpy(sink_buf + sink_len, s, len);
+   sink_len += len;
+   if (sink_interactive) {
+      sink_flush();
+   }
+}
+
+// Like stdio, output isn't lost if the decoder exits early
+
+static void sink_atexit() {
+   output_flush();
+}
+
+// Appends text (e.g. a whole line, or part of one)
+
+static void sink_text(const char *s, size_t len) {
+   if (binary) {
+      uint8_t prefix[16];
+      sink_write((char *)prefix, trace_encode_text(prefix, len));
+   }
+   sink_write(s, len);
+}
+
+// Appends a record produced by the format function, in buf (which must
+// have room for the newline)
+
+static void sink_record(char *buf, int n) {
+   if (!binary) {
+      buf[n++] = '\n';
+   }
+   sink_write(buf, n);
+}
+
+static void sink_init() {
+   // Anything already written through stdio comes first
+   fflush(stdout);
+   sink_buf = malloc(SINK_SIZE);
+   sink_len = 0;
+   if (!sink_buf) {
+      fprintf(stderr, "failed to allocate output buffer\n");
+      exit(1);
+   }
+   atexit(sink_atexit);
+   sink_interactive = isatty(STDOUT_FILENO);
+#ifdef F_SETPIPE_SZ
+   // If stdout is a pipe, make it large enough to take a whole buffer
+   // at once (this is just a hint, so failure doesn't matter)
+   struct stat st;
+   if (fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+      fcntl(STDOUT_FILENO, F_SETPIPE_SZ, SINK_SIZE);
+   }
+#endif
+}
+
+// ====================================================================
+// Batches and groups
+// ====================================================================
+
+static void write_text(const char *s, size_t len) {
+   if (group_file) {
+      if (group_len + len > group_size) {
+         while (group_len + len > group_size) {
+            group_size = group_size ? 2 * group_size : BATCH_SIZE;
+         }
+         group_buf = realloc(group_buf, group_size);
+         if (!group_buf) {
+            fprintf(stderr, "failed to allocate output group\n");
+            exit(1);
+         }
+      }
+      memcpy(group_buf + group_len, s, len);
+      group_len += len;
+   } else {
+      sink_text(s, len);
+   }
+}
+
+static void *formatter_thread(void *arg) {
+   char buf[LINE_SIZE];
+   batch_t *b;
+   while ((b = spsc_pop(&full_q)) != NULL) {
+      char *ptr = b->data;
+      char *end = b->data + b->len;
+      while (ptr < end) {
+         entry_t *entry = (entry_t *)ptr;
+         ptr += sizeof(entry_t);
+         if (entry->type == ENTRY_TEXT) {
+            sink_text(ptr, entry->len);
+         } else {
+            sink_record(buf, (*format_fn)(buf, ptr));
+         }
+         ptr += ENTRY_ALIGN(entry->len);
+      }
+      b->len = 0;
+      spsc_push(&free_q, b);
+   }
+   return NULL;
+}
+
+// Reserve space for an entry in the current batch, passing the batch on
+// to the formatter when it's full
+static void *reserve_entry(entry_type_t type, size_t len) {
+   size_t need = sizeof(entry_t) + ENTRY_ALIGN(len);
+   if (batch->len + need > BATCH_SIZE) {
+      spsc_push(&full_q, batch);
+      batch = spsc_pop(&free_q);
+   }
+   entry_t *entry = (entry_t *)(batch->data + batch->len);
+   entry->type = type;
+   entry->len = len;
+   batch->len += need;
+   return entry + 1;
+}
+
+// The newline (if any) is part of the same piece, so a line held back is
+// still written in one piece
+
+static void hold_text(const char *s, size_t len, int newline) {
+   size_t piece = len + newline;
+   size_t need = sizeof(size_t) + piece;
+   if (held_len + need > held_size) {
+      while (held_len + need > held_size) {
+         held_size = held_size ? 2 * held_size : LINE_SIZE;
+      }
+      held_buf = realloc(held_buf, held_size);
+      if (!held_buf) {
+         fprintf(stderr, "failed to allocate held output\n");
+         exit(1);
+      }
+   }
+   memcpy(held_buf + held_len, &piece, sizeof(size_t));
+   memcpy(held_buf + held_len + sizeof(size_t), s, len);
+   if (newline) {
+      held_buf[held_len + need - 1] = '\n';
+   }
+   held_len += need;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+// The header (if any) is written first
+
+void output_init(arguments_t *args, output_format_fn format, const void *header, size_t header_len) {
+   format_fn = format;
+   binary = args->output_format == OUTPUT_BINARY;
+   sink_init();
+   if (header_len) {
+      sink_write(header, header_len);
+   }
+   if (args->pipeline) {
+      spsc_init(&full_q);
+      spsc_init(&free_q);
+      for (int i = 0; i < NUM_BATCHES; i++) {
+         batch_t *b = malloc(sizeof(batch_t));
+         if (!b) {
+            break;
+         }
+         b->len = 0;
+         if (i == 0) {
+            batch = b;
+         } else {
+            spsc_push(&free_q, b);
+         }
+      }
+      if (batch && pthread_create(&formatter, NULL, formatter_thread, NULL) == 0) {
+         deferred = 1;
+      } else {
+         // Fall back to formatting on the calling thread
+         fprintf(stderr, "failed to start output formatter thread\n");
+      }
+   }
+}
+
+void output_write(const char *s, size_t len) {
+   if (muted) {
+      return;
+   }
+   if (holding) {
+      hold_text(s, len, 0);
+      return;
+   }
+   if (deferred) {
+      // Split very long text, so each piece fits in a batch
+      while (len > 0) {
+         size_t n = len < BATCH_SIZE / 2 ? len : BATCH_SIZE / 2;
+         memcpy(reserve_entry(ENTRY_TEXT, n), s, n);
+         s += n;
+         len -= n;
+      }
+   } else {
+      write_text(s, len);
+   }
+}
+
+void output_line(const char *s) {
+   if (muted) {
+      return;
+   }
+   if (holding) {
+      hold_text(s, strlen(s), 1);
+      return;
+   }
+   if (deferred) {
+      size_t len = strlen(s);
+      char *ptr = reserve_entry(ENTRY_TEXT, len + 1);
+      memcpy(ptr, s, len);
+      ptr[len] = '\n';
+   } else {
+      // Written in one piece, so it's one text record in a binary trace
+      size_t len = strlen(s);
+      if (len < LINE_SIZE) {
+         memcpy(line, s, len);
+         line[len] = '\n';
+         write_text(line, len + 1);
+      } else {
+         write_text(s, len);
+         write_text("\n", 1);
+      }
+   }
+}
+
+void output_printf(const char *format, ...) {
+   if (muted) {
+      return;
+   }
+   va_list ap;
+   va_start(ap, format);
+   char buf[LINE_SIZE];
+   int n = vsnprintf(buf, sizeof(buf), format, ap);
+   if (n > 0) {
+      output_write(buf, n < (int) sizeof(buf) ? (size_t) n : sizeof(buf) - 1);
+   }
+   va_end(ap);
+}
+
+void output_record(const void *record, size_t len) {
+   if (muted) {
+      return;
+   }
+   if (deferred) {
+      memcpy(reserve_entry(ENTRY_RECORD, len), record, len);
+   } else {
+      int n = (*format_fn)(line, record);
+      if (group_file) {
+         line[n++] = '\n';
+         write_text(line, n);
+      } else {
+         sink_record(line, n);
+      }
+   }
+}
+
+// Returns the previous setting
+int output_set_muted(int mute) {
+   int previous = muted;
+   muted = mute;
+   return previous;
+}
+
+// Holds back any text (e.g. memory accesses logged while emulating an
+// instruction) until it's known whether it should appear
+
+void output_hold() {
+   holding = 1;
+   held_len = 0;
+}
+
+// Writes out the held text, or discards it
+
+void output_release(int keep) {
+   holding = 0;
+   size_t i = 0;
+   while (keep && i < held_len) {
+      size_t len;
+      memcpy(&len, held_buf + i, sizeof(size_t));
+      i += sizeof(size_t);
+      output_write(held_buf + i, len);
+      i += len;
+   }
+   held_len = 0;
+}
+
+void output_start_groups(FILE *file) {
+   group_file = file;
+   group_len = 0;
+}
+
+size_t output_group_pending() {
+   return group_len;
+}
+
+void output_group(uint64_t sample, uint64_t hash, uint32_t count) {
+   output_group_t group;
+   group.sample = sample;
+   group.hash   = hash;
+   group.len    = group_len;
+   group.count  = count;
+   fwrite(&group, sizeof(group), 1, group_file);
+   fwrite(group_buf, 1, group_len, group_file);
+   group_len = 0;
+}
+
+void output_close() {
+   if (deferred) {
+      if (batch->len > 0) {
+         spsc_push(&full_q, batch);
+      } else {
+         free(batch);
+      }
+      batch = NULL;
+      spsc_push(&full_q, NULL);
+      pthread_join(formatter, NULL);
+      // All the batches are back on the free queue
+      unsigned n = atomic_load(&free_q.tail) - atomic_load(&free_q.head);
+      while (n-- > 0) {
+         free(spsc_pop(&free_q));
+      }
+      deferred = 0;
+   }
+   output_flush();
+}
+
+// Writes out anything buffered (e.g. before forking, so nothing is written
+// twice). With --pipeline, the sink belongs to the formatter thread, so is
+// left alone.
+
+void output_flush() {
+   if (sink_buf && !deferred) {
+      sink_flush();
+   }
+   fflush(stdout);
+}
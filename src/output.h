@@ -0,0 +1,49 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "defs.h"
+
+// Formats a record passed to output_record() as a line of text (without
+// the newline), or as a binary trace record, returning the number of
+// characters written
+typedef int (*output_format_fn)(char *bp, const void *record);
+
+void output_init(arguments_t *args, output_format_fn format, const void *header, size_t header_len);
+
+void output_write(const char *s, size_t len);
+
+void output_line(const char *s);
+
+void output_printf(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+
+void output_record(const void *record, size_t len);
+
+void output_close();
+
+void output_flush();
+
+int output_set_muted(int mute);
+
+void output_hold();
+
+void output_release(int keep);
+
+// A group of output (from a --jobs worker), followed by len bytes of text
+
+typedef struct {
+   uint64_t sample; // Sample number of the last instruction in the group
+   uint64_t hash;   // Hash of the state after that instruction (or 0)
+   uint32_t len;    // Length of the text that follows
+   uint32_t count;  // Number of instructions in the group
+} output_group_t;
+
+void output_start_groups(FILE *file);
+
+size_t output_group_pending();
+
+void output_group(uint64_t sample, uint64_t hash, uint32_t count);
+
+#endif
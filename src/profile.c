@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "defs.h"
+#include "output.h"
+#include "profile.h"
+
+// With --profile, the decoder counts the executions and cycles of each
+// instruction (by its PC, and on the Beeb by its sideways ROM when it's
+// in 8000-BFFF), rather than writing them out. At the end of the capture,
+// the hottest instructions are listed, most cycles first.
+//
+// The cycles of an instruction are just its own (exclusive). Each entry
+// also has the cycles spent servicing interrupts taken at it, from the
+// interrupt until the matching RTI, so its inclusive cycles show the code
+// that suffers from interrupts. A CWAI is treated the same way, as it takes
+// the interrupt it waits for. The RTI that matches an interrupt is the one
+// that pops its frame off the stack, so an RTI from a nested SWI (or an
+// interrupt handler that doesn't return) doesn't upset the counts.
+
+// Sideways ROMs 0-15, and an unknown ROM (see memory_get_bank())
+#define NUM_BANKS 17
+
+// Interrupts can nest, but not deeply
+#define MAX_FRAMES 32
+
+typedef struct {
+   uint64_t count;
+   uint64_t cycles;           // Cycles of the instruction itself
+   uint64_t int_cycles;       // Cycles of interrupts taken at it
+   uint8_t  length;           // The instruction (as first executed)
+   uint8_t  instr[7];
+} profile_entry_t;
+
+typedef struct {
+   profile_entry_t *entry;    // The interrupted instruction
+   uint64_t start;            // Total cycles at the interrupt
+   int s;                     // The stack pointer after the interrupt (or -1)
+} profile_frame_t;
+
+typedef struct {
+   profile_entry_t *entry;
+   int bank;
+   int pc;
+   const char *name;          // For the entries without a pc
+} profile_row_t;
+
+static int top;
+static cpu_emulator_t *em;
+static void *em_ctx;
+
+// Unpaged addresses, then each bank (allocated when first used)
+static profile_entry_t *flat;
+static profile_entry_t *banks[NUM_BANKS];
+
+// Interrupt and reset sequences, and instructions with an unknown pc
+static profile_entry_t interrupt_entry;
+static profile_entry_t reset_entry;
+static profile_entry_t unknown_entry;
+
+static profile_frame_t frames[MAX_FRAMES];
+static int depth;
+
+static uint64_t total_instructions;
+static uint64_t total_cycles;
+static uint64_t total_int_cycles;
+
+static profile_entry_t *alloc_entries() {
+   profile_entry_t *entries = calloc(0x10000, sizeof(profile_entry_t));
+   if (!entries) {
+      fprintf(stderr, "failed to allocate profile\n");
+      exit(1);
+   }
+   return entries;
+}
+
+static profile_entry_t *get_entry(int pc, int bank) {
+   if (pc < 0) {
+      return &unknown_entry;
+   }
+   if (bank < 0) {
+      return flat + pc;
+   }
+   if (!banks[bank]) {
+      banks[bank] = alloc_entries();
+   }
+   return banks[bank] + pc;
+}
+
+// The opcode, skipping any prefixes
+
+static int get_opcode(instruction_t *instruction) {
+   int i = 0;
+   while (i < instruction->length - 1 && (instruction->instr[i] == 0x10 || instruction->instr[i] == 0x11)) {
+      i++;
+   }
+   return instruction->length ? instruction->instr[i] : -1;
+}
+
+int profile_init(arguments_t *args, cpu_emulator_t *emulator, void *emulator_ctx) {
+   top = args->profile_top;
+   em = emulator;
+   em_ctx = emulator_ctx;
+   flat = alloc_entries();
+   return 0;
+}
+
+// Called after each instruction (or interrupt or reset sequence), with the
+// bank of its pc at the time
+
+void profile_instruction(instruction_t *instruction, int num_cycles, int bank) {
+   profile_entry_t *entry;
+   int opcode = -1;
+   if (instruction->rst_seen) {
+      entry = &reset_entry;
+      depth = 0;
+   } else if (instruction->intr_seen) {
+      entry = &interrupt_entry;
+   } else {
+      entry = get_entry(instruction->pc, bank);
+      if (!entry->count) {
+         int len = instruction->length < (int) sizeof(entry->instr) ? instruction->length : (int) sizeof(entry->instr);
+         memcpy(entry->instr, instruction->instr, len);
+         entry->length = len;
+      }
+      opcode = get_opcode(instruction);
+   }
+
+   // Interrupts are charged to the interrupted instruction (or the CWAI),
+   // from here until the RTI
+   if ((instruction->intr_seen || opcode == 0x3c) && depth < MAX_FRAMES) {
+      frames[depth].entry = instruction->intr_seen ? get_entry(instruction->pc, bank) : entry;
+      frames[depth].start = total_cycles;
+      frames[depth].s = em->get_S(em_ctx);
+      depth++;
+   }
+
+   entry->count++;
+   entry->cycles += num_cycles;
+   total_instructions++;
+   total_cycles += num_cycles;
+   if (depth > 0) {
+      total_int_cycles += num_cycles;
+   }
+
+   // Pop the frames that the RTI has gone above (or if the stack pointer
+   // isn't known, just the last one)
+   if (opcode == 0x3b && depth > 0) {
+      int s = em->get_S(em_ctx);
+      while (depth > 0) {
+         profile_frame_t *frame = frames + depth - 1;
+         if (s >= 0 && frame->s >= 0 && frame->s >= s) {
+            break;
+         }
+         frame->entry->int_cycles += total_cycles - frame->start;
+         depth--;
+         if (s < 0 || frame->s < 0) {
+            break;
+         }
+      }
+   }
+}
+
+// ====================================================================
+// Report
+// ====================================================================
+
+static int compare_rows(const void *a, const void *b) {
+   const profile_row_t *ra = a;
+   const profile_row_t *rb = b;
+   if (ra->entry->cycles != rb->entry->cycles) {
+      return ra->entry->cycles < rb->entry->cycles ? 1 : -1;
+   }
+   if (ra->bank != rb->bank) {
+      return ra->bank - rb->bank;
+   }
+   return ra->pc - rb->pc;
+}
+
+static int add_rows(profile_row_t *rows, int n, profile_entry_t *entries, int bank) {
+   for (int pc = 0; pc < 0x10000; pc++) {
+      if (entries[pc].count || entries[pc].int_cycles) {
+         profile_row_t *row = rows + n++;
+         row->entry = entries + pc;
+         row->bank = bank;
+         row->pc = pc;
+         row->name = NULL;
+      }
+   }
+   return n;
+}
+
+static int add_special(profile_row_t *rows, int n, profile_entry_t *entry, const char *name) {
+   if (entry->count) {
+      profile_row_t *row = rows + n++;
+      row->entry = entry;
+      row->bank = NUM_BANKS;
+      row->pc = 0;
+      row->name = name;
+   }
+   return n;
+}
+
+static double percent(uint64_t cycles) {
+   return total_cycles ? 100.0 * cycles / total_cycles : 0.0;
+}
+
+void profile_report() {
+   int max_rows = 0x10000 + 3;
+   for (int b = 0; b < NUM_BANKS; b++) {
+      if (banks[b]) {
+         max_rows += 0x10000;
+      }
+   }
+   profile_row_t *rows = malloc(max_rows * sizeof(profile_row_t));
+   if (!rows) {
+      fprintf(stderr, "failed to allocate profile report\n");
+      return;
+   }
+   int n = add_rows(rows, 0, flat, -1);
+   for (int b = 0; b < NUM_BANKS; b++) {
+      if (banks[b]) {
+         n = add_rows(rows, n, banks[b], b);
+      }
+   }
+   n = add_special(rows, n, &interrupt_entry, "INTERRUPT !!");
+   n = add_special(rows, n, &reset_entry, "RESET !!");
+   n = add_special(rows, n, &unknown_entry, "????");
+   qsort(rows, n, sizeof(profile_row_t), compare_rows);
+
+   output_printf("profile: %"PRIu64" instructions, %"PRIu64" cycles, %"PRIu64" (%.2f%%) servicing interrupts\n",
+                 total_instructions, total_cycles, total_int_cycles, percent(total_int_cycles));
+   output_printf("    pc        count       cycles       %%    incl cycles       %%  instruction\n");
+   if (top > 0 && n > top) {
+      n = top;
+   }
+   for (int i = 0; i < n; i++) {
+      profile_row_t *row = rows + i;
+      profile_entry_t *entry = row->entry;
+      char addr[8];
+      char text[256];
+      if (row->name) {
+         strcpy(addr, "----");
+         strcpy(text, row->name);
+      } else {
+         if (row->bank < 0) {
+            sprintf(addr, "%04X", row->pc);
+         } else if (row->bank < 16) {
+            sprintf(addr, "%X-%04X", row->bank, row->pc);
+         } else {
+            sprintf(addr, "?-%04X", row->pc);
+         }
+         text[0] = 0;
+         if (entry->length) {
+            instruction_t instruction;
+            memset(&instruction, 0, sizeof(instruction));
+            instruction.pc = row->pc;
+            instruction.length = entry->length;
+            memcpy(instruction.instr, entry->instr, entry->length);
+            text[em->disassemble(em_ctx, text, &instruction)] = 0;
+         }
+      }
+      uint64_t incl = entry->cycles + entry->int_cycles;
+      output_printf("%6s %12"PRIu64" %12"PRIu64" %6.2f%% %14"PRIu64" %6.2f%%  %s\n",
+                    addr, entry->count, entry->cycles, percent(entry->cycles), incl, percent(incl), text);
+   }
+   free(rows);
+}
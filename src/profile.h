@@ -0,0 +1,14 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "defs.h"
+
+#define DEFAULT_PROFILE_TOP 50
+
+int profile_init(arguments_t *args, cpu_emulator_t *em, void *em_ctx);
+
+void profile_instruction(instruction_t *instruction, int num_cycles, int bank);
+
+void profile_report();
+
+#endif
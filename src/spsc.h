@@ -0,0 +1,56 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdatomic.h>
+#include <sched.h>
+#include <unistd.h>
+
+// A bounded lock-free single-producer single-consumer queue of pointers,
+// used to connect the stages of the multi-threaded decoder.
+//
+// A full or empty queue is waited on by yielding, and then sleeping
+// briefly, so an idle stage doesn't burn a whole core.
+
+#define SPSC_SIZE 64 // Must be a power of 2
+
+typedef struct {
+   void *slot[SPSC_SIZE];
+   atomic_uint head;
+   atomic_uint tail;
+} spsc_t;
+
+static inline void spsc_init(spsc_t *q) {
+   atomic_init(&q->head, 0);
+   atomic_init(&q->tail, 0);
+}
+
+static inline void spsc_backoff(int *spins) {
+   if ((*spins)++ < 64) {
+      sched_yield();
+   } else {
+      usleep(50);
+   }
+}
+
+static inline void spsc_push(spsc_t *q, void *p) {
+   unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+   int spins = 0;
+   while (tail - atomic_load_explicit(&q->head, memory_order_acquire) == SPSC_SIZE) {
+      spsc_backoff(&spins);
+   }
+   q->slot[tail & (SPSC_SIZE - 1)] = p;
+   atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+static inline void *spsc_pop(spsc_t *q) {
+   unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+   int spins = 0;
+   while (head == atomic_load_explicit(&q->tail, memory_order_acquire)) {
+      spsc_backoff(&spins);
+   }
+   void *p = q->slot[head & (SPSC_SIZE - 1)];
+   atomic_store_explicit(&q->head, head + 1, memory_order_release);
+   return p;
+}
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "defs.h"
+#include "memory.h"
+#include "state.h"
+
+// With --save-state=FILE, the state at the end of a decode is saved, so the
+// decode of the next capture (e.g. the next segment of a long capture) can
+// carry on from it with --load-state=FILE, without having to synchronize to
+// the instruction stream again, and without losing the known registers and
+// memory.
+//
+// If the last instruction was cut off by the end of the capture, the state
+// is that before it, and its samples are saved too, so they can be
+// decoded along with the start of the next capture.
+//
+// The state is written in the host's byte order.
+//
+// State file:
+//    state_header_t
+//    sample_t[num_pending]
+//    checkpoint
+//
+// Checkpoint:
+//    u32      length      Length of the emulator context
+//    u8[]     context     See save_context
+//    memory model         See memory_save()
+
+#define STATE_MAGIC      "D6809STA"
+#define STATE_VERSION    1
+#define STATE_BYTE_ORDER 0x01020304
+
+typedef struct {
+   char     magic[8];
+   uint32_t version;
+   uint32_t byte_order;
+   int32_t  cpu;
+   int32_t  machine;
+   uint64_t sample;
+   uint64_t num_instructions;
+   uint32_t num_pending;
+   uint32_t reserved;
+} state_header_t;
+
+static FILE *state_file = NULL;
+
+// ====================================================================
+// Checkpoints
+// ====================================================================
+
+int state_write(FILE *file, cpu_emulator_t *em, void *em_ctx, memory_t *mem) {
+   uint8_t context[MAX_CONTEXT_SIZE];
+   uint32_t len = em->save_context(em_ctx, context);
+   if (fwrite(&len, sizeof(len), 1, file) != 1 || fwrite(context, len, 1, file) != 1) {
+      return -1;
+   }
+   return memory_save(mem, file);
+}
+
+// The emulator and memory model must have been initialized for the same
+// CPU and machine
+
+int state_read(FILE *file, cpu_emulator_t *em, void *em_ctx, memory_t *mem) {
+   uint8_t context[MAX_CONTEXT_SIZE];
+   uint32_t len;
+   if (fread(&len, sizeof(len), 1, file) != 1 || len > sizeof(context) || fread(context, len, 1, file) != 1) {
+      return -1;
+   }
+   if (em->load_context(em_ctx, context, len) < 0) {
+      return -1;
+   }
+   return memory_load(mem, file);
+}
+
+// ====================================================================
+// State files
+// ====================================================================
+
+// The state file is created before the decode starts, so a bad path isn't
+// only found at the end
+
+int state_create(arguments_t *args) {
+   state_file = fopen(args->save_state, "wb");
+   if (!state_file) {
+      perror("failed to create state file");
+      return -1;
+   }
+   return 0;
+}
+
+int state_save(arguments_t *args, const state_position_t *pos, cpu_emulator_t *em, void *em_ctx, memory_t *mem) {
+   FILE *file = state_file;
+   state_file = NULL;
+   state_header_t header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+   header.version = STATE_VERSION;
+   header.byte_order = STATE_BYTE_ORDER;
+   header.cpu = args->cpu_type;
+   header.machine = args->machine;
+   header.sample = pos->sample;
+   header.num_instructions = pos->num_instructions;
+   header.num_pending = pos->num_pending;
+   int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+   if (!failed && pos->num_pending) {
+      failed = fwrite(pos->pending, sizeof(sample_t), pos->num_pending, file) != (size_t) pos->num_pending;
+   }
+   if (!failed) {
+      failed = state_write(file, em, em_ctx, mem) < 0;
+   }
+   if (fclose(file)) {
+      failed = 1;
+   }
+   if (failed) {
+      perror("failed to write state file");
+      return -1;
+   }
+   return 0;
+}
+
+// Loads the state into an initialized emulator and memory model, and
+// allocates pos->pending (which the caller frees)
+
+int state_load(arguments_t *args, state_position_t *pos, cpu_emulator_t *em, void *em_ctx, memory_t *mem) {
+   const char *filename = args->load_state;
+   FILE *file = fopen(filename, "rb");
+   if (!file) {
+      perror("failed to open state file");
+      return -1;
+   }
+   const char *error = NULL;
+   state_header_t header;
+   pos->pending = NULL;
+   if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, STATE_MAGIC, sizeof(header.magic)) ||
+       header.version != STATE_VERSION || header.byte_order != STATE_BYTE_ORDER) {
+      error = "not a (supported) state file";
+   } else if (header.cpu != (int) args->cpu_type || header.machine != (int) args->machine) {
+      error = "was saved with a different --cpu or --machine";
+   } else {
+      pos->sample = header.sample;
+      pos->num_instructions = header.num_instructions;
+      pos->num_pending = header.num_pending;
+      if (pos->num_pending) {
+         pos->pending = malloc(pos->num_pending * sizeof(sample_t));
+         if (!pos->pending || fread(pos->pending, sizeof(sample_t), pos->num_pending, file) != (size_t) pos->num_pending) {
+            error = "truncated";
+         }
+      }
+      if (!error && state_read(file, em, em_ctx, mem) < 0) {
+         error = "truncated or corrupt";
+      }
+   }
+   fclose(file);
+   if (error) {
+      fprintf(stderr, "state file %s: %s\n", filename, error);
+      free(pos->pending);
+      pos->pending = NULL;
+      return -1;
+   }
+   return 0;
+}
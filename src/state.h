@@ -0,0 +1,31 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "defs.h"
+
+// The emulator and memory model state, as written to a checkpoint (e.g. in
+// an index)
+
+int state_write(FILE *file, cpu_emulator_t *em, void *em_ctx, memory_t *mem);
+
+int state_read(FILE *file, cpu_emulator_t *em, void *em_ctx, memory_t *mem);
+
+// Where the decode of a capture got to, for --save-state and --load-state
+
+typedef struct {
+   uint64_t  sample;           // Sample number of the first pending sample
+   uint64_t  num_instructions; // Instructions decoded so far
+   sample_t *pending;          // Samples of an instruction that was cut off
+   int       num_pending;      // by the end of the capture
+} state_position_t;
+
+int state_create(arguments_t *args);
+
+int state_save(arguments_t *args, const state_position_t *pos, cpu_emulator_t *em, void *em_ctx, memory_t *mem);
+
+int state_load(arguments_t *args, state_position_t *pos, cpu_emulator_t *em, void *em_ctx, memory_t *mem);
+
+#endif
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "defs.h"
+#include "timeline.h"
+
+// With --timeline=FILE, a timeline is written as it's decoded, in the JSON
+// trace event format read by chrome://tracing and Perfetto. The timestamps
+// are sample numbers, so they are in microseconds for a 1MHz bus.
+//
+// There are slices (a begin and an end event) for:
+// - interrupts, from the dispatch until the RTI
+// - calls (JSR, BSR, LBSR and SWI) to the entry points listed in
+//   --timeline-symbols=FILE, until the return
+// - SYNC and CWAI waits
+// - resets
+//
+// The open interrupts and calls are kept in a stack, with the stack pointer
+// after each, and a return ends the ones the stack pointer has gone back
+// above, so the slices are always nested. As with --callgraph, there is a
+// stack for each region of memory the S stack has been seen in (e.g. for
+// each OS-9 process), and each is shown as a separate thread. Nothing else
+// is kept, and the events are written as they happen, so any length of
+// capture can be converted. The closing ] of the array is optional, so the
+// timeline of an interrupted decode can still be loaded.
+//
+// The symbols file has a line per symbol: a hex address and a name.
+
+// A return to more than this above a call is taken to be on another stack
+#define STACK_REGION    0x100
+
+#define MAX_STACKS      16
+#define MAX_DEPTH       256
+
+// Calls and interrupts beyond MAX_DEPTH aren't shown
+typedef struct {
+   int frames[MAX_DEPTH];     // Stack pointer after each call (or -1)
+   int depth;
+   int named;
+   uint64_t last_used;
+} timeline_stack_t;
+
+static FILE *file;
+static cpu_emulator_t *em;
+static void *em_ctx;
+
+static char **symbols;
+
+static timeline_stack_t stacks[MAX_STACKS];
+static timeline_stack_t *stack;
+static uint64_t num_events;
+
+static uint64_t last_sample;
+
+static int get_tid(timeline_stack_t *st) {
+   return st - stacks + 1;
+}
+
+static void write_event(timeline_stack_t *st, const char *name, const char *cat, char ph, uint64_t ts) {
+   if (!st->named) {
+      fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"stack %d\"}}", get_tid(st), get_tid(st));
+      st->named = 1;
+   }
+   fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%"PRIu64",\"pid\":1,\"tid\":%d}", name, cat, ph, ts, get_tid(st));
+}
+
+static void write_end(timeline_stack_t *st, uint64_t ts) {
+   fprintf(file, ",\n{\"ph\":\"E\",\"ts\":%"PRIu64",\"pid\":1,\"tid\":%d}", ts, get_tid(st));
+}
+
+static void pop_all(timeline_stack_t *st, uint64_t ts) {
+   while (st->depth > 0) {
+      write_end(st, ts);
+      st->depth--;
+   }
+}
+
+static int is_near(int s, int frame_s) {
+   return s < 0 || frame_s < 0 || (frame_s >= s && frame_s - s <= STACK_REGION);
+}
+
+static void use_stack(timeline_stack_t *st) {
+   stack = st;
+   stack->last_used = ++num_events;
+}
+
+// Finds the stack a call (or interrupt) with the stack pointer s is made on:
+// the current stack if s is near it, otherwise another one that s is near,
+// otherwise an empty (or the least recently used) stack
+
+static void find_stack_for_call(int s, uint64_t ts) {
+   if (stack->depth == 0 || is_near(s, stack->frames[stack->depth - 1])) {
+      use_stack(stack);
+      return;
+   }
+   timeline_stack_t *best = NULL;
+   for (int i = 0; i < MAX_STACKS; i++) {
+      timeline_stack_t *st = stacks + i;
+      if (st->depth > 0 && is_near(s, st->frames[st->depth - 1])) {
+         use_stack(st);
+         return;
+      }
+      if (!best || (best->depth > 0 && (st->depth == 0 || st->last_used < best->last_used))) {
+         best = st;
+      }
+   }
+   pop_all(best, ts);
+   use_stack(best);
+}
+
+static void push_frame(const char *name, const char *cat, uint64_t ts, int s) {
+   find_stack_for_call(s, ts);
+   if (stack->depth == MAX_DEPTH) {
+      return;
+   }
+   write_event(stack, name, cat, 'B', ts);
+   stack->frames[stack->depth++] = s;
+}
+
+// Ends the slices of st that a return to s has gone above (or if the stack
+// pointer isn't known, just the last one), returning how many were ended
+
+static int pop_frames(timeline_stack_t *st, uint64_t ts, int s) {
+   int popped = 0;
+   while (st->depth > 0) {
+      int frame_s = st->frames[st->depth - 1];
+      if (s >= 0 && frame_s >= 0 && (frame_s >= s || s - frame_s > STACK_REGION)) {
+         break;
+      }
+      write_end(st, ts);
+      st->depth--;
+      popped++;
+      if (s < 0 || frame_s < 0) {
+         break;
+      }
+   }
+   return popped;
+}
+
+static void do_return(uint64_t ts, int s) {
+   if (pop_frames(stack, ts, s)) {
+      return;
+   }
+   // It may be a return to a process on another stack (e.g. the RTI at the
+   // end of a task switch)
+   for (int i = 0; i < MAX_STACKS; i++) {
+      if (stacks + i != stack && pop_frames(stacks + i, ts, s)) {
+         use_stack(stacks + i);
+         return;
+      }
+   }
+}
+
+// Names are written into JSON strings, so are limited to the characters
+// that don't need escaping
+
+static int read_symbols(const char *filename) {
+   FILE *sym = fopen(filename, "r");
+   if (!sym) {
+      perror("failed to open symbols");
+      return -1;
+   }
+   symbols = calloc(0x10000, sizeof(char *));
+   if (!symbols) {
+      fprintf(stderr, "failed to allocate symbols\n");
+      fclose(sym);
+      return -1;
+   }
+   char line[256];
+   char name[128];
+   unsigned int addr;
+   while (fgets(line, sizeof(line), sym)) {
+      if (sscanf(line, "%x %127s", &addr, name) != 2 || line[0] == '#') {
+         continue;
+      }
+      for (char *cp = name; *cp; cp++) {
+         if (*cp == '"' || *cp == '\\' || *cp < 32) {
+            *cp = '_';
+         }
+      }
+      free(symbols[addr & 0xffff]);
+      symbols[addr & 0xffff] = strdup(name);
+   }
+   fclose(sym);
+   return 0;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+int timeline_open(arguments_t *args, cpu_emulator_t *emulator, void *emulator_ctx) {
+   em = emulator;
+   em_ctx = emulator_ctx;
+   if (args->timeline_symbols && read_symbols(args->timeline_symbols) < 0) {
+      return -1;
+   }
+   file = fopen(args->timeline_file, "w");
+   if (!file) {
+      perror("failed to create timeline");
+      return -1;
+   }
+   fprintf(file, "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"6809\"}}");
+   stack = stacks;
+   return 0;
+}
+
+// Called after each instruction (or interrupt or reset sequence), with the
+// sample number of its first cycle
+
+void timeline_instruction(instruction_t *instruction, uint64_t sample, sample_t *sample_q, int num_cycles) {
+   if (!file) {
+      return;
+   }
+   uint64_t end = sample + num_cycles;
+   last_sample = end;
+
+   if (instruction->rst_seen) {
+      for (int i = 0; i < MAX_STACKS; i++) {
+         pop_all(stacks + i, sample);
+      }
+      use_stack(stacks);
+      write_event(stack, "RESET", "reset", 'B', sample);
+      write_end(stack, end);
+      return;
+   }
+
+   if (instruction->intr_seen) {
+      const char *name;
+      switch (sample_q[num_cycles - 3].addr) {
+      case 0x6:
+         name = "FIRQ";
+         break;
+      case 0xC:
+         name = "NMI";
+         break;
+      default:
+         name = (num_cycles < 19) ? "FIRQ" : "IRQ";
+         break;
+      }
+      push_frame(name, "interrupt", sample, em->get_S(em_ctx));
+      return;
+   }
+
+   int i = 0;
+   while (i < instruction->length - 1 && (instruction->instr[i] == 0x10 || instruction->instr[i] == 0x11)) {
+      i++;
+   }
+   if (!instruction->length) {
+      return;
+   }
+   switch (instruction->instr[i]) {
+   case 0x17: // LBSR
+   case 0x8d: // BSR
+   case 0x9d: // JSR
+   case 0xad:
+   case 0xbd:
+   case 0x3f: // SWI, SWI2, SWI3
+      if (symbols) {
+         int target = em->get_PC(em_ctx);
+         if (target >= 0 && symbols[target]) {
+            push_frame(symbols[target], "call", end, em->get_S(em_ctx));
+         }
+      }
+      break;
+   case 0x13: // SYNC
+      write_event(stack, "SYNC", "wait", 'B', sample);
+      write_end(stack, end);
+      break;
+   case 0x3c: // CWAI
+      {
+         // The wait ends with the vector fetch (and a dead cycle)
+         const char *name = sample_q[num_cycles - 3].addr == 0xC ? "NMI" :
+                            sample_q[num_cycles - 3].addr == 0x6 ? "FIRQ" : "IRQ";
+         int s = em->get_S(em_ctx);
+         find_stack_for_call(s, sample);
+         write_event(stack, "CWAI", "wait", 'B', sample);
+         write_end(stack, end - 3);
+         push_frame(name, "interrupt", end - 3, s);
+      }
+      break;
+   case 0x35: // PULS
+      if (instruction->instr[i + 1] & 0x80) {
+         do_return(end, em->get_S(em_ctx));
+      }
+      break;
+   case 0x39: // RTS
+   case 0x3b: // RTI
+      do_return(end, em->get_S(em_ctx));
+      break;
+   }
+}
+
+// Returns -1 if the timeline couldn't be written, which has already been
+// reported
+
+int timeline_close() {
+   if (!file) {
+      return 0;
+   }
+   for (int i = 0; i < MAX_STACKS; i++) {
+      pop_all(stacks + i, last_sample);
+   }
+   fprintf(file, "\n]\n");
+   int failed = fclose(file) != 0;
+   if (failed) {
+      perror("failed to write timeline");
+   }
+   file = NULL;
+   return failed ? -1 : 0;
+}
@@ -0,0 +1,14 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <inttypes.h>
+
+#include "defs.h"
+
+int timeline_open(arguments_t *args, cpu_emulator_t *em, void *em_ctx);
+
+void timeline_instruction(instruction_t *instruction, uint64_t sample, sample_t *sample_q, int num_cycles);
+
+int timeline_close();
+
+#endif
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// See trace.h for the format
+
+static inline uint8_t *put_varint(uint8_t *bp, uint64_t value) {
+   while (value >= 0x80) {
+      *bp++ = (value & 0x7f) | 0x80;
+      value >>= 7;
+   }
+   *bp++ = value;
+   return bp;
+}
+
+static inline uint8_t *put_u16(uint8_t *bp, int value) {
+   *bp++ = value & 0xff;
+   *bp++ = (value >> 8) & 0xff;
+   return bp;
+}
+
+// ====================================================================
+// Writing
+// ====================================================================
+
+int trace_encode_header(trace_encoder_t *enc, uint8_t *bp, int cpu, int machine, const char *const *names) {
+   int num_regs = 0;
+   while (names[num_regs] && num_regs < TRACE_MAX_REGS) {
+      num_regs++;
+   }
+   enc->num_regs = num_regs;
+   enc->sample = 0;
+   for (int i = 0; i < TRACE_MAX_REGS; i++) {
+      enc->regs[i] = -1;
+   }
+   uint8_t *ptr = bp;
+   memcpy(ptr, TRACE_MAGIC, 8);
+   ptr += 8;
+   ptr = put_u16(ptr, TRACE_VERSION);
+   ptr += 2; // length, filled in below
+   *ptr++ = cpu;
+   *ptr++ = machine;
+   *ptr++ = num_regs;
+   *ptr++ = 0;
+   for (int i = 0; i < num_regs; i++) {
+      size_t len = strnlen(names[i], sizeof(((trace_header_t *)0)->reg_names[0]) - 1);
+      memcpy(ptr, names[i], len);
+      ptr += len;
+      *ptr++ = 0;
+   }
+   put_u16(bp + 10, ptr - bp);
+   return ptr - bp;
+}
+
+int trace_encode_instruction(trace_encoder_t *enc, uint8_t *bp, const trace_record_t *record) {
+   uint8_t *ptr = bp;
+   int flags = record->flags & (TRACE_INTERRUPT | TRACE_RESET);
+   if (record->pc >= 0) {
+      flags |= TRACE_PC_KNOWN;
+   }
+   if (record->fail) {
+      flags |= TRACE_FAIL;
+   }
+   *ptr++ = flags;
+   ptr = put_varint(ptr, record->sample - enc->sample);
+   enc->sample = record->sample;
+   if (record->pc >= 0) {
+      ptr = put_u16(ptr, record->pc);
+   }
+   int length = record->length < 8 ? record->length : 8;
+   *ptr++ = length;
+   memcpy(ptr, record->bytes, length);
+   ptr += length;
+   ptr = put_varint(ptr, record->cycles);
+   if (record->fail) {
+      ptr = put_varint(ptr, record->fail);
+   }
+   uint32_t changed = 0;
+   for (int i = 0; i < enc->num_regs; i++) {
+      if (record->regs[i] != enc->regs[i]) {
+         changed |= 1u << i;
+      }
+   }
+   ptr = put_varint(ptr, changed);
+   for (int i = 0; i < enc->num_regs; i++) {
+      if (changed & (1u << i)) {
+         enc->regs[i] = record->regs[i];
+         ptr = put_varint(ptr, (uint32_t) (record->regs[i] + 1));
+      }
+   }
+   return ptr - bp;
+}
+
+int trace_encode_text(uint8_t *bp, size_t len) {
+   uint8_t *ptr = bp;
+   *ptr++ = TRACE_TEXT;
+   ptr = put_varint(ptr, len);
+   return ptr - bp;
+}
+
+// ====================================================================
+// Reading
+// ====================================================================
+
+static int get_byte(trace_reader_t *reader, int *value) {
+   int c = getc(reader->file);
+   if (c == EOF) {
+      return -1;
+   }
+   *value = c;
+   return 0;
+}
+
+static int get_varint(trace_reader_t *reader, uint64_t *value) {
+   uint64_t result = 0;
+   for (int shift = 0; shift < 64; shift += 7) {
+      int c;
+      if (get_byte(reader, &c)) {
+         return -1;
+      }
+      result |= (uint64_t) (c & 0x7f) << shift;
+      if (!(c & 0x80)) {
+         *value = result;
+         return 0;
+      }
+   }
+   return -1;
+}
+
+static int get_u16(trace_reader_t *reader, int *value) {
+   int lo, hi;
+   if (get_byte(reader, &lo) || get_byte(reader, &hi)) {
+      return -1;
+   }
+   *value = lo | (hi << 8);
+   return 0;
+}
+
+int trace_reader_open(trace_reader_t *reader, FILE *file) {
+   memset(reader, 0, sizeof(trace_reader_t));
+   reader->file = file;
+   uint8_t fixed[16];
+   if (fread(fixed, 1, sizeof(fixed), file) != sizeof(fixed) || memcmp(fixed, TRACE_MAGIC, 8)) {
+      return -1;
+   }
+   trace_header_t *header = &reader->header;
+   header->version  = fixed[8] | (fixed[9] << 8);
+   int length       = fixed[10] | (fixed[11] << 8);
+   header->cpu      = fixed[12];
+   header->machine  = fixed[13];
+   header->num_regs = fixed[14];
+   if (header->version != TRACE_VERSION || header->num_regs > TRACE_MAX_REGS) {
+      return -1;
+   }
+   // Read the register names (skipping anything a later version might add)
+   length -= sizeof(fixed);
+   for (int i = 0; i < header->num_regs; i++) {
+      int n = 0;
+      int c;
+      do {
+         if (length-- <= 0 || get_byte(reader, &c)) {
+            return -1;
+         }
+         if (n < (int) sizeof(header->reg_names[i]) - 1) {
+            header->reg_names[i][n++] = c;
+         }
+      } while (c);
+   }
+   while (length-- > 0) {
+      int c;
+      if (get_byte(reader, &c)) {
+         return -1;
+      }
+   }
+   reader->record.sample = 0;
+   for (int i = 0; i < TRACE_MAX_REGS; i++) {
+      reader->record.regs[i] = -1;
+   }
+   return 0;
+}
+
+static int read_text(trace_reader_t *reader, trace_record_t *record) {
+   uint64_t len;
+   if (get_varint(reader, &len)) {
+      return -1;
+   }
+   if (len + 1 > reader->text_size) {
+      char *text = realloc(record->text, len + 1);
+      if (!text) {
+         return -1;
+      }
+      record->text = text;
+      reader->text_size = len + 1;
+   }
+   if (fread(record->text, 1, len, reader->file) != len) {
+      return -1;
+   }
+   record->text[len] = 0;
+   record->text_len = len;
+   return 0;
+}
+
+static int read_instruction(trace_reader_t *reader, trace_record_t *record) {
+   uint64_t value;
+   if (get_varint(reader, &value)) {
+      return -1;
+   }
+   record->sample += value;
+   record->pc = -1;
+   if ((record->flags & TRACE_PC_KNOWN) && get_u16(reader, &record->pc)) {
+      return -1;
+   }
+   if (get_byte(reader, &record->length) || record->length > 8 ||
+       fread(record->bytes, 1, record->length, reader->file) != (size_t) record->length) {
+      return -1;
+   }
+   if (get_varint(reader, &value)) {
+      return -1;
+   }
+   record->cycles = value;
+   record->fail = 0;
+   if (record->flags & TRACE_FAIL) {
+      if (get_varint(reader, &value)) {
+         return -1;
+      }
+      record->fail = value;
+   }
+   uint64_t changed;
+   if (get_varint(reader, &changed)) {
+      return -1;
+   }
+   for (int i = 0; i < reader->header.num_regs; i++) {
+      if (changed & ((uint64_t) 1 << i)) {
+         if (get_varint(reader, &value)) {
+            return -1;
+         }
+         record->regs[i] = (int) value - 1;
+      }
+   }
+   return 0;
+}
+
+const trace_record_t *trace_reader_next(trace_reader_t *reader) {
+   trace_record_t *record = &reader->record;
+   if (get_byte(reader, &record->flags)) {
+      // The normal end of the trace
+      return NULL;
+   }
+   if ((record->flags & TRACE_TEXT) ? read_text(reader, record) : read_instruction(reader, record)) {
+      reader->error = 1;
+      return NULL;
+   }
+   return record;
+}
+
+void trace_reader_close(trace_reader_t *reader) {
+   free(reader->record.text);
+   reader->record.text = NULL;
+   reader->text_size = 0;
+}
@@ -0,0 +1,122 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// The compact binary trace written by --output-format=binary
+//
+// This header, and trace.c, only depend on the C library, so they can be
+// copied into other tools that read traces.
+//
+// A trace is a header followed by a sequence of records. All multi-byte
+// fixed size fields are little-endian, and "varint" is an unsigned LEB128
+// (7 bits per byte, least significant first, top bit set on all but the
+// last byte).
+//
+// Header:
+//    char[8]  magic       "D6809TRC"
+//    u16      version     TRACE_VERSION
+//    u16      length      Length of the whole header, in bytes
+//    u8       cpu         CPU type (the decoder's cpu_t)
+//    u8       machine     Machine type (the decoder's machine_t)
+//    u8       num_regs    Number of register slots in each record
+//    u8       reserved    Zero
+//    char[]   names       num_regs NUL terminated register names
+//
+// Record:
+//    u8       flags       TRACE_xxx
+//
+// followed, for a TRACE_TEXT record, by:
+//    varint   length
+//    char[]   text        Text output (e.g. memory logging), as written
+//
+// or, for an instruction record, by:
+//    varint   sample      Sample number, less that of the previous instruction
+//    u16      pc          If TRACE_PC_KNOWN
+//    u8       length      Number of instruction bytes
+//    u8[]     bytes
+//    varint   cycles
+//    varint   fail        If TRACE_FAIL, the prediction failures (FAIL_xxx)
+//    varint   changed     Bitmask of the register slots that changed
+//    varint[] regs        The new value + 1 (so 0 is unknown) of each
+//                         changed register, lowest slot first
+//
+// The register state before the first record is all unknown.
+
+#define TRACE_MAGIC      "D6809TRC"
+#define TRACE_VERSION    1
+
+#define TRACE_MAX_REGS   32
+
+// Record flags
+#define TRACE_PC_KNOWN   0x01
+#define TRACE_INTERRUPT  0x02
+#define TRACE_RESET      0x04
+#define TRACE_FAIL       0x08
+#define TRACE_TEXT       0x80
+
+// Longest header, and longest record (excluding text)
+#define TRACE_MAX_HEADER (16 + TRACE_MAX_REGS * 16)
+#define TRACE_MAX_RECORD (64 + TRACE_MAX_REGS * 5)
+
+typedef struct {
+   int version;
+   int cpu;
+   int machine;
+   int num_regs;
+   char reg_names[TRACE_MAX_REGS][16];
+} trace_header_t;
+
+typedef struct {
+   int      flags;          // TRACE_xxx
+   uint64_t sample;
+   int      pc;             // -1 if unknown
+   int      length;
+   uint8_t  bytes[8];
+   int      cycles;
+   uint32_t fail;
+   int      regs[TRACE_MAX_REGS]; // -1 if unknown
+   char    *text;           // TRACE_TEXT records only (not NUL terminated)
+   size_t   text_len;
+} trace_record_t;
+
+// Writing: the encoder remembers the previous record, as records are
+// delta encoded
+
+typedef struct {
+   int      num_regs;
+   uint64_t sample;
+   int      regs[TRACE_MAX_REGS];
+} trace_encoder_t;
+
+// names is a NULL terminated list; returns the header length
+int trace_encode_header(trace_encoder_t *enc, uint8_t *bp, int cpu, int machine, const char *const *names);
+
+// Returns the record length
+int trace_encode_instruction(trace_encoder_t *enc, uint8_t *bp, const trace_record_t *record);
+
+// Returns the length of the record prefix; the text follows it
+int trace_encode_text(uint8_t *bp, size_t len);
+
+// Reading
+
+typedef struct {
+   FILE          *file;
+   trace_header_t header;
+   trace_record_t record;
+   size_t         text_size;
+   int            error;   // Set if the trace was truncated or corrupt
+} trace_reader_t;
+
+// Returns 0, or -1 if the file isn't a (supported) trace
+int trace_reader_open(trace_reader_t *reader, FILE *file);
+
+// Returns the next record (valid until the next call), or NULL at the end
+// of the trace (or on an error, when reader->error is set)
+const trace_record_t *trace_reader_next(trace_reader_t *reader);
+
+void trace_reader_close(trace_reader_t *reader);
+
+#endif
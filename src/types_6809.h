@@ -68,9 +68,12 @@ typedef struct {
    int num_cycles;
 } sample_q_t;
 
+// The emulator's state (see em_6809.c)
+typedef struct em6809_ctx em6809_ctx_t;
+
 typedef struct {
    const char *mnemonic;
-   int (*emulate)(operand_t, ea_t, sample_q_t *);
+   int (*emulate)(em6809_ctx_t *, operand_t, ea_t, sample_q_t *);
    optype_t type;
    opsize_t size;
    storeimm_t storeimm;
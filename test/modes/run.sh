@@ -0,0 +1,109 @@
+#!/bin/bash
+
+# Checks that the decoder's other modes give the same output as a plain
+# serial decode of the same capture:
+#
+# - pipeline: --pipeline
+# - jobs:     --jobs=4, and --jobs=3 with a --skip (generated capture only,
+#             as the positron captures are too small to split, and use
+#             memory modelling)
+# - index:    --index, which shouldn't change the output
+# - from:     --from-sample, using that index, which should give the tail
+#             of the serial decode
+# - state:    --save-state on the first half of the capture, then
+#             --load-state on the second half
+# - trace:    --output-format=binary, read back with the reader in
+#             src/trace.c (see tracedump.c and tracecmp.awk)
+#
+# The positron captures are converted from ../positron as in its run.sh, and
+# a capture is generated with ../../bench/gen6809.c.
+
+cd `dirname $0`
+
+DIR=build
+DECODER=../../decode6809
+POSITRON=../positron
+
+mkdir -p $DIR
+rm -f $DIR/*
+
+gcc -Wall -Wextra -O2 -I../../src -o $DIR/tracedump tracedump.c ../../src/trace.c || exit 1
+gcc -Wall -Wextra -O2 -D_GNU_SOURCE -o $DIR/gen6809 ../../bench/gen6809.c || exit 1
+
+if [ ! -x $DECODER ]; then
+    (cd ../.. && ./build.sh) || exit 1
+fi
+
+for i in posiBoot0xFFFE8k.fixed posiBootF105.txt posiBootDA15.txt
+do
+    bin=${i%.*}.bin
+    if [ ! -f $POSITRON/$bin ]; then
+        (cd $POSITRON && ./posigrab $i $bin) || exit 1
+    fi
+done
+
+$DIR/gen6809 --cycles=4M --irq=5000 $DIR/gen.bin 2> /dev/null || exit 1
+
+FAILED=0
+
+result() {
+    if [ $2 -eq 0 ]; then
+        echo "$1: ok"
+    else
+        echo "$1: FAILED"
+        FAILED=1
+    fi
+}
+
+# check NAME CAPTURE BYTES_PER_SAMPLE OPTIONS...
+check() {
+    name=$1
+    capture=$2
+    bps=$3
+    shift 3
+    ref=$DIR/$name.log
+
+    $DECODER "$@" $capture > $ref
+
+    $DECODER "$@" --pipeline $capture | cmp -s - $ref
+    result "$name pipeline" $?
+
+    $DECODER "$@" --index=$DIR/$name.idx --index-interval=100 $capture | cmp -s - $ref
+    result "$name index" $?
+
+    samples=$(( `stat -c %s $capture` / bps ))
+    from=`printf %X $(( samples / 2 ))`
+    $DECODER "$@" --index=$DIR/$name.idx --from-sample=$from $capture > $DIR/$name.from
+    [ -s $DIR/$name.from ] && tail -n `wc -l < $DIR/$name.from` $ref | cmp -s - $DIR/$name.from
+    result "$name from" $?
+
+    # The first half's summary is left out, as the second half carries on
+    # counting the instructions
+    split=$(( samples / 2 * bps ))
+    head -c $split $capture > $DIR/$name.1.bin
+    tail -c +$(( split + 1 )) $capture > $DIR/$name.2.bin
+    ( $DECODER "$@" --save-state=$DIR/$name.state $DIR/$name.1.bin | grep -v "^num_instructions = "
+      $DECODER "$@" --load-state=$DIR/$name.state $DIR/$name.2.bin ) | cmp -s - $ref
+    result "$name state" $?
+
+    $DECODER "$@" -Y $capture > $DIR/$name.txt
+    $DECODER "$@" -Y --output-format=binary $capture > $DIR/$name.trace
+    $DIR/tracedump $DIR/$name.trace > $DIR/$name.dump && awk -v DUMP=$DIR/$name.dump -f tracecmp.awk $DIR/$name.txt
+    result "$name trace" $?
+}
+
+COMMON="--mem=FFF -d1 --lic= -ahisy"
+
+check posiBoot0xFFFE8k $POSITRON/posiBoot0xFFFE8k.bin 2 $COMMON
+check posiBootF105     $POSITRON/posiBootF105.bin     2 $COMMON --ba= --bs= --reg_pc=F105 --reg_s=0900
+check posiBootDA15     $POSITRON/posiBootDA15.bin     2 $COMMON
+check gen              $DIR/gen.bin                   2 -ahisy
+
+$DECODER -ahisy --jobs=4 $DIR/gen.bin | cmp -s - $DIR/gen.log
+result "gen jobs" $?
+
+$DECODER -ahisy --skip=12345 $DIR/gen.bin > $DIR/gen.skip.log
+$DECODER -ahisy --skip=12345 --jobs=3 $DIR/gen.bin | cmp -s - $DIR/gen.skip.log
+result "gen jobs --skip" $?
+
+exit $FAILED
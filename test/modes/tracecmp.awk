@@ -0,0 +1,72 @@
+# Compares the text output of a decode (with -Y) with tracedump's output for
+# the binary trace of the same decode (given as -v DUMP=FILE)
+#
+# Instruction lines must agree on the sample, PC, bytes, cycles, whether
+# the prediction failed, and the value of each register shown in the text;
+# any other lines must be the same.
+
+function get_regs(s, regs,   n, i, fields, kv, value) {
+   delete regs
+   n = split(s, fields, " ")
+   for (i = 1; i <= n; i++) {
+      split(fields[i], kv, "=")
+      value = kv[2]
+      if (value ~ /\?/) {
+         value = "?"
+      } else {
+         sub(/^0+/, "", value)
+         if (value == "") {
+            value = "0"
+         }
+      }
+      regs[kv[1]] = value
+   }
+}
+
+function trim(s) {
+   gsub(/^ +| +$/, "", s)
+   return s
+}
+
+function differs(why) {
+   print "line " FNR ": " why
+   failed = 1
+   exit 1
+}
+
+BEGIN {
+   FS = " : "
+}
+
+{
+   if ((getline dump < DUMP) <= 0) {
+      differs("missing from the trace")
+   }
+   if ($0 !~ /^[0-9A-F]+ : [0-9A-F?]+ : /) {
+      if ($0 != dump) {
+         differs("text differs")
+      }
+      next
+   }
+   n = split(dump, d, " : ")
+   if ($1 != d[1] || $2 != d[2] || trim($3) != d[3] || trim($5) != d[4]) {
+      differs("instruction differs")
+   }
+   if ((NF > 6) != (n > 5)) {
+      differs("prediction failure differs")
+   }
+   get_regs($6, text_regs)
+   get_regs(d[5], trace_regs)
+   for (name in text_regs) {
+      if (text_regs[name] != trace_regs[name]) {
+         differs(name " differs")
+      }
+   }
+}
+
+END {
+   if (!failed && (getline dump < DUMP) > 0) {
+      print "the trace has more records than the text"
+      exit 1
+   }
+}
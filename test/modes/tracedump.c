@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+// Prints a binary trace (from --output-format=binary) as text, for
+// tracecmp.awk to compare with the decoder's text output. Each instruction
+// is a line of:
+//
+//    SAMPLE : PC : BYTES : CYCLES : REGISTERS [: fail=FAIL]
+//
+// with each register in hex (without leading zeros), or ? if unknown. Any
+// text records are printed as they were written.
+
+int main(int argc, char *argv[]) {
+   if (argc != 2) {
+      fprintf(stderr, "usage: tracedump TRACE\n");
+      return 1;
+   }
+   FILE *file = fopen(argv[1], "rb");
+   if (!file) {
+      perror("failed to open trace");
+      return 1;
+   }
+   trace_reader_t reader;
+   if (trace_reader_open(&reader, file) < 0) {
+      fprintf(stderr, "%s is not a trace\n", argv[1]);
+      fclose(file);
+      return 1;
+   }
+   const trace_record_t *record;
+   while ((record = trace_reader_next(&reader))) {
+      if (record->flags & TRACE_TEXT) {
+         fwrite(record->text, 1, record->text_len, stdout);
+         continue;
+      }
+      printf("%08X : ", (unsigned) record->sample);
+      if (record->pc >= 0) {
+         printf("%04X : ", record->pc);
+      } else {
+         printf("???? : ");
+      }
+      // (An interrupt has no bytes)
+      for (int i = 0; i < record->length; i++) {
+         printf(i ? " %02X" : "%02X", record->bytes[i]);
+      }
+      printf(" : %d :", record->cycles);
+      for (int i = 0; i < reader.header.num_regs; i++) {
+         if (record->regs[i] >= 0) {
+            printf(" %s=%X", reader.header.reg_names[i], record->regs[i]);
+         } else {
+            printf(" %s=?", reader.header.reg_names[i]);
+         }
+      }
+      if (record->flags & TRACE_FAIL) {
+         printf(" : fail=%X", record->fail);
+      }
+      printf("\n");
+   }
+   int error = reader.error;
+   trace_reader_close(&reader);
+   fclose(file);
+   if (error) {
+      fprintf(stderr, "%s is truncated or corrupt\n", argv[1]);
+      return 1;
+   }
+   return 0;
+}